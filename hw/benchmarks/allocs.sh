@@ -0,0 +1,51 @@
+#!/usr/bin/env bash
+# Allocation Benchmark
+#
+# Counts the objects each benchmark kernel allocates at each Quack optimization level, as
+# reported by the runtime when QUACK_ALLOC_STATS is set.  Objects that are statically allocated
+# (literals, small Ints, and the Strings of constant STR results) or allocated on the stack are
+# not counted.  The output of each level is checked against level 0.
+
+if [[ $# -lt 2 || $# -gt 3 ]] ; then
+    echo "Correct command \"allocs.sh <BinFile> <RuntimeFolder> [<KernelsFolder>]\""
+    exit 1
+fi
+
+BIN=$1
+RUNTIME_FOLDER=$2
+KERNELS_FOLDER=${3:-$( dirname $0 )/kernels}
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:--O2}
+LEVELS=(0 1 2)
+
+WORK_DIR=$( mktemp -d )
+trap "rm -rf ${WORK_DIR}" EXIT
+
+cp ${RUNTIME_FOLDER}/builtins.h ${WORK_DIR}/
+${CC} ${CFLAGS} -c ${RUNTIME_FOLDER}/builtins.c -o ${WORK_DIR}/builtins.o &> /dev/null || exit 1
+
+printf "%-14s" "Kernel"
+for LEVEL in "${LEVELS[@]}"; do
+    printf "%14s" "-O${LEVEL} objects"
+done
+printf "\n"
+
+for KERNEL in ${KERNELS_FOLDER}/*.qk; do
+    NAME=$( basename ${KERNEL} .qk )
+    printf "%-14s" ${NAME}
+    for LEVEL in "${LEVELS[@]}"; do
+        SRC=${WORK_DIR}/${NAME}_O${LEVEL}.qk
+        cp ${KERNEL} ${SRC}
+        ${BIN} -O${LEVEL} ${SRC} &> /dev/null || { echo "Failed: ${NAME} -O${LEVEL}"; exit 1; }
+        ${CC} ${CFLAGS} ${SRC%.*}.c ${WORK_DIR}/builtins.o -o ${SRC%.*}.out &> /dev/null \
+            || { echo "Build failed: ${NAME} -O${LEVEL}"; exit 1; }
+
+        QUACK_ALLOC_STATS=1 ${SRC%.*}.out > ${SRC%.*}.txt 2> ${SRC%.*}.stats
+        if ! cmp -s ${SRC%.*}.txt ${WORK_DIR}/${NAME}_O${LEVELS[0]}.txt; then
+            echo "Output mismatch: ${NAME} -O${LEVEL}"
+            exit 1
+        fi
+        printf "%14s" $( awk '/^Objects allocated:/ { print $3 }' ${SRC%.*}.stats )
+    done
+    printf "\n"
+done
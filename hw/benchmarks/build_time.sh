@@ -0,0 +1,63 @@
+#!/usr/bin/env bash
+# Build Time Benchmark
+#
+# Compares the end-to-end build time (Quack compiler plus system compiler/assembler/linker) of
+# the C backend against the x86-64 assembly backend ("-S").  Every passing program listed in the
+# test CSV is built by both backends.  builtins.c is compiled once up front so only the work that
+# differs between the backends is timed.
+
+if [[ $# -lt 3 || $# -gt 4 ]] ; then
+    echo "Correct command \"build_time.sh <BinFile> <TestCsvFile> <SamplesFolder> [<NumRepeats>]\""
+    exit 1
+fi
+
+BIN=$1
+ALL_TESTS=$2
+SAMPLES_FOLDER=$3
+NUM_REPEATS=${4:-5}
+CC=${CC:-gcc}
+
+WORK_DIR=$( mktemp -d )
+trap "rm -rf ${WORK_DIR}" EXIT
+
+cp ${SAMPLES_FOLDER}/builtins.h ${WORK_DIR}/
+${CC} -c ${SAMPLES_FOLDER}/builtins.c -o ${WORK_DIR}/builtins.o &> /dev/null || exit 1
+
+# Copy the passing programs so the samples folder is not modified
+PROGRAMS=()
+for TEST in $( cat ${ALL_TESTS} ) ; do
+    IFS="," read TEST_FILE EXIT_TYPE <<< "${TEST}"
+    if [[ ${EXIT_TYPE} == "PASS" ]]; then
+        cp ${SAMPLES_FOLDER}/${TEST_FILE} ${WORK_DIR}/
+        PROGRAMS+=(${TEST_FILE})
+    fi
+done
+
+# Builds all programs with the specified backend and prints the elapsed time in milliseconds
+build_all () {
+    local FLAGS=$1
+    local EXT=$2
+    local START=$( date +%s%N )
+    for (( i=0; i<${NUM_REPEATS}; i++ )); do
+        for PROG in "${PROGRAMS[@]}"; do
+            local BASE=${WORK_DIR}/${PROG%.*}
+            ${BIN} ${FLAGS} ${WORK_DIR}/${PROG} &> /dev/null || { echo "Failed: ${PROG}" >&2; exit 1; }
+            ${CC} ${BASE}.${EXT} ${WORK_DIR}/builtins.o -o ${BASE}.out &> /dev/null \
+                || { echo "Build failed: ${PROG}" >&2; exit 1; }
+        done
+    done
+    local END=$( date +%s%N )
+    echo $(( (END - START) / 1000000 ))
+}
+
+C_MS=$( build_all "" "c" ) || exit 1
+ASM_MS=$( build_all "-S" "s" ) || exit 1
+
+NUM_BUILDS=$(( ${#PROGRAMS[@]} * NUM_REPEATS ))
+printf "Programs: %d, Repeats: %d\n" ${#PROGRAMS[@]} ${NUM_REPEATS}
+awk -v c=${C_MS} -v a=${ASM_MS} -v n=${NUM_BUILDS} 'BEGIN {
+    printf "%-10s %12s %14s\n", "Backend", "Total (ms)", "Per build (ms)"
+    printf "%-10s %12d %14.1f\n", "C", c, c / n
+    printf "%-10s %12d %14.1f\n", "asm", a, a / n
+    printf "Speedup: %.2fx\n", c / a
+}'
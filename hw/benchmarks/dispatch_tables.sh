@@ -0,0 +1,126 @@
+#!/usr/bin/env bash
+# Dispatch Table Benchmark
+#
+# Generates a program with a wide and deep class hierarchy and compares the per class method
+# tables against the shared dispatch table (-fdispatch=compact).  Every class overrides one
+# method of the root class and a loop calls every method on one object of each class, so each
+# call site sees all classes.  For each layout it reports the size of the binary's code and
+# data, the L1 data cache misses if perf is available, and the call throughput of the best run.
+
+if [[ $# -lt 2 || $# -gt 6 ]] ; then
+    echo "Correct command \"dispatch_tables.sh <BinFile> <RuntimeFolder> [<NumClasses>] [<NumMethods>] [<NumRounds>] [<NumRepeats>]\""
+    exit 1
+fi
+
+BIN=$1
+RUNTIME_FOLDER=$2
+NUM_CLASSES=${3:-400}
+NUM_METHODS=${4:-16}
+NUM_ROUNDS=${5:-2000}
+NUM_REPEATS=${6:-3}
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:--O2}
+OPT_LEVEL=${OPT_LEVEL:-2}
+# Each class extends the class with id (id - 1) / BRANCHING
+BRANCHING=4
+LAYOUTS=(vtable compact)
+
+WORK_DIR=$( mktemp -d )
+trap "rm -rf ${WORK_DIR}" EXIT
+
+cp ${RUNTIME_FOLDER}/builtins.h ${WORK_DIR}/
+${CC} ${CFLAGS} -c ${RUNTIME_FOLDER}/builtins.c -o ${WORK_DIR}/builtins.o &> /dev/null || exit 1
+
+# Writes the synthetic program
+generate () {
+    echo "class C0() {"
+    for (( m=0; m<${NUM_METHODS}; m++ )); do
+        echo "    def m${m}(x: Int): Int { return x; }"
+    done
+    echo "}"
+    for (( c=1; c<${NUM_CLASSES}; c++ )); do
+        echo "class C${c}() extends C$(( (c - 1) / BRANCHING )) {"
+        echo "    def m$(( c % NUM_METHODS ))(x: Int): Int { return x + ${c}; }"
+        echo "}"
+    done
+
+    echo "class Cell(item: C0) {"
+    echo "    this.item = item;"
+    echo "    this.rest = this;"
+    echo "    this.last = true;"
+    echo "    def link(n: Cell): Cell { this.rest = n; this.last = false; return this; }"
+    echo "    def next(): Cell { return this.rest; }"
+    echo "    def is_last(): Boolean { return this.last; }"
+    echo "    def run(x: Int): Int {"
+    echo "        total = 0;"
+    for (( m=0; m<${NUM_METHODS}; m++ )); do
+        echo "        total = total + this.item.m${m}(x);"
+    done
+    echo "        return total;"
+    echo "    }"
+    echo "}"
+
+    echo "head = Cell(C0());"
+    for (( c=1; c<${NUM_CLASSES}; c++ )); do
+        echo "head = Cell(C${c}()).link(head);"
+    done
+    echo "i = 0;"
+    echo "total = 0;"
+    echo "while i < ${NUM_ROUNDS} {"
+    echo "    cell = head;"
+    echo "    done = false;"
+    echo "    while not done {"
+    echo "        total = total + cell.run(i);"
+    echo "        done = cell.is_last();"
+    echo "        cell = cell.next();"
+    echo "    }"
+    echo "    i = i + 1;"
+    echo "}"
+    echo "total.PRINT();"
+    echo "\"\\n\".PRINT();"
+}
+
+# Runs a binary the specified number of times and prints the best time in milliseconds
+best_time () {
+    local EXE=$1
+    local BEST=
+    for (( i=0; i<${NUM_REPEATS}; i++ )); do
+        local START=$( date +%s%N )
+        ${EXE} > /dev/null
+        local END=$( date +%s%N )
+        local MS=$(( (END - START) / 1000000 ))
+        if [[ -z ${BEST} || ${MS} -lt ${BEST} ]]; then
+            BEST=${MS}
+        fi
+    done
+    echo ${BEST}
+}
+
+NUM_CALLS=$(( NUM_CLASSES * NUM_METHODS * NUM_ROUNDS ))
+echo "${NUM_CLASSES} classes, ${NUM_METHODS} methods, ${NUM_CALLS} dynamically dispatched calls"
+printf "%-10s%10s%10s%14s%10s%12s\n" "Layout" "text (B)" "data (B)" "L1d misses" "Time (ms)" "Mcalls/s"
+
+for LAYOUT in "${LAYOUTS[@]}"; do
+    SRC=${WORK_DIR}/hierarchy_${LAYOUT}.qk
+    generate > ${SRC}
+    ${BIN} -O${OPT_LEVEL} -fdispatch=${LAYOUT} ${SRC} &> /dev/null \
+        || { echo "Failed: ${LAYOUT}"; exit 1; }
+    ${CC} ${CFLAGS} ${SRC%.*}.c ${WORK_DIR}/builtins.o -o ${SRC%.*}.out &> /dev/null \
+        || { echo "Build failed: ${LAYOUT}"; exit 1; }
+
+    ${SRC%.*}.out > ${SRC%.*}.txt
+    if ! cmp -s ${SRC%.*}.txt ${WORK_DIR}/hierarchy_${LAYOUTS[0]}.txt; then
+        echo "Output mismatch: ${LAYOUT}"
+        exit 1
+    fi
+
+    read TEXT DATA BSS <<< $( size ${SRC%.*}.out | tail -n 1 | awk '{ print $1, $2, $3 }' )
+    MISSES="n/a"
+    if command -v perf &> /dev/null; then
+        MISSES=$( perf stat -x, -e L1-dcache-load-misses ${SRC%.*}.out 2>&1 > /dev/null \
+                  | awk -F, '/L1-dcache-load-misses/ { print $1 }' )
+    fi
+    MS=$( best_time ${SRC%.*}.out )
+    printf "%-10s%10d%10d%14s%10d" ${LAYOUT} ${TEXT} ${DATA} ${MISSES} ${MS}
+    awk -v calls=${NUM_CALLS} -v ms=${MS} 'BEGIN { printf "%12.1f\n", (ms > 0) ? calls / ms / 1000 : 0 }'
+done
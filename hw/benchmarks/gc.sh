@@ -0,0 +1,86 @@
+#!/usr/bin/env bash
+# Garbage Collection Benchmark
+#
+# Builds each benchmark kernel without a collector, with -fgc=mark-sweep, with -fgc=generational,
+# and with -fgc=rc at the same Quack optimization level (OPT_LEVEL, default 2) and C compiler
+# flags, checks that the outputs match, and reports the best wall clock time of each.  The pause
+# times reported by QUACK_GC_STATS are listed for the collectors: the number of collections and
+# the maximum pause of the mark-sweep collector, and the number of minor collections and the
+# mean and maximum minor pause of the generational collector.  For reference counting, the
+# number of objects freed and still live at exit are listed.  NURSERY_SIZE, if set, is passed
+# to -fnursery-size.
+
+if [[ $# -lt 2 || $# -gt 4 ]] ; then
+    echo "Correct command \"gc.sh <BinFile> <RuntimeFolder> [<NumRepeats>] [<KernelsFolder>]\""
+    exit 1
+fi
+
+BIN=$1
+RUNTIME_FOLDER=$2
+NUM_REPEATS=${3:-3}
+KERNELS_FOLDER=${4:-$( dirname $0 )/kernels}
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:--O2}
+OPT_LEVEL=${OPT_LEVEL:-2}
+MODES=(none mark-sweep generational rc)
+NURSERY_FLAG=${NURSERY_SIZE:+-fnursery-size=${NURSERY_SIZE}}
+
+WORK_DIR=$( mktemp -d )
+trap "rm -rf ${WORK_DIR}" EXIT
+
+cp ${RUNTIME_FOLDER}/builtins.h ${WORK_DIR}/
+${CC} ${CFLAGS} -c ${RUNTIME_FOLDER}/builtins.c -o ${WORK_DIR}/builtins.o &> /dev/null || exit 1
+
+# Runs a binary the specified number of times and prints the best time in milliseconds
+best_time () {
+    local EXE=$1
+    local BEST=
+    for (( i=0; i<${NUM_REPEATS}; i++ )); do
+        local START=$( date +%s%N )
+        ${EXE} > /dev/null
+        local END=$( date +%s%N )
+        local MS=$(( (END - START) / 1000000 ))
+        if [[ -z ${BEST} || ${MS} -lt ${BEST} ]]; then
+            BEST=${MS}
+        fi
+    done
+    echo ${BEST}
+}
+
+# Prints the numbers in the line of the collector statistics starting with the label
+gc_stat () {
+    grep "^$2" $1 | sed 's/([^)]*)//g' | grep -oE '[0-9]+(\.[0-9]+)?' | tr '\n' ' '
+}
+
+printf "%-12s%10s%10s%10s%10s%8s%10s%8s%10s%10s%10s%8s\n" "Kernel" "none (ms)" "m-s (ms)" \
+       "gen (ms)" "rc (ms)" "m-s GCs" "max (ms)" "minors" "mean (ms)" "max (ms)" "rc freed" \
+       "live"
+
+for KERNEL in ${KERNELS_FOLDER}/*.qk; do
+    NAME=$( basename ${KERNEL} .qk )
+    TIMES=()
+    for MODE in "${MODES[@]}"; do
+        SRC=${WORK_DIR}/${NAME}_${MODE}.qk
+        cp ${KERNEL} ${SRC}
+        ${BIN} -O${OPT_LEVEL} -fgc=${MODE} ${NURSERY_FLAG} ${SRC} &> /dev/null \
+            || { echo "Failed: ${NAME} -fgc=${MODE}"; exit 1; }
+        ${CC} ${CFLAGS} ${SRC%.*}.c ${WORK_DIR}/builtins.o -o ${SRC%.*}.out &> /dev/null \
+            || { echo "Build failed: ${NAME} -fgc=${MODE}"; exit 1; }
+
+        QUACK_GC_STATS=1 ${SRC%.*}.out > ${SRC%.*}.txt 2> ${SRC%.*}.stats
+        if ! cmp -s ${SRC%.*}.txt ${WORK_DIR}/${NAME}_${MODES[0]}.txt; then
+            echo "Output mismatch: ${NAME} -fgc=${MODE}"
+            exit 1
+        fi
+        TIMES+=( $( best_time ${SRC%.*}.out ) )
+    done
+
+    MS_STATS=${WORK_DIR}/${NAME}_mark-sweep.stats
+    GEN_STATS=${WORK_DIR}/${NAME}_generational.stats
+    RC_STATS=${WORK_DIR}/${NAME}_rc.stats
+    MINOR_PAUSE=( $( gc_stat ${GEN_STATS} "Minor pause" ) )
+    printf "%-12s%10d%10d%10d%10d%8d%10.3f%8d%10.3f%10.3f%10d%8d\n" ${NAME} "${TIMES[@]}" \
+           $( gc_stat ${MS_STATS} "Collections" ) $( gc_stat ${MS_STATS} "Max pause" ) \
+           $( gc_stat ${GEN_STATS} "Minor collections" ) ${MINOR_PAUSE[2]} ${MINOR_PAUSE[1]} \
+           $( gc_stat ${RC_STATS} "Objects freed" ) $( gc_stat ${RC_STATS} "Live objects" )
+done
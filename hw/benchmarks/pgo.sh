@@ -0,0 +1,77 @@
+#!/usr/bin/env bash
+# Profile Guided Optimization Benchmark
+#
+# Compares the run time of the benchmark kernels at -O2 without and with a profile.  Each kernel
+# is first built with -fprofile-generate and run once to write its profile, then rebuilt with
+# -fprofile-use.  Both builds use the same C compiler flags, their outputs are checked against
+# each other, and the best wall clock time of the repeats is reported.
+
+if [[ $# -lt 2 || $# -gt 4 ]] ; then
+    echo "Correct command \"pgo.sh <BinFile> <RuntimeFolder> [<NumRepeats>] [<KernelsFolder>]\""
+    exit 1
+fi
+
+BIN=$1
+RUNTIME_FOLDER=$2
+NUM_REPEATS=${3:-3}
+KERNELS_FOLDER=${4:-$( dirname $0 )/kernels}
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:--O2}
+
+WORK_DIR=$( mktemp -d )
+trap "rm -rf ${WORK_DIR}" EXIT
+
+cp ${RUNTIME_FOLDER}/builtins.h ${WORK_DIR}/
+${CC} ${CFLAGS} -c ${RUNTIME_FOLDER}/builtins.c -o ${WORK_DIR}/builtins.o &> /dev/null || exit 1
+
+# Runs a binary the specified number of times and prints the best time in milliseconds
+best_time () {
+    local EXE=$1
+    local BEST=
+    for (( i=0; i<${NUM_REPEATS}; i++ )); do
+        local START=$( date +%s%N )
+        ${EXE} > /dev/null
+        local END=$( date +%s%N )
+        local MS=$(( (END - START) / 1000000 ))
+        if [[ -z ${BEST} || ${MS} -lt ${BEST} ]]; then
+            BEST=${MS}
+        fi
+    done
+    echo ${BEST}
+}
+
+# Compiles a kernel with the specified Quack flags and builds the generated C
+build () {
+    local SRC=$1
+    shift
+    ${BIN} -O2 "$@" ${SRC} &> /dev/null || return 1
+    ${CC} ${CFLAGS} ${SRC%.*}.c ${WORK_DIR}/builtins.o -o ${SRC%.*}.out &> /dev/null
+}
+
+printf "%-14s%10s%10s%10s\n" "Kernel" "-O2 (ms)" "PGO (ms)" "Speedup"
+
+for KERNEL in ${KERNELS_FOLDER}/*.qk; do
+    NAME=$( basename ${KERNEL} .qk )
+    BASE=${WORK_DIR}/${NAME}_base.qk
+    PGO=${WORK_DIR}/${NAME}_pgo.qk
+    PROFILE=${WORK_DIR}/${NAME}.qprof
+    cp ${KERNEL} ${BASE}
+    cp ${KERNEL} ${PGO}
+
+    build ${BASE} || { echo "Build failed: ${NAME}"; exit 1; }
+    build ${PGO} -fprofile-generate=${PROFILE} || { echo "Build failed: ${NAME} (train)"; exit 1; }
+    ${PGO%.*}.out > /dev/null
+    build ${PGO} -fprofile-use=${PROFILE} || { echo "Build failed: ${NAME} (PGO)"; exit 1; }
+
+    ${BASE%.*}.out > ${BASE%.*}.txt
+    ${PGO%.*}.out > ${PGO%.*}.txt
+    if ! cmp -s ${BASE%.*}.txt ${PGO%.*}.txt; then
+        echo "Output mismatch: ${NAME}"
+        exit 1
+    fi
+
+    BASE_MS=$( best_time ${BASE%.*}.out )
+    PGO_MS=$( best_time ${PGO%.*}.out )
+    printf "%-14s%10d%10d" ${NAME} ${BASE_MS} ${PGO_MS}
+    awk -v base=${BASE_MS} -v pgo=${PGO_MS} 'BEGIN { printf "%9.2fx\n", (pgo > 0) ? base / pgo : 0 }'
+done
@@ -0,0 +1,74 @@
+#!/usr/bin/env bash
+# Runtime Benchmark
+#
+# Compares the run time of the benchmark kernels when compiled at each Quack optimization level.
+# Every generated file is built with the same C compiler flags so only the differences in the
+# generated code are measured.  The output of each level is checked against level 0 and the best
+# wall clock time of the repeats is reported.
+
+if [[ $# -lt 2 || $# -gt 4 ]] ; then
+    echo "Correct command \"run_time.sh <BinFile> <RuntimeFolder> [<NumRepeats>] [<KernelsFolder>]\""
+    exit 1
+fi
+
+BIN=$1
+RUNTIME_FOLDER=$2
+NUM_REPEATS=${3:-3}
+KERNELS_FOLDER=${4:-$( dirname $0 )/kernels}
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:--O2}
+LEVELS=(0 1 2)
+
+WORK_DIR=$( mktemp -d )
+trap "rm -rf ${WORK_DIR}" EXIT
+
+cp ${RUNTIME_FOLDER}/builtins.h ${WORK_DIR}/
+${CC} ${CFLAGS} -c ${RUNTIME_FOLDER}/builtins.c -o ${WORK_DIR}/builtins.o &> /dev/null || exit 1
+
+# Runs a binary the specified number of times and prints the best time in milliseconds
+best_time () {
+    local EXE=$1
+    local BEST=
+    for (( i=0; i<${NUM_REPEATS}; i++ )); do
+        local START=$( date +%s%N )
+        ${EXE} > /dev/null
+        local END=$( date +%s%N )
+        local MS=$(( (END - START) / 1000000 ))
+        if [[ -z ${BEST} || ${MS} -lt ${BEST} ]]; then
+            BEST=${MS}
+        fi
+    done
+    echo ${BEST}
+}
+
+printf "%-14s" "Kernel"
+for LEVEL in "${LEVELS[@]}"; do
+    printf "%10s" "-O${LEVEL} (ms)"
+done
+printf "%10s\n" "Speedup"
+
+for KERNEL in ${KERNELS_FOLDER}/*.qk; do
+    NAME=$( basename ${KERNEL} .qk )
+    TIMES=()
+    for LEVEL in "${LEVELS[@]}"; do
+        SRC=${WORK_DIR}/${NAME}_O${LEVEL}.qk
+        cp ${KERNEL} ${SRC}
+        ${BIN} -O${LEVEL} ${SRC} &> /dev/null || { echo "Failed: ${NAME} -O${LEVEL}"; exit 1; }
+        ${CC} ${CFLAGS} ${SRC%.*}.c ${WORK_DIR}/builtins.o -o ${SRC%.*}.out &> /dev/null \
+            || { echo "Build failed: ${NAME} -O${LEVEL}"; exit 1; }
+
+        ${SRC%.*}.out > ${SRC%.*}.txt
+        if ! cmp -s ${SRC%.*}.txt ${WORK_DIR}/${NAME}_O${LEVELS[0]}.txt; then
+            echo "Output mismatch: ${NAME} -O${LEVEL}"
+            exit 1
+        fi
+        TIMES+=( $( best_time ${SRC%.*}.out ) )
+    done
+
+    printf "%-14s" ${NAME}
+    for MS in "${TIMES[@]}"; do
+        printf "%10d" ${MS}
+    done
+    awk -v first=${TIMES[0]} -v last=${TIMES[${#TIMES[@]}-1]} \
+        'BEGIN { printf "%9.2fx\n", (last > 0) ? first / last : 0 }'
+done
@@ -0,0 +1,83 @@
+#!/usr/bin/env bash
+# String Concatenation Benchmark
+#
+# Generates a program that builds one String by appending a short String in a loop
+# (s = s + x) and prints it, for a doubling number of appends.  Copying both operands on every
+# concatenation takes quadratic time, so each run takes about four times as long as the one
+# before, while ropes that append to a growing buffer take linear time, about twice as long.
+# The ratio of each run to the previous one is reported.  The length of the printed String is
+# checked against the number of appends.
+
+if [[ $# -lt 2 || $# -gt 5 ]] ; then
+    echo "Correct command \"strings.sh <BinFile> <RuntimeFolder> [<FirstAppends>] [<NumSizes>] [<NumRepeats>]\""
+    exit 1
+fi
+
+BIN=$1
+RUNTIME_FOLDER=$2
+FIRST_APPENDS=${3:-25000}
+NUM_SIZES=${4:-5}
+NUM_REPEATS=${5:-3}
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:--O2}
+OPT_LEVEL=${OPT_LEVEL:-2}
+
+WORK_DIR=$( mktemp -d )
+trap "rm -rf ${WORK_DIR}" EXIT
+
+cp ${RUNTIME_FOLDER}/builtins.h ${WORK_DIR}/
+${CC} ${CFLAGS} -c ${RUNTIME_FOLDER}/builtins.c -o ${WORK_DIR}/builtins.o &> /dev/null || exit 1
+
+# Writes the program appending the specified number of 8 byte Strings
+generate () {
+    echo "s = \"\";"
+    echo "i = 0;"
+    echo "while i < $1 {"
+    echo "    s = s + \"abcdefgh\";"
+    echo "    i = i + 1;"
+    echo "}"
+    echo "s.PRINT();"
+}
+
+# Runs a binary the specified number of times and prints the best time in milliseconds
+best_time () {
+    local EXE=$1
+    local BEST=
+    for (( i=0; i<${NUM_REPEATS}; i++ )); do
+        local START=$( date +%s%N )
+        ${EXE} > /dev/null
+        local END=$( date +%s%N )
+        local MS=$(( (END - START) / 1000000 ))
+        if [[ -z ${BEST} || ${MS} -lt ${BEST} ]]; then
+            BEST=${MS}
+        fi
+    done
+    echo ${BEST}
+}
+
+printf "%-12s%12s%10s%10s\n" "Appends" "Bytes" "Time (ms)" "Ratio"
+
+APPENDS=${FIRST_APPENDS}
+PREV_MS=
+for (( n=0; n<${NUM_SIZES}; n++ )); do
+    SRC=${WORK_DIR}/concat_${APPENDS}.qk
+    generate ${APPENDS} > ${SRC}
+    ${BIN} -O${OPT_LEVEL} ${SRC} &> /dev/null || { echo "Failed: ${APPENDS} appends"; exit 1; }
+    ${CC} ${CFLAGS} ${SRC%.*}.c ${WORK_DIR}/builtins.o -o ${SRC%.*}.out &> /dev/null \
+        || { echo "Build failed: ${APPENDS} appends"; exit 1; }
+
+    BYTES=$( ${SRC%.*}.out | wc -c )
+    if [[ ${BYTES} -ne $(( APPENDS * 8 )) ]]; then
+        echo "Output mismatch: ${APPENDS} appends"
+        exit 1
+    fi
+    MS=$( best_time ${SRC%.*}.out )
+    printf "%-12d%12d%10d" ${APPENDS} ${BYTES} ${MS}
+    if [[ -n ${PREV_MS} ]]; then
+        awk -v prev=${PREV_MS} -v ms=${MS} 'BEGIN { printf "%9.2fx\n", (prev > 0) ? ms / prev : 0 }'
+    else
+        printf "%10s\n" "-"
+    fi
+    PREV_MS=${MS}
+    APPENDS=$(( APPENDS * 2 ))
+done
@@ -2,6 +2,7 @@
 // Created by Michal Young on 9/12/18.
 //
 
+#include <cstdlib>
 #include <string>
 
 #include "ASTNode.h"
@@ -20,18 +21,160 @@ namespace AST {
 
   std::string ASTNode::generate_temp_var(const std::string &var_to_store,
                                          CodeGen::Settings settings,
-                                         unsigned indent_lvl, bool is_lhs) const {
+                                         unsigned indent_lvl, bool is_lhs,
+                                         CodeGen::ExprKind kind) const {
     std::string var_name = define_new_temp_var();
-    PRINT_INDENT(indent_lvl);
-    settings.fout_ << type_->generated_object_type_name() << " " << (is_lhs?"* ":"") << var_name
-                   << " = " << (is_lhs ? "&(":"") <<  var_to_store << (is_lhs?")":"") << ";\n";
+    settings.temps_->define(settings.fout_, var_name, type_->generated_object_type_name(),
+                            var_to_store, kind, indent_lvl, is_lhs);
     if (!is_lhs)
       return var_name;
     return "(*" + var_name + ")";
   }
 
+  std::string ASTNode::generate_owned_temp_var(const std::string &var_to_store,
+                                               CodeGen::Settings &settings, unsigned indent_lvl,
+                                               CodeGen::ExprKind kind) const {
+    if (!settings.ref_counts_)
+      return generate_temp_var(var_to_store, settings, indent_lvl, false, kind);
+    std::string var_name = define_new_temp_var();
+    settings.temps_->define(settings.fout_, var_name, type_->generated_object_type_name(),
+                            var_to_store, kind, indent_lvl, false, true);
+    settings.ref_counts_->add_temp(var_name);
+    return var_name;
+  }
+
+  std::string ASTNode::generate_call_arg(CodeGen::Settings &settings, unsigned indent_lvl,
+                                         const std::string &var, const std::string &type) {
+    if (!settings.ref_counts_ || !settings.ref_counts_->is_borrowed_field(var))
+      return var;
+    std::string var_name = define_new_temp_var();
+    settings.temps_->define(settings.fout_, var_name, type, RC_RETAIN_FUNC "(" + var + ")",
+                            CodeGen::ExprKind::EFFECT, indent_lvl, false, true);
+    settings.ref_counts_->add_temp(var_name);
+    settings.ref_counts_->count_retained();
+    return var_name;
+  }
+
+  std::string ASTNode::generate_native_temp_var(const std::string &expr,
+                                                const std::string &native_type,
+                                                CodeGen::Settings &settings,
+                                                unsigned indent_lvl, CodeGen::ExprKind kind) {
+    std::string var_name = define_new_temp_var();
+    settings.temps_->define(settings.fout_, var_name, native_type, expr, kind, indent_lvl, false);
+    return var_name;
+  }
+
+  void ASTNode::generate_native_assign(CodeGen::Settings &settings, unsigned indent_lvl,
+                                       const std::string &var, const CodeGen::NativeLocal &native,
+                                       const std::string &value) {
+    generate_statement(settings, indent_lvl, native.native_ + " = " + value + ";");
+    if (!native.is_stale_)
+      generate_local_store(settings, indent_lvl, var,
+                           GENERATE_LIT_INT_FUNC "(" + native.native_ + ")", true);
+  }
+
+  void ASTNode::generate_local_store(CodeGen::Settings &settings, unsigned indent_lvl,
+                                     const std::string &var, const std::string &value,
+                                     bool is_new) {
+    if (!settings.ref_counts_) {
+      generate_statement(settings, indent_lvl, var + " = " + value + ";");
+      return;
+    }
+    std::string owned = value;
+    if (settings.ref_counts_->owns(value))
+      settings.ref_counts_->move(value);
+    else if (!is_new && !CodeGen::RefCountPool::is_static(value))
+      owned = RC_RETAIN_FUNC "(" + value + ")";
+    generate_statement(settings, indent_lvl, RC_STORE_FUNC "((void *)&(" + var + "), " + owned
+                       + ");");
+  }
+
+  std::string ASTNode::generate_native_value(CodeGen::Settings &settings,
+                                             unsigned indent_lvl) const {
+    if (auto int_lit = dynamic_cast<const IntLit*>(this))
+      return std::to_string(int_lit->value_);
+    if (auto ident = dynamic_cast<const Ident*>(this))
+      if (const CodeGen::NativeLocal * native = settings.native_local(ident->text_))
+        return native->native_;
+    if (auto bool_lit = dynamic_cast<const BoolLit*>(this))
+      return bool_lit->value_ ? "true" : "false";
+
+    // Reused values are read from the local holding their object
+    auto obj_call = dynamic_cast<const ObjectCall*>(this);
+    if (obj_call && !settings.value_number(this)) {
+      if (Quack::Class * field_type = obj_call->unboxed_field_type(settings)) {
+        auto ident = dynamic_cast<Ident*>(obj_call->next_);
+        std::string left_obj = obj_call->object_->generate_code(settings, indent_lvl, false);
+        return generate_native_temp_var(left_obj + "->" + ident->text_,
+                                        field_type == Quack::Class::Container::Int()
+                                        ? GENERATED_NATIVE_INT : GENERATED_NATIVE_BOOL,
+                                        settings, indent_lvl, CodeGen::ExprKind::READ);
+      }
+    }
+
+    auto bin_op = dynamic_cast<const BinOp*>(this);
+    if (bin_op && !dynamic_cast<const BoolOp*>(this)) {
+      if (settings.optimize(1) && bin_op->native_compare_class())
+        return bin_op->generate_native_compare(settings, indent_lvl);
+      if (settings.optimize(2) && bin_op->is_native_arithmetic()) {
+        std::string l_val = bin_op->left_->generate_native_value(settings, indent_lvl);
+        std::string r_val = bin_op->right_->generate_native_value(settings, indent_lvl);
+        return "(" + l_val + " " + bin_op->opsym + " " + r_val + ")";
+      }
+    }
+
+    std::string gen_var = generate_code(settings, indent_lvl, false);
+    if (type_ == Quack::Class::Container::Int())
+      return gen_var + "->" GENERATED_INT_VALUE_FIELD;
+    if (settings.optimize(2))
+      return GENERATED_IS_BOOL_TRUE_FUNC "(" + gen_var + ")";
+    return "(" GENERATED_LIT_TRUE " == " + gen_var + ")";
+  }
+
+  void ASTNode::generate_statement(CodeGen::Settings &settings, unsigned indent_lvl,
+                                   const std::string &stmt) {
+    std::set<std::string> deps;
+    CodeGen::ExprKind kind;
+    std::string resolved = settings.temps_->resolve(settings.fout_, stmt, deps, kind);
+
+    PRINT_INDENT(indent_lvl);
+    settings.fout_ << resolved << "\n";
+    settings.temps_->release(deps);
+  }
+
+  void ASTNode::generate_profile_count(CodeGen::Settings &settings, unsigned indent_lvl,
+                                       const void * key, unsigned long offset) {
+    if (!settings.profile_)
+      return;
+    std::string stmt = settings.profile_->increment(key, std::to_string(offset));
+    if (!stmt.empty())
+      generate_statement(settings, indent_lvl, stmt + ";");
+  }
+
+  void ASTNode::generate_gc_poll(CodeGen::Settings &settings, unsigned indent_lvl) {
+    if (settings.collect_garbage())
+      generate_statement(settings, indent_lvl, CodeGen::ShadowStack::poll_statement());
+  }
+
+  bool ASTNode::generate_numbered_value(CodeGen::Settings &settings, unsigned indent_lvl,
+                                        std::string &var) const {
+    const CodeGen::NumberedValue * number = settings.value_number(this);
+    if (!number)
+      return false;
+
+    var = number->var_;
+    if (number->is_def_) {
+      CodeGen::Settings def_settings = settings;
+      def_settings.computing_value_ = this;
+      std::string value = generate_code(def_settings, indent_lvl, false);
+      generate_local_store(settings, indent_lvl, var, value);
+    }
+    return true;
+  }
+
   void ASTNode::generate_eval_branch(CodeGen::Settings settings, const unsigned indent_lvl,
-                                     const std::string &true_label, const std::string &false_label){
+                                     const std::string &true_label, const std::string &false_label,
+                                     CodeGen::BranchHint hint) {
     if (auto bool_lit = dynamic_cast<BoolLit*>(this)) {
       if (bool_lit->value_)
         generate_goto(settings, indent_lvl, true_label);
@@ -40,12 +183,32 @@ namespace AST {
       return;
     }
     if (auto bool_op = dynamic_cast<BoolOp*>(this))
-      return bool_op->generate_eval_bool_op(settings, indent_lvl, true_label, false_label);
+      return bool_op->generate_eval_bool_op(settings, indent_lvl, true_label, false_label, hint);
 
-    std::string gen_var = this->generate_code(settings, indent_lvl, false);
-    PRINT_INDENT(indent_lvl);
-    settings.fout_ << "if(" GENERATED_LIT_TRUE " == " << gen_var << ") { goto "
-                   << true_label << "; }\n";
+    // Comparisons and unboxed fields feed the branch directly without a Boolean object
+    std::string cond, flag;
+    unsigned long rc_mark = settings.ref_counts_ ? settings.ref_counts_->mark() : 0;
+    if (settings.optimize(1))
+      cond = generate_native_value(settings, indent_lvl);
+    else
+      cond = GENERATED_LIT_TRUE " == " + this->generate_code(settings, indent_lvl, false);
+    if (settings.ref_counts_ && settings.ref_counts_->mark() > rc_mark) {
+      // Objects computed by the condition are released before either branch is taken
+      flag = generate_native_temp_var(cond, GENERATED_NATIVE_BOOL, settings, indent_lvl,
+                                      CodeGen::ExprKind::EFFECT);
+      flag = settings.temps_->materialize(settings.fout_, flag, true);
+      settings.ref_counts_->release_since(*settings.temps_, settings.fout_, indent_lvl, rc_mark);
+      cond = flag;
+    }
+    if (settings.optimize(2)) {
+      if (hint == CodeGen::BranchHint::LIKELY)
+        cond = GENERATED_LIKELY "(" + cond + ")";
+      else if (hint == CodeGen::BranchHint::UNLIKELY)
+        cond = GENERATED_UNLIKELY "(" + cond + ")";
+    }
+    generate_statement(settings, indent_lvl, "if(" + cond + ") { goto " + true_label + "; }");
+    if (!flag.empty())
+      settings.temps_->unpin(flag);
 
     if (false_label != GENERATED_NO_JUMP)
       generate_goto(settings, indent_lvl, false_label, true);
@@ -225,16 +388,120 @@ namespace AST {
     if (is_lhs)
       throw std::runtime_error("Return cannot be on left hand side");
 
+    if (settings.tail_calls_) {
+      auto itr = settings.tail_calls_->calls_.find(this);
+      if (itr != settings.tail_calls_->calls_.end()) {
+        generate_tail_call(settings, indent_lvl, itr->second);
+        return NO_RETURN_VAR;
+      }
+    }
+
     std::string temp_var_name = right_->generate_code(settings, indent_lvl, is_lhs);
 
-    PRINT_INDENT(indent_lvl);
-    settings.fout_ << "return "
-                   << "(" << settings.return_type_->generated_object_type_name() << ")"
-                   << "(" << temp_var_name << ");\n";
+    std::string type = settings.return_type_->generated_object_type_name();
+    if (settings.ref_counts_)
+      generate_counted_return(settings, indent_lvl, temp_var_name);
+    else if (settings.collect_garbage())
+      generate_statement(settings, indent_lvl,
+                         CodeGen::ShadowStack::return_statement(type, temp_var_name));
+    else
+      generate_statement(settings, indent_lvl, "return (" + type + ")(" + temp_var_name + ");");
 
     return NO_RETURN_VAR;
   }
 
+  void Return::generate_counted_return(CodeGen::Settings &settings, unsigned indent_lvl,
+                                       const std::string &value) const {
+    CodeGen::RefCountPool * ref_counts = settings.ref_counts_;
+    std::string type = settings.return_type_->generated_object_type_name();
+    std::string result = value, returned_local;
+    if (!dynamic_cast<const Ident*>(right_) && ref_counts->owns(value)) {
+      // The caller takes the reference of the call's result
+      result = settings.temps_->written(settings.fout_, value);
+      ref_counts->move(value);
+    } else if (ref_counts->is_owned_local(value)) {
+      returned_local = value;
+    } else if (!CodeGen::RefCountPool::is_static(value)) {
+      std::string var_name = define_new_temp_var();
+      settings.temps_->define(settings.fout_, var_name, type, RC_RETAIN_FUNC "(" + value + ")",
+                              CodeGen::ExprKind::EFFECT, indent_lvl, false, true);
+      ref_counts->add_temp(var_name);
+      result = settings.temps_->written(settings.fout_, var_name);
+      ref_counts->move(var_name);
+    }
+    ref_counts->release_all(*settings.temps_, settings.fout_, indent_lvl, returned_local);
+    generate_statement(settings, indent_lvl, "return (" + type + ")(" + result + ");");
+  }
+
+  void Return::generate_tail_call(CodeGen::Settings &settings, unsigned indent_lvl,
+                                  const ObjectCall * call) {
+    auto * func_call = dynamic_cast<const FunctionCall*>(call->next_);
+    Quack::Class * obj_type = call->object_->get_node_type();
+    Quack::Method * method = obj_type->generated_method(func_call->ident_).second;
+
+    // C locals reassigned by the call and their types
+    std::vector<std::pair<std::string, std::string>> targets;
+    targets.emplace_back(OBJECT_SELF, method->obj_class_->generated_object_type_name());
+    for (auto * param : *method->params_)
+      targets.emplace_back(param->name_, param->type_->generated_object_type_name());
+
+    std::vector<std::string> values;
+    values.emplace_back(call->object_->generate_code(settings, indent_lvl, false));
+    std::vector<std::string> * arg_vars = func_call->args_->generate_args(settings, indent_lvl);
+    values.insert(values.end(), arg_vars->begin(), arg_vars->end());
+    delete arg_vars;
+
+    // Every value is stored before any parameter is reassigned.  Parameters passed along
+    // unchanged need no assignment and parameters passed in another position are copied.
+    std::vector<bool> is_changed(values.size());
+    for (unsigned i = 0; i < values.size(); i++)
+      is_changed[i] = values[i] != targets[i].first;
+    for (unsigned i = 0; i < values.size(); i++) {
+      if (!is_changed[i])
+        continue;
+      for (auto &target : targets) {
+        if (values[i] != target.first)
+          continue;
+        std::string var = define_new_temp_var();
+        settings.temps_->define(settings.fout_, var, targets[i].second,
+                                "(" + targets[i].second + ")(" + values[i] + ")",
+                                CodeGen::ExprKind::PURE, indent_lvl, false);
+        values[i] = var;
+        break;
+      }
+    }
+    // The reassigned locals own their objects (see CodeGen::RefCountAnalysis).  New objects
+    // move into them, others are retained before the old objects are released.
+    CodeGen::RefCountPool * ref_counts = settings.ref_counts_;
+    std::vector<bool> is_owned(values.size());
+    for (unsigned i = 0; ref_counts && i < values.size(); i++) {
+      is_owned[i] = is_changed[i] && ref_counts->owns(values[i]);
+      if (is_owned[i])
+        ref_counts->move(values[i]);
+    }
+    for (unsigned i = 0; i < values.size(); i++)
+      if (is_changed[i])
+        values[i] = settings.temps_->materialize(settings.fout_, values[i], true);
+    if (ref_counts) {
+      for (unsigned i = 0; i < values.size(); i++)
+        if (is_changed[i] && !is_owned[i] && !CodeGen::RefCountPool::is_static(values[i]))
+          generate_statement(settings, indent_lvl, RC_RETAIN_FUNC "(" + values[i] + ");");
+      ref_counts->release_temps(*settings.temps_, settings.fout_, indent_lvl);
+      for (unsigned i = 0; i < values.size(); i++)
+        if (is_changed[i])
+          generate_statement(settings, indent_lvl, RC_RELEASE_FUNC "(" + targets[i].first + ");");
+    }
+
+    for (unsigned i = 0; i < values.size(); i++) {
+      if (!is_changed[i])
+        continue;
+      generate_statement(settings, indent_lvl, targets[i].first + " = (" + targets[i].second
+                         + ")(" + values[i] + ");");
+      settings.temps_->unpin(values[i]);
+    }
+    generate_goto(settings, indent_lvl, TAIL_CALL_LABEL, true);
+  }
+
   bool UniOp::perform_type_inference(TypeCheck::Settings &settings, Quack::Class *) {
     right_->perform_type_inference(settings, nullptr);
     type_ = right_->get_node_type();
@@ -412,13 +679,118 @@ namespace AST {
 
     // Use a dynamic cast to handle a field reference, e.g., obj.<FieldName>
     // Store the field value in a temporary variable
-    if (auto ident = dynamic_cast<Ident*>(next_))
-      return generate_temp_var(left_obj + "->" + ident->text_, settings, indent_lvl, is_lhs);
+    if (auto ident = dynamic_cast<Ident*>(next_)) {
+      // Unboxed fields are boxed when read as an object
+      Quack::Class * field_type = is_lhs ? nullptr : unboxed_field_type(settings);
+      std::string field = left_obj + "->" + ident->text_;
+      if (field_type == Quack::Class::Container::Int())
+        return generate_owned_temp_var(GENERATE_LIT_INT_FUNC "(" + field + ")", settings,
+                                       indent_lvl, CodeGen::ExprKind::READ);
+      if (field_type == Quack::Class::Container::Bool())
+        return generate_temp_var("(" + field + " ? " GENERATED_LIT_TRUE " : "
+                                 GENERATED_LIT_FALSE ")", settings, indent_lvl, false,
+                                 CodeGen::ExprKind::READ);
+
+      std::string field_var = generate_temp_var(field, settings, indent_lvl, is_lhs,
+                                                is_lhs ? CodeGen::ExprKind::PURE
+                                                       : CodeGen::ExprKind::READ);
+      // The field keeps the object alive unless a call replaces it
+      if (settings.ref_counts_ && !is_lhs)
+        settings.ref_counts_->add_borrowed(field_var);
+      return field_var;
+    }
 
     // THe code should never get here.  This indicates a logic error in the compiler
     throw std::runtime_error("Unexpected bottoming out of ObjectCall code generation");
   }
 
+  Quack::Class * ObjectCall::unboxed_field_type(const CodeGen::Settings &settings) const {
+    auto ident = dynamic_cast<Ident*>(next_);
+    if (!settings.optimize(2) || ident == nullptr)
+      return nullptr;
+    return object_->get_node_type()->unboxed_field_type(ident->text_);
+  }
+
+  std::string While::generate_counted_loop(CodeGen::Settings &settings, unsigned indent_lvl,
+                                           const CodeGen::CountedLoop &loop) const {
+    Quack::Class * int_class = Quack::Class::Container::Int();
+    generate_one_line_comment(settings, indent_lvl, "Counted Loop on " + loop.var_);
+    PRINT_INDENT(indent_lvl);
+    settings.fout_ << "{\n";
+    settings.temps_->open_scope();
+
+    // Initial value of the counter and value of the bound
+    Ident var(loop.var_.c_str());
+    var.set_node_type(int_class);
+    generate_statement(settings, indent_lvl + 1, GENERATED_NATIVE_INT " " + loop.counter_ + " = "
+                       + var.generate_native_value(settings, indent_lvl + 1) + ";");
+
+    std::map<std::string, CodeGen::NativeLocal> natives;
+    if (settings.native_locals_)
+      natives = *settings.native_locals_;
+    if (!loop.bound_var_.empty()) {
+      Ident bound(loop.bound_var_.c_str());
+      bound.set_node_type(int_class);
+      generate_statement(settings, indent_lvl + 1, GENERATED_NATIVE_INT " " + loop.bound_ + " = "
+                         + bound.generate_native_value(settings, indent_lvl + 1) + ";");
+      // The bound is never assigned in the loop so its object remains valid
+      natives[loop.bound_var_] = {loop.bound_, false};
+    }
+    natives[loop.var_] = {loop.counter_, !loop.sync_object_};
+
+    CodeGen::Settings loop_settings = settings;
+    loop_settings.native_locals_ = &natives;
+
+    std::string cond_val = cond_->generate_native_value(loop_settings, indent_lvl + 1);
+    if (loop_hint(settings) == CodeGen::BranchHint::UNLIKELY)
+      cond_val = GENERATED_UNLIKELY "(" + cond_val + ")";
+    std::string step;
+    if (loop.step_stmt_)
+      step = loop.counter_ + (loop.step_ >= 0 ? " += " + std::to_string(loop.step_)
+                                              : " -= " + std::to_string(-loop.step_));
+    PRINT_INDENT(indent_lvl + 1);
+    settings.fout_ << "for (; " << cond_val << "; " << step << ") {\n";
+    if (loop.sync_object_)
+      generate_local_store(settings, indent_lvl + 2, loop.var_,
+                           GENERATE_LIT_INT_FUNC "(" + loop.counter_ + ")", true);
+    generate_gc_poll(settings, indent_lvl + 2);
+    generate_profile_count(settings, indent_lvl + 2, this, 1);
+    body_->generate_code(loop_settings, indent_lvl + 1, loop.step_stmt_);
+    PRINT_INDENT(indent_lvl + 1);
+    settings.fout_ << "}\n";
+
+    if (loop.write_back_) {
+      // Nested counted loops on the same local update the outer loop's counter
+      const CodeGen::NativeLocal * outer = settings.native_local(loop.var_);
+      if (outer)
+        generate_native_assign(settings, indent_lvl + 1, loop.var_, *outer, loop.counter_);
+      else
+        generate_local_store(settings, indent_lvl + 1, loop.var_,
+                             GENERATE_LIT_INT_FUNC "(" + loop.counter_ + ")", true);
+    }
+    PRINT_INDENT(indent_lvl);
+    settings.fout_ << "}\n";
+    // Temporaries declared in the block are out of scope after it
+    settings.temps_->close_scope();
+    return NO_RETURN_VAR;
+  }
+
+  void While::generate_hoisted_values(CodeGen::Settings &settings, unsigned indent_lvl) const {
+    if (!settings.value_numbers_)
+      return;
+    auto itr = settings.value_numbers_->hoisted_.find(this);
+    if (itr == settings.value_numbers_->hoisted_.end())
+      return;
+
+    generate_one_line_comment(settings, indent_lvl, "Loop Invariant Values");
+    for (const ASTNode * node : itr->second) {
+      CodeGen::Settings def_settings = settings;
+      def_settings.computing_value_ = node;
+      std::string value = node->generate_code(def_settings, indent_lvl, false);
+      generate_local_store(settings, indent_lvl, settings.value_number(node)->var_, value);
+    }
+  }
+
   bool Typecase::perform_type_inference(TypeCheck::Settings &settings, Quack::Class *) {
     // type case does not have a type
     type_ = Quack::Class::Container::Nothing();
@@ -463,7 +835,41 @@ namespace AST {
                                              const std::string &gen_func_name_) const {
     std::ostringstream ss;
     ss << gen_func_name_ << "(" << value_ << ")";
-    return generate_temp_var(ss.str(), settings, indent_lvl, false);
+    return generate_owned_temp_var(ss.str(), settings, indent_lvl, CodeGen::ExprKind::PURE);
+  }
+
+  Quack::Class * BinOp::native_compare_class() const {
+    if (opsym != "<" && opsym != ">" && opsym != "<=" && opsym != ">=" && opsym != "==")
+      return nullptr;
+
+    Quack::Class * l_type = left_->get_node_type();
+    if (l_type != right_->get_node_type())
+      return nullptr;
+    if (l_type == Quack::Class::Container::Int() || l_type == Quack::Class::Container::Str())
+      return l_type;
+    return nullptr;
+  }
+
+  bool BinOp::is_native_arithmetic() const {
+    if (opsym != "+" && opsym != "-" && opsym != "*")
+      return false;
+    Quack::Class * int_class = Quack::Class::Container::Int();
+    return left_->get_node_type() == int_class && right_->get_node_type() == int_class;
+  }
+
+  std::string BinOp::generate_native_compare(CodeGen::Settings &settings,
+                                             unsigned indent_lvl) const {
+    // Quack only has an equality operator so "==" is also the C operator
+    if (native_compare_class() == Quack::Class::Container::Int()) {
+      std::string l_val = left_->generate_native_value(settings, indent_lvl);
+      return "(" + l_val + " " + opsym + " " + right_->generate_native_value(settings, indent_lvl)
+             + ")";
+    }
+    std::string l_var = left_->generate_code(settings, indent_lvl, false);
+    std::string r_var = right_->generate_code(settings, indent_lvl, false);
+    if (opsym == "==")
+      return STR_EQUALS_FUNC "(" + l_var + ", " + r_var + ")";
+    return "(" STR_COMPARE_FUNC "(" + l_var + ", " + r_var + ") " + opsym + " 0)";
   }
 
   std::string Typing::generate_code(CodeGen::Settings &settings, unsigned indent_lvl,
@@ -476,7 +882,7 @@ namespace AST {
 //    std::string cast_var = "(" + type_->generated_object_type_name() + ")" + gen_var;
 //    return generate_temp_var(cast_var, settings, indent_lvl, is_lhs);
     // Generate a cast temp variable
-    return generate_temp_var(gen_var, settings, indent_lvl, is_lhs);
+    return generate_temp_var(gen_var, settings, indent_lvl, is_lhs, CodeGen::ExprKind::PURE);
   }
 
 
@@ -491,17 +897,34 @@ namespace AST {
     std::ostringstream ss;
     if (q_class != get_node_type())
       ss << "(" << get_node_type()->generated_object_type_name() << ")";
-    ss << q_class->generated_constructor_name() << "(";
+
+    // Objects that never escape the function are built in its stack frame
+    bool is_first = true;
+    if (settings.stack_allocs_) {
+      auto itr = settings.stack_allocs_->vars_.find(this);
+      if (itr != settings.stack_allocs_->vars_.end()) {
+        ss << q_class->generated_initializer_name() << "(&" << itr->second;
+        is_first = false;
+      }
+    }
+    if (is_first)
+      ss << q_class->generated_constructor_name() << "(";
+
     assert(arg_vars->size() == params->count());
     for (unsigned i = 0; i < arg_vars->size(); i++) {
-      if (i != 0)
+      if (!is_first)
         ss << ", ";
-      ss << "(" << (*params)[i]->type_->generated_object_type_name() << ")" << (*arg_vars)[i];
+      is_first = false;
+      std::string param_type = (*params)[i]->type_->generated_object_type_name();
+      ss << "(" << param_type << ")"
+         << generate_call_arg(settings, indent_lvl, (*arg_vars)[i], param_type);
     }
     ss << ")";
     delete arg_vars;
 
-    return generate_temp_var(ss.str(), settings, indent_lvl, is_lhs);
+    if (is_lhs)
+      return generate_temp_var(ss.str(), settings, indent_lvl, is_lhs);
+    return generate_owned_temp_var(ss.str(), settings, indent_lvl);
   }
 
   std::string FunctionCall::generate_object_call(Quack::Class * obj_type, std::string object_name,
@@ -511,20 +934,91 @@ namespace AST {
 
     Quack::Method * method = obj_type->get_method(ident_);
 
-    std::ostringstream ss;
-    ss << object_name << "->" << GENERATED_CLASS_FIELD << "->" << ident_ << "("
-        << "(" << method->obj_class_->generated_object_type_name() << ")" << object_name;
-
     Quack::Param::Container * params = method->params_;
     assert(func_tmp_args->size() == params->count());
+    // Builtin methods other than Obj's never run Quack code that could replace a field
+    if (obj_type->is_user_class() || obj_type == Quack::Class::Container::Obj()) {
+      object_name = generate_call_arg(settings, indent_lvl, object_name,
+                                      obj_type->generated_object_type_name());
+      for (unsigned i = 0; i < params->count(); i++)
+        (*func_tmp_args)[i] = generate_call_arg(settings, indent_lvl, (*func_tmp_args)[i],
+                                                (*params)[i]->type_->generated_object_type_name());
+    }
+    std::string args, param_types;
     for (unsigned i = 0; i < params->count(); i ++) {
       Quack::Class * param_type = (*params)[i]->type_;
-      ss << ", " << "(" << param_type->generated_object_type_name() << ")" << (*func_tmp_args)[i];
+      args += ", (" + param_type->generated_object_type_name() + ")" + (*func_tmp_args)[i];
+      param_types += ", " + param_type->generated_object_type_name();
     }
-    ss << ")";
     delete func_tmp_args;
 
-    return generate_temp_var(ss.str(), settings, indent_lvl, is_lhs);
+    std::ostringstream ss;
+    CodeGen::ExprKind kind = CodeGen::ExprKind::EFFECT;
+    bool is_direct = settings.optimize(2) && obj_type->is_leaf_class();
+    // No class overrides the method so only one implementation can be called
+    if (settings.dispatch_ && obj_type->is_user_class())
+      is_direct = is_direct || settings.dispatch_->direct_methods_.count(ident_) > 0;
+    if (is_direct) {
+      // Dynamic type is known so bind the call statically and let the C compiler inline it
+      auto direct = obj_type->generated_direct_method(ident_);
+      ss << direct.second << "("
+         << "(" << direct.first->generated_object_type_name() << ")" << object_name << args << ")";
+      // Int objects are immutable so the fast paths have no observable side effects other
+      // than a division by zero and output
+      if (direct.first == Quack::Class::Container::Int() && ident_ != METHOD_STR
+          && ident_ != METHOD_PRINT && ident_ != METHOD_DIVIDE)
+        kind = CodeGen::ExprKind::PURE;
+    } else {
+      std::string class_id = object_name + "->" GENERATED_CLASS_FIELD "->" GENERATED_CLASS_ID_FIELD;
+      std::string self_type = method->obj_class_->generated_object_type_name();
+      std::string func = object_name + "->" GENERATED_CLASS_FIELD "->" + ident_;
+      std::string func_type = method->return_type_->generated_object_type_name() + " (*)("
+                              + self_type + param_types + ")";
+      if (settings.dispatch_ && obj_type->is_user_class()) {
+        // Methods other than Obj's are in the shared table at the class id plus the row offset
+        auto itr = settings.dispatch_->displacements_.find(ident_);
+        if (itr != settings.dispatch_->displacements_.end()) {
+          long displacement = itr->second;
+          func = "((" + func_type + ")" DISPATCH_TABLE_VAR "[" + class_id
+                 + (displacement < 0 ? " - " : " + ") + std::to_string(std::labs(displacement))
+                 + "])";
+        }
+      }
+      if (settings.inline_caches_) {
+        // The table is only read for receiver classes the site's cache has not seen
+        std::string cache = settings.inline_caches_->add_site(settings.temps_->method_name(),
+                                                              ident_);
+        std::string clazz = "(" + Quack::Class::Container::Obj()->generated_clazz_type_name()
+                            + ")" + object_name + "->" GENERATED_CLASS_FIELD;
+        func = "((" + func_type + ")(" INLINE_CACHE_LOOKUP_FUNC "(" + cache + ", " + clazz
+               + ") ?: " INLINE_CACHE_MISS_FUNC "(" + cache + ", " + clazz + ", ("
+               INLINE_CACHE_FN_TYPE ")" + func + ")))";
+      }
+      std::string call = func + "((" + self_type + ")" + object_name + args + ")";
+      if (settings.profile_) {
+        // Count the receiver's class
+        std::string count = settings.profile_->increment(this, class_id + " - "
+                                                         + std::to_string(obj_type->class_id()));
+        if (!count.empty())
+          call = "(" + count + ", " + call + ")";
+
+        // Receivers almost always of one class call its implementation directly
+        auto itr = settings.profile_->speculated_.find(this);
+        if (itr != settings.profile_->speculated_.end()) {
+          auto direct = itr->second->generated_direct_method(ident_);
+          std::string ret_type = "(" + type_->generated_object_type_name() + ")";
+          call = "(" GENERATED_LIKELY "(" + class_id + " == "
+                 + std::to_string(itr->second->class_id()) + ") ? " + ret_type + direct.second
+                 + "((" + direct.first->generated_object_type_name() + ")" + object_name + args
+                 + ") : " + ret_type + call + ")";
+        }
+      }
+      ss << call;
+    }
+
+    if (is_lhs)
+      return generate_temp_var(ss.str(), settings, indent_lvl, is_lhs, kind);
+    return generate_owned_temp_var(ss.str(), settings, indent_lvl, kind);
   }
 
   std::string Assn::generate_code(CodeGen::Settings &settings, unsigned indent_lvl,
@@ -532,13 +1026,48 @@ namespace AST {
     if (is_lhs)
       throw std::runtime_error("Cannot have assignment on LHS");
 
+    // Strip any type annotations on the left hand side
+    const ASTNode * lhs = lhs_;
+    while (auto typing = dynamic_cast<const Typing*>(lhs))
+      lhs = typing->expr_;
+
+    // Locals held in a native int are updated without creating an object
+    if (auto ident = dynamic_cast<const Ident*>(lhs)) {
+      if (const CodeGen::NativeLocal * native = settings.native_local(ident->text_)) {
+        std::string rhs_val = rhs_->generate_native_value(settings, indent_lvl);
+        generate_native_assign(settings, indent_lvl, ident->text_, *native, rhs_val);
+        return NO_RETURN_VAR;
+      }
+    }
+
+    // Unboxed fields store the native value without creating an object
+    auto obj_call = dynamic_cast<const ObjectCall*>(lhs);
+    if (obj_call && obj_call->unboxed_field_type(settings)) {
+      std::string rhs_val = rhs_->generate_native_value(settings, indent_lvl);
+      std::string left_obj = obj_call->object_->generate_code(settings, indent_lvl, false);
+      generate_statement(settings, indent_lvl, left_obj + "->"
+                         + dynamic_cast<Ident*>(obj_call->next_)->text_ + " = " + rhs_val + ";");
+      return NO_RETURN_VAR;
+    }
+
     std::string rhs_var = rhs_->generate_code(settings, indent_lvl, false);
     std::string lhs_var = lhs_->generate_code(settings, indent_lvl, true);
 
-    PRINT_INDENT(indent_lvl);
-    settings.fout_ << lhs_var << " = "
-                   << "(" << lhs_->get_node_type()->generated_object_type_name() << ")"
-                   << "(" << rhs_var << ");\n";
+    std::string store = lhs_var + " = (" + lhs_->get_node_type()->generated_object_type_name()
+                        + ")(" + rhs_var + ");";
+    if (settings.ref_counts_) {
+      // A new object's reference moves into the variable instead of being retained and released
+      std::string value = rhs_var;
+      if (!dynamic_cast<const Ident*>(rhs_) && settings.ref_counts_->owns(rhs_var))
+        settings.ref_counts_->move(rhs_var);
+      else if (!CodeGen::RefCountPool::is_static(rhs_var))
+        value = RC_RETAIN_FUNC "(" + rhs_var + ")";
+      store = RC_STORE_FUNC "((void *)&(" + lhs_var + "), " + value + ");";
+    }
+    // Old objects referring to nursery objects are remembered by the generational collector
+    if (obj_call && settings.write_barriers())
+      store += " " GC_WRITE_FUNC "((" GC_ROOT_TYPE " *)&(" + lhs_var + "));";
+    generate_statement(settings, indent_lvl, store);
     return NO_RETURN_VAR;
   }
 
@@ -585,6 +1114,77 @@ namespace AST {
     return success;
   }
 
+  std::vector<unsigned long> Typecase::resolve_alternatives() const {
+    std::vector<unsigned long> targets;
+    for (auto &class_pair : *Quack::Class::Container::singleton()) {
+      Quack::Class * q_class = class_pair.second;
+      if (targets.size() <= static_cast<unsigned long>(q_class->class_id()))
+        targets.resize(q_class->class_id() + 1, alts_->size());
+
+      // First match semantics
+      for (unsigned long i = 0; i < alts_->size(); i++) {
+        auto * alt_class = Quack::Class::Container::singleton()->get((*alts_)[i]->type_names_[1]);
+        if (q_class->is_subtype(alt_class)) {
+          targets[q_class->class_id()] = i;
+          break;
+        }
+      }
+    }
+    return targets;
+  }
+
+  void Typecase::generate_typecase_switch(CodeGen::Settings &settings, unsigned indent_lvl,
+                                          const std::string &typecase_var,
+                                          const std::vector<std::string> &labels) const {
+    std::vector<unsigned long> targets = resolve_alternatives();
+
+    // The most common target becomes the default to keep the switch short
+    std::vector<unsigned long> counts(labels.size(), 0);
+    for (auto target : targets)
+      counts[target]++;
+    unsigned long default_target = 0;
+    for (unsigned long i = 1; i < counts.size(); i++)
+      if (counts[i] > counts[default_target])
+        default_target = i;
+
+    PRINT_INDENT(indent_lvl);
+    settings.fout_ << "switch(" << typecase_var << "->" << GENERATED_CLASS_FIELD << "->"
+                   << GENERATED_CLASS_ID_FIELD << ") {\n";
+    for (unsigned long target = 0; target < labels.size(); target++) {
+      if (target == default_target || counts[target] == 0)
+        continue;
+
+      unsigned long num_on_line = 0;
+      for (unsigned long id = 0; id < targets.size(); id++) {
+        if (targets[id] != target)
+          continue;
+        if (num_on_line++ % TYPECASE_CASES_PER_LINE == 0)
+          settings.fout_ << (num_on_line > 1 ? "\n" : "") << indent_str(indent_lvl + 1);
+        settings.fout_ << "case " << id << ": ";
+      }
+      settings.fout_ << "goto " << labels[target] << ";\n";
+    }
+    PRINT_INDENT(indent_lvl + 1);
+    settings.fout_ << "default: goto " << labels[default_target] << ";\n";
+    PRINT_INDENT(indent_lvl);
+    settings.fout_ << "}\n";
+  }
+
+  void Typecase::generate_typecase_fast_path(CodeGen::Settings &settings, unsigned indent_lvl,
+                                             const std::string &typecase_var,
+                                             const CodeGen::TypecaseLayout &layout,
+                                             const std::string &label) {
+    std::string class_id = typecase_var + "->" GENERATED_CLASS_FIELD "->" GENERATED_CLASS_ID_FIELD;
+    std::string cond;
+    if (layout.fast_lo_ == layout.fast_hi_)
+      cond = class_id + " == " + std::to_string(layout.fast_lo_);
+    else
+      cond = "(unsigned)(" + class_id + " - " + std::to_string(layout.fast_lo_) + ") <= "
+             + std::to_string(layout.fast_hi_ - layout.fast_lo_) + "u";
+    generate_statement(settings, indent_lvl, "if(" GENERATED_LIKELY "(" + cond + ")) { goto "
+                       + label + "; }");
+  }
+
   std::string Typecase::generate_code(CodeGen::Settings &settings, unsigned indent_lvl,
                                       bool is_lhs) const {
     if (is_lhs)
@@ -602,29 +1202,34 @@ namespace AST {
 
     generate_one_line_comment(settings, indent_lvl, "Typecase START");
 
+    // Typecase variable is assigned in each alternative so it must be stored in a local
     std::string typecase_var = expr_->generate_code(settings, indent_lvl, false);
+    typecase_var = settings.temps_->materialize(settings.fout_, typecase_var, true);
+
+    // A profile lays out the alternatives hottest first and may check the dominant one before
+    // the switch
+    std::vector<unsigned long> order(alts_->size());
+    for (unsigned long i = 0; i < order.size(); i++)
+      order[i] = i;
+    if (settings.profile_) {
+      auto itr = settings.profile_->typecases_.find(this);
+      if (itr != settings.profile_->typecases_.end()) {
+        const CodeGen::TypecaseLayout &layout = itr->second;
+        order = layout.order_;
+        if (layout.fast_alt_ < alts_->size())
+          generate_typecase_fast_path(settings, indent_lvl, typecase_var, layout,
+                                      labels[layout.fast_alt_]);
+      }
+    }
 
-    for (unsigned i = 0; i < alts_->size(); i++) {
-      TypeAlternative * alt = (*alts_)[i];
-
-      std::string tc_name = alt->type_names_[1];
+    generate_typecase_switch(settings, indent_lvl, typecase_var, labels);
 
-      generate_one_line_comment(settings, indent_lvl, "Typecase Type - " + tc_name);
+    for (unsigned long i : order) {
+      TypeAlternative * alt = (*alts_)[i];
 
-      // Start the typecase check for this type
+      generate_one_line_comment(settings, indent_lvl, "Typecase Type - " + alt->type_names_[1]);
       generate_label(settings, indent_lvl, labels[i], true);
-
-      Quack::Class * typecase_class = Quack::Class::Container::singleton()->get(tc_name);
-
-      // Go To Next typecase check
-      PRINT_INDENT(indent_lvl);
-      settings.fout_ << "if(!" << GENERATED_IS_SUBTYPE_FUNC << "("
-                     << "(" << Quack::Class::Container::Obj()->generated_clazz_type_name() << ")"
-                     << typecase_var << "->"
-                     << GENERATED_CLASS_FIELD << ", "
-                     << "(" << Quack::Class::Container::Obj()->generated_clazz_type_name() << ")"
-                     << "(&" << typecase_class->generated_clazz_obj_struct_name() << ")"
-                     << ")) { goto " << labels[i+1] <<  "; }\n";
+      generate_profile_count(settings, indent_lvl + 1, this, i);
 
       // Set assign the expression
       auto * var = new Ident(alt->type_names_[0].c_str());
@@ -647,8 +1252,316 @@ namespace AST {
 
     generate_label(settings, indent_lvl, end_typecase, true);
     generate_one_line_comment(settings, indent_lvl, "Typecase END");
+    settings.temps_->unpin(typecase_var);
 
     return NO_RETURN_VAR;
   }
 
+
+  //====================================================================//
+  //                 Assembly Generation Related Methods                //
+  //====================================================================//
+
+  void ASTNode::generate_asm_branch(CodeGen::AsmSettings &settings, const std::string &true_label,
+                                    const std::string &false_label) const {
+    if (auto bool_lit = dynamic_cast<const BoolLit*>(this)) {
+      settings.emit("jmp " + (bool_lit->value_ ? true_label : false_label));
+      return;
+    }
+    if (auto bool_op = dynamic_cast<const BoolOp*>(this))
+      return bool_op->generate_asm_bool_op(settings, true_label, false_label);
+    auto bin_op = dynamic_cast<const BinOp*>(this);
+    if (bin_op && bin_op->native_compare_class())
+      return bin_op->generate_asm_native_compare(settings, true_label, false_label);
+
+    generate_asm(settings);
+    settings.emit("cmpq " GENERATED_LIT_TRUE "(%rip), %rax");
+    settings.emit("je " + true_label);
+    if (false_label != GENERATED_NO_JUMP)
+      settings.emit("jmp " + false_label);
+  }
+
+  void ASTNode::generate_asm_call(CodeGen::AsmSettings &settings, const ASTNode * receiver,
+                                  const std::vector<ASTNode*> &args, const std::string &target,
+                                  long method_offset) {
+    // Evaluate the receiver and arguments in order and store them in temporaries
+    std::vector<std::string> vals;
+    std::vector<const ASTNode*> all_args;
+    if (receiver != nullptr)
+      all_args.emplace_back(receiver);
+    all_args.insert(all_args.end(), args.begin(), args.end());
+    for (auto * arg : all_args) {
+      arg->generate_asm(settings);
+      vals.emplace_back(settings.frame_->push_temp());
+      settings.emit("movq %rax, " + vals.back());
+    }
+
+    // Arguments that do not fit in registers are pushed right to left
+    unsigned long num_stack = 0, padding = 0;
+    if (vals.size() > ASM_NUM_ARG_REGS) {
+      num_stack = vals.size() - ASM_NUM_ARG_REGS;
+      padding = (num_stack % 2 == 0) ? 0 : ASM_WORD_SIZE;
+      if (padding > 0)
+        settings.emit("subq $" + std::to_string(padding) + ", %rsp");
+      for (unsigned long i = vals.size(); i > ASM_NUM_ARG_REGS; i--)
+        settings.emit("pushq " + vals[i - 1]);
+    }
+    for (unsigned long i = 0; i < vals.size() && i < ASM_NUM_ARG_REGS; i++)
+      settings.emit("movq " + vals[i] + ", " + CodeGen::ASM_ARG_REGS[i]);
+
+    if (method_offset >= 0) {
+      settings.emit("movq (%rdi), %rax");
+      settings.emit("call *" + std::to_string(method_offset) + "(%rax)");
+    } else {
+      settings.emit("call " + target);
+    }
+
+    if (num_stack > 0)
+      settings.emit("addq $" + std::to_string(ASM_WORD_SIZE * num_stack + padding) + ", %rsp");
+    settings.frame_->pop_temps(vals.size());
+  }
+
+  void If::generate_asm(CodeGen::AsmSettings &settings) const {
+    std::string if_label = define_new_asm_label("if");
+    std::string else_label = define_new_asm_label("else");
+    std::string end_if_label = define_new_asm_label("end_if");
+
+    cond_->generate_asm_branch(settings, if_label, else_label);
+
+    settings.emit_label(if_label);
+    truepart_->generate_asm(settings);
+    settings.emit("jmp " + end_if_label);
+
+    settings.emit_label(else_label);
+    if (falsepart_)
+      falsepart_->generate_asm(settings);
+
+    settings.emit_label(end_if_label);
+  }
+
+  void Ident::generate_asm(CodeGen::AsmSettings &settings) const {
+    settings.emit("movq " + settings.frame_->local(text_) + ", %rax");
+  }
+
+  void IntLit::generate_asm(CodeGen::AsmSettings &settings) const {
+    settings.emit("leaq " + settings.literals_->int_literal(value_) + "(%rip), %rax");
+  }
+
+  void BoolLit::generate_asm(CodeGen::AsmSettings &settings) const {
+    settings.emit(std::string("movq ") + (value_ ? GENERATED_LIT_TRUE : GENERATED_LIT_FALSE)
+                  + "(%rip), %rax");
+  }
+
+  void NothingLit::generate_asm(CodeGen::AsmSettings &settings) const {
+    settings.emit("movq " GENERATED_LIT_NONE "(%rip), %rax");
+  }
+
+  void StrLit::generate_asm(CodeGen::AsmSettings &settings) const {
+    settings.emit("leaq " + settings.literals_->str_literal(value_) + "(%rip), %rax");
+  }
+
+  void Return::generate_asm(CodeGen::AsmSettings &settings) const {
+    if (right_ != nullptr)
+      right_->generate_asm(settings);
+    else
+      settings.emit("movq " GENERATED_LIT_NONE "(%rip), %rax");
+    settings.emit("jmp " + settings.return_label_);
+  }
+
+  void While::generate_asm(CodeGen::AsmSettings &settings) const {
+    std::string test_cond_label = define_new_asm_label("test_cond");
+    std::string loop_again_label = define_new_asm_label("loop_again");
+    std::string end_while_label = define_new_asm_label("end_while");
+
+    settings.emit("jmp " + test_cond_label);
+    settings.emit_label(loop_again_label);
+    body_->generate_asm(settings);
+
+    settings.emit_label(test_cond_label);
+    cond_->generate_asm_branch(settings, loop_again_label, end_while_label);
+    settings.emit_label(end_while_label);
+  }
+
+  void RhsArgs::generate_asm(CodeGen::AsmSettings &settings) const {
+    throw std::runtime_error("Cannot generate RHS args similar to normal args");
+  }
+
+  void FunctionCall::generate_asm(CodeGen::AsmSettings &settings) const {
+    Quack::Class * q_class = Quack::Class::Container::singleton()->get(ident_);
+    assert(q_class);
+    generate_asm_call(settings, nullptr, args_->args_, q_class->generated_constructor_name());
+  }
+
+  void ObjectCall::generate_asm(CodeGen::AsmSettings &settings) const {
+    Quack::Class * obj_type = object_->get_node_type();
+
+    if (auto func_call = dynamic_cast<FunctionCall*>(next_)) {
+      generate_asm_call(settings, object_, func_call->args_->args_, "",
+                        obj_type->generated_method_offset(func_call->ident_));
+      return;
+    }
+
+    if (auto ident = dynamic_cast<Ident*>(next_)) {
+      object_->generate_asm(settings);
+      settings.emit("movq " + std::to_string(obj_type->generated_field_offset(ident->text_))
+                    + "(%rax), %rax");
+      return;
+    }
+
+    throw std::runtime_error("Unexpected bottoming out of ObjectCall assembly generation");
+  }
+
+  void BinOp::generate_asm(CodeGen::AsmSettings &settings) const {
+    Quack::Class * l_type = left_->get_node_type();
+    generate_asm_call(settings, left_, {right_}, "",
+                      l_type->generated_method_offset(op_lookup(opsym)));
+  }
+
+  void BinOp::generate_asm_native_compare(CodeGen::AsmSettings &settings,
+                                          const std::string &true_label,
+                                          const std::string &false_label) const {
+    left_->generate_asm(settings);
+    std::string l_tmp = settings.frame_->push_temp();
+    settings.emit("movq %rax, " + l_tmp);
+    right_->generate_asm(settings);
+    settings.emit("movq " + l_tmp + ", %rdx");
+    settings.frame_->pop_temps();
+
+    // Int's value directly follows the class pointer
+    std::string field = std::to_string(ASM_WORD_SIZE);
+    if (native_compare_class() == Quack::Class::Container::Int()) {
+      settings.emit("movl " + field + "(%rdx), %edx");
+      settings.emit("cmpl " + field + "(%rax), %edx");
+    } else {
+      settings.emit("movq %rdx, %rdi");
+      settings.emit("movq %rax, %rsi");
+      settings.emit("call " STR_ORDER_FUNC);
+      settings.emit("cmpl $0, %eax");
+    }
+
+    std::string jump;
+    if (opsym == "<")
+      jump = "jl ";
+    else if (opsym == ">")
+      jump = "jg ";
+    else if (opsym == "<=")
+      jump = "jle ";
+    else if (opsym == ">=")
+      jump = "jge ";
+    else
+      jump = "je ";
+    settings.emit(jump + true_label);
+    if (false_label != GENERATED_NO_JUMP)
+      settings.emit("jmp " + false_label);
+  }
+
+  void BoolOp::generate_asm(CodeGen::AsmSettings &settings) const {
+    std::string bool_true = define_new_asm_label(opsym + "_TRUE");
+    std::string bool_false = define_new_asm_label(opsym + "_FALSE");
+    std::string bool_end = define_new_asm_label(opsym + "_END");
+
+    generate_asm_branch(settings, bool_true, bool_false);
+
+    settings.emit_label(bool_true);
+    settings.emit("movq " GENERATED_LIT_TRUE "(%rip), %rax");
+    settings.emit("jmp " + bool_end);
+    settings.emit_label(bool_false);
+    settings.emit("movq " GENERATED_LIT_FALSE "(%rip), %rax");
+    settings.emit_label(bool_end);
+  }
+
+  void BoolOp::generate_asm_bool_op(CodeGen::AsmSettings &settings, const std::string &true_label,
+                                    const std::string &false_label) const {
+    if (opsym == UNARY_OP_NOT) {
+      left_->generate_asm_branch(settings, false_label, true_label);
+      return;
+    }
+
+    std::string halfway_label = define_new_asm_label("halfway");
+    if (opsym == METHOD_AND)
+      left_->generate_asm_branch(settings, halfway_label, false_label);
+    else if (opsym == METHOD_OR)
+      left_->generate_asm_branch(settings, true_label, halfway_label);
+    else
+      throw std::runtime_error("Unknown Boolean operator " + opsym);
+
+    settings.emit_label(halfway_label);
+    right_->generate_asm_branch(settings, true_label, false_label);
+  }
+
+  void UniOp::generate_asm(CodeGen::AsmSettings &settings) const {
+    if (opsym != UNARY_OP_NEG)
+      throw std::runtime_error("Only unary operation supported is \"" UNARY_OP_NEG "\"");
+
+    // Same as the C code generator, negation is "0 - x"
+    Quack::Class * int_class = Quack::Class::Container::Int();
+    IntLit zero(0);
+    zero.set_node_type(int_class);
+    generate_asm_call(settings, &zero, {right_}, "",
+                      int_class->generated_method_offset(BinOp::op_lookup(opsym)));
+  }
+
+  void Typing::generate_asm(CodeGen::AsmSettings &settings) const {
+    expr_->generate_asm(settings);
+  }
+
+  void Assn::generate_asm(CodeGen::AsmSettings &settings) const {
+    rhs_->generate_asm(settings);
+
+    // Strip any type annotations on the left hand side
+    const ASTNode * lhs = lhs_;
+    while (auto typing = dynamic_cast<const Typing*>(lhs))
+      lhs = typing->expr_;
+
+    if (auto ident = dynamic_cast<const Ident*>(lhs)) {
+      settings.emit("movq %rax, " + settings.frame_->local(ident->text_));
+      return;
+    }
+
+    auto obj_call = dynamic_cast<const ObjectCall*>(lhs);
+    auto field = (obj_call != nullptr) ? dynamic_cast<const Ident*>(obj_call->next_) : nullptr;
+    if (field == nullptr)
+      throw std::runtime_error("Unsupported left hand side in assembly generation");
+
+    std::string rhs_val = settings.frame_->push_temp();
+    settings.emit("movq %rax, " + rhs_val);
+    obj_call->object_->generate_asm(settings);
+    settings.emit("movq " + rhs_val + ", %rcx");
+    long offset = obj_call->object_->get_node_type()->generated_field_offset(field->text_);
+    settings.emit("movq %rcx, " + std::to_string(offset) + "(%rax)");
+    settings.frame_->pop_temps();
+  }
+
+  void Typecase::generate_asm(CodeGen::AsmSettings &settings) const {
+    std::string end_typecase = define_new_asm_label("end_typecase");
+
+    expr_->generate_asm(settings);
+    std::string typecase_val = settings.frame_->push_temp();
+    settings.emit("movq %rax, " + typecase_val);
+
+    for (auto * alt : *alts_) {
+      std::string next_label = define_new_asm_label("typecase_next");
+      Quack::Class * typecase_class;
+      typecase_class = Quack::Class::Container::singleton()->get(alt->type_names_[1]);
+
+      // Subtypes have ids in the alternative class's preorder interval
+      settings.emit("movq " + typecase_val + ", %rax");
+      settings.emit("movq (%rax), %rax");
+      settings.emit("movl " + std::to_string(ASM_WORD_SIZE) + "(%rax), %eax");
+      settings.emit("cmpl $" + std::to_string(typecase_class->class_id()) + ", %eax");
+      settings.emit("jl " + next_label);
+      settings.emit("cmpl $" + std::to_string(typecase_class->class_max_id()) + ", %eax");
+      settings.emit("jg " + next_label);
+
+      settings.emit("movq " + typecase_val + ", %rax");
+      settings.emit("movq %rax, " + settings.frame_->local(alt->type_names_[0]));
+      alt->block_->generate_asm(settings);
+      settings.emit("jmp " + end_typecase);
+      settings.emit_label(next_label);
+    }
+
+    settings.emit_label(end_typecase);
+    settings.frame_->pop_temps();
+  }
+
 }
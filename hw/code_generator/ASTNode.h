@@ -22,9 +22,11 @@
 #include "symbol_table.h"
 #include "compiler_utils.h"
 #include "code_gen_utils.h"
+#include "asm_gen_utils.h"
 
 #define NO_RETURN_VAR ""
-#define PRINT_INDENT(a) (settings.fout_ << AST::ASTNode::indent_str(a))
+#define PRINT_INDENT(a) (AST::ASTNode::flush_temp_vars(settings), \
+                         settings.fout_ << AST::ASTNode::indent_str(a))
 #define PADDING_WIDTH 4
 
 // Forward declaration
@@ -89,8 +91,43 @@ namespace AST {
     virtual std::string generate_code(CodeGen::Settings &settings, unsigned indent_lvl,
                                       bool is_lhs) const = 0;
 
+    /**
+     * Generates a conditional jump on a Boolean expression.
+     *
+     * @param settings Code generator settings
+     * @param indent_lvl Level of indentation
+     * @param true_label Label to jump to if the expression evaluates to true
+     * @param false_label Label to jump to if the expression evaluates to false
+     * @param hint Expected likelihood of jumping to \p true_label
+     */
     void generate_eval_branch(CodeGen::Settings settings, const unsigned indent_lvl,
-                              const std::string &true_label, const std::string &false_label);
+                              const std::string &true_label, const std::string &false_label,
+                              CodeGen::BranchHint hint = CodeGen::BranchHint::NONE);
+    /**
+     * Generates x86-64 assembly (GNU as syntax) for the node.  If the node has a value, it is
+     * left in %rax.
+     *
+     * @param settings Assembly generator settings
+     */
+    virtual void generate_asm(CodeGen::AsmSettings &settings) const = 0;
+    /**
+     * Assembly equivalent of generate_eval_branch.
+     *
+     * @param settings Assembly generator settings
+     * @param true_label Label to jump to if the node evaluates to true
+     * @param false_label Label to jump to if the node evaluates to false
+     */
+    void generate_asm_branch(CodeGen::AsmSettings &settings, const std::string &true_label,
+                             const std::string &false_label) const;
+    /**
+     * Helper function used to create a unique assembly local label.
+     *
+     * @param label_header Header used for the label
+     * @return Unique label
+     */
+    static const std::string define_new_asm_label(const std::string &label_header) {
+      return ".L" + define_new_label(label_header);
+    }
 
     static std::string indent_str(unsigned indent_level) {
       return std::string(indent_level, '\t');
@@ -154,7 +191,131 @@ namespace AST {
      * @return Pointer to the memory location
      */
     std::string generate_temp_var(const std::string &var_to_store, CodeGen::Settings settings,
-                                  unsigned indent_lvl, bool is_lhs) const;
+                                  unsigned indent_lvl, bool is_lhs,
+                                  CodeGen::ExprKind kind = CodeGen::ExprKind::EFFECT) const;
+    /**
+     * Stores a new object, e.g., the result of a call, in a new temporary.  When objects are
+     * reference counted, the temporary owns the reference and releases it after its use.
+     *
+     * @param var_to_store Expression returning a reference owned by the caller
+     * @param settings Code generation settings
+     * @param indent_lvl Level of indentation
+     * @param kind Reordering class of \p var_to_store
+     * @return Name of the temporary
+     */
+    std::string generate_owned_temp_var(const std::string &var_to_store,
+                                        CodeGen::Settings &settings, unsigned indent_lvl,
+                                        CodeGen::ExprKind kind = CodeGen::ExprKind::EFFECT) const;
+    /**
+     * Retains a field value passed to a call that may run Quack code.  The callee could store
+     * another object in the field and so free the value while it is still being used.
+     *
+     * @param settings Code generation settings
+     * @param indent_lvl Level of indentation
+     * @param var Argument or receiver of the call
+     * @param type C type of the temporary holding the retained value
+     * @return \p var or the temporary owning the retained value
+     */
+    static std::string generate_call_arg(CodeGen::Settings &settings, unsigned indent_lvl,
+                                         const std::string &var, const std::string &type);
+    /**
+     * Stores a native (i.e., unboxed) C value in a new temporary variable.
+     *
+     * @param expr Expression to store in the temporary
+     * @param native_type C type of the expression, e.g., int
+     * @param settings Code generation settings
+     * @param indent_lvl Level of indentation
+     * @param kind Reordering class of \p expr
+     * @return Name of the temporary
+     */
+    static std::string generate_native_temp_var(const std::string &expr,
+                                                const std::string &native_type,
+                                                CodeGen::Settings &settings, unsigned indent_lvl,
+                                                CodeGen::ExprKind kind);
+    /**
+     * Generates the native C value of an Int or Boolean expression, i.e., an int or a bool
+     * respectively.  Literals, unboxed fields, comparisons, and Int arithmetic are evaluated
+     * without creating any objects.  Other expressions are unboxed from their object.
+     *
+     * @param settings Code generation settings
+     * @param indent_lvl Level of indentation
+     * @return C expression with the native value
+     */
+    std::string generate_native_value(CodeGen::Settings &settings, unsigned indent_lvl) const;
+    /**
+     * Writes a single statement that consumes temporary variables.  Any temporaries used only
+     * by the statement are forwarded into it and are released once it is written.
+     *
+     * @param settings Code generation settings
+     * @param indent_lvl Level of indentation
+     * @param stmt Complete statement including any trailing semicolon
+     */
+    static void generate_statement(CodeGen::Settings &settings, unsigned indent_lvl,
+                                   const std::string &stmt);
+    /**
+     * Increments a profile counter if the program is instrumented.
+     *
+     * @param settings Code generation settings
+     * @param indent_lvl Level of indentation
+     * @param key Function, call site, typecase, or loop that owns the counter
+     * @param offset Position of the counter after the owner's first counter
+     */
+    static void generate_profile_count(CodeGen::Settings &settings, unsigned indent_lvl,
+                                       const void * key, unsigned long offset = 0);
+    /**
+     * Runs the garbage collector if a collection was requested and objects are collected.
+     *
+     * @param settings Code generation settings
+     * @param indent_lvl Level of indentation
+     */
+    static void generate_gc_poll(CodeGen::Settings &settings, unsigned indent_lvl);
+    /**
+     * Generates an expression whose value is reused (see CodeGen::ValueNumbering).  The first
+     * evaluation stores the value in a C local and all others read the local.
+     *
+     * @param settings Code generation settings
+     * @param indent_lvl Level of indentation
+     * @param var Local holding the value of the expression
+     * @return True if the expression's value is reused and false if its code must be generated
+     *         normally
+     */
+    bool generate_numbered_value(CodeGen::Settings &settings, unsigned indent_lvl,
+                                 std::string &var) const;
+    /**
+     * Assigns a local held in a native int.  If the local's object is kept up to date, it is
+     * updated as well.
+     *
+     * @param settings Code generation settings
+     * @param indent_lvl Level of indentation
+     * @param var Name of the Quack local
+     * @param native Native storage of the local
+     * @param value Native value assigned
+     */
+    static void generate_native_assign(CodeGen::Settings &settings, unsigned indent_lvl,
+                                       const std::string &var, const CodeGen::NativeLocal &native,
+                                       const std::string &value);
+    /**
+     * Stores an object in a C local introduced by an optimization.  When objects are reference
+     * counted, the local owns the object like a Quack local and releases the one it held.
+     *
+     * @param settings Code generation settings
+     * @param indent_lvl Level of indentation
+     * @param var Name of the C local
+     * @param value Object stored
+     * @param is_new True if \p value is a new reference, e.g., a boxed native int
+     */
+    static void generate_local_store(CodeGen::Settings &settings, unsigned indent_lvl,
+                                     const std::string &var, const std::string &value,
+                                     bool is_new = false);
+    /**
+     * Writes any pending temporary variables.  Called before any other output is written.
+     *
+     * @param settings Code generation settings
+     */
+    static void flush_temp_vars(CodeGen::Settings &settings) {
+      if (settings.temps_ != nullptr)
+        settings.temps_->flush(settings.fout_);
+    }
     /**
      * Standardizes creating a one line comment.
      *
@@ -175,6 +336,20 @@ namespace AST {
     virtual bool contains_return_all_paths() { return false; }
 
    protected:
+    /**
+     * Generates a call using the System V AMD64 calling convention.  The receiver (if any) and
+     * the arguments are evaluated left to right.
+     *
+     * @param settings Assembly generator settings
+     * @param receiver Receiver object.  If nullptr, the call has no implicit receiver.
+     * @param args Arguments to the call
+     * @param target Function called directly.  Ignored if \p method_offset is used.
+     * @param method_offset If non-negative, the method is called through the receiver's clazz
+     *                      at this byte offset.
+     */
+    static void generate_asm_call(CodeGen::AsmSettings &settings, const ASTNode * receiver,
+                                  const std::vector<ASTNode*> &args, const std::string &target,
+                                  long method_offset = -1);
     /** Type for the node */
     Quack::Class * type_ = nullptr;
     /**
@@ -192,6 +367,14 @@ namespace AST {
    * and leave it to the parser to build valid structures.
    */
   class Block {
+    friend class CodeGen::EscapeAnalysis;
+    friend class CodeGen::LoopAnalysis;
+    friend class CodeGen::EffectAnalysis;
+    friend class CodeGen::ValueNumbering;
+    friend class CodeGen::TailCallAnalysis;
+    friend class CodeGen::FieldLayout;
+    friend class CodeGen::ProfileAnalysis;
+    friend class CodeGen::RefCountAnalysis;
    public:
     Block() : stmts_{std::vector<ASTNode *>()} {}
 
@@ -236,12 +419,35 @@ namespace AST {
      *
      * @param settings
      * @param indent_lvl Incoming number of indents
+     * @param skip Statement that is not generated (e.g., generated elsewhere by the caller)
      */
-    void generate_code(CodeGen::Settings &settings, unsigned indent_lvl = 0) {
+    void generate_code(CodeGen::Settings &settings, unsigned indent_lvl = 0,
+                       const ASTNode * skip = nullptr) {
       std::string indent_str = AST::ASTNode::indent_str(indent_lvl);
 
+      for (auto * stmt : stmts_) {
+        if (stmt == skip)
+          continue;
+        unsigned long rc_mark = settings.ref_counts_ ? settings.ref_counts_->mark() : 0;
+        std::string stmt_var = stmt->generate_code(settings, indent_lvl + 1, false);
+        // Statement's value is never used
+        if (settings.temps_ != nullptr)
+          settings.temps_->discard(settings.fout_, stmt_var);
+        // References owned by the statement's temporaries are dead once it is done.  A return
+        // already released them.
+        if (settings.ref_counts_)
+          settings.ref_counts_->release_since(*settings.temps_, settings.fout_, indent_lvl + 1,
+                                              rc_mark, !stmt->contains_return_all_paths());
+      }
+    }
+    /**
+     * Generates the assembly for a block of statements.
+     *
+     * @param settings Assembly generator settings
+     */
+    void generate_asm(CodeGen::AsmSettings &settings) {
       for (auto * stmt : stmts_)
-        stmt->generate_code(settings, indent_lvl + 1, false);
+        stmt->generate_asm(settings);
     }
     /**
      * Checks whether the block has a return on all paths through the block.
@@ -261,6 +467,14 @@ namespace AST {
   };
 
   class If : public ASTNode {
+    friend class CodeGen::EscapeAnalysis;
+    friend class CodeGen::LoopAnalysis;
+    friend class CodeGen::EffectAnalysis;
+    friend class CodeGen::ValueNumbering;
+    friend class CodeGen::TailCallAnalysis;
+    friend class CodeGen::FieldLayout;
+    friend class CodeGen::ProfileAnalysis;
+    friend class CodeGen::RefCountAnalysis;
    public:
     explicit If(ASTNode *cond, Block* truepart, Block* falsepart) :
         cond_{cond}, truepart_{truepart}, falsepart_{falsepart} {};
@@ -356,6 +570,8 @@ namespace AST {
       return truepart_->contains_return_all_paths() && falsepart_->contains_return_all_paths();
     }
 
+    void generate_asm(CodeGen::AsmSettings &settings) const override;
+
     bool perform_type_inference(TypeCheck::Settings &settings, Quack::Class * parent_type) override;
    private:
     ASTNode *cond_; // The boolean expression to be evaluated
@@ -428,6 +644,8 @@ namespace AST {
     bool update_inferred_type(TypeCheck::Settings &settings, Quack::Class *inferred_type,
                               bool is_field) override;
 
+    void generate_asm(CodeGen::AsmSettings &settings) const override;
+
     bool perform_type_inference(TypeCheck::Settings &settings, Quack::Class * parent_type) override;
     /**
      * Simply prints the identifier name.
@@ -437,6 +655,11 @@ namespace AST {
      */
     std::string generate_code(CodeGen::Settings &settings, unsigned indent_lvl ,
                               bool is_lhs) const override {
+      // Locals held in a native int are boxed when their value is needed as an object
+      const CodeGen::NativeLocal * native = settings.native_local(text_);
+      if (!is_lhs && native && native->is_stale_)
+        return generate_owned_temp_var(GENERATE_LIT_INT_FUNC "(" + native->native_ + ")",
+                                       settings, indent_lvl, CodeGen::ExprKind::PURE);
       return text_;
     }
     /** Identifier name */
@@ -483,9 +706,13 @@ namespace AST {
 
     std::string generate_code(CodeGen::Settings &settings, unsigned indent_lvl,
                               bool is_lhs) const override {
+      if (settings.literals_)
+        return "(&" + settings.literals_->int_literal(value_) + ")";
       return generate_lit_code(settings, indent_lvl, GENERATE_LIT_INT_FUNC);
     }
 
+    void generate_asm(CodeGen::AsmSettings &settings) const override;
+
     bool perform_type_inference(TypeCheck::Settings &settings, Quack::Class * parent_type) override;
   };
 
@@ -503,6 +730,8 @@ namespace AST {
       return GENERATED_LIT_FALSE;
     }
 
+    void generate_asm(CodeGen::AsmSettings &settings) const override;
+
     bool perform_type_inference(TypeCheck::Settings &settings, Quack::Class * parent_type) override;
   };
 
@@ -518,6 +747,8 @@ namespace AST {
       return GENERATED_LIT_NONE;
     }
 
+    void generate_asm(CodeGen::AsmSettings &settings) const override;
+
     bool perform_type_inference(TypeCheck::Settings &settings, Quack::Class * parent_type) override;
   };
 
@@ -528,19 +759,25 @@ namespace AST {
       std::cout  << "\"" << value_ << "\"";
     }
     /**
-     * Generates the code to create a string literal.  It relies on the standardized literal
-     * generation method.
+     * Generates the code to create a string literal.  When literals are pooled, the shared
+     * static object is referenced directly.
      *
      * @param settings Code generator setting
      * @param indent_lvl Level of indention
      */
     std::string generate_code(CodeGen::Settings &settings, unsigned indent_lvl,
                               bool is_lhs) const override {
+      if (settings.literals_)
+        return "(&" + settings.literals_->str_literal(value_) + ")";
       std::ostringstream ss;
-      ss << GENERATE_LIT_STRING_FUNC << "(\"" << value_ << "\")";
-      return generate_temp_var(ss.str(), settings, indent_lvl, false);
+      std::string bytes = CodeGen::LiteralPool::text_bytes(value_);
+      ss << GENERATE_LIT_STRING_FUNC << "(\"" << CodeGen::LiteralPool::quoted_bytes(bytes)
+         << "\", " << bytes.size() << ")";
+      return generate_owned_temp_var(ss.str(), settings, indent_lvl, CodeGen::ExprKind::PURE);
     }
 
+    void generate_asm(CodeGen::AsmSettings &settings) const override;
+
     bool perform_type_inference(TypeCheck::Settings &settings, Quack::Class * parent_type) override;
   };
 
@@ -575,6 +812,26 @@ namespace AST {
      */
     std::string generate_code(CodeGen::Settings &settings, unsigned indent_lvl,
                               bool is_lhs) const override;
+    /**
+     * Releases the references the method owns and returns one owned by the caller.  A new
+     * object or a local is returned without a retain.
+     *
+     * @param settings Code generator settings
+     * @param indent_lvl Level of indentation
+     * @param value Returned value
+     */
+    void generate_counted_return(CodeGen::Settings &settings, unsigned indent_lvl,
+                                 const std::string &value) const;
+    /**
+     * Generates a self tail call as a jump back to the start of the method.  The receiver and
+     * the arguments are all computed before this and the parameters are reassigned.
+     *
+     * @param settings Code generator settings
+     * @param indent_lvl Level of indentation
+     * @param call Method call returned by this statement
+     */
+    static void generate_tail_call(CodeGen::Settings &settings, unsigned indent_lvl,
+                                   const ObjectCall * call);
     /**
      * Always returns true since this is a return statement.
      *
@@ -582,6 +839,8 @@ namespace AST {
      */
     bool contains_return_all_paths() override { return true; }
 
+    void generate_asm(CodeGen::AsmSettings &settings) const override;
+
     bool perform_type_inference(TypeCheck::Settings &settings, Quack::Class * parent_type) override;
   };
 
@@ -629,6 +888,8 @@ namespace AST {
       return success;
     }
 
+    void generate_asm(CodeGen::AsmSettings &settings) const override;
+
     bool perform_type_inference(TypeCheck::Settings &settings, Quack::Class * parent_type) override;
 
     std::string generate_code(CodeGen::Settings &settings, unsigned indent_lvl,
@@ -636,6 +897,15 @@ namespace AST {
       if (is_lhs)
         throw std::runtime_error("While loop cannot be on LHS");
 
+      generate_hoisted_values(settings, indent_lvl);
+      generate_profile_count(settings, indent_lvl, this);
+
+      if (settings.counted_loops_) {
+        auto itr = settings.counted_loops_->loops_.find(this);
+        if (itr != settings.counted_loops_->loops_.end())
+          return generate_counted_loop(settings, indent_lvl, itr->second);
+      }
+
       std::string test_cond_label = define_new_label("test_cond");
       std::string loop_again_label = define_new_label("loop_again");
       std::string end_while_label = define_new_label("end_while");
@@ -643,14 +913,16 @@ namespace AST {
       generate_one_line_comment(settings, indent_lvl, "WHILE Loop Start");
       generate_goto(settings, indent_lvl, test_cond_label, true);
       generate_label(settings, indent_lvl, loop_again_label, true);
+      generate_gc_poll(settings, indent_lvl + 1);
+      generate_profile_count(settings, indent_lvl + 1, this, 1);
 
       // Body of the loop is a simple block
       body_->generate_code(settings, indent_lvl + 1);
 
       generate_label(settings, indent_lvl, test_cond_label, true);
 
-      // Checks while condition
-      cond_->generate_eval_branch(settings, indent_lvl, loop_again_label, end_while_label);
+      cond_->generate_eval_branch(settings, indent_lvl, loop_again_label, end_while_label,
+                                  loop_hint(settings));
       generate_label(settings, indent_lvl, end_while_label, true);
 
       // Comment for clarity. Delete if cluttering
@@ -658,6 +930,38 @@ namespace AST {
 
       return NO_RETURN_VAR;
     }
+    /**
+     * Generates a counted loop as a C for loop whose counter is a native int.  The counter's
+     * object is only updated after the loop and only if it may be read there.
+     *
+     * @param settings Code generator settings
+     * @param indent_lvl Level of indentation
+     * @param loop Counter and bound of the loop
+     */
+    std::string generate_counted_loop(CodeGen::Settings &settings, unsigned indent_lvl,
+                                      const CodeGen::CountedLoop &loop) const;
+    /**
+     * Expected outcome of the loop condition.  Loops usually run more than once unless the
+     * profile shows otherwise.
+     *
+     * @param settings Code generator settings
+     * @return Branch hint of the condition
+     */
+    CodeGen::BranchHint loop_hint(const CodeGen::Settings &settings) const {
+      if (settings.profile_) {
+        auto itr = settings.profile_->loop_hints_.find(this);
+        if (itr != settings.profile_->loop_hints_.end())
+          return itr->second;
+      }
+      return CodeGen::BranchHint::LIKELY;
+    }
+    /**
+     * Computes the values of the loop invariant expressions moved out of the loop.
+     *
+     * @param settings Code generator settings
+     * @param indent_lvl Level of indentation
+     */
+    void generate_hoisted_values(CodeGen::Settings &settings, unsigned indent_lvl) const;
   };
 
   struct RhsArgs : public ASTNode {
@@ -713,18 +1017,16 @@ namespace AST {
       std::vector<std::string> * gen_args = new std::vector<std::string>();
 
       for (auto * arg: args_) {
-        if (auto arg_cast = dynamic_cast<Ident *>(arg)) {
-          gen_args->emplace_back(arg_cast->text_);
-        } else {
-          // Cannot have ARGS on LHS even if incoming is LHS
-          std::string temp_var = arg->generate_code(settings, indent_lvl, false);
-          gen_args->emplace_back(temp_var);
-        }
+        // Cannot have ARGS on LHS even if incoming is LHS
+        std::string temp_var = arg->generate_code(settings, indent_lvl, false);
+        gen_args->emplace_back(temp_var);
       }
 
       return gen_args;
     }
 
+    void generate_asm(CodeGen::AsmSettings &settings) const override;
+
     bool perform_type_inference(TypeCheck::Settings &settings, Quack::Class * parent_type) override{
       std::string msg = "Type inference not valid for right hand side args";
       throw TypeInferenceException("UnexpectedStateReached", msg);
@@ -782,6 +1084,8 @@ namespace AST {
     std::string generate_code(CodeGen::Settings &settings, unsigned indent_lvl,
                               bool is_lhs) const override;
 
+    void generate_asm(CodeGen::AsmSettings &settings) const override;
+
     bool perform_type_inference(TypeCheck::Settings &settings, Quack::Class * parent_type) override;
     /**
      * Function call for an object name.
@@ -856,9 +1160,14 @@ namespace AST {
      */
     std::string generate_code(CodeGen::Settings &settings, unsigned indent_lvl,
                               bool is_lhs) const override {
+      std::string value_var;
+      if (!is_lhs && generate_numbered_value(settings, indent_lvl, value_var))
+        return value_var;
+
       // Handle the bottom out of the recursion
       if (auto obj = dynamic_cast<Ident*>(object_))
-        return process_object_call(obj->text_, settings, indent_lvl, is_lhs);
+        return process_object_call(obj->generate_code(settings, indent_lvl, false), settings,
+                                   indent_lvl, is_lhs);
 
       std::string left_obj = object_->generate_code(settings, indent_lvl, is_lhs);
       return process_object_call(left_obj, settings, indent_lvl, is_lhs);
@@ -874,6 +1183,16 @@ namespace AST {
      */
     const std::string process_object_call(const std::string &left_obj, CodeGen::Settings &settings,
                                           unsigned indent_lvl, bool is_lhs) const;
+    /**
+     * Accessor for the type of an unboxed field reference.  Fields are only unboxed at the
+     * highest optimization level.
+     *
+     * @param settings Code generator settings
+     * @return Int or Boolean class if this node reads an unboxed field and nullptr otherwise
+     */
+    Quack::Class * unboxed_field_type(const CodeGen::Settings &settings) const;
+
+    void generate_asm(CodeGen::AsmSettings &settings) const override;
 
     bool perform_type_inference(TypeCheck::Settings &settings, Quack::Class * parent_type) override;
 
@@ -947,11 +1266,62 @@ namespace AST {
      * @param settings Code generator settings
      * @param indent_lvl Level of indentation
      */
+    /**
+     * Accessor for the class whose builtin comparison implements this operator.  Int and String
+     * cannot be subclassed so when both operands have the same one of these static types, the
+     * comparison can be performed natively without a method call or a Boolean object.
+     *
+     * @return Int or String class if the comparison can be fused into a branch and nullptr
+     *         otherwise
+     */
+    Quack::Class * native_compare_class() const;
+    /**
+     * Generates a native C comparison equivalent to the operator's builtin method.
+     *
+     * @param settings Code generator settings
+     * @param indent_lvl Level of indentation
+     * @return C expression that is nonzero if the comparison is true
+     */
+    std::string generate_native_compare(CodeGen::Settings &settings, unsigned indent_lvl) const;
+    /**
+     * Assembly equivalent of generate_native_compare.  It jumps directly to the target labels.
+     *
+     * @param settings Assembly generator settings
+     * @param true_label Label to jump to if the comparison is true
+     * @param false_label Label to jump to if the comparison is false
+     */
+    void generate_asm_native_compare(CodeGen::AsmSettings &settings,
+                                     const std::string &true_label,
+                                     const std::string &false_label) const;
+    /**
+     * Checks whether the operator is Int addition, subtraction, or multiplication, which can be
+     * evaluated as native C arithmetic.  Division is excluded since it may trap.
+     *
+     * @return True if the operator can be evaluated natively
+     */
+    bool is_native_arithmetic() const;
+
     virtual std::string generate_code(CodeGen::Settings &settings, unsigned indent_lvl,
                                       bool is_lhs) const override {
       if (is_lhs)
         throw std::runtime_error("Boolean operator cannot be on LHS");
 
+      std::string value_var;
+      if (generate_numbered_value(settings, indent_lvl, value_var))
+        return value_var;
+
+      // Int arithmetic boxes only the final result and not any intermediate values
+      if (settings.optimize(2) && is_native_arithmetic()) {
+        std::string native = generate_native_value(settings, indent_lvl);
+        return generate_owned_temp_var(GENERATE_LIT_INT_FUNC "(" + native + ")", settings,
+                                       indent_lvl, CodeGen::ExprKind::PURE);
+      }
+      if (settings.optimize(2) && native_compare_class()) {
+        std::string cmp = generate_native_compare(settings, indent_lvl);
+        return generate_temp_var("(" + cmp + " ? " GENERATED_LIT_TRUE " : " GENERATED_LIT_FALSE ")",
+                                 settings, indent_lvl, false, CodeGen::ExprKind::PURE);
+      }
+
       // Create the ObjectCall stand-in AST node
       RhsArgs args;
       args.add(right_);
@@ -974,6 +1344,8 @@ namespace AST {
       return obj_out;
     }
 
+    void generate_asm(CodeGen::AsmSettings &settings) const override;
+
     virtual bool perform_type_inference(TypeCheck::Settings &settings,
                                         Quack::Class * parent_type) override;
   };
@@ -990,11 +1362,15 @@ namespace AST {
       if (opsym == UNARY_OP_NOT) {
         generate_one_line_comment(settings, indent_lvl, "NOT Start");
         std::string op_var = left_->generate_code(settings, indent_lvl, is_lhs);
-        std::string gen_var = "(" + op_var + " == " + GENERATED_LIT_FALSE + ")";
-        return generate_temp_var(gen_var, settings, indent_lvl, false);
+        std::string gen_var = "((" + op_var + " == " GENERATED_LIT_FALSE ") ? "
+                              GENERATED_LIT_TRUE " : " GENERATED_LIT_FALSE ")";
+        return generate_temp_var(gen_var, settings, indent_lvl, false, CodeGen::ExprKind::PURE);
       }
-      // Variable that will store the evaluated result
-      std::string eval_bool = generate_temp_var(GENERATED_LIT_FALSE, settings, indent_lvl, false);
+      // Variable that will store the evaluated result.  It is assigned in multiple places so
+      // it must be stored in a local.
+      std::string eval_bool = generate_temp_var(GENERATED_LIT_FALSE, settings, indent_lvl, false,
+                                                CodeGen::ExprKind::PURE);
+      std::string eval_bool_local = settings.temps_->materialize(settings.fout_, eval_bool, false);
 
       // Labels for jumping
       std::string bool_halfway = define_new_label(opsym + "_HALFWAY");
@@ -1020,7 +1396,7 @@ namespace AST {
       generate_one_line_comment(settings, indent_lvl, "Boolean Get True");
       generate_label(settings, indent_lvl, bool_true, true);
       PRINT_INDENT(indent_lvl);
-      settings.fout_ << eval_bool << " = " << GENERATED_LIT_TRUE << ";\n";
+      settings.fout_ << eval_bool_local << " = " << GENERATED_LIT_TRUE << ";\n";
 
 
       // End Boolean
@@ -1036,28 +1412,45 @@ namespace AST {
      * @param indent_lvl Level of indentaiton
      * @param true_label Label to jump to if the Boolean operator evaluates to true
      * @param false_label Label to jump to if the Boolean operator evaluates to false
+     * @param hint Expected likelihood of jumping to \p true_label
      */
     void generate_eval_bool_op(CodeGen::Settings settings, const unsigned indent_lvl,
-                               const std::string &true_label, const std::string &false_label) {
+                               const std::string &true_label, const std::string &false_label,
+                               CodeGen::BranchHint hint) {
       if (opsym == UNARY_OP_NOT) {
-        return left_->generate_eval_branch(settings, indent_lvl, false_label, true_label);
+        if (hint != CodeGen::BranchHint::NONE)
+          hint = (hint == CodeGen::BranchHint::LIKELY) ? CodeGen::BranchHint::UNLIKELY
+                                                       : CodeGen::BranchHint::LIKELY;
+        return left_->generate_eval_branch(settings, indent_lvl, false_label, true_label, hint);
       }
 
       std::string halfway_label = define_new_label("halfway");
       if (opsym == METHOD_AND) {
         generate_one_line_comment(settings, indent_lvl, "Generate AND");
-        left_->generate_eval_branch(settings, indent_lvl + 1, halfway_label, false_label);
+        left_->generate_eval_branch(settings, indent_lvl + 1, halfway_label, false_label, hint);
         generate_label(settings, indent_lvl, halfway_label, true);
       } else if (opsym == METHOD_OR) {
         generate_one_line_comment(settings, indent_lvl, "Generate OR");
-        left_->generate_eval_branch(settings, indent_lvl + 1, true_label, halfway_label);
+        left_->generate_eval_branch(settings, indent_lvl + 1, true_label, halfway_label, hint);
         generate_label(settings, indent_lvl, halfway_label, true);
       } else {
         throw std::runtime_error("Unknown Boolean operator " + opsym);
       }
-      right_->generate_eval_branch(settings, indent_lvl + 1, true_label, false_label);
+      right_->generate_eval_branch(settings, indent_lvl + 1, true_label, false_label, hint);
     }
 
+    void generate_asm(CodeGen::AsmSettings &settings) const override;
+
+    /**
+     * Assembly equivalent of generate_eval_bool_op.
+     *
+     * @param settings Assembly generator settings
+     * @param true_label Label to jump to if the Boolean operator evaluates to true
+     * @param false_label Label to jump to if the Boolean operator evaluates to false
+     */
+    void generate_asm_bool_op(CodeGen::AsmSettings &settings, const std::string &true_label,
+                              const std::string &false_label) const;
+
     bool perform_type_inference(TypeCheck::Settings &settings, Quack::Class *parent_type) override;
   };
 
@@ -1088,6 +1481,8 @@ namespace AST {
     std::string generate_code(CodeGen::Settings &settings, unsigned indent_lvl,
                               bool is_lhs) const override;
 
+    void generate_asm(CodeGen::AsmSettings &settings) const override;
+
     bool perform_type_inference(TypeCheck::Settings &settings, Quack::Class * parent_type) override;
   };
 
@@ -1137,6 +1532,8 @@ namespace AST {
     bool update_inferred_type(TypeCheck::Settings &settings, Quack::Class *inferred_type,
                               bool is_field) override;
 
+    void generate_asm(CodeGen::AsmSettings &settings) const override;
+
     bool perform_type_inference(TypeCheck::Settings &settings, Quack::Class * parent_type) override{
       configure_initial_typing(BASE_CLASS);
 
@@ -1216,6 +1613,8 @@ namespace AST {
       return lhs_->check_initialize_before_use(inits, all_inits, is_method);
     }
 
+    void generate_asm(CodeGen::AsmSettings &settings) const override;
+
     bool perform_type_inference(TypeCheck::Settings &settings, Quack::Class * parent_type) override{
       bool success = rhs_->perform_type_inference(settings, nullptr);
 
@@ -1236,6 +1635,14 @@ namespace AST {
   };
 
   struct Typecase : public ASTNode {
+    friend class CodeGen::EscapeAnalysis;
+    friend class CodeGen::LoopAnalysis;
+    friend class CodeGen::EffectAnalysis;
+    friend class CodeGen::ValueNumbering;
+    friend class CodeGen::TailCallAnalysis;
+    friend class CodeGen::FieldLayout;
+    friend class CodeGen::ProfileAnalysis;
+    friend class CodeGen::RefCountAnalysis;
     Typecase(ASTNode* expr, std::vector<TypeAlternative*>* alts) : expr_(expr), alts_(alts) {}
 
     ~Typecase() {
@@ -1266,6 +1673,8 @@ namespace AST {
       std::cout << indent_str << "}";
     }
 
+    void generate_asm(CodeGen::AsmSettings &settings) const override;
+
     bool perform_type_inference(TypeCheck::Settings &settings, Quack::Class * parent_type) override;
 
     bool check_initialize_before_use(InitializedList &inits, InitializedList *all_inits,
@@ -1304,6 +1713,39 @@ namespace AST {
                               bool is_lhs) const override;
 
    private:
+    /**
+     * Finds the first alternative that matches objects of each class.
+     *
+     * @return Index of the first matching alternative for each class id.  Classes that match no
+     *         alternative map to the number of alternatives.
+     */
+    std::vector<unsigned long> resolve_alternatives() const;
+    /**
+     * Generates a switch over the class id of the typecase variable that jumps directly to the
+     * first matching alternative.
+     *
+     * @param settings Code generator settings
+     * @param indent_lvl Level of indentation
+     * @param typecase_var Variable holding the typecase object
+     * @param labels Label of each alternative followed by the end of typecase label
+     */
+    void generate_typecase_switch(CodeGen::Settings &settings, unsigned indent_lvl,
+                                  const std::string &typecase_var,
+                                  const std::vector<std::string> &labels) const;
+    /**
+     * Generates a check that jumps to the alternative a profile shows is almost always taken.
+     *
+     * @param settings Code generator settings
+     * @param indent_lvl Level of indentation
+     * @param typecase_var Variable holding the typecase object
+     * @param layout Layout of the typecase selected from the profile
+     * @param label Label of the dominant alternative
+     */
+    static void generate_typecase_fast_path(CodeGen::Settings &settings, unsigned indent_lvl,
+                                            const std::string &typecase_var,
+                                            const CodeGen::TypecaseLayout &layout,
+                                            const std::string &label);
+
     ASTNode* expr_;
     std::vector<TypeAlternative*>* alts_;
   };
@@ -0,0 +1,172 @@
+//
+// Shared state for the x86-64 assembly backend.
+//
+
+#ifndef CODE_GENERATOR_ASM_GEN_UTILS_H
+#define CODE_GENERATOR_ASM_GEN_UTILS_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <stdexcept>
+
+#include "literal_pool.h"
+
+#define ASM_WORD_SIZE 8
+#define ASM_STACK_ALIGN 16
+/** Number of arguments passed in registers under the System V AMD64 calling convention */
+#define ASM_NUM_ARG_REGS 6
+
+namespace CodeGen {
+  /** Integer argument registers in the order of the System V AMD64 calling convention */
+  static const char * const ASM_ARG_REGS[ASM_NUM_ARG_REGS]
+      = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
+
+  /**
+   * Stack frame of a single generated function.  Every Quack local and parameter lives in its
+   * own slot addressed relative to %rbp.  Intermediate values are stored in temporary slots
+   * that are allocated and freed in stack order as expressions are evaluated.
+   */
+  class AsmFrame {
+   public:
+    /**
+     * Adds a new local variable to the frame.
+     *
+     * @param name Name of the local
+     * @return Offset of the local relative to %rbp
+     */
+    long add_local(const std::string &name) {
+      if (locals_.find(name) == locals_.end()) {
+        num_locals_++;
+        locals_[name] = -ASM_WORD_SIZE * static_cast<long>(num_locals_);
+      }
+      return locals_[name];
+    }
+    /**
+     * Adds a local that already has a location in the caller's frame (i.e., a stack argument).
+     *
+     * @param name Name of the parameter
+     * @param offset Offset of the argument relative to %rbp
+     */
+    void add_stack_param(const std::string &name, long offset) { locals_[name] = offset; }
+    /**
+     * Accessor for the location of a local.
+     *
+     * @param name Name of the local
+     * @return Location of the local in a form usable as an instruction operand
+     */
+    std::string local(const std::string &name) const {
+      auto itr = locals_.find(name);
+      if (itr == locals_.end())
+        throw std::runtime_error("Unknown local \"" + name + "\" in assembly generation");
+      return std::to_string(itr->second) + "(%rbp)";
+    }
+    /**
+     * Allocates a temporary slot.  Slots must be released in the reverse order of allocation.
+     *
+     * @return Location of the temporary in a form usable as an instruction operand
+     */
+    std::string push_temp() {
+      num_temps_++;
+      if (num_temps_ > max_temps_)
+        max_temps_ = num_temps_;
+      long offset = -ASM_WORD_SIZE * static_cast<long>(num_locals_ + num_temps_);
+      return std::to_string(offset) + "(%rbp)";
+    }
+    /**
+     * Releases the most recently allocated temporary slots.
+     *
+     * @param cnt Number of temporary slots to release
+     */
+    void pop_temps(unsigned long cnt = 1) {
+      if (cnt > num_temps_)
+        throw std::runtime_error("Temporary slot underflow in assembly generation");
+      num_temps_ -= cnt;
+    }
+    /**
+     * Total size of the frame.  It is always a multiple of the stack alignment so %rsp is
+     * aligned at each call.
+     *
+     * @return Frame size in bytes
+     */
+    unsigned long size() const {
+      unsigned long bytes = ASM_WORD_SIZE * (num_locals_ + max_temps_);
+      return ((bytes + ASM_STACK_ALIGN - 1) / ASM_STACK_ALIGN) * ASM_STACK_ALIGN;
+    }
+
+   private:
+    std::map<std::string, long> locals_;
+    unsigned long num_locals_ = 0;
+    unsigned long num_temps_ = 0;
+    unsigned long max_temps_ = 0;
+  };
+
+  /** String literals used by the program.  They are written to the read-only data section. */
+  class AsmStrings {
+   public:
+    /**
+     * Gets the label of a string literal adding it to the table if needed.
+     *
+     * @param str Contents of the literal (with escape sequences)
+     * @return Label of the literal
+     */
+    const std::string& label(const std::string &str) {
+      auto itr = labels_.find(str);
+      if (itr != labels_.end())
+        return itr->second;
+
+      std::string lbl = ".LSTR" + std::to_string(labels_.size());
+      order_.emplace_back(str);
+      return labels_[str] = lbl;
+    }
+    /**
+     * Writes all string literals to the output file.
+     *
+     * @param out Output stream
+     */
+    void generate_asm(std::ostream &out) const {
+      if (order_.empty())
+        return;
+
+      out << "\n\t.section .rodata\n";
+      for (const auto &str : order_) {
+        out << labels_.at(str) << ":\n\t.string \""
+            << LiteralPool::quoted_bytes(LiteralPool::text_bytes(str)) << "\"\n";
+      }
+    }
+
+   private:
+    std::map<std::string, std::string> labels_;
+    std::vector<std::string> order_;
+  };
+
+  struct AsmSettings {
+    std::ostream & fout_;
+    /** Frame of the function currently being generated */
+    AsmFrame * frame_;
+    /** Label of the current function's epilogue */
+    std::string return_label_;
+    /** All string literals in the program */
+    AsmStrings * strings_;
+    /** Static Int and String literal objects */
+    LiteralPool * literals_;
+
+    AsmSettings(std::ostream &fout, AsmStrings * strings, LiteralPool * literals)
+        : fout_(fout), frame_(nullptr), strings_(strings), literals_(literals) {}
+    /**
+     * Writes a single instruction.
+     *
+     * @param instr Instruction to write
+     */
+    void emit(const std::string &instr) { fout_ << "\t" << instr << "\n"; }
+    /**
+     * Writes a label.
+     *
+     * @param label Label to write
+     */
+    void emit_label(const std::string &label) { fout_ << label << ":\n"; }
+  };
+}
+
+#endif //CODE_GENERATOR_ASM_GEN_UTILS_H
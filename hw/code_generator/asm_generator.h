@@ -0,0 +1,87 @@
+//
+// x86-64 assembly backend.  Emits GNU as (AT&T syntax) directly from the type checked program.
+//
+
+#ifndef CODE_GENERATOR_ASM_GENERATOR_H
+#define CODE_GENERATOR_ASM_GENERATOR_H
+
+#include <string>
+#include <sstream>
+#include <fstream>
+
+#include "quack_program.h"
+#include "quack_class.h"
+#include "code_generator.h"
+#include "asm_gen_utils.h"
+#include "ASTNode.h"
+
+namespace CodeGen {
+  class AsmGen {
+   public:
+    AsmGen(Quack::Program * prog, const std::string &quack_filename, const Options &options)
+        : prog_(prog), options_(options) {
+      output_file_path_ = Gen::build_output_file_path(quack_filename, ".s");
+      fout_.open(output_file_path_);
+    }
+
+    ~AsmGen() {
+      fout_.close();
+    }
+    /**
+     * Generates the assembly file associated with the specified program.
+     */
+    void run() {
+      fout_ << "# Generated by the Quack compiler.  Link with builtins.c.\n"
+            << "\t.text\n";
+
+      AsmStrings strings;
+      LiteralPool literals;
+      AsmSettings settings(fout_, &strings, &literals);
+      Quack::Class::assign_class_ids();
+      for (auto q_class : Gen::topologically_sort_classes())
+        q_class->generate_asm(settings);
+
+      export_main(settings);
+      // Labels of the pooled strings' characters are added before the string table is written
+      literals.generate_asm(fout_, [&strings](const std::string &str) {
+        return strings.label(str);
+      });
+      strings.generate_asm(fout_);
+
+      // Generated code never needs an executable stack
+      fout_ << "\n\t.section .note.GNU-stack,\"\",@progbits\n";
+      std::cout << "Assembly generation completed successfully." << std::endl;
+    }
+
+   private:
+    /**
+     * Writes the Quack main body and the C main() function to the output file.
+     *
+     * @param settings Assembly generator settings
+     */
+    void export_main(AsmSettings &settings) {
+      fout_ << "\n# ======================= main =======================\n";
+      Quack::Class::generate_asm_function(settings, METHOD_MAIN, prog_->main_, nullptr, false);
+
+      fout_ << "\n\t.globl main\n\t.type main, @function\n";
+      settings.emit_label("main");
+      settings.emit("pushq %rbp");
+      settings.emit("movq %rsp, %rbp");
+      settings.emit("call " METHOD_MAIN);
+      settings.emit("xorl %eax, %eax");
+      settings.emit("popq %rbp");
+      settings.emit("ret");
+      fout_ << "\t.size main, .-main\n";
+    }
+    /** Location to which the generated assembly is written */
+    std::string output_file_path_;
+    /** Filestream where the generated assembly is written */
+    std::ofstream fout_;
+
+    const Quack::Program * prog_;
+    /** User specified code generation options */
+    const Options options_;
+  };
+}
+
+#endif //CODE_GENERATOR_ASM_GENERATOR_H
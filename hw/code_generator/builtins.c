@@ -7,10 +7,81 @@
 #include <stdlib.h>  /* Malloc lives here; might replace with gc.h    */
 #include <string.h>  /* For strcpy; might replace with cords.h from gc */
 #include <stdbool.h>
+#include <sys/mman.h>
+#include <time.h>
 
 #include "builtins.h"
 
 
+/* ==============
+ * Output
+ * PRINT copies text into one large buffer that is written to stdout when it
+ * is full, when the program exits, and before statistics are reported on
+ * stderr.
+ * ==============
+ */
+
+#define QUACK_OUT_SIZE (1 << 16)
+
+static char out_buf[QUACK_OUT_SIZE];
+static unsigned long out_used = 0;
+static bool out_at_exit = false;
+
+static void out_flush(void) {
+  fwrite(out_buf, 1, out_used, stdout);
+  out_used = 0;
+  fflush(stdout);
+}
+
+/* Appends text to the output buffer, writing text longer than the buffer directly */
+static void out_write(const char *text, unsigned long len) {
+  if (!out_at_exit) {
+    out_at_exit = true;
+    atexit(out_flush);
+  }
+  if (len > QUACK_OUT_SIZE - out_used) {
+    out_flush();
+    if (len > QUACK_OUT_SIZE) {
+      fwrite(text, 1, len, stdout);
+      return;
+    }
+  }
+  memcpy(out_buf + out_used, text, len);
+  out_used += len;
+}
+
+/* Two decimal digits of every number below 100 */
+static const char digit_pairs[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+/* Bytes needed for the decimal text of any int, including the sign */
+#define QUACK_INT_CHARS 11
+
+/* Writes the decimal text of value so that it ends just before end, two
+ * digits per division, and returns its first character.  The last one or
+ * two digits are written from one pair and the sign is written always, so
+ * the only branches are the loop and the choice of where the text starts.
+ */
+static char *int_format(char *end, int value) {
+  unsigned int n = (value < 0) ? 0u - (unsigned int) value : (unsigned int) value;
+  while (n >= 100) {
+    const char *pair = digit_pairs + 2 * (n % 100);
+    n /= 100;
+    *--end = pair[1];
+    *--end = pair[0];
+  }
+  const char *pair = digit_pairs + 2 * n;
+  end[-1] = pair[1];
+  end[-2] = pair[0];
+  end -= 1 + (n >= 10);
+  end[-1] = '-';
+  return end - (value < 0);
+}
+
 /* ==============
  * Obj
  * Fields: None
@@ -25,26 +96,42 @@
 
 class_Obj the_class_Obj;
 
+/* Pointer map of the built-in classes, which have no fields holding objects */
+static const unsigned short no_ptrs[] = { 0 };
+
 /* Constructor */
 obj_Obj new_Obj() {
-  obj_Obj new_thing = (obj_Obj) malloc(sizeof(struct obj_Obj_struct));
+  obj_Obj new_thing = (obj_Obj) quack_alloc(sizeof(struct obj_Obj_struct));
   new_thing->clazz = the_class_Obj;
   return new_thing;
 }
 
-/* Obj:STR */
+static const char hex_digits[] = "0123456789abcdef";
+
+static obj_String str_from_text(const char *text, unsigned long len);
+
+/* Obj:STR, the low 32 bits of the address as 8 hex digits */
 obj_String Obj_method_STR(obj_Obj this) {
-  char * rep;
-  asprintf(&rep, "<Object at %08x>", (unsigned)this);
-  obj_String str = str_literal(rep);
-  return str;
+  static const char prefix[] = "<Object at ";
+  char rep[sizeof(prefix) - 1 + 8 + 1];
+  unsigned long len = sizeof(rep);
+  unsigned int addr = (unsigned int) (unsigned long) this;
+  memcpy(rep, prefix, sizeof(prefix) - 1);
+  for (int i = 0; i < 8; i++)
+    rep[sizeof(prefix) - 1 + i] = hex_digits[(addr >> (28 - 4 * i)) & 0xf];
+  rep[len - 1] = '>';
+  return str_from_text(rep, len);
 }
 
+static void str_write(obj_String str);
+
 /* Obj:PRINT */
 obj_Obj Obj_method_PRINT(obj_Obj this) {
   obj_String str = this->clazz->STR(this);
-  fprintf(stdout, "%s", str->text);
-  return this;
+  str_write(str);
+  /* Methods return a reference owned by the caller (see quack_rc_store) */
+  quack_rc_release(str);
+  return quack_rc_retain(this);
 }
 
 /* Obj:EQUALS (Note we may want to replace this */
@@ -60,6 +147,8 @@ obj_Boolean Obj_method_EQUALS(obj_Obj this, obj_Obj other) {
 /* The Obj Class (a singleton) */
 struct class_Obj_struct  the_class_Obj_struct = {
   NULL,
+  CLASS_ID_OBJ, CLASS_ID_MAX,
+  sizeof(struct obj_Obj_struct), no_ptrs,
   new_Obj,     /* Constructor */
   Obj_method_EQUALS,
   Obj_method_PRINT,
@@ -72,69 +161,227 @@ class_Obj the_class_Obj = &the_class_Obj_struct;
 /* ================
  * String
  * Fields:
- *    One hidden field, currently holding char*
- *    (change later to a rope for garbage collection)
+ *    Hidden fields, the text and its length or the
+ *    two halves of a concatenation (a rope)
  * Methods:
  *    Those of Obj, plus ordering, concatenation
  *    (Incomplete for now.)
  * ==================
  */
 
+/* Pointer map of a String, whose halves are traced if it is a rope node */
+static const unsigned short string_ptrs[] = {
+  offsetof(struct obj_String_struct, left), offsetof(struct obj_String_struct, right), 0
+};
+
+/* Text of the Strings made at run time.  The Strings sharing a buffer hold prefixes of its
+ * text, so only the one ending at used may append to it, and the buffer is freed when the
+ * last of them is freed.
+ */
+struct quack_str_buf {
+  unsigned long refs;   /* Strings whose text is in the buffer */
+  unsigned long used;
+  unsigned long cap;
+  char text[];
+};
+
+/* Hooks of the allocator and the collector defined below */
+static void *alloc_text(size_t size);
+static void alloc_free_text(void *text, size_t size);
+static void gc_count_text(obj_String str, unsigned long size);
+
+static struct quack_str_buf *str_buf(obj_String str) {
+  return (struct quack_str_buf *)(str->text - offsetof(struct quack_str_buf, text));
+}
+
+/* Allocates a buffer holding len bytes of text with room for cap */
+static struct quack_str_buf *str_buf_alloc(unsigned long len, unsigned long cap) {
+  struct quack_str_buf *buf = alloc_text(sizeof(struct quack_str_buf) + cap);
+  buf->refs = 0;
+  buf->used = len;
+  buf->cap = cap;
+  return buf;
+}
+
+/* Makes the first len bytes of a buffer the text of a String */
+static void str_attach(obj_String str, struct quack_str_buf *buf, unsigned long len) {
+  gc_count_text(str, buf->refs ? 0 : sizeof(struct quack_str_buf) + buf->cap);
+  buf->refs++;
+  str->text = buf->text;
+  str->len = len;
+  str->is_buffered = true;
+}
+
+/* Drops the reference of a String being freed to its buffer */
+static void str_detach(obj_String str) {
+  if (!str->is_buffered)
+    return;
+  struct quack_str_buf *buf = str_buf(str);
+  if (--buf->refs == 0)
+    alloc_free_text(buf, sizeof(struct quack_str_buf) + buf->cap);
+}
+
+/* Makes a String holding a copy of len bytes of text */
+static obj_String str_from_text(const char *text, unsigned long len) {
+  struct quack_str_buf *buf = str_buf_alloc(len, len);
+  memcpy(buf->text, text, len);
+  obj_String str = new_String();
+  str_attach(str, buf, len);
+  return str;
+}
+
+/* Copies the text of a String, i.e., the leaves of a rope node, to dest */
+static void str_copy(char *dest, obj_String str) {
+  while (!str->text) {
+    str_copy(dest, str->left);
+    dest += str->left->len;
+    str = str->right;
+  }
+  memcpy(dest, str->text, str->len);
+}
+
+/* Writes the text of a String to the output buffer leaf by leaf */
+static void str_write(obj_String str) {
+  while (!str->text) {
+    str_write(str->left);
+    str = str->right;
+  }
+  out_write(str->text, str->len);
+}
+
+/* Copies the leaves of a rope node into a buffer with room for extra more bytes and drops
+ * the halves
+ */
+static const char *str_flatten(obj_String str, unsigned long extra) {
+  struct quack_str_buf *buf = str_buf_alloc(str->len, str->len + extra);
+  str_copy(buf->text, str);
+  str_attach(str, buf, str->len);
+  str->depth = 0;
+  quack_rc_release(str->left);
+  quack_rc_release(str->right);
+  str->left = str->right = NULL;
+  return str->text;
+}
+
+const char *quack_str_flatten(obj_String str) {
+  return str_flatten(str, 0);
+}
+
+/* 32-bit FNV-1a, the hash the compiler computes for literals, with 0 replaced by 1 */
+unsigned int quack_str_hash_text(obj_String str) {
+  const unsigned char *text = (const unsigned char *) quack_str_text(str);
+  unsigned int hash = 2166136261u;
+  for (unsigned long i = 0; i < str->len; i++)
+    hash = (hash ^ text[i]) * 16777619u;
+  str->hash = hash ? hash : 1;
+  return str->hash;
+}
+
 /* Constructor */
 obj_String new_String(  ) {
-  obj_String new_thing = (obj_String) malloc(sizeof(struct obj_String_struct));
+  obj_String new_thing = (obj_String) quack_alloc(sizeof(struct obj_String_struct));
   new_thing->clazz = the_class_String;
+  new_thing->text = "";
+  new_thing->len = 0;
+  new_thing->left = new_thing->right = NULL;
+  new_thing->depth = 0;
+  new_thing->hash = 0;
+  new_thing->is_buffered = false;
+  new_thing->is_interned = false;
   return new_thing;
 }
 
 /* String:STR */
 obj_String String_method_STR(obj_String this) {
-  return this;
+  return quack_rc_retain(this);
 }
 
-///* String:PRINT */
-//obj_String String_method_PRINT(obj_String this) {
-//  fprintf(stdout, "%s", this->text);
-//  return this;
-//}
+/* String:PRINT */
+obj_Obj String_method_PRINT(obj_String this) {
+  str_write(this);
+  return quack_rc_retain(this);
+}
 
 /* String:EQUALS (Note we may want to replace this */
 obj_Boolean String_method_EQUALS(obj_String this, obj_Obj other) {
   obj_String other_str = (obj_String) other;
   /* But is it really? */
-  if (other_str->clazz == the_class_String && strcmp(this->text, other_str->text) == 0)
+  if (other_str->clazz == the_class_String && quack_str_equals(this, other_str))
     return lit_true;
   return lit_false;
 }
 
+/* Copies at most QUACK_STR_LEAF bytes: a short result is one flat String, a short right
+ * operand is copied into the free room of the left operand's buffer, and any other
+ * concatenation is a rope node.
+ */
 obj_String String_method_PLUS(obj_String this, obj_String other) {
-  char* combo;
-  asprintf(&combo, "%s%s", this->text, other->text);
-  return str_literal(combo);
+  unsigned long len = this->len + other->len;
+  if (other->len == 0)
+    return quack_rc_retain(this);
+  if (this->len == 0)
+    return quack_rc_retain(other);
+  if (len <= QUACK_STR_LEAF) {
+    struct quack_str_buf *buf = str_buf_alloc(len, len);
+    str_copy(buf->text, this);
+    str_copy(buf->text + this->len, other);
+    obj_String str = new_String();
+    str_attach(str, buf, len);
+    return str;
+  }
+  if (this->is_buffered && other->len <= QUACK_STR_LEAF) {
+    struct quack_str_buf *buf = str_buf(this);
+    if (buf->used == this->len && len <= buf->cap) {
+      str_copy(buf->text + this->len, other);
+      buf->used = len;
+      obj_String str = new_String();
+      str_attach(str, buf, len);
+      return str;
+    }
+  }
+
+  obj_String str = new_String();
+  str->text = NULL;
+  str->len = len;
+  str->left = quack_rc_retain(this);
+  quack_gc_write((obj_Obj *)&str->left);
+  str->right = quack_rc_retain(other);
+  quack_gc_write((obj_Obj *)&str->right);
+  str->depth = 1 + ((this->depth > other->depth) ? this->depth : other->depth);
+  /* Room to double the length for a String built by appending, none if built by prepending */
+  if (str->depth > QUACK_STR_MAX_DEPTH)
+    str_flatten(str, (this->depth >= other->depth) ? len : 0);
+  return str;
 }
 
 obj_Boolean String_method_LESS(obj_String this, obj_String other) {
-  return (strcmp(this->text, other->text) < 0) ? lit_true : lit_false;
+  return (quack_str_compare(this, other) < 0) ? lit_true : lit_false;
 }
 
 obj_Boolean String_method_MORE(obj_String this, obj_String other) {
-  return (strcmp(this->text, other->text) > 0) ? lit_true : lit_false;
+  return (quack_str_compare(this, other) > 0) ? lit_true : lit_false;
 }
 
 obj_Boolean String_method_ATLEAST(obj_String this, obj_String other) {
-  return (strcmp(this->text, other->text) <= 0) ? lit_true : lit_false;
+  return (quack_str_compare(this, other) >= 0) ? lit_true : lit_false;
 }
 
 obj_Boolean String_method_ATMOST(obj_String this, obj_String other) {
-  return (strcmp(this->text, other->text) >= 0) ? lit_true : lit_false;
+  return (quack_str_compare(this, other) <= 0) ? lit_true : lit_false;
+}
+
+int quack_str_order(obj_String a, obj_String b) {
+  return quack_str_compare(a, b);
 }
 
 /* The String Class (a singleton) */
 struct  class_String_struct  the_class_String_struct = {
   &the_class_Obj_struct,
+  CLASS_ID_STRING, CLASS_ID_STRING,
+  sizeof(struct obj_String_struct), string_ptrs,
   new_String,     /* Constructor */
   String_method_EQUALS,
-  Obj_method_PRINT,
+  String_method_PRINT,
   String_method_STR,
   String_method_ATLEAST,
   String_method_ATMOST,
@@ -149,10 +396,10 @@ class_String the_class_String = &the_class_String_struct;
  * Internal use function for creating String objects
  * from char*.  Use this to create string literals.
  */
-obj_String str_literal(char *s) {
-  char *rep;
+obj_String str_literal(const char *s, unsigned long len) {
   obj_String str = the_class_String->constructor();
   str->text = s;
+  str->len = len;
   return str;
 }
 
@@ -167,17 +414,27 @@ obj_String str_literal(char *s) {
 /* Constructor */
 obj_Boolean new_Boolean(  ) {
   obj_Boolean new_thing = (obj_Boolean)
-    malloc(sizeof(struct obj_Boolean_struct));
+    quack_alloc(sizeof(struct obj_Boolean_struct));
   new_thing->clazz = the_class_Boolean;
   return new_thing;
 }
 
+/* The Strings returned by Boolean:STR, which are not interned like the
+ * compiler's literals so they can equal a literal with the same text
+ */
+static struct obj_String_struct str_true = {
+  .clazz = &the_class_String_struct, .text = "true", .len = 4
+};
+static struct obj_String_struct str_false = {
+  .clazz = &the_class_String_struct, .text = "false", .len = 5
+};
+
 /* Boolean:STR */
 obj_String Boolean_method_STR(obj_Boolean this) {
   if (this == lit_true) {
-    return str_literal("true");
+    return &str_true;
   } else if (this == lit_false) {
-    return str_literal("false");
+    return &str_false;
   } else {
     fprintf(stderr, "Unknown boolean object");
     exit(EXIT_FAILURE);
@@ -189,14 +446,23 @@ obj_String Boolean_method_STR(obj_Boolean this) {
  * objects of class Boolean.
  */
 
-/* Inherit Obj:PRINT, which will call Boolean:STR */
+/* Boolean:PRINT */
+obj_Obj Boolean_method_PRINT(obj_Boolean this) {
+  if (this == lit_true)
+    out_write("true", 4);
+  else
+    out_write("false", 5);
+  return quack_rc_retain(this);
+}
 
 /* The Boolean Class (a singleton) */
 struct  class_Boolean_struct  the_class_Boolean_struct = {
   &the_class_Obj_struct,
+  CLASS_ID_BOOLEAN, CLASS_ID_BOOLEAN,
+  sizeof(struct obj_Boolean_struct), no_ptrs,
   new_Boolean,     /* Constructor */
   Obj_method_EQUALS,
-  Obj_method_PRINT,
+  Boolean_method_PRINT,
   Boolean_method_STR
 };
 
@@ -228,23 +494,35 @@ obj_Nothing new_Nothing(  ) {
   return none;
 }
 
-/* Boolean:STR */
+/* The String returned by Nothing:STR */
+static struct obj_String_struct str_nothing = {
+  .clazz = &the_class_String_struct, .text = "<nothing>", .len = 9
+};
+
+/* Nothing:STR */
 obj_String Nothing_method_STR(obj_Nothing this) {
-    return str_literal("<nothing>");
+  (void) this;
+  return &str_nothing;
 }
 
 /* Inherit Obj:EQUAL, since we have only one
  * object of class None
  */
 
-/* Inherit Obj:PRINT, which will call Nothing:STR */
+/* Nothing:PRINT */
+obj_Obj Nothing_method_PRINT(obj_Nothing this) {
+  out_write("<nothing>", 9);
+  return quack_rc_retain(this);
+}
 
 /* The Nothing Class (a singleton) */
 struct  class_Nothing_struct  the_class_Nothing_struct = {
   &the_class_Obj_struct,
+  CLASS_ID_NOTHING, CLASS_ID_NOTHING,
+  sizeof(struct obj_Nothing_struct), no_ptrs,
   new_Nothing,     /* Constructor */
   Obj_method_EQUALS,
-  Obj_method_PRINT,
+  Nothing_method_PRINT,
   Nothing_method_STR
 };
 
@@ -271,17 +549,55 @@ obj_Nothing none = &nothing_struct;
 
 /* Constructor */
 obj_Int new_Int(  ) {
-  obj_Int new_thing = (obj_Int)malloc(sizeof(struct obj_Int_struct));
+  obj_Int new_thing = (obj_Int) quack_alloc(sizeof(struct obj_Int_struct));
   new_thing->clazz = the_class_Int;
   new_thing->value = 0;
   return new_thing;
 }
 
+/* Small Ints, from QUACK_SMALL_INT_MIN to QUACK_SMALL_INT_MAX, are static
+ * objects shared by every Int with that value and their STR is a static
+ * String, both filled in the first time they are needed.  Ints are immutable
+ * and compared by value, so sharing them is not observable.  The range can
+ * be changed with -D when building the runtime.
+ */
+#ifndef QUACK_SMALL_INT_MIN
+#define QUACK_SMALL_INT_MIN (-128)
+#endif
+#ifndef QUACK_SMALL_INT_MAX
+#define QUACK_SMALL_INT_MAX 1023
+#endif
+#define QUACK_SMALL_INT_NUM (QUACK_SMALL_INT_MAX - QUACK_SMALL_INT_MIN + 1)
+
+static struct obj_Int_struct small_ints[QUACK_SMALL_INT_NUM];
+static struct obj_String_struct int_strs[QUACK_SMALL_INT_NUM];
+static char int_str_texts[QUACK_SMALL_INT_NUM][QUACK_INT_CHARS];
+
+/* Index of a small Int in the tables, or at least QUACK_SMALL_INT_NUM for
+ * any other value, so one unsigned comparison checks both ends of the range
+ */
+static inline unsigned int small_int_index(int n) {
+  return (unsigned int) n - (unsigned int) QUACK_SMALL_INT_MIN;
+}
+
 /* Int:STR */
 obj_String Int_method_STR(obj_Int this) {
-  char *rep;
-  asprintf(&rep, "%d", this->value);
-  return str_literal(rep);
+  char text[QUACK_INT_CHARS];
+  char *end = text + QUACK_INT_CHARS;
+  unsigned int idx = small_int_index(this->value);
+  if (idx < QUACK_SMALL_INT_NUM) {
+    obj_String str = &int_strs[idx];
+    if (!str->clazz) {
+      char *start = int_format(end, this->value);
+      memcpy(int_str_texts[idx], start, end - start);
+      str->text = int_str_texts[idx];
+      str->len = end - start;
+      str->clazz = the_class_String;
+    }
+    return str;
+  }
+  char *start = int_format(end, this->value);
+  return str_from_text(start, end - start);
 }
 
 /* Int:EQUALS */
@@ -294,8 +610,14 @@ obj_Boolean Int_method_EQUALS(obj_Int this, obj_Obj other) {
   return lit_true;
 }
 
-/* Inherit Obj:PRINT, which will call Int:STR */
-// FixMe Inherit Obj::Print
+/* Int:PRINT */
+obj_Obj Int_method_PRINT(obj_Int this) {
+  char text[QUACK_INT_CHARS];
+  char *end = text + QUACK_INT_CHARS;
+  char *start = int_format(end, this->value);
+  out_write(start, end - start);
+  return quack_rc_retain(this);
+}
 
 /* LESS (new method) */
 obj_Boolean Int_method_LESS(obj_Int this, obj_Int other) {
@@ -305,11 +627,11 @@ obj_Boolean Int_method_LESS(obj_Int this, obj_Int other) {
 obj_Boolean Int_method_MORE(obj_Int this, obj_Int other) {
   return this->value > other->value ? lit_true: lit_false;
 }
-/* ATLEAST (new method) */
+/* ATMOST (new method) */
 obj_Boolean Int_method_ATMOST(obj_Int this, obj_Int other) {
   return this->value <= other->value ? lit_true: lit_false;
 }
-/* ATMOST (new method) */
+/* ATLEAST (new method) */
 obj_Boolean Int_method_ATLEAST(obj_Int this, obj_Int other) {
   return this->value >= other->value ? lit_true: lit_false;
 }
@@ -337,9 +659,11 @@ obj_Int Int_method_DIVIDE(obj_Int this, obj_Int other) {
 /* The Int Class (a singleton) */
 struct class_Int_struct  the_class_Int_struct = {
   &the_class_Obj_struct,
+  CLASS_ID_INT, CLASS_ID_INT,
+  sizeof(struct obj_Int_struct), no_ptrs,
   new_Int,     /* Constructor */
   Int_method_EQUALS,
-  Obj_method_PRINT,
+  Int_method_PRINT,
   Int_method_STR,
   Int_method_ATLEAST,
   Int_method_ATMOST,
@@ -355,22 +679,878 @@ class_Int the_class_Int = &the_class_Int_struct;
 
 /* Integer literals constructor,
  * used by compiler and not otherwise available in
- * Quack programs.
+ * Quack programs.  Also boxes the results of Int
+ * arithmetic.  Small Ints are never allocated.
  */
 obj_Int int_literal(int n) {
+  unsigned int idx = small_int_index(n);
+  if (idx < QUACK_SMALL_INT_NUM) {
+    obj_Int boxed = &small_ints[idx];
+    if (!boxed->clazz) {
+      boxed->value = n;
+      boxed->clazz = the_class_Int;
+    }
+    return boxed;
+  }
   obj_Int boxed = new_Int();
   boxed->value = n;
   return boxed;
 }
 
 bool is_subtype(class_Obj obj, class_Obj other) {
-  if (obj == other)
-    return true;
-  if (obj->super_ == NULL)
-    return false;
-  return is_subtype(obj->super_, other);
+  return other->class_id_ <= obj->class_id_ && obj->class_id_ <= other->class_max_id_;
+}
+
+/* ===============================
+ * Profile counters written by programs
+ * compiled with -fprofile-generate.
+ *================================
+ */
+static const char *profile_path;
+static unsigned long *profile_counts;
+static const char * const *profile_names;
+static unsigned long profile_num_counts;
+
+static void profile_dump(void) {
+  FILE *fout = fopen(profile_path, "w");
+  if (!fout) {
+    fprintf(stderr, "Unable to write profile %s\n", profile_path);
+    return;
+  }
+  for (unsigned long i = 0; i < profile_num_counts; i++)
+    fprintf(fout, "%lu %s\n", profile_counts[i], profile_names[i]);
+  fclose(fout);
+}
+
+void quack_profile_start(const char *path, unsigned long *counts,
+                         const char * const *names, unsigned long num_counts) {
+  profile_path = path;
+  profile_counts = counts;
+  profile_names = names;
+  profile_num_counts = num_counts;
+  atexit(profile_dump);
+}
+
+/* ===============================
+ * Inline caches of programs compiled
+ * with -finline-caches.
+ *================================
+ */
+static struct quack_ic *ic_caches;
+static unsigned long ic_num_caches;
+
+/* Adds the implementation for a class that missed in the cache */
+quack_fn quack_ic_miss(struct quack_ic *ic, class_Obj clazz, quack_fn target) {
+  ic->misses++;
+  if (ic->num_classes < QUACK_IC_SIZE) {
+    ic->classes[ic->num_classes] = clazz;
+    ic->targets[ic->num_classes] = target;
+    ic->num_classes++;
+  } else {
+    ic->num_classes = QUACK_IC_SIZE + 1;
+  }
+  return target;
+}
+
+static void ic_dump(void) {
+  fprintf(stderr, "%12s %12s %7s  %-11s %s\n", "Hits", "Misses", "Hit %", "State", "Site");
+  for (unsigned long i = 0; i < ic_num_caches; i++) {
+    struct quack_ic *ic = &ic_caches[i];
+    unsigned long calls = ic->hits + ic->misses;
+    const char *state = "unused";
+    if (ic->num_classes == 1)
+      state = "monomorphic";
+    else if (ic->num_classes > QUACK_IC_SIZE)
+      state = "megamorphic";
+    else if (ic->num_classes > 1)
+      state = "polymorphic";
+    fprintf(stderr, "%12lu %12lu %7.2f  %-11s %s\n", ic->hits, ic->misses,
+            calls ? 100.0 * ic->hits / calls : 0.0, state, ic->site);
+  }
+}
+
+void quack_ic_start(struct quack_ic *caches, unsigned long num_caches) {
+  ic_caches = caches;
+  ic_num_caches = num_caches;
+  if (getenv("QUACK_IC_STATS"))
+    atexit(ic_dump);
+}
+
+/* ===============================
+ * Bump allocation of objects from
+ * chunks mapped with mmap.
+ *================================
+ */
+__thread struct quack_region quack_region;
+static __thread char *region_start;
+
+static bool alloc_started;
+static unsigned long alloc_heap_size;
+/* Totals of all threads, updated when a chunk is mapped or a region is retired */
+static unsigned long alloc_mapped;
+static unsigned long alloc_used;
+static unsigned long alloc_num_objects;
+static unsigned long alloc_num_chunks;
+static unsigned long alloc_num_large;
+/* Bytes of String text, which is allocated with malloc */
+static unsigned long alloc_text_bytes;
+
+/* Hooks of the garbage collector defined below */
+static bool gc_enabled;
+static void gc_add_chunk(char *start, unsigned long size, bool is_large);
+static char *gc_nursery_end;
+static void gc_format_free(char *start, char *end);
+static void gc_old_region(struct quack_region *region, size_t size);
+static void gc_count_region(unsigned long size);
+
+/* Parses a size in bytes optionally followed by K, M or G */
+static unsigned long parse_heap_size(const char *text) {
+  char *end;
+  unsigned long size = strtoul(text, &end, 10);
+  switch (*end) {
+    case 'g': case 'G': size <<= 10;  /* Fall through */
+    case 'm': case 'M': size <<= 10;  /* Fall through */
+    case 'k': case 'K': size <<= 10;
+  }
+  return size;
+}
+
+/* Maps memory for the heap, exiting if the heap size would be exceeded */
+static char *alloc_map(size_t size) {
+  unsigned long mapped = __atomic_add_fetch(&alloc_mapped, size, __ATOMIC_RELAXED);
+  if (alloc_heap_size != 0 && mapped > alloc_heap_size) {
+    fprintf(stderr, "Out of memory: the heap size of %lu bytes is exhausted\n",
+            alloc_heap_size);
+    exit(EXIT_FAILURE);
+  }
+  void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    fprintf(stderr, "Out of memory: unable to map %lu bytes\n", (unsigned long)size);
+    exit(EXIT_FAILURE);
+  }
+  return (char *)mem;
+}
+
+/* Allocates String text, which counts against the heap size like the objects */
+static void *alloc_text(size_t size) {
+  unsigned long text_bytes = __atomic_add_fetch(&alloc_text_bytes, size, __ATOMIC_RELAXED);
+  if (alloc_heap_size != 0 && alloc_mapped + text_bytes > alloc_heap_size) {
+    fprintf(stderr, "Out of memory: the heap size of %lu bytes is exhausted\n",
+            alloc_heap_size);
+    exit(EXIT_FAILURE);
+  }
+  void *text = malloc(size);
+  if (!text) {
+    fprintf(stderr, "Out of memory: unable to allocate %lu bytes\n", (unsigned long)size);
+    exit(EXIT_FAILURE);
+  }
+  return text;
+}
+
+static void alloc_free_text(void *text, size_t size) {
+  __atomic_sub_fetch(&alloc_text_bytes, size, __ATOMIC_RELAXED);
+  free(text);
+}
+
+/* Adds the counts of the thread's region to the totals */
+static void alloc_retire(void) {
+  __atomic_add_fetch(&alloc_used, (unsigned long)(quack_region.next - region_start),
+                     __ATOMIC_RELAXED);
+  __atomic_add_fetch(&alloc_num_objects, quack_region.num_objects, __ATOMIC_RELAXED);
+  region_start = quack_region.next;
+  quack_region.num_objects = 0;
+}
+
+/* Makes [start, end) the thread's region and allocates the first object from it */
+static void *alloc_region(char *start, char *end, size_t size) {
+  region_start = start;
+  quack_region.next = start + size;
+  quack_region.end = end;
+  quack_region.num_objects = 1;
+  return start;
+}
+
+/* Slow path of quack_alloc when the object does not fit in the thread's region */
+void *quack_alloc_chunk(size_t size) {
+  if (!alloc_started)
+    quack_alloc_start(0);
+  // Reference counted objects never use the region so every allocation of the builtins ends
+  // up here
+  if (quack_rc_heap_size != 0)
+    return quack_rc_alloc(size);
+
+  if (size > QUACK_CHUNK_SIZE / 4) {
+    char *obj = alloc_map(size);
+    __atomic_add_fetch(&alloc_used, size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&alloc_num_objects, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&alloc_num_large, 1, __ATOMIC_RELAXED);
+    if (gc_enabled) {
+      gc_add_chunk(obj, size, true);
+      gc_count_region(size);
+    }
+    return obj;
+  }
+
+  alloc_retire();
+  if (gc_enabled) {
+    if (quack_nursery_size != 0 && quack_region.end == gc_nursery_end) {
+      // The nursery is full.  It is collected at the next poll and the objects allocated
+      // until then go to the old space.
+      quack_gc_requested = true;
+    } else {
+      // The rest of the region stays walkable by the sweep
+      gc_format_free(quack_region.next, quack_region.end);
+    }
+    gc_old_region(&quack_region, size);
+    return alloc_region(quack_region.next, quack_region.end, size);
+  }
+  char *chunk = alloc_map(QUACK_CHUNK_SIZE);
+  __atomic_add_fetch(&alloc_num_chunks, 1, __ATOMIC_RELAXED);
+  return alloc_region(chunk, chunk + QUACK_CHUNK_SIZE, size);
+}
+
+/* Called by code that cannot inline quack_alloc, e.g., the assembly backend */
+void *quack_alloc_object(size_t size) {
+  return quack_alloc(size);
+}
+
+static void alloc_dump(void) {
+  alloc_retire();
+  out_flush();
+  fprintf(stderr, "Objects allocated: %lu\n", alloc_num_objects);
+  fprintf(stderr, "Bytes allocated:   %lu\n", alloc_used);
+  fprintf(stderr, "Bytes mapped:      %lu (%lu chunks of %lu bytes, %lu large objects)\n",
+          alloc_mapped, alloc_num_chunks, QUACK_CHUNK_SIZE, alloc_num_large);
+  fprintf(stderr, "Bytes of text:     %lu\n", alloc_text_bytes);
+  if (alloc_heap_size != 0)
+    fprintf(stderr, "Heap size:         %lu\n", alloc_heap_size);
+}
+
+void quack_alloc_start(unsigned long heap_size) {
+  if (alloc_started)
+    return;
+  alloc_started = true;
+  const char *env_size = getenv("QUACK_HEAP_SIZE");
+  alloc_heap_size = env_size ? parse_heap_size(env_size) : heap_size;
+  if (getenv("QUACK_ALLOC_STATS"))
+    atexit(alloc_dump);
+}
+
+/* ===============================
+ * Mark-sweep and generational garbage
+ * collection of programs compiled
+ * with -fgc.
+ *================================
+ */
+/* Size of the smallest free memory reused by the allocator */
+#define GC_MIN_SPAN 256
+/* Smallest region the allocator is given once the trigger is reached */
+#define GC_MIN_REGION (32 * 1024)
+/* Largest region the allocator is given, which bounds the memory cleared at once */
+#define GC_MAX_REGION (256 * 1024)
+/* Bytes in use that start the first collection */
+#ifndef GC_MIN_TRIGGER
+#define GC_MIN_TRIGGER (2 * QUACK_CHUNK_SIZE)
+#endif
+/* Bytes in use that start the next collection, relative to the live bytes */
+#define GC_GROWTH 2
+
+__thread struct quack_gc_frame *quack_gc_top;
+bool quack_gc_requested;
+
+/* A chunk of objects, or a single large object, in the heap */
+struct gc_chunk {
+  char *start;
+  unsigned long size;
+  unsigned char *marks;   /* One bit per word of a chunk */
+  bool is_marked;         /* Mark of a large object */
+};
+
+static struct gc_chunk *gc_chunks;   /* Sorted by start */
+static unsigned long gc_num_chunks;
+static unsigned long gc_max_chunks;
+
+/* Free memory of at least GC_MIN_SPAN bytes found by the last sweep */
+struct gc_span {
+  char *start;
+  char *end;
+};
+
+static struct gc_span *gc_spans;
+static unsigned long gc_num_spans;
+static unsigned long gc_max_spans;
+static unsigned long gc_next_span;
+
+static obj_Obj *gc_mark_stack;
+static unsigned long gc_mark_top;
+static unsigned long gc_max_marks;
+
+/* Bytes of the live objects after the last collection plus the regions taken since */
+static unsigned long gc_in_use;
+static unsigned long gc_trigger;
+/* Whether the next collection also collects the old space */
+static bool gc_major_due;
+
+char *quack_nursery_start;
+unsigned long quack_nursery_size;
+
+/* Old space region the objects surviving a minor collection are copied to */
+static struct quack_region gc_promote_region;
+
+/* Fields of old objects that referred to nursery objects when they were stored */
+static obj_Obj **gc_remembered;
+static unsigned long gc_num_remembered;
+static unsigned long gc_max_remembered;
+
+/* Nursery Strings holding text, which is freed when they are not promoted, and its bytes */
+static obj_String *gc_young_strs;
+static unsigned long gc_num_young_strs;
+static unsigned long gc_max_young_strs;
+static unsigned long gc_young_text;
+
+static unsigned long gc_num_collections;
+static double gc_total_pause;
+static double gc_max_pause;
+static unsigned long gc_total_freed;
+static unsigned long gc_live;
+static double gc_start_time;
+
+static unsigned long gc_num_minor;
+static double gc_minor_total_pause;
+static double gc_minor_max_pause;
+static unsigned long gc_total_promoted;
+
+/* Free memory is formatted as cells so the sweep can walk a chunk object by object.  A cell
+ * of one word has the class gc_free_word and a larger one stores its size after the class.
+ */
+struct gc_free_cell {
+  class_Obj clazz;
+  unsigned long size;
+};
+
+static struct class_Obj_struct gc_free_class = {
+  .super_ = NULL, .class_id_ = -1, .class_max_id_ = -1,
+  .obj_size_ = sizeof(struct gc_free_cell), .ptr_map_ = no_ptrs
+};
+static struct class_Obj_struct gc_free_word_class = {
+  .super_ = NULL, .class_id_ = -1, .class_max_id_ = -1,
+  .obj_size_ = sizeof(void *), .ptr_map_ = no_ptrs
+};
+
+static double gc_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Grows an array to hold at least one more element */
+static void *gc_grow(void *array, unsigned long *max, size_t elem_size) {
+  *max = *max ? 2 * *max : 64;
+  array = realloc(array, *max * elem_size);
+  if (!array) {
+    fprintf(stderr, "Out of memory: unable to grow the collector's tables\n");
+    exit(EXIT_FAILURE);
+  }
+  return array;
+}
+
+static void gc_add_chunk(char *start, unsigned long size, bool is_large) {
+  if (gc_num_chunks == gc_max_chunks)
+    gc_chunks = gc_grow(gc_chunks, &gc_max_chunks, sizeof(struct gc_chunk));
+  unsigned long i = gc_num_chunks;
+  while (i > 0 && gc_chunks[i - 1].start > start) {
+    gc_chunks[i] = gc_chunks[i - 1];
+    i--;
+  }
+  gc_chunks[i].start = start;
+  gc_chunks[i].size = size;
+  gc_chunks[i].marks = is_large ? NULL : calloc(QUACK_CHUNK_SIZE / sizeof(void *) / 8, 1);
+  gc_chunks[i].is_marked = false;
+  gc_num_chunks++;
+}
+
+/* Chunk holding an address or NULL if it is not in the heap, e.g., a literal or an object in a
+ * stack frame
+ */
+static struct gc_chunk *gc_find_chunk(const void *addr) {
+  unsigned long low = 0, high = gc_num_chunks;
+  while (low < high) {
+    unsigned long mid = (low + high) / 2;
+    struct gc_chunk *chunk = &gc_chunks[mid];
+    if ((const char *)addr < chunk->start)
+      high = mid;
+    else if ((const char *)addr >= chunk->start + chunk->size)
+      low = mid + 1;
+    else
+      return chunk;
+  }
+  return NULL;
+}
+
+static void gc_format_free(char *start, char *end) {
+  if (end - start == sizeof(void *)) {
+    ((struct gc_free_cell *)start)->clazz = &gc_free_word_class;
+  } else if (end > start) {
+    ((struct gc_free_cell *)start)->clazz = &gc_free_class;
+    ((struct gc_free_cell *)start)->size = end - start;
+  }
+}
+
+static unsigned long gc_object_size(obj_Obj obj) {
+  if (obj->clazz == &gc_free_class)
+    return ((struct gc_free_cell *)obj)->size;
+  return (obj->clazz->obj_size_ + QUACK_ALLOC_ALIGN - 1) & ~(QUACK_ALLOC_ALIGN - 1);
+}
+
+static void gc_add_span(char *start, char *end) {
+  gc_format_free(start, end);
+  if (end - start < GC_MIN_SPAN)
+    return;
+  if (gc_num_spans == gc_max_spans)
+    gc_spans = gc_grow(gc_spans, &gc_max_spans, sizeof(struct gc_span));
+  gc_spans[gc_num_spans].start = start;
+  gc_spans[gc_num_spans].end = end;
+  gc_num_spans++;
+}
+
+/* Bytes of free memory [start, end) given to a region for an object of size bytes.
+ * Regions stop at the trigger, or GC_MIN_REGION bytes past it, so a collection is requested
+ * once the bytes actually allocated reach the trigger rather than when a large span is taken.
+ * They are also limited to GC_MAX_REGION bytes since they are cleared when they are taken.
+ */
+static unsigned long gc_region_size(char *start, char *end, size_t size) {
+  unsigned long avail = end - start;
+  unsigned long bytes = gc_trigger > gc_in_use ? gc_trigger - gc_in_use : 0;
+  if (bytes > GC_MAX_REGION)
+    bytes = GC_MAX_REGION;
+  if (bytes < GC_MIN_REGION)
+    bytes = GC_MIN_REGION;
+  if (bytes < size)
+    bytes = size;
+  bytes = (bytes + QUACK_ALLOC_ALIGN - 1) & ~(QUACK_ALLOC_ALIGN - 1);
+  return avail < bytes + GC_MIN_SPAN ? avail : bytes;
+}
+
+/* Gives a region the next free span, or a new chunk if no span is large enough, for an object
+ * of size bytes
+ */
+static void gc_old_region(struct quack_region *region, size_t size) {
+  for (; gc_next_span < gc_num_spans; gc_next_span++) {
+    struct gc_span *span = &gc_spans[gc_next_span];
+    if ((size_t)(span->end - span->start) < size)
+      continue;
+    unsigned long bytes = gc_region_size(span->start, span->end, size);
+    memset(span->start, 0, bytes);
+    region->next = span->start;
+    region->end = span->start + bytes;
+    span->start += bytes;
+    if (span->start == span->end)
+      gc_next_span++;
+    else
+      gc_format_free(span->start, span->end);
+    gc_count_region(bytes);
+    return;
+  }
+
+  char *chunk = alloc_map(QUACK_CHUNK_SIZE);
+  __atomic_add_fetch(&alloc_num_chunks, 1, __ATOMIC_RELAXED);
+  gc_add_chunk(chunk, QUACK_CHUNK_SIZE, false);
+  // The rest of the chunk past the region is reused like memory freed by a sweep
+  char *end = chunk + gc_region_size(chunk, chunk + QUACK_CHUNK_SIZE, size);
+  gc_add_span(end, chunk + QUACK_CHUNK_SIZE);
+  gc_count_region(end - chunk);
+  region->next = chunk;
+  region->end = end;
+}
+
+/* Counts memory given to the allocator, requesting a collection if the memory given before
+ * reached the trigger
+ */
+static void gc_count_region(unsigned long size) {
+  if (gc_in_use >= gc_trigger)
+    quack_gc_requested = gc_major_due = true;
+  gc_in_use += size;
+}
+
+/* Counts the text of a String toward the next collection.  The text of nursery Strings is
+ * freed by the minor collection, which is requested once it exceeds the size of the nursery.
+ */
+static void gc_count_text(obj_String str, unsigned long size) {
+  if (!gc_enabled)
+    return;
+  if (!quack_gc_is_young(str)) {
+    gc_count_region(size);
+    return;
+  }
+  if (gc_num_young_strs == gc_max_young_strs)
+    gc_young_strs = gc_grow(gc_young_strs, &gc_max_young_strs, sizeof(obj_String));
+  gc_young_strs[gc_num_young_strs++] = str;
+  gc_young_text += size;
+  if (gc_young_text > quack_nursery_size)
+    quack_gc_requested = true;
+}
+
+static void gc_visit(obj_Obj obj) {
+  if (!obj)
+    return;
+  struct gc_chunk *chunk = gc_find_chunk(obj);
+  if (chunk && chunk->marks) {
+    unsigned long word = ((char *)obj - chunk->start) / sizeof(void *);
+    if (chunk->marks[word / 8] & (1 << (word % 8)))
+      return;
+    chunk->marks[word / 8] |= 1 << (word % 8);
+  } else if (chunk) {
+    if (chunk->is_marked)
+      return;
+    chunk->is_marked = true;
+  }
+  /* Objects outside the heap are traced every time they are reached.  They are literals
+   * without object fields or objects in stack frames, which are never stored in a field. */
+  if (gc_mark_top == gc_max_marks)
+    gc_mark_stack = gc_grow(gc_mark_stack, &gc_max_marks, sizeof(obj_Obj));
+  gc_mark_stack[gc_mark_top++] = obj;
+}
+
+static void gc_mark(void) {
+  for (struct quack_gc_frame *frame = quack_gc_top; frame; frame = frame->prev)
+    for (unsigned long i = 0; i < frame->num_roots; i++)
+      gc_visit(*frame->roots[i]);
+
+  while (gc_mark_top > 0) {
+    obj_Obj obj = gc_mark_stack[--gc_mark_top];
+    for (const unsigned short *offset = obj->clazz->ptr_map_; *offset != 0; offset++)
+      gc_visit(*(obj_Obj *)((char *)obj + *offset));
+  }
+}
+
+/* Frees the unmarked objects and collects the free memory into spans */
+static void gc_sweep(void) {
+  unsigned long num_chunks = 0;
+  gc_num_spans = 0;
+  gc_next_span = 0;
+  gc_live = 0;
+  for (unsigned long i = 0; i < gc_num_chunks; i++) {
+    struct gc_chunk *chunk = &gc_chunks[i];
+    if (!chunk->marks) {
+      if (!chunk->is_marked) {
+        gc_total_freed += chunk->size;
+        munmap(chunk->start, chunk->size);
+        __atomic_sub_fetch(&alloc_mapped, chunk->size, __ATOMIC_RELAXED);
+        continue;
+      }
+      chunk->is_marked = false;
+      gc_live += chunk->size;
+      gc_chunks[num_chunks++] = *chunk;
+      continue;
+    }
+
+    char *free_start = NULL;
+    char *addr = chunk->start;
+    char *end = chunk->start + chunk->size;
+    while (addr < end) {
+      obj_Obj obj = (obj_Obj)addr;
+      unsigned long size = gc_object_size(obj);
+      unsigned long word = (addr - chunk->start) / sizeof(void *);
+      bool is_free = obj->clazz == &gc_free_class || obj->clazz == &gc_free_word_class;
+      if (!is_free && !(chunk->marks[word / 8] & (1 << (word % 8)))) {
+        if (obj->clazz == (class_Obj)the_class_String)
+          str_detach((obj_String)obj);
+        gc_total_freed += size;
+        is_free = true;
+      }
+      if (is_free && !free_start) {
+        free_start = addr;
+      } else if (!is_free) {
+        gc_live += size;
+        if (free_start)
+          gc_add_span(free_start, addr);
+        free_start = NULL;
+      }
+      addr += size;
+    }
+    if (free_start)
+      gc_add_span(free_start, end);
+    memset(chunk->marks, 0, QUACK_CHUNK_SIZE / sizeof(void *) / 8);
+    gc_chunks[num_chunks++] = *chunk;
+  }
+  gc_num_chunks = num_chunks;
+}
+
+void quack_gc_remember(obj_Obj *slot) {
+  if (gc_num_remembered == gc_max_remembered)
+    gc_remembered = gc_grow(gc_remembered, &gc_max_remembered, sizeof(obj_Obj *));
+  gc_remembered[gc_num_remembered++] = slot;
+}
+
+/* Copies a nursery object to the old space the first time it is reached.  The class pointer of
+ * a copied object is replaced by the address of its copy with the low bit set.
+ */
+static obj_Obj gc_promote(obj_Obj obj) {
+  if (!quack_gc_is_young(obj))
+    return obj;
+  unsigned long word = (unsigned long)obj->clazz;
+  if (word & 1)
+    return (obj_Obj)(word & ~1UL);
+
+  unsigned long size = gc_object_size(obj);
+  if ((unsigned long)(gc_promote_region.end - gc_promote_region.next) < size) {
+    gc_format_free(gc_promote_region.next, gc_promote_region.end);
+    gc_old_region(&gc_promote_region, size);
+  }
+  obj_Obj copy = (obj_Obj)gc_promote_region.next;
+  gc_promote_region.next += size;
+  memcpy(copy, obj, size);
+  obj->clazz = (class_Obj)((unsigned long)copy | 1);
+  gc_total_promoted += size;
+
+  // The copy's fields are updated once the roots are done
+  if (gc_mark_top == gc_max_marks)
+    gc_mark_stack = gc_grow(gc_mark_stack, &gc_max_marks, sizeof(obj_Obj));
+  gc_mark_stack[gc_mark_top++] = copy;
+  return copy;
 }
 
-bool is_bool_true(obj_Boolean cond_val) {
-  return cond_val == lit_true;
+static void gc_promote_fields(obj_Obj obj) {
+  for (const unsigned short *offset = obj->clazz->ptr_map_; *offset != 0; offset++) {
+    obj_Obj *field = (obj_Obj *)((char *)obj + *offset);
+    *field = gc_promote(*field);
+  }
+}
+
+/* Copies the live nursery objects to the old space and empties the nursery */
+static void gc_minor(char *nursery_used) {
+  for (struct quack_gc_frame *frame = quack_gc_top; frame; frame = frame->prev) {
+    for (unsigned long i = 0; i < frame->num_roots; i++) {
+      obj_Obj obj = *frame->roots[i];
+      if (quack_gc_is_young(obj))
+        *frame->roots[i] = gc_promote(obj);
+      else if (obj && !gc_find_chunk(obj))
+        gc_promote_fields(obj);   // An object in a stack frame is not remembered
+    }
+  }
+  // Remembered fields of stack objects may be gone with their frames
+  for (unsigned long i = 0; i < gc_num_remembered; i++)
+    if (gc_find_chunk(gc_remembered[i]))
+      *gc_remembered[i] = gc_promote(*gc_remembered[i]);
+  gc_num_remembered = 0;
+
+  while (gc_mark_top > 0)
+    gc_promote_fields(gc_mark_stack[--gc_mark_top]);
+
+  // The copies of the promoted Strings keep their text
+  for (unsigned long i = 0; i < gc_num_young_strs; i++)
+    if (!((unsigned long)gc_young_strs[i]->clazz & 1))
+      str_detach(gc_young_strs[i]);
+  gc_num_young_strs = 0;
+  gc_young_text = 0;
+
+  memset(quack_nursery_start, 0, nursery_used - quack_nursery_start);
+}
+
+void quack_gc_collect(void) {
+  double start = gc_now();
+
+  alloc_retire();
+  char *nursery_used = gc_nursery_end;
+  if (quack_nursery_size != 0 && quack_region.end == gc_nursery_end) {
+    nursery_used = quack_region.next;
+  } else {
+    // The rest of the thread's region is swept as free memory
+    gc_format_free(quack_region.next, quack_region.end);
+  }
+  quack_region.next = quack_region.end = region_start = NULL;
+
+  if (quack_nursery_size != 0) {
+    gc_minor(nursery_used);
+    double end = gc_now();
+    gc_num_minor++;
+    gc_minor_total_pause += end - start;
+    if (end - start > gc_minor_max_pause)
+      gc_minor_max_pause = end - start;
+    start = end;
+  }
+
+  if (quack_nursery_size == 0 || gc_major_due) {
+    // Every object is in the old space now
+    gc_format_free(gc_promote_region.next, gc_promote_region.end);
+    gc_promote_region.next = gc_promote_region.end = NULL;
+    gc_mark();
+    gc_sweep();
+
+    gc_in_use = gc_live;
+    gc_trigger = gc_live * GC_GROWTH;
+    if (gc_trigger < GC_MIN_TRIGGER)
+      gc_trigger = GC_MIN_TRIGGER;
+    if (alloc_heap_size != 0 && gc_trigger > alloc_heap_size / 4 * 3)
+      gc_trigger = alloc_heap_size / 4 * 3;
+    gc_major_due = false;
+
+    double pause = gc_now() - start;
+    gc_num_collections++;
+    gc_total_pause += pause;
+    if (pause > gc_max_pause)
+      gc_max_pause = pause;
+  }
+  quack_gc_requested = false;
+
+  if (quack_nursery_size != 0) {
+    region_start = quack_region.next = quack_nursery_start;
+    quack_region.end = gc_nursery_end;
+  }
+}
+
+static void gc_dump(void) {
+  double run_time = gc_now() - gc_start_time;
+  out_flush();
+  if (quack_nursery_size != 0) {
+    fprintf(stderr, "Minor collections: %lu\n", gc_num_minor);
+    fprintf(stderr, "Minor pause:       %.3f ms (%.1f%% of run time), max %.3f ms, mean %.3f ms\n",
+            gc_minor_total_pause * 1e3,
+            run_time > 0 ? 100 * gc_minor_total_pause / run_time : 0.0,
+            gc_minor_max_pause * 1e3,
+            gc_num_minor ? gc_minor_total_pause * 1e3 / gc_num_minor : 0.0);
+    fprintf(stderr, "Bytes promoted:    %lu\n", gc_total_promoted);
+  }
+  fprintf(stderr, "Collections:       %lu\n", gc_num_collections);
+  fprintf(stderr, "Total pause:       %.3f ms (%.1f%% of %.3f ms run time)\n",
+          gc_total_pause * 1e3, run_time > 0 ? 100 * gc_total_pause / run_time : 0.0,
+          run_time * 1e3);
+  fprintf(stderr, "Max pause:         %.3f ms\n", gc_max_pause * 1e3);
+  fprintf(stderr, "Mean pause:        %.3f ms\n",
+          gc_num_collections ? gc_total_pause * 1e3 / gc_num_collections : 0.0);
+  fprintf(stderr, "Bytes freed:       %lu\n", gc_total_freed);
+  fprintf(stderr, "Live after last:   %lu\n", gc_live);
+}
+
+void quack_gc_start(unsigned long nursery_size) {
+  gc_enabled = true;
+  gc_trigger = GC_MIN_TRIGGER;
+  if (alloc_heap_size != 0 && gc_trigger > alloc_heap_size / 4 * 3)
+    gc_trigger = alloc_heap_size / 4 * 3;
+
+  const char *env_size = getenv("QUACK_NURSERY_SIZE");
+  if (env_size)
+    nursery_size = parse_heap_size(env_size);
+  nursery_size = (nursery_size + QUACK_ALLOC_ALIGN - 1) & ~(QUACK_ALLOC_ALIGN - 1);
+  if (nursery_size != 0) {
+    alloc_retire();
+    quack_nursery_start = alloc_map(nursery_size);
+    quack_nursery_size = nursery_size;
+    gc_nursery_end = quack_nursery_start + nursery_size;
+    region_start = quack_region.next = quack_nursery_start;
+    quack_region.end = gc_nursery_end;
+  }
+
+  gc_start_time = gc_now();
+  if (getenv("QUACK_GC_STATS"))
+    atexit(gc_dump);
+}
+
+/* ===============================
+ * Reference counting of programs
+ * compiled with -fgc=rc.
+ *================================
+ */
+/* Addresses reserved for the counted heap when the heap size is not limited */
+#define RC_RESERVE (64UL << 30)
+
+char *quack_rc_heap_start;
+unsigned long quack_rc_heap_size;
+void *quack_rc_free_lists[QUACK_RC_NUM_CLASSES];
+unsigned long quack_rc_num_reused;
+
+/* The heap is bumped from rc_next and its memory is writable up to rc_committed */
+static char *rc_next;
+static char *rc_committed;
+
+static unsigned long rc_num_freed;
+static unsigned long rc_bytes_freed;
+static unsigned long rc_num_unlisted;   /* Freed objects too large for a free list */
+
+/* Slow path of quack_rc_alloc when the free list of the size is empty */
+void *quack_rc_alloc_slow(size_t size) {
+  char *end = rc_next + sizeof(unsigned long) + size;
+  if (end > rc_committed) {
+    unsigned long bytes = (end - rc_committed + QUACK_CHUNK_SIZE - 1) & ~(QUACK_CHUNK_SIZE - 1);
+    if (rc_committed + bytes > quack_rc_heap_start + quack_rc_heap_size
+        || mprotect(rc_committed, bytes, PROT_READ | PROT_WRITE) != 0) {
+      if (alloc_heap_size != 0)
+        fprintf(stderr, "Out of memory: the heap size of %lu bytes is exhausted\n",
+                alloc_heap_size);
+      else
+        fprintf(stderr, "Out of memory: unable to map %lu bytes\n", bytes);
+      exit(EXIT_FAILURE);
+    }
+    rc_committed += bytes;
+    __atomic_add_fetch(&alloc_mapped, bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&alloc_num_chunks, bytes / QUACK_CHUNK_SIZE, __ATOMIC_RELAXED);
+  }
+
+  unsigned long *header = (unsigned long *)rc_next;
+  rc_next = end;
+  *header = 1;
+  __atomic_add_fetch(&alloc_used, size, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&alloc_num_objects, 1, __ATOMIC_RELAXED);
+  return header + 1;
+}
+
+/* Frees an object whose count dropped to 0 together with every object only it referred to.
+ * The dead objects whose fields are not released yet are linked through their count words so
+ * freeing a long list needs neither recursion nor memory.
+ */
+void quack_rc_free(obj_Obj obj) {
+  *quack_rc_count(obj) = 0;
+  while (obj) {
+    unsigned long *header = quack_rc_count(obj);
+    obj_Obj next = (obj_Obj)*header;
+    for (const unsigned short *offset = obj->clazz->ptr_map_; *offset != 0; offset++) {
+      obj_Obj field = *(obj_Obj *)((char *)obj + *offset);
+      if (quack_rc_is_counted(field) && --*quack_rc_count(field) == 0) {
+        *quack_rc_count(field) = (unsigned long)next;
+        next = field;
+      }
+    }
+    if (obj->clazz == (class_Obj)the_class_String)
+      str_detach((obj_String)obj);
+
+    unsigned long size = (obj->clazz->obj_size_ + QUACK_ALLOC_ALIGN - 1) & ~(QUACK_ALLOC_ALIGN - 1);
+    unsigned long words = size / sizeof(void *);
+    if (words < QUACK_RC_NUM_CLASSES) {
+      *(void **)header = quack_rc_free_lists[words];
+      quack_rc_free_lists[words] = header;
+    } else {
+      rc_num_unlisted++;
+    }
+    rc_num_freed++;
+    rc_bytes_freed += size;
+    obj = next;
+  }
+}
+
+static void rc_dump(void) {
+  unsigned long allocated = alloc_num_objects + quack_rc_num_reused;
+  out_flush();
+  fprintf(stderr, "Objects allocated: %lu (%lu from free lists)\n", allocated,
+          quack_rc_num_reused);
+  fprintf(stderr, "Objects freed:     %lu (%lu bytes, %lu too large to reuse)\n", rc_num_freed,
+          rc_bytes_freed, rc_num_unlisted);
+  fprintf(stderr, "Live objects:      %lu\n", allocated - rc_num_freed);
+  fprintf(stderr, "Bytes mapped:      %lu\n", alloc_mapped);
+}
+
+void quack_rc_start(void) {
+  unsigned long size = RC_RESERVE;
+  if (alloc_heap_size != 0)
+    size = (alloc_heap_size + QUACK_CHUNK_SIZE - 1) & ~(QUACK_CHUNK_SIZE - 1);
+  // Only the address range is reserved.  Its memory is made writable as the heap grows.
+  void *mem = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mem == MAP_FAILED) {
+    fprintf(stderr, "Out of memory: unable to reserve %lu bytes\n", size);
+    exit(EXIT_FAILURE);
+  }
+  quack_rc_heap_start = rc_next = rc_committed = (char *)mem;
+  quack_rc_heap_size = size;
+
+  if (getenv("QUACK_GC_STATS"))
+    atexit(rc_dump);
 }
@@ -9,6 +9,8 @@
 #define Builtins_h
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
 
 /* Naming conventions:
  * class_X means a reference to the class structure for class X,
@@ -33,6 +35,18 @@
  * in Quack but an explicit argument in the runtime.
  */
 
+/* Class ids are assigned in preorder so the ids of a class and all of
+ * its subclasses form the interval [class_id_, class_max_id_].  The
+ * built-in classes have fixed ids and the compiler numbers the user
+ * classes after them.  The compiler's copy of these ids is in keywords.h.
+ */
+#define CLASS_ID_OBJ 0
+#define CLASS_ID_BOOLEAN 1
+#define CLASS_ID_INT 2
+#define CLASS_ID_NOTHING 3
+#define CLASS_ID_STRING 4
+#define CLASS_ID_MAX 0x7fffffff
+
 /* The following object types are "known" from Obj, in the
  * sense that there are Obj methods that return these types.
  */
@@ -63,6 +77,12 @@ typedef struct obj_Obj_struct {
 
 struct class_Obj_struct {
   class_Obj super_;
+  int class_id_;
+  int class_max_id_;
+  /* Object layout traced by the garbage collector: the size of an object
+   * and the byte offsets of its fields holding objects, ended by 0 */
+  unsigned long obj_size_;
+  const unsigned short *ptr_map_;
 
   /* Method table */
   obj_Obj (*constructor) ( void );
@@ -71,14 +91,19 @@ struct class_Obj_struct {
   obj_String (*STR) (obj_Obj);
 };
 
+/* PRINT writes into a large output buffer owned by the runtime, which is written to stdout
+ * when it is full and when the program exits.  Int, Boolean, Nothing and String override
+ * PRINT to write their text directly without creating a String.
+ */
+
 extern class_Obj the_class_Obj; /* Initialized in Builtins.c */
 extern struct class_Obj_struct the_class_Obj_struct;
 
 /* ================
  * String
  * Fields:
- *    One hidden field, currently holding char*
- *    (change later to a rope for garbage collection)
+ *    Hidden fields, the text and its length or the
+ *    two halves of a concatenation (a rope)
  * Methods:
  *    Those of Obj, plus ordering, concatenation
  *    (Incomplete for now.)
@@ -88,19 +113,51 @@ extern struct class_Obj_struct the_class_Obj_struct;
 struct class_String_struct;
 typedef struct class_String_struct* class_String;
 
+/* String and Int objects are immutable once constructed.  The compiler relies on this to
+ * share a single statically allocated object for each literal, so the runtime must never
+ * write to, or free, a String's text or an Int's value after construction.
+ *
+ * A String carries the length of its text so comparisons and concatenation never scan for
+ * a terminating NUL, and the text is not NUL terminated.  A concatenation of long Strings
+ * is a rope node referring to its two halves without copying them.  Its text is NULL until
+ * it is needed, e.g., by a comparison, when the leaves are copied into one buffer (the node
+ * is flattened), which does not change the String's value.  PRINT writes the leaves
+ * directly.  A node deeper than QUACK_STR_MAX_DEPTH is flattened when it is built into a
+ * buffer with room to grow, and a short String appended to the end of such a buffer is
+ * copied into it, so building a String by repeated concatenation takes linear time.
+ *
+ * The hash of the text is computed the first time it is needed and cached in the object.  The
+ * compiler interns its literals: each distinct text is one static object whose hash is
+ * computed at compile time, so two different interned Strings never have equal text.
+ * Flattening and caching the hash do not change a String's value.
+ */
 typedef struct obj_String_struct {
   class_String clazz;
-  char *text;     /* FIXME: Make this a garbage-collectable rope */
+  const char *text;     /* NULL if the rope node is not flattened */
+  unsigned long len;    /* Bytes in text */
+  struct obj_String_struct *left, *right;   /* Halves of a rope node or NULL */
+  unsigned int depth;   /* 0 for a flat String */
+  unsigned int hash;    /* Hash of the text or 0 if not computed yet */
+  bool is_buffered;     /* True if text is in a quack_str_buf that may have free room */
+  bool is_interned;     /* True for the compiler's literal objects */
 } * obj_String;
 
+/* Concatenations of at most this many bytes are copied into one flat String */
+#define QUACK_STR_LEAF 64
+/* Rope nodes deeper than this are flattened, which bounds the recursion walking them */
+#define QUACK_STR_MAX_DEPTH 32
+
 struct class_String_struct {
   class_Obj super_;
+  int class_id_;
+  int class_max_id_;
+  unsigned long obj_size_;
+  const unsigned short *ptr_map_;
 
   /* Method table: Inherited or overridden */
   obj_String (*constructor) ( void );
   obj_Boolean (*EQUALS) (obj_String, obj_Obj);
-//  obj_String (*PRINT) (obj_String);
-  obj_Obj (*PRINT) (obj_Obj);
+  obj_Obj (*PRINT) (obj_String);
   obj_String (*STR) (obj_String);
 
   /* Method table: Introduced in String */
@@ -118,9 +175,54 @@ extern struct class_String_struct the_class_String_struct;
 /* Construct an object from a string literal.
  * This is not available to the Quack programmer, but
  * is used by the compiler to create a literal string
- * from a Quack literal string.
+ * from a Quack literal string.  The compiler passes
+ * the length of the text computed at compile time.
  */
-extern obj_String str_literal(char *s);
+extern obj_String str_literal(const char *s, unsigned long len);
+
+/* Copies the leaves of a rope node into one buffer and returns the text */
+extern const char *quack_str_flatten(obj_String str);
+
+/* Text of a String, flattening a rope node the first time it is read */
+static inline const char *quack_str_text(obj_String str) {
+  return str->text ? str->text : quack_str_flatten(str);
+}
+
+/* Compares the text of two Strings like strcmp but with memcmp over the shorter length.
+ * Used by the String methods and by the comparisons the compiler generates directly.
+ */
+static inline int quack_str_compare(obj_String a, obj_String b) {
+  unsigned long len = (a->len < b->len) ? a->len : b->len;
+  int cmp = memcmp(quack_str_text(a), quack_str_text(b), len);
+  if (cmp != 0)
+    return cmp;
+  return (a->len > b->len) - (a->len < b->len);
+}
+
+/* Computes and caches the hash of a String's text */
+extern unsigned int quack_str_hash_text(obj_String str);
+
+/* Hash of a String's text, which is never 0 */
+static inline unsigned int quack_str_hash(obj_String str) {
+  return str->hash ? str->hash : quack_str_hash_text(str);
+}
+
+/* String equality.  Identical objects are equal and different interned literals are not.
+ * Otherwise it fails without reading the text when the lengths differ or without comparing
+ * the text when the cached hashes differ.
+ */
+static inline bool quack_str_equals(obj_String a, obj_String b) {
+  if (a == b)
+    return true;
+  if (a->len != b->len || (a->is_interned && b->is_interned))
+    return false;
+  if (quack_str_hash(a) != quack_str_hash(b))
+    return false;
+  return memcmp(quack_str_text(a), quack_str_text(b), a->len) == 0;
+}
+
+/* Out of line quack_str_compare called by the assembly backend */
+extern int quack_str_order(obj_String a, obj_String b);
 
 /* ================
  * Boolean
@@ -141,11 +243,15 @@ typedef struct obj_Boolean_struct {
 
 struct class_Boolean_struct {
   class_Obj super_;
+  int class_id_;
+  int class_max_id_;
+  unsigned long obj_size_;
+  const unsigned short *ptr_map_;
 
   /* Method table: Inherited or overridden */
   obj_Boolean (*constructor) ( void );
   obj_Boolean (*EQUALS) (obj_Obj, obj_Obj); /* Inherit */
-  obj_Obj (*PRINT) (obj_Obj);               /* Inherit */
+  obj_Obj (*PRINT) (obj_Boolean);
   obj_String (*STR) (obj_Boolean);
 };
 
@@ -188,11 +294,15 @@ typedef struct obj_Nothing_struct {
  */
 struct class_Nothing_struct {
   class_Obj super_;
+  int class_id_;
+  int class_max_id_;
+  unsigned long obj_size_;
+  const unsigned short *ptr_map_;
 
   /* Method table */
   obj_Nothing (*constructor) ( void );
   obj_Boolean (*EQUALS) (obj_Obj, obj_Obj); /* Inherited */
-  obj_Obj (*PRINT) (obj_Obj);               /* Inherited */
+  obj_Obj (*PRINT) (obj_Nothing);
   obj_String (*STR) (obj_Nothing);
 };
 
@@ -210,7 +320,7 @@ extern obj_Nothing none;
  *    One hidden field, an int
  * Methods:
  *    STR  (override)
- *    PRINT   (inherit)
+ *    PRINT   (overridden)
  *    EQUALS  (override)
  *    LESS
  *    MORE
@@ -233,12 +343,16 @@ typedef struct obj_Int_struct {
 
 struct class_Int_struct {
   class_Obj super_;
+  int class_id_;
+  int class_max_id_;
+  unsigned long obj_size_;
+  const unsigned short *ptr_map_;
 
   /* Method table: Inherited or overridden */
   obj_Int (*constructor) ( void );
 
   obj_Boolean (*EQUALS) (obj_Int, obj_Obj); /* Overridden */
-  obj_Obj (*PRINT) (obj_Obj);      /* Inherited */
+  obj_Obj (*PRINT) (obj_Int);      /* Overridden */
   obj_String (*STR) (obj_Int);  /* Overridden */
 
   obj_Boolean (*ATLEAST) (obj_Int, obj_Int);   /* Introduced */
@@ -256,7 +370,10 @@ extern struct class_Int_struct the_class_Int_struct;
 
 /* Integer literals constructor,
  * used by compiler and not otherwise available in
- * Quack programs.
+ * Quack programs.  It also boxes the results of Int
+ * arithmetic, and returns a shared static object for
+ * Ints from QUACK_SMALL_INT_MIN to QUACK_SMALL_INT_MAX
+ * (-128 to 1023 unless defined when building builtins.c).
  */
 extern obj_Int int_literal(int n);
 
@@ -273,7 +390,7 @@ obj_Boolean Obj_method_EQUALS(obj_Obj this, obj_Obj other);
 
 obj_String new_String();
 obj_String String_method_STR(obj_String this);
-//obj_String String_method_PRINT(obj_String this);
+obj_Obj String_method_PRINT(obj_String this);
 obj_Boolean String_method_EQUALS(obj_String this, obj_Obj other);
 obj_String String_method_PLUS(obj_String this, obj_String other);
 obj_Boolean String_method_LESS(obj_String this, obj_String other);
@@ -281,12 +398,15 @@ obj_Boolean String_method_MORE(obj_String this, obj_String other);
 obj_Boolean String_method_ATLEAST(obj_String this, obj_String other);
 obj_Boolean String_method_ATMOST(obj_String this, obj_String other);
 
+obj_Obj Nothing_method_PRINT(obj_Nothing this);
 obj_String Nothing_method_STR(obj_Nothing this);
 
 obj_Boolean new_Boolean();
+obj_Obj Boolean_method_PRINT(obj_Boolean this);
 obj_String Boolean_method_STR(obj_Boolean this);
 
 obj_Int new_Int();
+obj_Obj Int_method_PRINT(obj_Int this);
 obj_String Int_method_STR(obj_Int this);
 obj_Boolean Int_method_EQUALS(obj_Int this, obj_Obj other);
 obj_Boolean Int_method_LESS(obj_Int this, obj_Int other);
@@ -300,4 +420,286 @@ obj_Int Int_method_TIMES(obj_Int this, obj_Int other);
 
 bool is_subtype(class_Obj obj, class_Obj other);
 
+/* Profiling support for programs compiled with -fprofile-generate.
+ * The counts are written to path as "<count> <name>" lines when the
+ * program exits.
+ */
+void quack_profile_start(const char *path, unsigned long *counts,
+                         const char * const *names, unsigned long num_counts);
+
+/* ===============================
+ * Inline fast paths used by optimized
+ * generated code.  Calls on Int are bound
+ * at compile time since Int has no subclasses.
+ *================================
+ */
+#define QUACK_LIKELY(x) __builtin_expect(!!(x), 1)
+#define QUACK_UNLIKELY(x) __builtin_expect(!!(x), 0)
+
+static inline bool is_bool_true(obj_Boolean cond_val) {
+  return cond_val == lit_true;
+}
+
+static inline obj_Boolean Int_inline_EQUALS(obj_Int this, obj_Obj other) {
+  obj_Int other_int = (obj_Int) other;
+  if (other_int->clazz != this->clazz || this->value != other_int->value)
+    return lit_false;
+  return lit_true;
+}
+static inline obj_Boolean Int_inline_LESS(obj_Int this, obj_Int other) {
+  return this->value < other->value ? lit_true : lit_false;
+}
+static inline obj_Boolean Int_inline_MORE(obj_Int this, obj_Int other) {
+  return this->value > other->value ? lit_true : lit_false;
+}
+static inline obj_Boolean Int_inline_ATLEAST(obj_Int this, obj_Int other) {
+  return this->value >= other->value ? lit_true : lit_false;
+}
+static inline obj_Boolean Int_inline_ATMOST(obj_Int this, obj_Int other) {
+  return this->value <= other->value ? lit_true : lit_false;
+}
+static inline obj_Int Int_inline_PLUS(obj_Int this, obj_Int other) {
+  return int_literal(this->value + other->value);
+}
+static inline obj_Int Int_inline_MINUS(obj_Int this, obj_Int other) {
+  return int_literal(this->value - other->value);
+}
+static inline obj_Int Int_inline_TIMES(obj_Int this, obj_Int other) {
+  return int_literal(this->value * other->value);
+}
+static inline obj_Int Int_inline_DIVIDE(obj_Int this, obj_Int other) {
+  return int_literal(this->value / other->value);
+}
+
+
+/* ===============================
+ * Inline caches of the dynamically
+ * dispatched call sites of programs
+ * compiled with -finline-caches.
+ *================================
+ */
+/* A cache holds the implementations called for the first QUACK_IC_SIZE
+ * receiver classes seen at its site.  A site that sees more classes is
+ * megamorphic and calls the other classes through the method table.
+ * If the environment variable QUACK_IC_STATS is set, the hits and
+ * misses of every site are printed to stderr when the program exits.
+ */
+#define QUACK_IC_SIZE 4
+
+typedef void (*quack_fn)(void);
+
+struct quack_ic {
+  const char *site;
+  unsigned long hits;
+  unsigned long misses;
+  int num_classes;     /* QUACK_IC_SIZE + 1 once the site is megamorphic */
+  class_Obj classes[QUACK_IC_SIZE];
+  quack_fn targets[QUACK_IC_SIZE];
+};
+
+quack_fn quack_ic_miss(struct quack_ic *ic, class_Obj clazz, quack_fn target);
+void quack_ic_start(struct quack_ic *caches, unsigned long num_caches);
+
+/* Returns the cached implementation for the class or NULL on a miss */
+static inline quack_fn quack_ic_lookup(struct quack_ic *ic, class_Obj clazz) {
+  if (QUACK_LIKELY(ic->classes[0] == clazz)) {
+    ic->hits++;
+    return ic->targets[0];
+  }
+  for (int i = 1; i < QUACK_IC_SIZE && i < ic->num_classes; i++) {
+    if (ic->classes[i] == clazz) {
+      ic->hits++;
+      return ic->targets[i];
+    }
+  }
+  return NULL;
+}
+
+/* ===============================
+ * Allocation of objects
+ *================================
+ */
+/* Objects are bump allocated from large chunks mapped with mmap and are
+ * never freed.  Each thread allocates from its own chunk so allocating
+ * needs no lock.  Objects larger than a quarter of a chunk get a mapping
+ * of their own.  The text of the Strings made at run time is allocated
+ * with malloc and freed with the String.  The total size of the mappings
+ * and the text is limited to the heap size passed to quack_alloc_start
+ * (the compiler's -fheap-size option), which the environment variable
+ * QUACK_HEAP_SIZE overrides.  Both are in
+ * bytes, optionally followed by K, M or G, and 0 means no limit.  If the
+ * environment variable QUACK_ALLOC_STATS is set, the allocation
+ * statistics are printed to stderr when the program exits.
+ */
+#define QUACK_CHUNK_SIZE (4UL << 20)
+#define QUACK_ALLOC_ALIGN sizeof(void*)
+
+struct quack_region {
+  char *next;
+  char *end;
+  unsigned long num_objects;
+};
+
+extern __thread struct quack_region quack_region;
+
+void *quack_alloc_chunk(size_t size);
+void *quack_alloc_object(size_t size);
+void quack_alloc_start(unsigned long heap_size);
+
+/* Allocates an object from the thread's chunk */
+static inline void *quack_alloc(size_t size) {
+  size = (size + QUACK_ALLOC_ALIGN - 1) & ~(QUACK_ALLOC_ALIGN - 1);
+  char *obj = quack_region.next;
+  if (QUACK_UNLIKELY((size_t)(quack_region.end - obj) < size))
+    return quack_alloc_chunk(size);
+  quack_region.next = obj + size;
+  quack_region.num_objects++;
+  return obj;
+}
+
+/* ===============================
+ * Garbage collection of programs
+ * compiled with -fgc.
+ *================================
+ */
+/* Every generated function pushes a frame on the shadow stack holding the
+ * addresses of its locals and temporaries that hold objects.  Allocation
+ * never collects: it only requests a collection once the memory in use,
+ * including the text of Strings, passes the trigger, and the collection
+ * runs at the next poll, which the compiler places at function entries
+ * and loop back edges where every live object is in a registered local.
+ * Collection marks the objects reachable from the frames through the
+ * pointer maps of their classes and sweeps the rest, freeing the text of
+ * the dead Strings.  Swept memory is reused by the bump allocator.
+ *
+ * With -fgc=generational, objects are bump allocated from a nursery
+ * instead.  When it is full, the objects allocated until the next poll
+ * go to the old space (the mark-sweep heap) and the poll runs a minor
+ * collection, which copies the nursery objects reachable from the frames
+ * and from the old objects' fields remembered by the write barrier to
+ * the old space and empties the nursery.  The text of the nursery Strings
+ * that are not copied is freed, and a minor collection is also requested
+ * once the nursery Strings hold more text than the nursery's size.  The
+ * size of the nursery passed to quack_gc_start is overridden by the
+ * environment variable QUACK_NURSERY_SIZE.  If the environment variable
+ * QUACK_GC_STATS is set, the number of collections and their pause times
+ * are printed to stderr when the program exits.
+ */
+struct quack_gc_frame {
+  struct quack_gc_frame *prev;
+  unsigned long num_roots;
+  obj_Obj **roots;
+};
+
+extern __thread struct quack_gc_frame *quack_gc_top;
+extern bool quack_gc_requested;
+extern char *quack_nursery_start;
+extern unsigned long quack_nursery_size;   /* 0 without a nursery */
+
+void quack_gc_collect(void);
+void quack_gc_remember(obj_Obj *slot);
+void quack_gc_start(unsigned long nursery_size);
+
+static inline void quack_gc_poll(void) {
+  if (QUACK_UNLIKELY(quack_gc_requested))
+    quack_gc_collect();
+}
+
+/* Checks whether an address is in the nursery */
+static inline bool quack_gc_is_young(const void *addr) {
+  return (unsigned long)addr - (unsigned long)quack_nursery_start < quack_nursery_size;
+}
+
+/* Write barrier run after an object is stored in a field.  Fields of old
+ * objects that refer to nursery objects are remembered as roots of the
+ * next minor collection.
+ */
+static inline void quack_gc_write(obj_Obj *slot) {
+  if (!quack_gc_is_young(slot) && QUACK_UNLIKELY(quack_gc_is_young(*slot)))
+    quack_gc_remember(slot);
+}
+
+/* Pops a function's frame and returns the function's result */
+static inline void *quack_gc_pop(struct quack_gc_frame *frame, void *result) {
+  quack_gc_top = frame->prev;
+  return result;
+}
+
+/* ===============================
+ * Reference counting of programs
+ * compiled with -fgc=rc.
+ *================================
+ */
+/* Every object is preceded by a word holding its reference count.  A new
+ * object and the result of every method start with one reference owned
+ * by the caller.  Storing an object in a local or a field retains it and
+ * releases the object stored there before, and the compiler releases the
+ * results it is done with.  An object is freed as soon as its count drops
+ * to 0: the objects its fields refer to are released and its memory goes
+ * to the free list of its size, which the allocator takes from before
+ * bumping, and the text of a String is freed with it.  There are no
+ * pauses, but cycles are never freed.  The counted objects are allocated
+ * from one range of addresses reserved by quack_rc_start, so literals,
+ * statics, and objects in stack frames, which are never freed, are
+ * recognized by their address and retaining or releasing them does
+ * nothing.  Counts are not atomic since Quack programs have a single
+ * thread.  If the environment variable QUACK_GC_STATS is set, the numbers
+ * of objects freed and reused are printed to stderr when the program
+ * exits.
+ */
+/* Objects of up to this many words are reused through free lists */
+#define QUACK_RC_NUM_CLASSES 64
+
+extern char *quack_rc_heap_start;
+extern unsigned long quack_rc_heap_size;   /* 0 without reference counting */
+extern void *quack_rc_free_lists[QUACK_RC_NUM_CLASSES];
+extern unsigned long quack_rc_num_reused;
+
+void *quack_rc_alloc_slow(size_t size);
+void quack_rc_free(obj_Obj obj);
+void quack_rc_start(void);
+
+/* Checks whether an address is in the counted heap */
+static inline bool quack_rc_is_counted(const void *addr) {
+  return (unsigned long)addr - (unsigned long)quack_rc_heap_start < quack_rc_heap_size;
+}
+
+static inline unsigned long *quack_rc_count(const void *obj) {
+  return (unsigned long *)obj - 1;
+}
+
+/* Allocates an object with a count of 1, reusing freed memory if possible */
+static inline void *quack_rc_alloc(size_t size) {
+  size = (size + QUACK_ALLOC_ALIGN - 1) & ~(QUACK_ALLOC_ALIGN - 1);
+  size_t words = size / sizeof(void *);
+  void **cell = words < QUACK_RC_NUM_CLASSES ? (void **)quack_rc_free_lists[words] : NULL;
+  if (QUACK_UNLIKELY(!cell))
+    return quack_rc_alloc_slow(size);
+  quack_rc_free_lists[words] = *cell;
+  quack_rc_num_reused++;
+  *(unsigned long *)cell = 1;
+  __builtin_memset(cell + 1, 0, size);
+  return cell + 1;
+}
+
+static inline void *quack_rc_retain(void *obj) {
+  if (quack_rc_is_counted(obj))
+    ++*quack_rc_count(obj);
+  return obj;
+}
+
+static inline void quack_rc_release(void *obj) {
+  if (quack_rc_is_counted(obj) && --*quack_rc_count(obj) == 0)
+    quack_rc_free((obj_Obj)obj);
+}
+
+/* Stores an object whose reference is owned by the caller in a local or a
+ * field and releases the object stored there before
+ */
+static inline void quack_rc_store(void *slot, void *obj) {
+  void *old = *(void **)slot;
+  *(void **)slot = obj;
+  quack_rc_release(old);
+}
+
 #endif
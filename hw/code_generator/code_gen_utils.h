@@ -5,19 +5,341 @@
 #ifndef TYPE_CHECKER_CODE_GEN_UTILS_H
 #define TYPE_CHECKER_CODE_GEN_UTILS_H
 
-#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <ostream>
 #include "symbol_table.h"
+#include "temp_var_pool.h"
+#include "literal_pool.h"
+#include "inline_cache_pool.h"
+#include "shadow_stack.h"
+#include "ref_count_pool.h"
 
 // Forward Declaration
-namespace Quack { class Class; }
+namespace Quack { class Class; class Method; }
+namespace AST { struct ASTNode; struct FunctionCall; struct While; struct Assn; struct Return;
+                struct ObjectCall; struct Typecase; }
+namespace CodeGen {
+  class EscapeAnalysis; class LoopAnalysis; class EffectAnalysis; class ValueNumbering;
+  class TailCallAnalysis; class ProfileAnalysis; class FieldLayout; class DispatchLayout;
+  class RefCountAnalysis;
+}
+
+/** Optimization level used when none is specified */
+#define OPT_LEVEL_DEFAULT 1
+/** Highest supported optimization level */
+#define OPT_LEVEL_MAX 2
+/** Size in bytes of the nursery of the generational collector used when none is specified */
+#define NURSERY_SIZE_DEFAULT (1UL << 20)
 
 namespace CodeGen {
+  /** Memory management of the objects of the generated program */
+  enum class GcMode {
+    NONE,          /** Objects are never freed */
+    MARK_SWEEP,    /** Unreachable objects are freed by a mark-sweep collector */
+    GENERATIONAL,  /** New objects are allocated in a nursery collected by copying */
+    RC             /** Objects are freed when their reference count drops to 0 */
+  };
+
+  /** User selectable options that control code generation */
+  struct Options {
+    /** Print code generation statistics (e.g., temporaries per method) after compiling */
+    bool report_stats_ = false;
+    /** Emit x86-64 assembly directly instead of C */
+    bool emit_asm_ = false;
+    /**
+     * Optimization level.  Level 0 emits one C local per intermediate value.  Level 1 also
+     * forwards and reuses temporaries and pools Int and String literals in static objects.
+     * Level 2 also binds calls on classes without subclasses at compile time and emits code
+     * tuned for the C compiler (e.g., static functions and branch hints).
+     */
+    unsigned opt_level_ = OPT_LEVEL_DEFAULT;
+    /**
+     * Instrument the generated program to count function calls, the receiver classes of
+     * dynamically dispatched calls, typecase alternatives taken, and loop iterations.  The
+     * program writes the counts to the profile file when it exits.
+     */
+    bool profile_generate_ = false;
+    /** Optimize using the counts in the profile file written by an instrumented program */
+    bool profile_use_ = false;
+    /** Path of the profile file.  If empty, it is the Quack file with the extension changed. */
+    std::string profile_path_;
+    /**
+     * Dispatch the methods of user classes through one shared table indexed by class id and
+     * method instead of through a method table in each class struct.
+     */
+    bool compact_dispatch_ = false;
+    /**
+     * Give every dynamically dispatched call site a cache of the implementations it called for
+     * the last few receiver classes.
+     */
+    bool inline_caches_ = false;
+    /** Maximum size in bytes of the heap the objects are allocated from.  0 means no limit. */
+    unsigned long heap_size_ = 0;
+    /** Memory management of the objects */
+    GcMode gc_ = GcMode::NONE;
+    /** Size in bytes of the nursery new objects are allocated from with GcMode::GENERATIONAL */
+    unsigned long nursery_size_ = NURSERY_SIZE_DEFAULT;
+  };
+
+  /** Expected outcome of a conditional jump passed to the C compiler as a hint */
+  enum class BranchHint { NONE, LIKELY, UNLIKELY };
+
+  /** Objects allocated in the generated function's stack frame instead of on the heap */
+  struct StackAllocs {
+    /** Stack variable holding the object of each non-escaping constructor call */
+    std::map<const AST::FunctionCall*, std::string> vars_;
+    /** Stack variables (name and class) declared by each function */
+    std::map<const Quack::Method*, std::vector<std::pair<std::string, Quack::Class*>>> decls_;
+  };
+
+  /** While loop whose Int counter is kept in a native C int */
+  struct CountedLoop {
+    /** Quack local used as the counter */
+    std::string var_;
+    /** C local holding the counter's value */
+    std::string counter_;
+    /** Quack local used as the bound or empty if the bound is a literal */
+    std::string bound_var_;
+    /** C local holding the bound's value */
+    std::string bound_;
+    /** Final step of the body moved to the loop header or nullptr if it stays in the body */
+    const AST::Assn * step_stmt_ = nullptr;
+    /** Amount added to the counter by step_stmt_ */
+    int step_ = 0;
+    /** True if the counter's object must be updated after the loop */
+    bool write_back_ = false;
+    /**
+     * True if the loop reads the counter as an object.  The object is then updated once each
+     * iteration instead of being boxed at every read.
+     */
+    bool sync_object_ = false;
+  };
+
+  struct CountedLoops {
+    std::map<const AST::While*, CountedLoop> loops_;
+  };
+
+  /** Quack Int local whose current value is held in a native C int */
+  struct NativeLocal {
+    /** C local holding the value */
+    std::string native_;
+    /** True if the local's object does not hold the current value */
+    bool is_stale_;
+  };
+
+  /** Self calls in return statements compiled to a jump back to the start of the method */
+  struct TailCalls {
+    /** Call made by each converted return statement */
+    std::map<const AST::Return*, const AST::ObjectCall*> calls_;
+    /** Methods containing a converted call.  They start with the label the calls jump to. */
+    std::set<const Quack::Method*> methods_;
+  };
+
+  /**
+   * Shared dispatch table of the methods of user classes.  The implementations of a method form
+   * a row indexed by class id, and the rows of all methods are overlapped in one array with each
+   * row displaced so that no two entries share a slot.  The implementation of a method for an
+   * object is the entry at its class id plus the method's displacement.  Methods no class
+   * overrides have no row.
+   */
+  struct DispatchTable {
+    /** Displacement of the row of each method in the table */
+    std::map<std::string, long> displacements_;
+    /** Generated function in each slot of the table or an empty string if the slot is unused */
+    std::vector<std::string> entries_;
+    /** Methods with a single implementation in all classes.  Calls to them are direct. */
+    std::set<std::string> direct_methods_;
+  };
+
+  /** Order in which the alternatives of a typecase are laid out, hottest first */
+  struct TypecaseLayout {
+    std::vector<unsigned long> order_;
+    /** Alternative tested before the switch or the number of alternatives if none is */
+    unsigned long fast_alt_;
+    /** Class ids matched by the fast alternative */
+    int fast_lo_;
+    int fast_hi_;
+  };
+
+  /**
+   * Counters of an instrumented program and the optimizations chosen from the counts of an
+   * earlier run.  Counters are numbered from the program's structure alone so the same program
+   * has the same counters at every optimization level.
+   */
+  struct Profile {
+    /** Name of each counter as written to the profile file */
+    std::vector<std::string> names_;
+    /**
+     * First counter of each function (its calls), dynamically dispatched call site (one per
+     * class the receiver may have, in class id order), typecase (one per alternative), and
+     * loop (entries then iterations)
+     */
+    std::map<const void*, unsigned long> counters_;
+    /** True if the generated program increments the counters */
+    bool instrument_ = false;
+    /** Profile file written by the instrumented program */
+    std::string path_;
+
+    /** Functions called often enough to be optimized for speed */
+    std::set<const Quack::Method*> hot_;
+    /** Functions never called */
+    std::set<const Quack::Method*> cold_;
+    /** Call sites whose receivers almost always have the mapped class */
+    std::map<const AST::FunctionCall*, Quack::Class*> speculated_;
+    /** Typecases laid out by how often each alternative is taken */
+    std::map<const AST::Typecase*, TypecaseLayout> typecases_;
+    /** Expected outcome of the condition of each loop that ran */
+    std::map<const AST::While*, BranchHint> loop_hints_;
+
+    /**
+     * Builds the statement incrementing a counter.
+     *
+     * @param key Function, call site, typecase, or loop that owns the counter
+     * @param offset C expression added to the owner's first counter
+     * @return Statement or an empty string if the program is not instrumented
+     */
+    std::string increment(const void * key, const std::string &offset = "0") const {
+      auto itr = counters_.find(key);
+      if (!instrument_ || itr == counters_.end())
+        return "";
+      std::string index = std::to_string(itr->second);
+      if (offset != "0")
+        index += " + " + offset;
+      return PROFILE_COUNTS_VAR "[" + index + "]++";
+    }
+  };
+
+  /** C local holding the value of an expression that is computed once and then reused */
+  struct NumberedValue {
+    std::string var_;
+    /** True if the expression computes the value and stores it in var_ */
+    bool is_def_;
+  };
+
+  /** Expressions whose values are reused instead of being recomputed */
+  struct ValueNumbers {
+    /** Value of each reused expression and each expression whose value is reused */
+    std::map<const AST::ASTNode*, NumberedValue> values_;
+    /** Loop invariant expressions computed just before each loop */
+    std::map<const AST::While*, std::vector<const AST::ASTNode*>> hoisted_;
+    /** Value locals (name and class) declared by each function */
+    std::map<const Quack::Method*, std::vector<std::pair<std::string, Quack::Class*>>> decls_;
+  };
+
   struct Settings {
-    std::ofstream & fout_;
+    std::ostream & fout_;
     Quack::Class * return_type_;
     Symbol::Table * st_;
+    /** Temporaries of the method currently being generated */
+    TempVarPool * temps_;
+    /** User specified code generation options */
+    const Options * options_;
+    /** Objects that do not escape the function that creates them */
+    const StackAllocs * stack_allocs_;
+    /** Static Int and String literal objects.  If null, literals are allocated at each use. */
+    LiteralPool * literals_;
+    /** Loops whose counters are native C ints */
+    const CountedLoops * counted_loops_;
+    /** Locals held in native C ints in the code currently being generated */
+    const std::map<std::string, NativeLocal> * native_locals_;
+    /** Expressions whose values are reused */
+    const ValueNumbers * value_numbers_;
+    /** Numbered expression whose value is currently being computed */
+    const AST::ASTNode * computing_value_;
+    /** Return statements whose self calls jump back to the start of the method */
+    const TailCalls * tail_calls_;
+    /** Profile counters and profile guided optimizations or nullptr if no profile is used */
+    const Profile * profile_;
+    /** Shared table of user methods or nullptr if methods are dispatched through the classes */
+    const DispatchTable * dispatch_;
+    /** Caches of the dynamically dispatched call sites or nullptr if calls are not cached */
+    InlineCachePool * inline_caches_;
+    /** References owned by the method being generated or nullptr if objects are not counted */
+    RefCountPool * ref_counts_;
 
-    explicit Settings(std::ofstream& fout) : fout_(fout), return_type_(nullptr), st_(nullptr) {}
+    explicit Settings(std::ostream& fout)
+        : fout_(fout), return_type_(nullptr), st_(nullptr), temps_(nullptr), options_(nullptr),
+          stack_allocs_(nullptr), literals_(nullptr), counted_loops_(nullptr),
+          native_locals_(nullptr), value_numbers_(nullptr), computing_value_(nullptr),
+          tail_calls_(nullptr), profile_(nullptr), dispatch_(nullptr),
+          inline_caches_(nullptr), ref_counts_(nullptr) {}
+    /**
+     * Checks whether the optimizations of the specified level are enabled.
+     *
+     * @param level Optimization level
+     * @return True if code is generated at \p level or higher
+     */
+    bool optimize(unsigned level) const { return options_ && options_->opt_level_ >= level; }
+    /**
+     * Checks whether the generated functions register their object locals as garbage collector
+     * roots.
+     *
+     * @return True if objects are freed by a tracing collector
+     */
+    bool collect_garbage() const {
+      return options_ && (options_->gc_ == GcMode::MARK_SWEEP
+                          || options_->gc_ == GcMode::GENERATIONAL);
+    }
+    /**
+     * Checks whether stores of objects in fields run the write barrier of the generational
+     * collector.
+     *
+     * @return True if objects are allocated in a nursery
+     */
+    bool write_barriers() const { return options_ && options_->gc_ == GcMode::GENERATIONAL; }
+    /**
+     * Copy of the settings that writes to another stream, e.g., to generate the body of a
+     * function before its declarations.
+     *
+     * @param out Stream where the generated code is written
+     * @return Settings identical to these except for the output stream
+     */
+    Settings with_output(std::ostream &out) const {
+      Settings settings(out);
+      settings.return_type_ = return_type_;
+      settings.st_ = st_;
+      settings.temps_ = temps_;
+      settings.options_ = options_;
+      settings.stack_allocs_ = stack_allocs_;
+      settings.literals_ = literals_;
+      settings.counted_loops_ = counted_loops_;
+      settings.native_locals_ = native_locals_;
+      settings.value_numbers_ = value_numbers_;
+      settings.computing_value_ = computing_value_;
+      settings.tail_calls_ = tail_calls_;
+      settings.profile_ = profile_;
+      settings.dispatch_ = dispatch_;
+      settings.inline_caches_ = inline_caches_;
+      settings.ref_counts_ = ref_counts_;
+      return settings;
+    }
+    /**
+     * Accessor for a local held in a native C int.
+     *
+     * @param name Name of the Quack local
+     * @return Native local or nullptr if the local is only stored as an object
+     */
+    const NativeLocal * native_local(const std::string &name) const {
+      if (!native_locals_)
+        return nullptr;
+      auto itr = native_locals_->find(name);
+      return (itr == native_locals_->end()) ? nullptr : &itr->second;
+    }
+    /**
+     * Accessor for the reused value of an expression.
+     *
+     * @param node Expression
+     * @return Value of the expression or nullptr if its code is generated normally
+     */
+    const NumberedValue * value_number(const AST::ASTNode * node) const {
+      if (!value_numbers_ || node == computing_value_)
+        return nullptr;
+      auto itr = value_numbers_->values_.find(node);
+      return (itr == value_numbers_->values_.end()) ? nullptr : &itr->second;
+    }
   };
 }
 
@@ -16,30 +16,29 @@
 #include "quack_param.h"
 #include "compiler_utils.h"
 #include "ASTNode.h"
+#include "escape_analysis.h"
+#include "loop_analysis.h"
+#include "effect_analysis.h"
+#include "value_numbering.h"
+#include "tail_call_analysis.h"
+#include "profile_analysis.h"
+#include "field_layout.h"
+#include "dispatch_layout.h"
+#include "ref_count_analysis.h"
+
+/** C compiler flags suggested in code generated at the highest optimization level */
+#define RECOMMENDED_CC_FLAGS "gcc -O2"
 
 namespace CodeGen {
   class Gen {
    public:
 
-    Gen(Quack::Program * prog, const std::string &quack_filename) : prog_(prog) {
-      #ifdef _WIN32
-        char file_sep = '\\';
-      #else
-        char file_sep = '/';
-      #endif
-      std::size_t per_loc = quack_filename.rfind('.');
-      std::size_t slash_loc = quack_filename.rfind(file_sep);
-
-      // Preserve path and filename for the generated code
-      if (per_loc==std::string::npos || (slash_loc != std::string::npos && per_loc < slash_loc)) {
-        output_file_path_ = quack_filename;
-      } else if (per_loc == 0 || (slash_loc != std::string::npos && per_loc == slash_loc + 1)) {
-        throw std::runtime_error("It appears you have only file extension and no file name");
-      } else {
-        output_file_path_ = quack_filename.substr(0, per_loc);
-      }
-      output_file_path_ += ".c";
-
+    Gen(Quack::Program * prog, const std::string &quack_filename, const Options &options)
+        : prog_(prog), options_(options) {
+      output_file_path_ = build_output_file_path(quack_filename, ".c");
+      profile_path_ = options_.profile_path_.empty()
+                      ? build_output_file_path(quack_filename, PROFILE_FILE_EXT)
+                      : options_.profile_path_;
       fout_.open(output_file_path_);
     }
 
@@ -53,16 +52,143 @@ namespace CodeGen {
       export_includes();
 
       std::vector<Quack::Class*> user_classes = topologically_sort_classes();
+      Quack::Class::assign_class_ids();
+
+      // Literals are only known after the whole program is generated so the body is buffered
+      // and the literal pool written before it.
+      std::ostringstream body;
+      bool count_refs = options_.gc_ == CodeGen::GcMode::RC;
+      CodeGen::TempVarPool temps(options_.opt_level_ >= 1,
+                                 options_.gc_ != CodeGen::GcMode::NONE && !count_refs);
+      CodeGen::LiteralPool literals;
+      CodeGen::Settings settings(body);
+      settings.temps_ = &temps;
+      settings.options_ = &options_;
+      if (options_.opt_level_ >= 1)
+        settings.literals_ = &literals;
+      CodeGen::InlineCachePool inline_caches;
+      if (options_.inline_caches_)
+        settings.inline_caches_ = &inline_caches;
 
-      CodeGen::Settings settings(fout_);
+      CodeGen::ProfileAnalysis profile_analysis(prog_->main_);
+      CodeGen::Profile profile;
+      if (options_.profile_generate_ || options_.profile_use_) {
+        profile_analysis.assign_counters(user_classes, profile);
+        settings.profile_ = &profile;
+      }
+      if (options_.profile_generate_) {
+        profile.instrument_ = true;
+        profile.path_ = profile_path_;
+      }
+      if (options_.profile_use_)
+        read_profile(profile_analysis, profile);
+
+      CodeGen::TailCallAnalysis tail_call_analysis;
+      CodeGen::TailCalls tail_calls;
+      CodeGen::EscapeAnalysis escapes(prog_->main_);
+      CodeGen::StackAllocs stack_allocs;
+      CodeGen::LoopAnalysis loops(prog_->main_);
+      CodeGen::CountedLoops counted_loops;
+      CodeGen::EffectAnalysis effects(prog_->main_);
+      CodeGen::ValueNumbering numbering(prog_->main_, effects);
+      CodeGen::ValueNumbers value_numbers;
+      CodeGen::DispatchLayout dispatch_layout;
+      CodeGen::DispatchTable dispatch_table;
+      if (options_.compact_dispatch_) {
+        dispatch_layout.run(user_classes, dispatch_table);
+        settings.dispatch_ = &dispatch_table;
+      }
+
+      if (options_.opt_level_ >= 2) {
+        tail_call_analysis.run(user_classes, tail_calls);
+        settings.tail_calls_ = &tail_calls;
+      }
+      CodeGen::RefCountAnalysis ref_count_analysis;
+      CodeGen::RefCountPool ref_counts;
+      if (count_refs) {
+        ref_count_analysis.run(user_classes, settings.tail_calls_, ref_counts);
+        settings.ref_counts_ = &ref_counts;
+      }
+
+      CodeGen::FieldLayout field_layout(prog_->main_);
+      if (options_.opt_level_ >= 2)
+        field_layout.run(user_classes, settings.profile_ ? &profile_analysis : nullptr, true);
+      if (options_.opt_level_ >= 2) {
+        // A stack object would be released when its last reference is dropped
+        if (!count_refs) {
+          escapes.run(user_classes, tail_calls, stack_allocs);
+          settings.stack_allocs_ = &stack_allocs;
+        }
+        loops.run(user_classes, counted_loops);
+        settings.counted_loops_ = &counted_loops;
+        effects.run(user_classes);
+        numbering.run(user_classes, &counted_loops, value_numbers);
+        settings.value_numbers_ = &value_numbers;
+      }
       for (auto q_class : user_classes)
-        q_class->generate_code(settings);
+        q_class->generate_declarations(settings);
+      if (settings.dispatch_)
+        export_dispatch_table(settings);
+      for (auto q_class : user_classes)
+        q_class->generate_definitions(settings);
 
       export_main(settings);
+      literals.generate_code(fout_);
+      inline_caches.generate_code(fout_);
+      if (profile.instrument_)
+        export_profile_counters(profile);
+      fout_ << body.str();
       std::cout << "Code generation completed successfully." << std::endl;
+
+      if (options_.report_stats_) {
+        report_temp_var_stats(temps);
+        if (options_.opt_level_ >= 2)
+          report_field_layout_stats(field_layout);
+        if (settings.dispatch_)
+          report_dispatch_stats(dispatch_layout);
+        if (settings.stack_allocs_)
+          report_escape_stats(escapes);
+        if (settings.counted_loops_)
+          report_loop_stats(loops);
+        if (settings.value_numbers_)
+          report_value_number_stats(numbering);
+        if (settings.tail_calls_)
+          report_tail_call_stats(tail_call_analysis);
+        if (options_.profile_use_)
+          report_profile_stats(profile_analysis);
+        if (settings.ref_counts_)
+          report_ref_count_stats(ref_counts);
+      }
     }
+    /**
+     * Builds the path of the generated output file.  It has the same path and name as the
+     * Quack file with only the extension changed.
+     *
+     * @param quack_filename Path to the Quack source file
+     * @param extension Extension (including the period) of the generated file
+     * @return Path to the generated file
+     */
+    static std::string build_output_file_path(const std::string &quack_filename,
+                                              const std::string &extension) {
+      #ifdef _WIN32
+        char file_sep = '\\';
+      #else
+        char file_sep = '/';
+      #endif
+      std::size_t per_loc = quack_filename.rfind('.');
+      std::size_t slash_loc = quack_filename.rfind(file_sep);
 
-   private:
+      // Preserve path and filename for the generated code
+      std::string output_file_path;
+      if (per_loc==std::string::npos || (slash_loc != std::string::npos && per_loc < slash_loc)) {
+        output_file_path = quack_filename;
+      } else if (per_loc == 0 || (slash_loc != std::string::npos && per_loc == slash_loc + 1)) {
+        throw std::runtime_error("It appears you have only file extension and no file name");
+      } else {
+        output_file_path = quack_filename.substr(0, per_loc);
+      }
+      return output_file_path + extension;
+    }
     /**
      * Classes are topologically sorted.  This is needed to ensure that inherited classes
      * have the functions of their super classes already defined in the generated code.
@@ -101,11 +227,265 @@ namespace CodeGen {
       }
       return user_classes;
     }
+   private:
+    /**
+     * Prints the number of temporaries requested and declared for each generated method.
+     *
+     * @param temps Temporary variable pool used for code generation
+     */
+    static void report_temp_var_stats(const CodeGen::TempVarPool &temps) {
+      unsigned long tot_requested = 0, tot_declared = 0;
+
+      std::cout << "Temporary variables (requested -> declared, forwarded, discarded):\n";
+      for (const auto &stats : temps.stats()) {
+        std::cout << "  " << std::left << std::setw(40) << stats.method_name_ << std::right
+                  << std::setw(5) << stats.requested_ << " -> " << std::setw(5) << stats.declared_
+                  << ", " << stats.forwarded_ << ", " << stats.discarded_ << "\n";
+        tot_requested += stats.requested_;
+        tot_declared += stats.declared_;
+      }
+      std::cout << "  " << std::left << std::setw(40) << "Total" << std::right
+                << std::setw(5) << tot_requested << " -> " << std::setw(5) << tot_declared
+                << std::endl;
+    }
+    /**
+     * Prints the number of constructor calls in each generated function whose objects are
+     * allocated on the stack instead of on the heap.
+     *
+     * @param escapes Escape analysis of the program
+     */
+    static void report_escape_stats(const CodeGen::EscapeAnalysis &escapes) {
+      unsigned long tot_sites = 0, tot_stack = 0;
+
+      std::cout << "Heap allocations eliminated (stack allocated / constructor calls):\n";
+      for (const auto &stats : escapes.stats()) {
+        if (stats.sites_ == 0)
+          continue;
+        std::cout << "  " << std::left << std::setw(40) << stats.method_name_ << std::right
+                  << std::setw(5) << stats.stack_ << " / " << stats.sites_ << "\n";
+        tot_sites += stats.sites_;
+        tot_stack += stats.stack_;
+      }
+      std::cout << "  " << std::left << std::setw(40) << "Total" << std::right
+                << std::setw(5) << tot_stack << " / " << tot_sites << std::endl;
+    }
+    /**
+     * Prints the while loops in each generated function that were converted to counted loops.
+     *
+     * @param loops Loop analysis of the program
+     */
+    static void report_loop_stats(const CodeGen::LoopAnalysis &loops) {
+      unsigned long tot_loops = 0;
+
+      std::cout << "Counted loops (condition, step):\n";
+      for (const auto &stats : loops.stats()) {
+        for (const auto &loop : stats.loops_)
+          std::cout << "  " << std::left << std::setw(40) << stats.method_name_ << loop << "\n";
+        tot_loops += stats.loops_.size();
+      }
+      std::cout << "  " << std::left << std::setw(40) << "Total" << tot_loops << std::endl;
+    }
+    /**
+     * Prints the number of loop invariant expressions moved out of loops and the number of
+     * expressions that reuse an earlier value in each generated function.
+     *
+     * @param numbering Value numbering of the program
+     */
+    static void report_value_number_stats(const CodeGen::ValueNumbering &numbering) {
+      unsigned long tot_hoisted = 0, tot_reused = 0;
+
+      std::cout << "Values reused (hoisted out of loops, reused expressions):\n";
+      for (const auto &stats : numbering.stats()) {
+        if (stats.hoisted_ == 0 && stats.reused_ == 0)
+          continue;
+        std::cout << "  " << std::left << std::setw(40) << stats.method_name_ << std::right
+                  << std::setw(5) << stats.hoisted_ << ", " << stats.reused_ << "\n";
+        tot_hoisted += stats.hoisted_;
+        tot_reused += stats.reused_;
+      }
+      std::cout << "  " << std::left << std::setw(40) << "Total" << std::right
+                << std::setw(5) << tot_hoisted << ", " << tot_reused << std::endl;
+    }
+    /**
+     * Prints the number of references owned by temporaries in each generated function, and
+     * how many were moved instead of retained, released when computed, or retained for a call.
+     *
+     * @param ref_counts Reference counts of the program
+     */
+    static void report_ref_count_stats(const CodeGen::RefCountPool &ref_counts) {
+      unsigned long tot_temps = 0, tot_moved = 0, tot_dropped = 0, tot_retained = 0;
+
+      std::cout << "Owned references (temporaries, moved, dropped, retained for calls):\n";
+      for (const auto &stats : ref_counts.stats()) {
+        if (stats.temps_ == 0 && stats.retained_ == 0)
+          continue;
+        std::cout << "  " << std::left << std::setw(40) << stats.method_name_ << std::right
+                  << std::setw(5) << stats.temps_ << ", " << stats.moved_ << ", "
+                  << stats.dropped_ << ", " << stats.retained_ << "\n";
+        tot_temps += stats.temps_;
+        tot_moved += stats.moved_;
+        tot_dropped += stats.dropped_;
+        tot_retained += stats.retained_;
+      }
+      std::cout << "  " << std::left << std::setw(40) << "Total" << std::right << std::setw(5)
+                << tot_temps << ", " << tot_moved << ", " << tot_dropped << ", " << tot_retained
+                << std::endl;
+    }
+    /**
+     * Prints the size of the objects of each class with the chosen field layout and with the
+     * fields in alphabetical order.
+     *
+     * @param field_layout Field layout of the program
+     */
+    static void report_field_layout_stats(const CodeGen::FieldLayout &field_layout) {
+      std::cout << "Object sizes in bytes (fields, hot-first layout, alphabetical layout):\n";
+      for (const auto &stats : field_layout.stats()) {
+        std::cout << "  " << std::left << std::setw(40) << stats.class_name_ << std::right
+                  << std::setw(5) << stats.num_fields_ << ", " << std::setw(5) << stats.size_
+                  << ", " << std::setw(5) << stats.default_size_ << "\n";
+      }
+      std::cout << std::flush;
+    }
+    /**
+     * Prints the size of the shared dispatch table and of the method tables the class structs
+     * would hold without it.
+     *
+     * @param dispatch_layout Dispatch table layout of the program
+     */
+    static void report_dispatch_stats(const CodeGen::DispatchLayout &dispatch_layout) {
+      const CodeGen::DispatchStats &stats = dispatch_layout.stats();
+      std::pair<const char*, unsigned long> rows[] = {
+          {"User classes", stats.num_classes_},
+          {"Methods in the shared table", stats.num_methods_},
+          {"Methods called directly", stats.num_direct_},
+          {"Implementations in the shared table", stats.num_entries_},
+          {"Shared table slots", stats.table_size_},
+          {"Method pointers in per class tables", stats.vtable_size_}};
+
+      std::cout << "Compact dispatch:\n";
+      for (auto &row : rows)
+        std::cout << "  " << std::left << std::setw(40) << row.first << std::right
+                  << std::setw(5) << row.second << "\n";
+      std::cout << std::flush;
+    }
+    /**
+     * Prints the number of self tail calls in each method that were converted to jumps.
+     *
+     * @param tail_call_analysis Tail call analysis of the program
+     */
+    static void report_tail_call_stats(const CodeGen::TailCallAnalysis &tail_call_analysis) {
+      unsigned long tot_calls = 0;
+
+      std::cout << "Self tail calls converted to jumps:\n";
+      for (const auto &stats : tail_call_analysis.stats()) {
+        if (stats.calls_ == 0)
+          continue;
+        std::cout << "  " << std::left << std::setw(40) << stats.method_name_ << std::right
+                  << std::setw(5) << stats.calls_ << "\n";
+        tot_calls += stats.calls_;
+      }
+      std::cout << "  " << std::left << std::setw(40) << "Total" << std::right
+                << std::setw(5) << tot_calls << std::endl;
+    }
+    /**
+     * Prints the number of optimizations chosen from the profile.
+     *
+     * @param profile_analysis Profile analysis of the program
+     */
+    static void report_profile_stats(const CodeGen::ProfileAnalysis &profile_analysis) {
+      const CodeGen::ProfileStats &stats = profile_analysis.stats();
+      std::pair<const char*, unsigned long> rows[] = {
+          {"Hot functions", stats.hot_},
+          {"Cold functions", stats.cold_},
+          {"Speculated call sites", stats.speculated_},
+          {"Dynamically dispatched call sites", stats.sites_},
+          {"Reordered typecases", stats.typecases_},
+          {"Loops usually exiting at once", stats.early_exit_loops_}};
+
+      std::cout << "Profile guided optimizations:\n";
+      for (auto &row : rows)
+        std::cout << "  " << std::left << std::setw(40) << row.first << std::right
+                  << std::setw(5) << row.second << "\n";
+      std::cout << std::flush;
+    }
+    /**
+     * Reads the profile file and selects the optimizations it supports.  A missing or stale
+     * profile is not an error since the program is still correct without it.
+     *
+     * @param profile_analysis Profile analysis of the program
+     * @param profile Profile with assigned counters
+     */
+    void read_profile(CodeGen::ProfileAnalysis &profile_analysis, CodeGen::Profile &profile) {
+      long num_found = profile_analysis.read(profile_path_, profile);
+      if (num_found < 0) {
+        std::cerr << "Warning: Unable to read profile \"" << profile_path_
+                  << "\".  Profile guided optimizations are disabled." << std::endl;
+        return;
+      }
+      if (static_cast<unsigned long>(num_found) != profile.names_.size())
+        std::cerr << "Warning: Profile \"" << profile_path_ << "\" has " << num_found << " of "
+                  << profile.names_.size() << " counters.  The program may have changed since "
+                  << "it was profiled." << std::endl;
+      profile_analysis.plan(profile);
+    }
+    /**
+     * Writes the counters of an instrumented program and their names.
+     *
+     * @param profile Profile with assigned counters
+     */
+    void export_profile_counters(const CodeGen::Profile &profile) {
+      if (profile.names_.empty())
+        return;
+      fout_ << "static unsigned long " PROFILE_COUNTS_VAR "[" << profile.names_.size() << "];\n"
+            << "static const char * const " PROFILE_NAMES_VAR "[] = {\n";
+      for (const auto &name : profile.names_)
+        fout_ << AST::ASTNode::indent_str(1) << c_string_literal(name) << ",\n";
+      fout_ << "};\n" << std::endl;
+    }
+    /**
+     * Writes the shared dispatch table.  It must follow the prototypes of the methods.
+     *
+     * @param settings Code generator settings
+     */
+    void export_dispatch_table(CodeGen::Settings &settings) {
+      const std::vector<std::string> &entries = settings.dispatch_->entries_;
+      if (entries.empty())
+        return;
+      settings.fout_ << "\nstatic void (* const " DISPATCH_TABLE_VAR "[" << entries.size()
+                     << "])(void) = {";
+      for (unsigned long i = 0; i < entries.size(); i++) {
+        settings.fout_ << (i == 0 ? "\n" : ",\n") << AST::ASTNode::indent_str(1);
+        if (entries[i].empty())
+          settings.fout_ << "NULL";
+        else
+          settings.fout_ << "(void (*)(void))" << entries[i];
+      }
+      settings.fout_ << "\n};\n";
+    }
+    /**
+     * Quotes a string for use in the generated code.
+     *
+     * @param str String without control characters
+     * @return C string literal
+     */
+    static std::string c_string_literal(const std::string &str) {
+      std::string literal = "\"";
+      for (char c : str) {
+        if (c == '"' || c == '\\')
+          literal += '\\';
+        literal += c;
+      }
+      return literal + "\"";
+    }
     /** Write any includes to the beginning of the generated file. */
     void export_includes() {
+      if (options_.opt_level_ >= 2)
+        fout_ << "/* Recommended build: " RECOMMENDED_CC_FLAGS " <file>.c builtins.c */\n";
+
       std::pair<std::string, bool> libs[] = {{"stdlib", false},
                                              {"stdio", false},
                                              {"stdbool", false},
+                                             {"string", false},
                                              {"builtins", true}};
       for (auto &lib_pair : libs) {
         fout_ << "#include " << (lib_pair.second ? "\"" : "<")
@@ -121,7 +501,7 @@ namespace CodeGen {
     void generate_main(CodeGen::Settings settings, const std::string &main_subfunc_name) {
       Quack::Class * nothing_class = Quack::Class::Container::Nothing();
 
-      fout_ << "\n"
+      settings.fout_ << "\n" << (settings.optimize(2) ? "static " : "")
             << nothing_class->generated_object_type_name() << " " << main_subfunc_name << "() {\n";
 
       settings.return_type_ = Quack::Class::Container::Nothing();
@@ -129,10 +509,8 @@ namespace CodeGen {
 
       Quack::Class::generate_symbol_table(settings, 1, prog_->main_);
       AST::ASTNode::generate_one_line_comment(settings, 1, "main Method Body");
-      prog_->main_->block_->generate_code(settings, 0);
-
-      fout_ << AST::ASTNode::indent_str(1) << "return none;\n"
-            << "}" << std::endl;
+      Quack::Class::generate_function_body(settings, main_subfunc_name, prog_->main_, false,
+                                           GENERATED_LIT_NONE);
 
       settings.return_type_ = nullptr;
       settings.st_ = nullptr;
@@ -141,16 +519,43 @@ namespace CodeGen {
     void export_main(CodeGen::Settings settings) {
       generate_main(settings, METHOD_MAIN);
 
-      fout_ << "\n" << "int main() {"
-            << "\n" << AST::ASTNode::indent_str(1) << METHOD_MAIN << "();\n"
+      settings.fout_ << "\n" << "int main() {\n"
+                     << AST::ASTNode::indent_str(1) << ALLOC_START_FUNC "(" << options_.heap_size_
+                     << "UL);\n";
+      if (settings.ref_counts_)
+        settings.fout_ << AST::ASTNode::indent_str(1) << RC_START_FUNC "();\n";
+      if (settings.collect_garbage()) {
+        // A nursery size of 0 collects the whole heap every time
+        unsigned long nursery_size = settings.write_barriers() ? options_.nursery_size_ : 0;
+        settings.fout_ << AST::ASTNode::indent_str(1) << GC_START_FUNC "(" << nursery_size
+                       << "UL);\n";
+      }
+      const CodeGen::Profile * profile = settings.profile_;
+      if (profile && profile->instrument_ && !profile->names_.empty()) {
+        // The counts are written to the profile file when the program exits
+        settings.fout_ << AST::ASTNode::indent_str(1) << PROFILE_START_FUNC "("
+                       << c_string_literal(profile->path_) << ", "
+                       << PROFILE_COUNTS_VAR ", " PROFILE_NAMES_VAR ", "
+                       << profile->names_.size() << ");\n";
+      }
+      if (settings.inline_caches_ && settings.inline_caches_->size() > 0) {
+        // The cache statistics are printed at exit if the environment variable is set
+        settings.fout_ << AST::ASTNode::indent_str(1) << INLINE_CACHE_START_FUNC "("
+                       << INLINE_CACHES_VAR ", " << settings.inline_caches_->size() << ");\n";
+      }
+      settings.fout_ << AST::ASTNode::indent_str(1) << METHOD_MAIN << "();\n"
             << "}" << std::endl;
     }
     /** Location to which the generated code is written */
     std::string output_file_path_;
+    /** Profile file written by an instrumented program and read by a profile guided build */
+    std::string profile_path_;
     /** Filestream where the generated code is written */
     std::ofstream fout_;
 
     const Quack::Program * prog_;
+    /** User specified code generation options */
+    const Options options_;
   };
 }
 
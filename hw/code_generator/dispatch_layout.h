@@ -0,0 +1,147 @@
+//
+// Layout of the shared dispatch table used instead of per class method tables.
+//
+
+#ifndef CODE_GENERATOR_DISPATCH_LAYOUT_H
+#define CODE_GENERATOR_DISPATCH_LAYOUT_H
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "quack_class.h"
+#include "quack_method.h"
+#include "code_gen_utils.h"
+
+namespace CodeGen {
+  /** Size of the method dispatch data of a program */
+  struct DispatchStats {
+    unsigned long num_classes_ = 0;
+    unsigned long num_methods_ = 0;
+    /** Number of (class, method) implementations in the rows */
+    unsigned long num_entries_ = 0;
+    /** Size of the shared table including unused slots */
+    unsigned long table_size_ = 0;
+    /** Methods with a single implementation that are called directly */
+    unsigned long num_direct_ = 0;
+    /** Pointers to methods other than Obj's the class structs would hold without the table */
+    unsigned long vtable_size_ = 0;
+  };
+
+  /**
+   * Builds the shared dispatch table by row displacement.  Every method of a user class other
+   * than those of Obj has a row holding its implementation for each class that has it.  Class
+   * ids are assigned in preorder so the row of a method introduced by a single class is a run of
+   * consecutive ids.  Rows are placed from the longest to the shortest at the first
+   * displacement where they do not overlap a placed row, so most rows end up back to back and
+   * all implementations of a method are adjacent in memory.
+   *
+   * Methods with the same implementation in every class that has them are called directly and
+   * get no row.  Obj's methods stay in the class structs since the runtime calls them through
+   * the clazz pointer of any object.
+   */
+  class DispatchLayout {
+   public:
+    /**
+     * Lays out the table.  Class ids must be assigned.
+     *
+     * @param classes User classes of the program
+     * @param table Table being built
+     */
+    void run(const std::vector<Quack::Class*> &classes, DispatchTable &table) {
+      stats_ = DispatchStats();
+      stats_.num_classes_ = classes.size();
+
+      // Implementation of each method by class id
+      std::map<std::string, std::map<int, std::string>> rows;
+      for (auto * q_class : classes) {
+        auto * gen_methods = Quack::Class::build_generated_methods(q_class);
+        for (const auto &method_info : *gen_methods) {
+          const std::string &name = method_info.second->name_;
+          if (Quack::Class::Container::Obj()->methods_->exists(name))
+            continue;
+          rows[name][q_class->class_id()] =
+              Quack::Class::generated_method_name(method_info.first, method_info.second);
+          stats_.vtable_size_++;
+        }
+      }
+
+      // Methods that are never overridden need no row
+      table.direct_methods_.clear();
+      for (auto itr = rows.begin(); itr != rows.end(); ) {
+        const std::string &first_impl = itr->second.begin()->second;
+        bool is_overridden = false;
+        for (const auto &entry : itr->second)
+          is_overridden = is_overridden || entry.second != first_impl;
+        if (is_overridden) {
+          itr++;
+          continue;
+        }
+        table.direct_methods_.insert(itr->first);
+        stats_.num_direct_++;
+        itr = rows.erase(itr);
+      }
+
+      std::vector<std::string> order;
+      for (const auto &row : rows)
+        order.emplace_back(row.first);
+      std::stable_sort(order.begin(), order.end(),
+                       [&rows](const std::string &a, const std::string &b) {
+                         return rows[a].size() > rows[b].size();
+                       });
+
+      table.displacements_.clear();
+      table.entries_.clear();
+      for (const auto &name : order) {
+        const std::map<int, std::string> &row = rows[name];
+        long displacement = find_displacement(row, table.entries_);
+        for (const auto &entry : row) {
+          unsigned long slot = static_cast<unsigned long>(entry.first + displacement);
+          if (slot >= table.entries_.size())
+            table.entries_.resize(slot + 1);
+          table.entries_[slot] = entry.second;
+        }
+        table.displacements_[name] = displacement;
+        stats_.num_entries_ += row.size();
+      }
+      stats_.num_methods_ = rows.size();
+      stats_.table_size_ = table.entries_.size();
+    }
+    /**
+     * Accessor for the size of the dispatch data.
+     *
+     * @return Statistics of the last layout
+     */
+    const DispatchStats& stats() const { return stats_; }
+
+   private:
+    /**
+     * Finds the first displacement at which a row only uses free slots.
+     *
+     * @param row Implementation of the method by class id
+     * @param entries Slots of the table placed so far
+     * @return Displacement added to a class id to get its slot
+     */
+    static long find_displacement(const std::map<int, std::string> &row,
+                                  const std::vector<std::string> &entries) {
+      for (long displacement = -row.begin()->first; ; displacement++) {
+        bool is_free = true;
+        for (const auto &entry : row) {
+          unsigned long slot = static_cast<unsigned long>(entry.first + displacement);
+          if (slot < entries.size() && !entries[slot].empty()) {
+            is_free = false;
+            break;
+          }
+        }
+        if (is_free)
+          return displacement;
+      }
+    }
+
+    DispatchStats stats_;
+  };
+}
+
+#endif //CODE_GENERATOR_DISPATCH_LAYOUT_H
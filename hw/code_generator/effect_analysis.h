@@ -0,0 +1,247 @@
+//
+// Side effect summaries of the functions in a program.  Optimizations use them to decide
+// whether a call may be reused, moved, or may invalidate values read from fields.
+//
+
+#ifndef CODE_GENERATOR_EFFECT_ANALYSIS_H
+#define CODE_GENERATOR_EFFECT_ANALYSIS_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "quack_class.h"
+#include "quack_method.h"
+#include "code_gen_utils.h"
+#include "ASTNode.h"
+
+namespace CodeGen {
+  /** Side effects of evaluating a call */
+  struct Effects {
+    /** Reads a field of an object that already existed before the call */
+    bool reads_memory_ = false;
+    /** Stores to a field of an object that already existed before the call */
+    bool writes_memory_ = false;
+    /** Prints output */
+    bool does_io_ = false;
+    /** Constructs objects of a user class so each call may return a distinct object */
+    bool allocates_ = false;
+    /** May loop forever or abort the program, e.g., with a division by zero */
+    bool may_not_return_ = false;
+    /**
+     * Adds the effects of another call.
+     *
+     * @param other Effects to add
+     */
+    void merge(const Effects &other) {
+      reads_memory_ = reads_memory_ || other.reads_memory_;
+      writes_memory_ = writes_memory_ || other.writes_memory_;
+      does_io_ = does_io_ || other.does_io_;
+      allocates_ = allocates_ || other.allocates_;
+      may_not_return_ = may_not_return_ || other.may_not_return_;
+    }
+    /**
+     * Checks whether two calls with the same arguments return equivalent values as long as no
+     * field is stored to in between.
+     */
+    bool is_pure() const { return !writes_memory_ && !does_io_ && !allocates_; }
+    /** Checks whether the call can be evaluated even where the program would not evaluate it */
+    bool is_speculatable() const { return is_pure() && !may_not_return_; }
+
+    bool operator==(const Effects &other) const {
+      return reads_memory_ == other.reads_memory_ && writes_memory_ == other.writes_memory_
+             && does_io_ == other.does_io_ && allocates_ == other.allocates_
+             && may_not_return_ == other.may_not_return_;
+    }
+    bool operator!=(const Effects &other) const { return !(*this == other); }
+  };
+
+  /**
+   * Computes the effects of every user function.  The effects of a dynamically dispatched call
+   * are those of all implementations of the method in the receiver's static type and its
+   * subclasses.  Stores a constructor makes to the fields of the object it creates are not
+   * visible to the caller so they are not counted.  Summaries are iterated to a fixed point.
+   * Since recursion may not terminate, every function starts out as possibly not returning.
+   */
+  class EffectAnalysis {
+   public:
+    /**
+     * @param main Method containing the body of the Quack main
+     */
+    explicit EffectAnalysis(Quack::Method * main) : main_(main) {}
+    /**
+     * Summarizes every function in the program.
+     *
+     * @param classes User classes of the program
+     */
+    void run(const std::vector<Quack::Class*> &classes) {
+      std::vector<std::pair<Quack::Method*, bool>> funcs;
+      for (auto * q_class : classes) {
+        funcs.emplace_back(q_class->get_constructor(), true);
+        for (auto &method_pair : *q_class->methods_)
+          funcs.emplace_back(method_pair.second, false);
+      }
+      funcs.emplace_back(main_, false);
+      for (auto &func : funcs)
+        summaries_[func.first].may_not_return_ = true;
+
+      bool changed;
+      do {
+        changed = false;
+        for (auto &func : funcs) {
+          cur_ = Effects();
+          is_constructor_ = func.second;
+          walk(func.first->block_);
+
+          // Effects only grow while a function can only be found to return
+          Effects &summary = summaries_[func.first];
+          bool may_not_return = cur_.may_not_return_ && summary.may_not_return_;
+          cur_.merge(summary);
+          cur_.may_not_return_ = may_not_return;
+          if (cur_ != summary) {
+            summary = cur_;
+            changed = true;
+          }
+        }
+      } while (changed);
+    }
+    /**
+     * Combined effects of all implementations that a method call may dispatch to.
+     *
+     * @param static_type Static type of the receiver
+     * @param method_name Name of the method
+     * @return Effects of the call
+     */
+    Effects call_effects(Quack::Class * static_type, const std::string &method_name) const {
+      Effects combined;
+      for (auto &class_pair : *Quack::Class::Container::singleton()) {
+        Quack::Class * q_class = class_pair.second;
+        if (!q_class->is_subtype(static_type))
+          continue;
+
+        auto impl = q_class->generated_method(method_name);
+        if (impl.first->is_user_class()) {
+          combined.merge(summary_of(impl.second));
+        } else if (method_name == METHOD_PRINT) {
+          // The runtime's PRINT calls the receiver's STR
+          combined.does_io_ = true;
+          combined.merge(call_effects(q_class, METHOD_STR));
+        } else if (impl.first == Quack::Class::Container::Int() && method_name == METHOD_DIVIDE) {
+          combined.may_not_return_ = true;
+        }
+      }
+      return combined;
+    }
+    /**
+     * Effects of calling a class's constructor.
+     *
+     * @param q_class Class constructed
+     * @return Effects of the constructor call
+     */
+    Effects constructor_effects(Quack::Class * q_class) const {
+      Effects effects;
+      if (q_class->is_user_class())
+        effects = summary_of(q_class->get_constructor());
+      effects.allocates_ = true;
+      return effects;
+    }
+
+   private:
+    /**
+     * Accessor for the summary of a function.
+     *
+     * @param func User function
+     * @return Summary of the function.  Functions not yet analyzed may not return.
+     */
+    Effects summary_of(const Quack::Method * func) const {
+      auto itr = summaries_.find(func);
+      if (itr != summaries_.end())
+        return itr->second;
+      Effects effects;
+      effects.may_not_return_ = true;
+      return effects;
+    }
+    /**
+     * Visits all statements in a block.
+     *
+     * @param block Block to visit
+     */
+    void walk(const AST::Block * block) {
+      if (!block)
+        return;
+      for (auto * stmt : block->stmts_)
+        walk(stmt);
+    }
+    /**
+     * Adds the effects of a statement or expression and all of its subexpressions.
+     *
+     * @param node Node to visit
+     */
+    void walk(const AST::ASTNode * node) {
+      if (!node)
+        return;
+
+      if (auto * if_node = dynamic_cast<const AST::If*>(node)) {
+        walk(if_node->cond_);
+        walk(if_node->truepart_);
+        walk(if_node->falsepart_);
+      } else if (auto * while_node = dynamic_cast<const AST::While*>(node)) {
+        cur_.may_not_return_ = true;
+        walk(while_node->cond_);
+        walk(while_node->body_);
+      } else if (auto * ret = dynamic_cast<const AST::Return*>(node)) {
+        walk(ret->right_);
+      } else if (auto * assn = dynamic_cast<const AST::Assn*>(node)) {
+        walk(assn->rhs_);
+        auto * field = dynamic_cast<const AST::ObjectCall*>(assn->lhs_->expr_);
+        if (!field)
+          return;
+        walk(field->object_);
+        auto * obj = dynamic_cast<const AST::Ident*>(field->object_);
+        if (!is_constructor_ || !obj || obj->text_ != OBJECT_SELF)
+          cur_.writes_memory_ = true;
+      } else if (auto * tc = dynamic_cast<const AST::Typecase*>(node)) {
+        walk(tc->expr_);
+        for (auto * alt : *tc->alts_)
+          walk(alt->block_);
+      } else if (auto * obj_call = dynamic_cast<const AST::ObjectCall*>(node)) {
+        walk(obj_call->object_);
+        if (auto * func_call = dynamic_cast<const AST::FunctionCall*>(obj_call->next_)) {
+          walk(func_call->args_);
+          cur_.merge(call_effects(obj_call->object_->get_node_type(), func_call->ident_));
+        } else {
+          cur_.reads_memory_ = true;
+        }
+      } else if (auto * bool_op = dynamic_cast<const AST::BoolOp*>(node)) {
+        walk(bool_op->left_);
+        walk(bool_op->right_);
+      } else if (auto * bin_op = dynamic_cast<const AST::BinOp*>(node)) {
+        walk(bin_op->left_);
+        walk(bin_op->right_);
+        cur_.merge(call_effects(bin_op->left_->get_node_type(),
+                                AST::BinOp::op_lookup(bin_op->opsym)));
+      } else if (auto * uni_op = dynamic_cast<const AST::UniOp*>(node)) {
+        walk(uni_op->right_);
+      } else if (auto * func_call = dynamic_cast<const AST::FunctionCall*>(node)) {
+        // Outside of an ObjectCall, a function call is always a constructor call
+        walk(func_call->args_);
+        cur_.merge(constructor_effects(Quack::Class::Container::singleton()->get(func_call->ident_)));
+      } else if (auto * args = dynamic_cast<const AST::RhsArgs*>(node)) {
+        for (auto * arg : args->args_)
+          walk(arg);
+      } else if (auto * typing = dynamic_cast<const AST::Typing*>(node)) {
+        walk(typing->expr_);
+      }
+    }
+
+    Quack::Method * main_;
+    /** Effects of every user function */
+    std::map<const Quack::Method*, Effects> summaries_;
+
+    // State of the function currently being analyzed
+    Effects cur_;
+    bool is_constructor_ = false;
+  };
+}
+
+#endif //CODE_GENERATOR_EFFECT_ANALYSIS_H
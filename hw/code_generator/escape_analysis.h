@@ -0,0 +1,413 @@
+//
+// Escape analysis of objects created by constructor calls.  Objects that are proven never to
+// outlive the function that creates them are allocated in that function's C stack frame.
+//
+
+#ifndef CODE_GENERATOR_ESCAPE_ANALYSIS_H
+#define CODE_GENERATOR_ESCAPE_ANALYSIS_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "quack_class.h"
+#include "quack_method.h"
+#include "code_gen_utils.h"
+#include "ASTNode.h"
+
+namespace CodeGen {
+  /** Number of constructor calls in a function and how many of them are stack allocated */
+  struct EscapeStats {
+    std::string method_name_;
+    unsigned long sites_;
+    unsigned long stack_;
+  };
+
+  /**
+   * Flow insensitive escape analysis.  Within a function, every local tracks the set of values
+   * (constructor call sites, parameters, and this) it may hold.  A value escapes if it is returned,
+   * stored in a field, or passed to a callee that lets the corresponding parameter escape.  The
+   * callees of a dynamically dispatched call are all implementations of the method in the
+   * receiver's static type and its subclasses.  Parameter summaries are iterated to a fixed point.
+   */
+  class EscapeAnalysis {
+   public:
+    /**
+     * @param main Method containing the body of the Quack main
+     */
+    explicit EscapeAnalysis(Quack::Method * main) : main_(main) {}
+    /**
+     * Analyzes the entire program and selects the constructor calls whose objects can be
+     * allocated on the stack.
+     *
+     * @param classes User classes of the program
+     * @param tail_calls Self tail calls that reuse the caller's stack frame
+     * @param allocs Stack allocated objects found by the analysis
+     */
+    void run(const std::vector<Quack::Class*> &classes, const TailCalls &tail_calls,
+             StackAllocs &allocs) {
+      tail_calls_ = &tail_calls;
+      std::vector<Quack::Method*> funcs;
+      for (auto * q_class : classes) {
+        funcs.emplace_back(q_class->get_constructor());
+        for (auto &method_pair : *q_class->methods_)
+          funcs.emplace_back(method_pair.second);
+      }
+      funcs.emplace_back(main_);
+
+      // Parameters only ever go from not escaping to escaping so this terminates
+      do {
+        changed_ = false;
+        for (auto * func : funcs)
+          analyze(func, nullptr);
+      } while (changed_);
+
+      stats_.clear();
+      for (auto * q_class : classes) {
+        analyze(q_class->get_constructor(), &allocs);
+        record_stats(q_class->generated_constructor_name(), q_class->get_constructor(), allocs);
+        for (auto &method_pair : *q_class->methods_) {
+          analyze(method_pair.second, &allocs);
+          record_stats(Quack::Class::generated_method_name(q_class, method_pair.second),
+                       method_pair.second, allocs);
+        }
+      }
+      analyze(main_, &allocs);
+      record_stats(METHOD_MAIN, main_, allocs);
+    }
+    /**
+     * Accessor for the per function allocation statistics.
+     *
+     * @return Statistics for each function in the order they were analyzed
+     */
+    const std::vector<EscapeStats>& stats() const { return stats_; }
+
+   private:
+    /** Values a local may hold */
+    struct Values {
+      std::set<const AST::FunctionCall*> sites_;
+      /** Parameter names including this */
+      std::set<std::string> params_;
+
+      bool merge(const Values &other) {
+        unsigned long size = sites_.size() + params_.size();
+        sites_.insert(other.sites_.begin(), other.sites_.end());
+        params_.insert(other.params_.begin(), other.params_.end());
+        return size != sites_.size() + params_.size();
+      }
+
+      void clear() {
+        sites_.clear();
+        params_.clear();
+      }
+    };
+    /** Parameters (and this) of a function that escape */
+    struct Summary {
+      bool this_ = false;
+      std::vector<bool> params_;
+    };
+    /**
+     * Analyzes a single function.  Its parameter summary is updated.
+     *
+     * @param func Function to analyze
+     * @param allocs If not null, the stack allocated calls in the function are added
+     */
+    void analyze(Quack::Method * func, StackAllocs * allocs) {
+      locals_.clear();
+      escaped_.clear();
+      site_in_loop_.clear();
+      loop_depth_ = 0;
+
+      locals_[OBJECT_SELF].params_.insert(OBJECT_SELF);
+      for (auto * param : *func->params_)
+        locals_[param->name_].params_.insert(param->name_);
+
+      // Propagate values through the assignments to locals
+      do {
+        locals_changed_ = false;
+        walk(func->block_, false);
+      } while (locals_changed_);
+      walk(func->block_, true);
+
+      Summary &summary = summary_of(func);
+      if (escaped_.params_.count(OBJECT_SELF) && !summary.this_)
+        changed_ = summary.this_ = true;
+      for (unsigned i = 0; i < func->params_->count(); i++) {
+        if (escaped_.params_.count((*func->params_)[i]->name_) && !summary.params_[i])
+          changed_ = summary.params_[i] = true;
+      }
+
+      if (!allocs)
+        return;
+      std::set<const AST::FunctionCall*> stored;
+      for (auto &local : locals_)
+        stored.insert(local.second.sites_.begin(), local.second.sites_.end());
+      for (auto &site_info : site_in_loop_) {
+        const AST::FunctionCall * site = site_info.first;
+        // A stored object created in a loop could still be referenced in the next iteration
+        if (escaped_.sites_.count(site) || (site_info.second && stored.count(site)))
+          continue;
+        std::string var = STACK_OBJ_HEADER + std::to_string(allocs->vars_.size());
+        allocs->vars_[site] = var;
+        allocs->decls_[func].emplace_back(var, constructed_class(site));
+      }
+    }
+    /**
+     * Visits all statements in a block.
+     *
+     * @param block Block to visit
+     * @param mark_escapes If true, escaping values are recorded.  Otherwise only the values of
+     *                     locals are propagated.
+     */
+    void walk(const AST::Block * block, bool mark_escapes) {
+      if (!block)
+        return;
+      for (auto * stmt : block->stmts_)
+        walk(stmt, mark_escapes);
+    }
+    /**
+     * Visits a statement or expression and all of its subexpressions.
+     *
+     * @param node Node to visit
+     * @param mark_escapes If true, escaping values are recorded
+     */
+    void walk(const AST::ASTNode * node, bool mark_escapes) {
+      if (!node)
+        return;
+
+      if (auto * if_node = dynamic_cast<const AST::If*>(node)) {
+        walk(if_node->cond_, mark_escapes);
+        walk(if_node->truepart_, mark_escapes);
+        walk(if_node->falsepart_, mark_escapes);
+      } else if (auto * while_node = dynamic_cast<const AST::While*>(node)) {
+        loop_depth_++;
+        walk(while_node->cond_, mark_escapes);
+        walk(while_node->body_, mark_escapes);
+        loop_depth_--;
+      } else if (auto * ret = dynamic_cast<const AST::Return*>(node)) {
+        walk(ret->right_, mark_escapes);
+        if (mark_escapes)
+          escape(values(ret->right_));
+        // A self tail call runs the function again in the same frame where the objects this
+        // call created are built anew while the parameters may still reference them
+        auto itr = tail_calls_->calls_.find(ret);
+        if (mark_escapes && itr != tail_calls_->calls_.end()) {
+          escape_sites(itr->second->object_);
+          auto * func_call = dynamic_cast<const AST::FunctionCall*>(itr->second->next_);
+          for (auto * arg : func_call->args_->args_)
+            escape_sites(arg);
+        }
+      } else if (auto * assn = dynamic_cast<const AST::Assn*>(node)) {
+        walk(assn->rhs_, mark_escapes);
+        if (auto * ident = dynamic_cast<const AST::Ident*>(assn->lhs_->expr_)) {
+          assign(ident->text_, values(assn->rhs_));
+        } else {
+          // Stores to a field make the value reachable from another object
+          walk(assn->lhs_->expr_, mark_escapes);
+          if (mark_escapes)
+            escape(values(assn->rhs_));
+        }
+      } else if (auto * tc = dynamic_cast<const AST::Typecase*>(node)) {
+        walk(tc->expr_, mark_escapes);
+        for (auto * alt : *tc->alts_) {
+          assign(alt->type_names_[0], values(tc->expr_));
+          walk(alt->block_, mark_escapes);
+        }
+      } else if (auto * obj_call = dynamic_cast<const AST::ObjectCall*>(node)) {
+        walk(obj_call->object_, mark_escapes);
+        auto * func_call = dynamic_cast<const AST::FunctionCall*>(obj_call->next_);
+        if (!func_call)
+          return;
+        walk(func_call->args_, mark_escapes);
+        if (mark_escapes)
+          escape_call(obj_call->object_, func_call->ident_, func_call->args_->args_);
+      } else if (auto * bool_op = dynamic_cast<const AST::BoolOp*>(node)) {
+        walk(bool_op->left_, mark_escapes);
+        walk(bool_op->right_, mark_escapes);
+      } else if (auto * bin_op = dynamic_cast<const AST::BinOp*>(node)) {
+        walk(bin_op->left_, mark_escapes);
+        walk(bin_op->right_, mark_escapes);
+        if (mark_escapes)
+          escape_call(bin_op->left_, AST::BinOp::op_lookup(bin_op->opsym), {bin_op->right_});
+      } else if (auto * uni_op = dynamic_cast<const AST::UniOp*>(node)) {
+        walk(uni_op->right_, mark_escapes);
+      } else if (auto * func_call = dynamic_cast<const AST::FunctionCall*>(node)) {
+        // Outside of an ObjectCall, a function call is always a constructor call
+        walk(func_call->args_, mark_escapes);
+        if (!constructed_class(func_call)->is_user_class())
+          return;
+        if (mark_escapes) {
+          site_in_loop_[func_call] = loop_depth_ > 0;
+          Summary &summary = summary_of(constructed_class(func_call)->get_constructor());
+          if (summary.this_)
+            escape(values(func_call));
+          escape_args(summary, func_call->args_->args_);
+        }
+      } else if (auto * args = dynamic_cast<const AST::RhsArgs*>(node)) {
+        for (auto * arg : args->args_)
+          walk(arg, mark_escapes);
+      } else if (auto * typing = dynamic_cast<const AST::Typing*>(node)) {
+        walk(typing->expr_, mark_escapes);
+      }
+    }
+    /**
+     * Values an expression may evaluate to.  Method results and field reads are never
+     * stack allocated objects of this function since those would have escaped.
+     *
+     * @param node Expression
+     * @return Values of the expression
+     */
+    Values values(const AST::ASTNode * node) {
+      if (auto * typing = dynamic_cast<const AST::Typing*>(node))
+        return values(typing->expr_);
+      if (auto * ident = dynamic_cast<const AST::Ident*>(node))
+        return locals_[ident->text_];
+
+      Values vals;
+      if (auto * func_call = dynamic_cast<const AST::FunctionCall*>(node))
+        vals.sites_.insert(func_call);
+      return vals;
+    }
+    /**
+     * Adds values to those a local may hold.
+     *
+     * @param name Name of the local
+     * @param vals Values assigned to the local
+     */
+    void assign(const std::string &name, const Values &vals) {
+      if (locals_[name].merge(vals))
+        locals_changed_ = true;
+    }
+    /**
+     * Marks values as escaping.
+     *
+     * @param vals Values that escape
+     */
+    void escape(const Values &vals) { escaped_.merge(vals); }
+    /**
+     * Marks the objects created by this function that an expression may evaluate to as
+     * escaping.  Parameters are not affected.
+     *
+     * @param node Expression
+     */
+    void escape_sites(const AST::ASTNode * node) {
+      Values vals = values(node);
+      vals.params_.clear();
+      escape(vals);
+    }
+    /**
+     * Marks the receiver and arguments of a dynamically dispatched call that escape in any of
+     * the possible callees.
+     *
+     * @param receiver Receiver of the call
+     * @param method_name Name of the method called
+     * @param args Arguments of the call
+     */
+    void escape_call(const AST::ASTNode * receiver, const std::string &method_name,
+                     const std::vector<AST::ASTNode*> &args) {
+      Summary summary = call_summary(receiver->get_node_type(), method_name, args.size());
+      if (summary.this_)
+        escape(values(receiver));
+      escape_args(summary, args);
+    }
+    /**
+     * Marks the arguments of a call whose parameters escape.
+     *
+     * @param summary Summary of the callee
+     * @param args Arguments of the call
+     */
+    void escape_args(const Summary &summary, const std::vector<AST::ASTNode*> &args) {
+      for (unsigned i = 0; i < args.size() && i < summary.params_.size(); i++)
+        if (summary.params_[i])
+          escape(values(args[i]));
+    }
+    /**
+     * Combined summary of all implementations of a method that a call may dispatch to.
+     *
+     * @param static_type Static type of the receiver
+     * @param method_name Name of the method
+     * @param num_args Number of arguments of the call
+     * @return Summary where a parameter escapes if it escapes in any possible callee
+     */
+    Summary call_summary(Quack::Class * static_type, const std::string &method_name,
+                         unsigned long num_args) {
+      Summary combined;
+      combined.params_.assign(num_args, false);
+      for (auto &class_pair : *Quack::Class::Container::singleton()) {
+        Quack::Class * q_class = class_pair.second;
+        if (!q_class->is_subtype(static_type))
+          continue;
+
+        auto impl = q_class->generated_method(method_name);
+        if (!impl.first->is_user_class()) {
+          // The runtime's PRINT calls the receiver's STR.  No other builtin retains its arguments.
+          if (method_name == METHOD_PRINT)
+            combined.this_ = combined.this_ || call_summary(q_class, METHOD_STR, 0).this_;
+          continue;
+        }
+        Summary &summary = summary_of(impl.second);
+        combined.this_ = combined.this_ || summary.this_;
+        for (unsigned long i = 0; i < num_args && i < summary.params_.size(); i++)
+          combined.params_[i] = combined.params_[i] || summary.params_[i];
+      }
+      return combined;
+    }
+    /**
+     * Accessor for the summary of a function.  Summaries start with nothing escaping.
+     *
+     * @param func User function
+     * @return Summary of the function
+     */
+    Summary& summary_of(const Quack::Method * func) {
+      auto itr = summaries_.find(func);
+      if (itr != summaries_.end())
+        return itr->second;
+      Summary &summary = summaries_[func];
+      summary.params_.assign(func->params_->count(), false);
+      return summary;
+    }
+    /**
+     * Class whose constructor is called.
+     *
+     * @param site Constructor call
+     * @return Class constructed
+     */
+    static Quack::Class * constructed_class(const AST::FunctionCall * site) {
+      return Quack::Class::Container::singleton()->get(site->ident_);
+    }
+    /**
+     * Records the number of constructor calls and stack allocations in a function.
+     *
+     * @param name Name of the generated function
+     * @param func Function analyzed
+     * @param allocs Stack allocated objects
+     */
+    void record_stats(const std::string &name, const Quack::Method * func,
+                      const StackAllocs &allocs) {
+      auto itr = allocs.decls_.find(func);
+      unsigned long num_stack = (itr == allocs.decls_.end()) ? 0 : itr->second.size();
+      stats_.push_back({name, site_in_loop_.size(), num_stack});
+    }
+
+    Quack::Method * main_;
+    /** Self tail calls of the program */
+    const TailCalls * tail_calls_ = nullptr;
+    /** Escape summary of every user function */
+    std::map<const Quack::Method*, Summary> summaries_;
+    /** True if any summary changed in the current iteration */
+    bool changed_ = false;
+    /** Statistics of each function */
+    std::vector<EscapeStats> stats_;
+
+    // State of the function currently being analyzed
+    std::map<std::string, Values> locals_;
+    bool locals_changed_ = false;
+    Values escaped_;
+    /** Constructor calls of user classes in the function and whether each is inside a loop */
+    std::map<const AST::FunctionCall*, bool> site_in_loop_;
+    unsigned loop_depth_ = 0;
+  };
+}
+
+#endif //CODE_GENERATOR_ESCAPE_ANALYSIS_H
@@ -0,0 +1,311 @@
+//
+// Layout of the fields in the object structs.  Fields that are accessed most often are placed
+// first so they share cache lines with the clazz pointer, and native fields are packed to avoid
+// padding.
+//
+
+#ifndef CODE_GENERATOR_FIELD_LAYOUT_H
+#define CODE_GENERATOR_FIELD_LAYOUT_H
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "quack_class.h"
+#include "quack_method.h"
+#include "code_gen_utils.h"
+#include "profile_analysis.h"
+#include "ASTNode.h"
+
+/** Estimated number of iterations of a loop when no profile is used */
+#define FIELD_LOOP_WEIGHT 10
+/** Loop nesting depth after which accesses are not weighted any higher */
+#define FIELD_MAX_LOOP_DEPTH 6
+/** Percentage of the accesses of the hottest new field of a class needed to be laid out first */
+#define FIELD_HOT_PERCENT 25
+
+namespace CodeGen {
+  /** Object struct size of a class */
+  struct FieldLayoutStats {
+    std::string class_name_;
+    unsigned long num_fields_;
+    /** Size in bytes with the chosen layout */
+    unsigned long size_;
+    /** Size in bytes with the fields in alphabetical order */
+    unsigned long default_size_;
+  };
+
+  /**
+   * Orders the fields of every user class.  A subclass's struct must start with the fields of
+   * its super class in the same order so only the fields a class adds are reordered.  They are
+   * split into hot fields (accessed at least FIELD_HOT_PERCENT as often as the class's hottest
+   * new field) and cold fields.  Each group is ordered by decreasing size so that native int and
+   * bool fields are packed together, then by decreasing number of accesses.
+   *
+   * The number of accesses is estimated from the field reads and stores in the program.  Each
+   * access counts once per call of its function and FIELD_LOOP_WEIGHT times more per enclosing
+   * loop.  With a profile, the measured number of calls and loop iterations are used instead.
+   */
+  class FieldLayout {
+   public:
+    /**
+     * @param main Method containing the body of the Quack main
+     */
+    explicit FieldLayout(Quack::Method * main) : main_(main) {}
+    /**
+     * Lays out the fields of all user classes.  It must run before any object struct or field
+     * offset is generated.
+     *
+     * @param classes User classes of the program sorted with super classes first
+     * @param profile Profile analysis with the counts read or nullptr if no profile is used
+     * @param is_packed True if Int and Boolean fields may be stored natively
+     */
+    void run(const std::vector<Quack::Class*> &classes, const ProfileAnalysis * profile,
+             bool is_packed) {
+      profile_ = profile && profile->has_counts() ? profile : nullptr;
+      is_packed_ = is_packed;
+      heat_.clear();
+      default_sizes_.clear();
+      stats_.clear();
+
+      for (auto * q_class : classes) {
+        count_function(q_class->get_constructor());
+        for (auto &method_pair : *q_class->methods_)
+          count_function(method_pair.second);
+      }
+      count_function(main_);
+
+      for (auto * q_class : classes)
+        layout(q_class);
+    }
+    /**
+     * Accessor for the object sizes of the classes.
+     *
+     * @return Statistics for each class in the order they were laid out
+     */
+    const std::vector<FieldLayoutStats>& stats() const { return stats_; }
+
+   private:
+    /**
+     * Counts the field accesses of a function.
+     *
+     * @param func Function
+     */
+    void count_function(const Quack::Method * func) {
+      weight_ = profile_ ? profile_->count(func) : 1;
+      depth_ = 0;
+      walk(func->block_);
+    }
+    /**
+     * Visits all statements in a block.
+     *
+     * @param block Block to visit
+     */
+    void walk(const AST::Block * block) {
+      if (!block)
+        return;
+      for (auto * stmt : block->stmts_)
+        walk(stmt);
+    }
+    /**
+     * Counts the field accesses of a statement or expression and all of its subexpressions.
+     *
+     * @param node Node to visit
+     */
+    void walk(const AST::ASTNode * node) {
+      if (!node)
+        return;
+
+      if (auto * if_node = dynamic_cast<const AST::If*>(node)) {
+        walk(if_node->cond_);
+        walk(if_node->truepart_);
+        walk(if_node->falsepart_);
+      } else if (auto * while_node = dynamic_cast<const AST::While*>(node)) {
+        unsigned long outer_weight = weight_;
+        if (profile_) {
+          weight_ = profile_->count(while_node, 1);
+        } else if (depth_ < FIELD_MAX_LOOP_DEPTH) {
+          weight_ *= FIELD_LOOP_WEIGHT;
+        }
+        depth_++;
+        walk(while_node->cond_);
+        walk(while_node->body_);
+        depth_--;
+        weight_ = outer_weight;
+      } else if (auto * ret = dynamic_cast<const AST::Return*>(node)) {
+        walk(ret->right_);
+      } else if (auto * assn = dynamic_cast<const AST::Assn*>(node)) {
+        walk(assn->rhs_);
+        walk(assn->lhs_);
+      } else if (auto * tc = dynamic_cast<const AST::Typecase*>(node)) {
+        walk(tc->expr_);
+        for (auto * alt : *tc->alts_)
+          walk(alt->block_);
+      } else if (auto * obj_call = dynamic_cast<const AST::ObjectCall*>(node)) {
+        walk(obj_call->object_);
+        if (auto * func_call = dynamic_cast<const AST::FunctionCall*>(obj_call->next_)) {
+          walk(func_call->args_);
+        } else if (auto * field = dynamic_cast<const AST::Ident*>(obj_call->next_)) {
+          add_access(obj_call->object_->get_node_type(), field->text_);
+        }
+      } else if (auto * bool_op = dynamic_cast<const AST::BoolOp*>(node)) {
+        walk(bool_op->left_);
+        walk(bool_op->right_);
+      } else if (auto * bin_op = dynamic_cast<const AST::BinOp*>(node)) {
+        walk(bin_op->left_);
+        walk(bin_op->right_);
+      } else if (auto * uni_op = dynamic_cast<const AST::UniOp*>(node)) {
+        walk(uni_op->right_);
+      } else if (auto * func_call = dynamic_cast<const AST::FunctionCall*>(node)) {
+        walk(func_call->args_);
+      } else if (auto * args = dynamic_cast<const AST::RhsArgs*>(node)) {
+        for (auto * arg : args->args_)
+          walk(arg);
+      } else if (auto * typing = dynamic_cast<const AST::Typing*>(node)) {
+        walk(typing->expr_);
+      }
+    }
+    /**
+     * Adds an access to the class that first declares the field.  That class decides the
+     * field's position in its own struct and in the structs of all of its subclasses.
+     *
+     * @param q_class Static type of the object whose field is accessed
+     * @param field_name Name of the field
+     */
+    void add_access(Quack::Class * q_class, const std::string &field_name) {
+      if (!q_class->has_field(field_name))
+        return;
+      while (q_class->super_ && q_class->super_->has_field(field_name))
+        q_class = q_class->super_;
+      heat_[q_class][field_name] += weight_;
+    }
+    /**
+     * Orders the fields a class adds to those of its super class.
+     *
+     * @param q_class User class whose super class is already laid out
+     */
+    void layout(Quack::Class * q_class) {
+      assert(!q_class->gen_fields_);
+      auto * gen_fields = Quack::Class::build_generated_fields(q_class);
+      auto first = gen_fields->begin() + q_class->super_->gen_fields_->size();
+      // The new fields start out in alphabetical order
+      std::vector<unsigned long> &default_sizes = default_sizes_[q_class];
+      default_sizes = default_sizes_[q_class->super_];
+      for (auto itr = first; itr != gen_fields->end(); itr++)
+        default_sizes.emplace_back(field_size(q_class, itr->second));
+
+      std::map<std::string, unsigned long> &heat = heat_[q_class];
+      unsigned long max_heat = 0;
+      for (auto itr = first; itr != gen_fields->end(); itr++)
+        max_heat = std::max(max_heat, heat[itr->second->name_]);
+
+      auto is_hot = [&](const std::pair<Quack::Class*, Quack::Field*> &field_info) {
+        unsigned long field_heat = heat[field_info.second->name_];
+        return field_heat > 0 && field_heat * 100 >= max_heat * FIELD_HOT_PERCENT;
+      };
+      // Names break ties since the new fields start out in alphabetical order
+      std::stable_sort(first, gen_fields->end(),
+                       [&](const std::pair<Quack::Class*, Quack::Field*> &a,
+                           const std::pair<Quack::Class*, Quack::Field*> &b) {
+                         if (is_hot(a) != is_hot(b))
+                           return is_hot(a);
+                         unsigned long a_size = field_size(q_class, a.second);
+                         unsigned long b_size = field_size(q_class, b.second);
+                         if (a_size != b_size)
+                           return a_size > b_size;
+                         return heat[a.second->name_] > heat[b.second->name_];
+                       });
+      fill_padding(q_class, *gen_fields, q_class->super_->gen_fields_->size());
+
+      std::vector<unsigned long> sizes;
+      for (const auto &field_info : *gen_fields)
+        sizes.emplace_back(field_size(q_class, field_info.second));
+      stats_.push_back({q_class->name_, gen_fields->size(), struct_size(sizes),
+                        struct_size(default_sizes)});
+    }
+    /**
+     * Moves a smaller field forward into the padding the C compiler would insert before a
+     * larger one.  Fields otherwise keep their order.
+     *
+     * @param q_class Class whose struct holds the fields
+     * @param gen_fields Fields of the class in order
+     * @param first Position of the first field the class adds
+     */
+    void fill_padding(Quack::Class * q_class,
+                      Quack::Class::GenObjContainer<Quack::Field> &gen_fields,
+                      unsigned long first) {
+      unsigned long offset = sizeof(void*);
+      for (unsigned long i = 0; i < gen_fields.size(); i++) {
+        unsigned long size = field_size(q_class, gen_fields[i].second);
+        for (unsigned long j = i + 1; i >= first && j < gen_fields.size(); j++) {
+          if (offset % size == 0)
+            break;
+          unsigned long filler_size = field_size(q_class, gen_fields[j].second);
+          if (filler_size >= size || offset % filler_size != 0)
+            continue;
+          auto filler = gen_fields.begin() + j;
+          std::rotate(gen_fields.begin() + i, filler, filler + 1);
+          offset += filler_size;
+          i++;
+        }
+        offset = field_end(offset, size);
+      }
+    }
+    /**
+     * Size of a field in the object struct.  Alignment equals size for all field types.
+     *
+     * @param q_class Class whose struct holds the field
+     * @param field Field
+     * @return Size in bytes
+     */
+    unsigned long field_size(Quack::Class * q_class, Quack::Field * field) const {
+      Quack::Class * unboxed_type = nullptr;
+      if (is_packed_)
+        unboxed_type = q_class->unboxed_field_type(field->name_);
+      if (unboxed_type == Quack::Class::Container::Int())
+        return sizeof(int);
+      if (unboxed_type == Quack::Class::Container::Bool())
+        return sizeof(bool);
+      return sizeof(void*);
+    }
+    /**
+     * Size of an object struct as laid out by the C compiler.
+     *
+     * @param sizes Size of each field in order
+     * @return Size in bytes of the clazz pointer followed by the fields and the tail padding
+     */
+    static unsigned long struct_size(const std::vector<unsigned long> &sizes) {
+      unsigned long size = sizeof(void*);
+      for (unsigned long field_size : sizes)
+        size = field_end(size, field_size);
+      return (size + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*);
+    }
+    /**
+     * Offset after a field placed as the C compiler does.
+     *
+     * @param offset Offset after the previous field
+     * @param size Size of the field
+     * @return Offset after the field
+     */
+    static unsigned long field_end(unsigned long offset, unsigned long size) {
+      return (offset + size - 1) / size * size + size;
+    }
+
+    Quack::Method * main_;
+    const ProfileAnalysis * profile_ = nullptr;
+    bool is_packed_ = false;
+    /** Number of accesses of each field by the class that declares it first */
+    std::map<Quack::Class*, std::map<std::string, unsigned long>> heat_;
+    /** Size of each field of a class if all classes kept the fields in alphabetical order */
+    std::map<Quack::Class*, std::vector<unsigned long>> default_sizes_;
+    /** Object size of each class */
+    std::vector<FieldLayoutStats> stats_;
+
+    // State of the function currently being counted
+    unsigned long weight_ = 1;
+    unsigned long depth_ = 0;
+  };
+}
+
+#endif //CODE_GENERATOR_FIELD_LAYOUT_H
@@ -0,0 +1,70 @@
+//
+// Inline caches of the dynamically dispatched call sites of a program.  Each site has a
+// statically allocated cache of the implementations it called for the last few receiver
+// classes so a call on a class seen before skips the method table.
+//
+
+#ifndef CODE_GENERATOR_INLINE_CACHE_POOL_H
+#define CODE_GENERATOR_INLINE_CACHE_POOL_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "keywords.h"
+
+namespace CodeGen {
+  class InlineCachePool {
+   public:
+    /**
+     * Adds the cache of a call site.  Sites are numbered in the order they are added within
+     * each generated function.
+     *
+     * @param func_name Name of the generated function containing the site
+     * @param method_name Name of the called method
+     * @return Expression for the address of the cache
+     */
+    std::string add_site(const std::string &func_name, const std::string &method_name) {
+      if (func_name != func_name_) {
+        func_name_ = func_name;
+        num_func_sites_ = 0;
+      }
+      sites_.emplace_back(func_name + " site" + std::to_string(num_func_sites_++) + " "
+                          + method_name);
+      return "&" INLINE_CACHES_VAR "[" + std::to_string(sites_.size() - 1) + "]";
+    }
+    /**
+     * Accessor for the number of call sites with a cache.
+     *
+     * @return Number of caches
+     */
+    unsigned long size() const { return sites_.size(); }
+    /**
+     * Writes the caches.  They only depend on the runtime so they can be placed directly after
+     * the includes.
+     *
+     * @param out Output stream
+     */
+    void generate_code(std::ostream &out) const {
+      if (sites_.empty())
+        return;
+
+      out << "/* Receiver classes and implementations seen at each dynamically dispatched call */\n"
+          << "static struct " INLINE_CACHE_STRUCT " " INLINE_CACHES_VAR "[" << sites_.size()
+          << "] = {\n";
+      for (const auto &site : sites_)
+        out << "\t{ \"" << site << "\" },\n";
+      out << "};\n\n";
+    }
+
+   private:
+    /** Description of each call site in the order the caches were added */
+    std::vector<std::string> sites_;
+
+    // Function whose sites are currently being added
+    std::string func_name_;
+    unsigned long num_func_sites_ = 0;
+  };
+}
+
+#endif //CODE_GENERATOR_INLINE_CACHE_POOL_H
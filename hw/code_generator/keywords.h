@@ -56,6 +56,43 @@
 //#define STRUCT_TYPE_SUFFIX "_struct"
 #define GENERATED_CLASS_FIELD "clazz"
 #define TEMP_VAR_HEADER "__temp_var_"
+#define STACK_OBJ_HEADER "__stack_obj_"
+#define COUNTER_VAR_HEADER "__counter_"
+#define BOUND_VAR_HEADER "__bound_"
+#define VALUE_VAR_HEADER "__value_"
+#define TAIL_CALL_LABEL "__tail_call_entry"
+#define PROFILE_COUNTS_VAR "__profile_counts"
+#define PROFILE_NAMES_VAR "__profile_names"
+#define PROFILE_START_FUNC "quack_profile_start"
+#define PROFILE_FILE_EXT ".qprof"
+#define DISPATCH_TABLE_VAR "quack_dispatch"
+#define INLINE_CACHES_VAR "__inline_caches"
+#define INLINE_CACHE_STRUCT "quack_ic"
+#define INLINE_CACHE_FN_TYPE "quack_fn"
+#define INLINE_CACHE_LOOKUP_FUNC "quack_ic_lookup"
+#define INLINE_CACHE_MISS_FUNC "quack_ic_miss"
+#define INLINE_CACHE_START_FUNC "quack_ic_start"
+#define ALLOC_FUNC "quack_alloc"
+#define ALLOC_OBJECT_FUNC "quack_alloc_object"
+#define ALLOC_START_FUNC "quack_alloc_start"
+#define GC_FRAME_STRUCT "quack_gc_frame"
+#define GC_ROOT_TYPE "obj_Obj"
+#define OBJ_TYPE_PREFIX "obj_"
+#define GC_FRAME_VAR "__gc_frame"
+#define GC_ROOTS_VAR "__gc_roots"
+#define GC_TOP_VAR "quack_gc_top"
+#define GC_POLL_FUNC "quack_gc_poll"
+#define GC_POP_FUNC "quack_gc_pop"
+#define GC_START_FUNC "quack_gc_start"
+#define GC_WRITE_FUNC "quack_gc_write"
+#define RC_ALLOC_FUNC "quack_rc_alloc"
+#define RC_RETAIN_FUNC "quack_rc_retain"
+#define RC_RELEASE_FUNC "quack_rc_release"
+#define RC_STORE_FUNC "quack_rc_store"
+#define RC_START_FUNC "quack_rc_start"
+#define PTR_MAP_HEADER "ptr_map_"
+#define LIT_INT_HEADER "quack_lit_int_"
+#define LIT_STR_HEADER "quack_lit_str_"
 
 #define GENERATE_LIT_INT_FUNC "int_literal"
 #define GENERATE_LIT_STRING_FUNC "str_literal"
@@ -68,7 +105,29 @@
 
 #define GENERATED_NO_JUMP ""
 
-#define GENERATED_IS_SUBTYPE_FUNC "is_subtype"
+#define TYPECASE_CASES_PER_LINE 8
+#define GENERATED_IS_BOOL_TRUE_FUNC "is_bool_true"
+#define GENERATED_LIKELY "QUACK_LIKELY"
+#define GENERATED_UNLIKELY "QUACK_UNLIKELY"
 #define GENERATED_SUPER_FIELD "super_"
+#define GENERATED_INT_VALUE_FIELD "value"
+#define STR_COMPARE_FUNC "quack_str_compare"
+#define STR_EQUALS_FUNC "quack_str_equals"
+#define STR_ORDER_FUNC "quack_str_order"
+#define GENERATED_NATIVE_INT "int"
+#define GENERATED_NATIVE_BOOL "bool"
+#define GENERATED_CLASS_ID_FIELD "class_id_"
+#define GENERATED_CLASS_MAX_ID_FIELD "class_max_id_"
+#define GENERATED_OBJ_SIZE_FIELD "obj_size_"
+#define GENERATED_PTR_MAP_FIELD "ptr_map_"
+
+// Preorder class ids of the builtin classes.  Must match builtins.h
+#define CLASS_ID_OBJ 0
+#define CLASS_ID_BOOLEAN 1
+#define CLASS_ID_INT 2
+#define CLASS_ID_NOTHING 3
+#define CLASS_ID_STRING 4
+#define CLASS_ID_FIRST_USER 5
+#define CLASS_ID_MAX 0x7fffffff
 
 #endif //PROJECT02_KEYWORDS_H
@@ -0,0 +1,177 @@
+//
+// Pool of the Int and String literals used by a program.  Each distinct literal is a single
+// statically initialized object so evaluating a literal never allocates.  The String objects
+// are the program's interned Strings, so two of them are equal only if they are the same
+// object.
+//
+
+#ifndef CODE_GENERATOR_LITERAL_POOL_H
+#define CODE_GENERATOR_LITERAL_POOL_H
+
+#include <cctype>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "keywords.h"
+
+namespace CodeGen {
+  class LiteralPool {
+   public:
+    /**
+     * Gets the static object of an integer literal adding it to the pool if needed.
+     *
+     * @param value Value of the literal
+     * @return Name of the static object
+     */
+    const std::string& int_literal(int value) {
+      auto itr = ints_.find(value);
+      if (itr != ints_.end())
+        return itr->second;
+
+      std::string name = LIT_INT_HEADER;
+      name += (value < 0) ? "m" + std::to_string(-static_cast<long>(value))
+                          : std::to_string(value);
+      int_order_.emplace_back(value);
+      return ints_[value] = name;
+    }
+    /**
+     * Gets the static object of a string literal adding it to the pool if needed.  Literals
+     * are pooled by their text once escape sequences are replaced, e.g., a block string with
+     * a raw new line and the same string written with "\n" share an object.
+     *
+     * @param text Contents of the literal (with escape sequences)
+     * @return Name of the static object
+     */
+    const std::string& str_literal(const std::string &text) {
+      std::string bytes = text_bytes(text);
+      auto itr = strs_.find(bytes);
+      if (itr != strs_.end())
+        return itr->second;
+
+      std::string name = LIT_STR_HEADER + std::to_string(str_order_.size());
+      str_order_.emplace_back(text);
+      return strs_[bytes] = name;
+    }
+    /**
+     * Writes the definitions of all pooled literals.  They only depend on the builtin class
+     * structs so they can be placed directly after the includes.
+     *
+     * @param out Output stream
+     */
+    void generate_code(std::ostream &out) const {
+      if (int_order_.empty() && str_order_.empty())
+        return;
+
+      out << "/* Literal objects are immutable and shared by every use */\n";
+      for (int value : int_order_)
+        out << "static struct obj_Int_struct " << ints_.at(value)
+            << " = { &the_class_Int_struct, " << value << " };\n";
+      for (const auto &text : str_order_) {
+        std::string bytes = text_bytes(text);
+        out << "static struct obj_String_struct " << strs_.at(bytes)
+            << " = { &the_class_String_struct, \"" << quoted_bytes(bytes) << "\", "
+            << bytes.size() << ", NULL, NULL, 0, " << hash(bytes) << "u, false, true };\n";
+      }
+      out << "\n";
+    }
+    /**
+     * Writes the pooled literals as read-only data for the assembly backend.  The objects have
+     * the same layout as the structs in builtins.h.
+     *
+     * @param out Output stream
+     * @param str_label Function mapping a string's contents to the label of its characters
+     */
+    template <typename _F>
+    void generate_asm(std::ostream &out, _F str_label) const {
+      if (int_order_.empty() && str_order_.empty())
+        return;
+
+      out << "\n\t.section .data.rel.ro,\"aw\"\n\t.align 8\n";
+      for (int value : int_order_)
+        out << ints_.at(value) << ":\n\t.quad the_class_Int_struct\n\t.long " << value
+            << "\n\t.zero 4\n";
+      for (const auto &text : str_order_) {
+        std::string bytes = text_bytes(text);
+        // Flat, so no rope halves, followed by the hash and the is_interned flag
+        out << strs_.at(bytes) << ":\n\t.quad the_class_String_struct\n\t.quad "
+            << str_label(text) << "\n\t.quad " << bytes.size()
+            << "\n\t.zero 20\n\t.long " << hash(bytes) << "\n\t.byte 0, 1\n\t.zero 6\n";
+      }
+    }
+    /**
+     * Text of a literal once its escape sequences are replaced by the characters they stand
+     * for, as the C compiler does.
+     *
+     * @param text Contents of the literal (with escape sequences)
+     * @return Bytes of the String's text
+     */
+    static std::string text_bytes(const std::string &text) {
+      std::string bytes;
+      for (unsigned long i = 0; i < text.size(); i++) {
+        if (text[i] != '\\' || i + 1 == text.size()) {
+          bytes += text[i];
+          continue;
+        }
+        switch (text[++i]) {
+          case '0': bytes += '\0'; break;
+          case 'b': bytes += '\b'; break;
+          case 't': bytes += '\t'; break;
+          case 'n': bytes += '\n'; break;
+          case 'r': bytes += '\r'; break;
+          case 'f': bytes += '\f'; break;
+          default: bytes += text[i];
+        }
+      }
+      return bytes;
+    }
+    /**
+     * Text of a String written as the contents of a C or assembler string literal.  Quotes,
+     * backslashes and the bytes that are not printable, e.g., the new lines of block strings
+     * and NUL, are written as three digit octal escapes, so a digit following one is never
+     * read as part of the escape.
+     *
+     * @param bytes Text of the String
+     * @return Contents of the quoted literal
+     */
+    static std::string quoted_bytes(const std::string &bytes) {
+      std::string quoted;
+      for (char c : bytes) {
+        auto byte = static_cast<unsigned char>(c);
+        if (std::isprint(byte) && c != '"' && c != '\\') {
+          quoted += c;
+          continue;
+        }
+        quoted += '\\';
+        quoted += static_cast<char>('0' + (byte >> 6));
+        quoted += static_cast<char>('0' + ((byte >> 3) & 7));
+        quoted += static_cast<char>('0' + (byte & 7));
+      }
+      return quoted;
+    }
+    /**
+     * Hash of a String's text, which must match quack_str_hash_text in builtins.c (32-bit
+     * FNV-1a with 0 replaced by 1).
+     *
+     * @param bytes Text of the String
+     * @return Hash stored in the literal's object
+     */
+    static uint32_t hash(const std::string &bytes) {
+      uint32_t hash = 2166136261u;
+      for (char c : bytes)
+        hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+      return hash ? hash : 1;
+    }
+
+   private:
+    std::map<int, std::string> ints_;
+    /** Literal object names keyed by the text with escape sequences replaced */
+    std::vector<int> int_order_;
+    std::map<std::string, std::string> strs_;
+    std::vector<std::string> str_order_;
+  };
+}
+
+#endif //CODE_GENERATOR_LITERAL_POOL_H
@@ -0,0 +1,325 @@
+//
+// Recognition of counted while loops.  The counter of a counted loop is kept in a native C int
+// for the duration of the loop instead of being boxed in a new Int every iteration.
+//
+
+#ifndef CODE_GENERATOR_LOOP_ANALYSIS_H
+#define CODE_GENERATOR_LOOP_ANALYSIS_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "quack_class.h"
+#include "quack_method.h"
+#include "code_gen_utils.h"
+#include "ASTNode.h"
+
+namespace CodeGen {
+  /** Counted loops found in a single generated function */
+  struct LoopStats {
+    std::string method_name_;
+    /** Description of each counted loop, e.g., "i < n, step +1" */
+    std::vector<std::string> loops_;
+  };
+
+  /**
+   * Finds while loops of the form "while i < n { ...; i = i + 1; }".  The condition must
+   * compare a local Int (the counter) against an integer literal or a local Int that is not
+   * assigned in the loop (the bound) with <, <=, >, or >=.  Every assignment to the counter in
+   * the loop must add or subtract an integer literal.
+   */
+  class LoopAnalysis {
+   public:
+    /**
+     * @param main Method containing the body of the Quack main
+     */
+    explicit LoopAnalysis(Quack::Method * main) : main_(main) {}
+    /**
+     * Analyzes every function in the program.
+     *
+     * @param classes User classes of the program
+     * @param loops Counted loops found by the analysis
+     */
+    void run(const std::vector<Quack::Class*> &classes, CountedLoops &loops) {
+      stats_.clear();
+      for (auto * q_class : classes) {
+        analyze(q_class->get_constructor(), q_class->generated_constructor_name(), loops);
+        for (auto &method_pair : *q_class->methods_)
+          analyze(method_pair.second,
+                  Quack::Class::generated_method_name(q_class, method_pair.second), loops);
+      }
+      analyze(main_, METHOD_MAIN, loops);
+    }
+    /**
+     * Accessor for the per function counted loops.
+     *
+     * @return Statistics for each function in the order they were analyzed
+     */
+    const std::vector<LoopStats>& stats() const { return stats_; }
+
+   private:
+    /** Use of a local along with the loops that enclose it */
+    struct Use {
+      std::string name_;
+      /** Assignment to the local or nullptr if the use is a read or a typecase binding */
+      const AST::Assn * assn_;
+      bool is_read_;
+      /** True if the value is read as an object instead of as a native int */
+      bool is_object_read_;
+      std::vector<const AST::While*> loops_;
+    };
+    /**
+     * Finds the counted loops in a single function.
+     *
+     * @param func Function to analyze
+     * @param name Name of the generated function
+     * @param loops Counted loops found so far
+     */
+    void analyze(Quack::Method * func, const std::string &name, CountedLoops &loops) {
+      uses_.clear();
+      whiles_.clear();
+      walk(func->block_);
+
+      stats_.emplace_back();
+      stats_.back().method_name_ = name;
+      for (auto &while_info : whiles_) {
+        const AST::While * while_node = while_info.first;
+        auto * cond = dynamic_cast<const AST::BinOp*>(while_node->cond_);
+        if (!cond || dynamic_cast<const AST::BoolOp*>(cond) || !is_ordering(cond->opsym))
+          continue;
+
+        // The counter may be on either side of the comparison
+        for (int side = 0; side < 2; side++) {
+          const AST::ASTNode * counter = side == 0 ? cond->left_ : cond->right_;
+          const AST::ASTNode * bound = side == 0 ? cond->right_ : cond->left_;
+          auto * var = dynamic_cast<const AST::Ident*>(counter);
+          if (!var || !is_int(var) || var->text_ == OBJECT_SELF)
+            continue;
+
+          CountedLoop loop;
+          if (!find_steps(while_node, var->text_, loop) || !is_bound(while_node, bound, var))
+            continue;
+
+          unsigned long id = loops.loops_.size();
+          loop.var_ = var->text_;
+          loop.counter_ = COUNTER_VAR_HEADER + std::to_string(id);
+          if (auto * bound_var = dynamic_cast<const AST::Ident*>(bound)) {
+            loop.bound_var_ = bound_var->text_;
+            loop.bound_ = BOUND_VAR_HEADER + std::to_string(id);
+          }
+          // The object of the counter is only updated if it may be read after the loop
+          loop.write_back_ = while_info.second > 0;
+          for (auto &use : uses_) {
+            if (use.name_ != loop.var_ || !use.is_read_)
+              continue;
+            if (!is_inside(use, while_node))
+              loop.write_back_ = true;
+            else if (use.is_object_read_)
+              loop.sync_object_ = true;
+          }
+          loops.loops_[while_node] = loop;
+
+          stats_.back().loops_.emplace_back(describe(cond, var, bound, loop));
+          break;
+        }
+      }
+    }
+    /**
+     * Checks all assignments to the counter in the loop and extracts the step of the loop.
+     *
+     * @param while_node Loop of interest
+     * @param var Name of the counter
+     * @param loop Counted loop whose step is updated
+     * @return True if all assignments to the counter in the loop add or subtract a literal
+     */
+    bool find_steps(const AST::While * while_node, const std::string &var, CountedLoop &loop) {
+      std::vector<const AST::Assn*> steps;
+      for (auto &use : uses_) {
+        if (use.name_ != var || use.is_read_ || !is_inside(use, while_node))
+          continue;
+        if (!use.assn_ || !step_of(use.assn_, var, loop.step_))
+          return false;
+        steps.emplace_back(use.assn_);
+      }
+      if (steps.empty())
+        return false;
+
+      // A single step at the end of the body moves to the loop header
+      const std::vector<AST::ASTNode*> &stmts = while_node->body_->stmts_;
+      if (steps.size() == 1 && !stmts.empty() && stmts.back() == steps[0])
+        loop.step_stmt_ = steps[0];
+      else
+        loop.step_stmt_ = nullptr;
+      return true;
+    }
+    /**
+     * Extracts the step of an assignment of the form "i = i + c", "i = c + i", or "i = i - c".
+     *
+     * @param assn Assignment to the counter
+     * @param var Name of the counter
+     * @param step Amount added to the counter
+     * @return True if the assignment has one of the supported forms
+     */
+    static bool step_of(const AST::Assn * assn, const std::string &var, int &step) {
+      auto * rhs = dynamic_cast<const AST::BinOp*>(assn->rhs_);
+      if (!rhs || dynamic_cast<const AST::BoolOp*>(rhs))
+        return false;
+
+      auto * l_var = dynamic_cast<const AST::Ident*>(rhs->left_);
+      auto * r_var = dynamic_cast<const AST::Ident*>(rhs->right_);
+      auto * l_lit = dynamic_cast<const AST::IntLit*>(rhs->left_);
+      auto * r_lit = dynamic_cast<const AST::IntLit*>(rhs->right_);
+      if (l_var && l_var->text_ == var && r_lit && (rhs->opsym == "+" || rhs->opsym == "-")) {
+        step = rhs->opsym == "+" ? r_lit->value_ : -r_lit->value_;
+        return true;
+      }
+      if (r_var && r_var->text_ == var && l_lit && rhs->opsym == "+") {
+        step = l_lit->value_;
+        return true;
+      }
+      return false;
+    }
+    /**
+     * Checks whether an expression is a valid bound of a counted loop.
+     *
+     * @param while_node Loop of interest
+     * @param bound Expression compared against the counter
+     * @param var Counter of the loop
+     * @return True if \p bound is an integer literal or a local Int not assigned in the loop
+     */
+    bool is_bound(const AST::While * while_node, const AST::ASTNode * bound,
+                  const AST::Ident * var) {
+      if (dynamic_cast<const AST::IntLit*>(bound))
+        return true;
+      auto * bound_var = dynamic_cast<const AST::Ident*>(bound);
+      if (!bound_var || !is_int(bound_var) || bound_var->text_ == var->text_
+          || bound_var->text_ == OBJECT_SELF)
+        return false;
+      for (auto &use : uses_)
+        if (use.name_ == bound_var->text_ && !use.is_read_ && is_inside(use, while_node))
+          return false;
+      return true;
+    }
+    /**
+     * Visits all statements in a block.
+     *
+     * @param block Block to visit
+     */
+    void walk(const AST::Block * block) {
+      if (!block)
+        return;
+      for (auto * stmt : block->stmts_)
+        walk(stmt);
+    }
+    /**
+     * Records the uses of locals in a statement or expression and all of its subexpressions.
+     *
+     * @param node Node to visit
+     * @param is_native True if the value of \p node is used as a native int
+     */
+    void walk(const AST::ASTNode * node, bool is_native = false) {
+      if (!node)
+        return;
+
+      if (auto * if_node = dynamic_cast<const AST::If*>(node)) {
+        walk(if_node->cond_);
+        walk(if_node->truepart_);
+        walk(if_node->falsepart_);
+      } else if (auto * while_node = dynamic_cast<const AST::While*>(node)) {
+        whiles_.emplace_back(while_node, loop_stack_.size());
+        loop_stack_.emplace_back(while_node);
+        walk(while_node->cond_);
+        walk(while_node->body_);
+        loop_stack_.pop_back();
+      } else if (auto * ret = dynamic_cast<const AST::Return*>(node)) {
+        walk(ret->right_);
+      } else if (auto * assn = dynamic_cast<const AST::Assn*>(node)) {
+        walk(assn->rhs_);
+        if (auto * ident = dynamic_cast<const AST::Ident*>(assn->lhs_->expr_))
+          uses_.push_back({ident->text_, assn, false, false, loop_stack_});
+        else
+          walk(assn->lhs_->expr_);
+      } else if (auto * tc = dynamic_cast<const AST::Typecase*>(node)) {
+        walk(tc->expr_);
+        for (auto * alt : *tc->alts_) {
+          uses_.push_back({alt->type_names_[0], nullptr, false, false, loop_stack_});
+          walk(alt->block_);
+        }
+      } else if (auto * obj_call = dynamic_cast<const AST::ObjectCall*>(node)) {
+        walk(obj_call->object_);
+        if (auto * func_call = dynamic_cast<const AST::FunctionCall*>(obj_call->next_))
+          walk(func_call->args_);
+      } else if (auto * bin_op = dynamic_cast<const AST::BinOp*>(node)) {
+        // Operands of Int arithmetic and comparisons are evaluated as native ints
+        bool is_native_op = !dynamic_cast<const AST::BoolOp*>(node) && is_int(bin_op->left_)
+                            && is_int(bin_op->right_) && bin_op->opsym != "/";
+        walk(bin_op->left_, is_native_op);
+        walk(bin_op->right_, is_native_op);
+      } else if (auto * uni_op = dynamic_cast<const AST::UniOp*>(node)) {
+        walk(uni_op->right_);
+      } else if (auto * func_call = dynamic_cast<const AST::FunctionCall*>(node)) {
+        walk(func_call->args_);
+      } else if (auto * args = dynamic_cast<const AST::RhsArgs*>(node)) {
+        for (auto * arg : args->args_)
+          walk(arg);
+      } else if (auto * typing = dynamic_cast<const AST::Typing*>(node)) {
+        walk(typing->expr_);
+      } else if (auto * ident = dynamic_cast<const AST::Ident*>(node)) {
+        uses_.push_back({ident->text_, nullptr, true, !is_native, loop_stack_});
+      }
+    }
+    /**
+     * Checks whether a use is in the condition or the body of a loop.
+     *
+     * @param use Use of a local
+     * @param while_node Loop of interest
+     * @return True if \p use is inside \p while_node
+     */
+    static bool is_inside(const Use &use, const AST::While * while_node) {
+      for (auto * loop : use.loops_)
+        if (loop == while_node)
+          return true;
+      return false;
+    }
+    static bool is_ordering(const std::string &opsym) {
+      return opsym == "<" || opsym == "<=" || opsym == ">" || opsym == ">=";
+    }
+    static bool is_int(const AST::ASTNode * node) {
+      return node->get_node_type() == Quack::Class::Container::Int();
+    }
+    /**
+     * Builds the description of a counted loop used in the statistics report.
+     *
+     * @return Description of the condition and the step of the loop
+     */
+    static std::string describe(const AST::BinOp * cond, const AST::Ident * var,
+                                const AST::ASTNode * bound, const CountedLoop &loop) {
+      std::string bound_str;
+      if (auto * lit = dynamic_cast<const AST::IntLit*>(bound))
+        bound_str = std::to_string(lit->value_);
+      else
+        bound_str = dynamic_cast<const AST::Ident*>(bound)->text_;
+
+      std::string desc = (cond->left_ == var) ? var->text_ + " " + cond->opsym + " " + bound_str
+                                              : bound_str + " " + cond->opsym + " " + var->text_;
+      if (loop.step_stmt_)
+        desc += ", step " + std::string(loop.step_ >= 0 ? "+" : "") + std::to_string(loop.step_);
+      else
+        desc += ", steps in body";
+      return desc;
+    }
+
+    Quack::Method * main_;
+    /** Statistics of each function */
+    std::vector<LoopStats> stats_;
+
+    // State of the function currently being analyzed
+    std::vector<Use> uses_;
+    /** Every while loop in the function and the number of loops enclosing it */
+    std::vector<std::pair<const AST::While*, unsigned long>> whiles_;
+    std::vector<const AST::While*> loop_stack_;
+  };
+}
+
+#endif //CODE_GENERATOR_LOOP_ANALYSIS_H
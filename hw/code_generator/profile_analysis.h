@@ -0,0 +1,396 @@
+//
+// Profile guided optimization.  Counters are assigned to the functions, dynamically dispatched
+// call sites, typecases, and loops of a program.  An instrumented program writes their counts to
+// a profile file at exit and a later compilation reads the file to guide optimization.
+//
+
+#ifndef CODE_GENERATOR_PROFILE_ANALYSIS_H
+#define CODE_GENERATOR_PROFILE_ANALYSIS_H
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "quack_class.h"
+#include "quack_method.h"
+#include "code_gen_utils.h"
+#include "ASTNode.h"
+
+/** Percentage of the runs of a call site or typecase that must take the same path to speculate */
+#define PROFILE_DOMINANT_PERCENT 90
+/** Percentage of all function calls a function needs to be optimized as hot */
+#define PROFILE_HOT_PERCENT 1
+
+namespace CodeGen {
+  /** Number of optimizations chosen from a profile */
+  struct ProfileStats {
+    unsigned long hot_ = 0;
+    unsigned long cold_ = 0;
+    unsigned long sites_ = 0;
+    unsigned long speculated_ = 0;
+    unsigned long typecases_ = 0;
+    unsigned long early_exit_loops_ = 0;
+  };
+
+  /**
+   * Assigns the counters of a program and selects optimizations from their counts:
+   *   - Functions that receive a large share of all calls are marked hot and functions that
+   *     were never called are marked cold.
+   *   - Call sites whose receivers almost always have one class call that class's
+   *     implementation directly after checking the class.
+   *   - Typecase alternatives are laid out hottest first and an alternative that is almost
+   *     always taken is checked before the switch.
+   *   - Loops that usually exit before their first iteration get the opposite branch hint.
+   */
+  class ProfileAnalysis {
+   public:
+    /**
+     * @param main Method containing the body of the Quack main
+     */
+    explicit ProfileAnalysis(Quack::Method * main) : main_(main) {}
+    /**
+     * Numbers the counters of every function in a fixed order.  Class ids must be assigned.
+     *
+     * @param classes User classes of the program
+     * @param profile Profile whose counters are assigned
+     */
+    void assign_counters(const std::vector<Quack::Class*> &classes, Profile &profile) {
+      profile_ = &profile;
+      id_classes_.clear();
+      for (auto &class_pair : *Quack::Class::Container::singleton())
+        id_classes_[class_pair.second->class_id()] = class_pair.second;
+
+      for (auto * q_class : classes) {
+        add_function(q_class->get_constructor(), q_class->generated_constructor_name());
+        for (auto &method_pair : *q_class->methods_)
+          add_function(method_pair.second,
+                       Quack::Class::generated_method_name(q_class, method_pair.second));
+      }
+      add_function(main_, METHOD_MAIN);
+    }
+    /**
+     * Reads the counts written by the instrumented program.  Counters missing from the file
+     * are zero.
+     *
+     * @param path Profile file
+     * @param profile Profile with assigned counters
+     * @return Number of counters found in the file or -1 if the file cannot be read
+     */
+    long read(const std::string &path, const Profile &profile) {
+      std::ifstream fin(path);
+      if (!fin)
+        return -1;
+
+      std::map<std::string, unsigned long> file_counts;
+      std::string line;
+      while (std::getline(fin, line)) {
+        std::size_t split = line.find(' ');
+        if (split == std::string::npos)
+          continue;
+        file_counts[line.substr(split + 1)] += std::stoul(line.substr(0, split));
+      }
+
+      long num_found = 0;
+      counts_.assign(profile.names_.size(), 0);
+      for (unsigned long i = 0; i < profile.names_.size(); i++) {
+        auto itr = file_counts.find(profile.names_[i]);
+        if (itr == file_counts.end())
+          continue;
+        counts_[i] = itr->second;
+        num_found++;
+      }
+      return num_found;
+    }
+    /**
+     * Selects the profile guided optimizations from the counts read.
+     *
+     * @param profile Profile with assigned counters
+     */
+    void plan(Profile &profile) {
+      stats_ = ProfileStats();
+
+      unsigned long total_calls = 0;
+      for (auto * func : funcs_)
+        total_calls += count(func);
+      for (auto * func : funcs_) {
+        unsigned long calls = count(func);
+        if (calls == 0) {
+          profile.cold_.insert(func);
+          stats_.cold_++;
+        } else if (calls * 100 >= total_calls * PROFILE_HOT_PERCENT) {
+          profile.hot_.insert(func);
+          stats_.hot_++;
+        }
+      }
+
+      for (auto &site : sites_) {
+        stats_.sites_++;
+        std::vector<unsigned long> hist = counts(site.first, site.second.size());
+        unsigned long best = dominant(hist);
+        if (best < hist.size()) {
+          profile.speculated_[site.first] = site.second[best];
+          stats_.speculated_++;
+        }
+      }
+
+      for (auto * tc : typecases_)
+        plan_typecase(profile, tc);
+
+      for (auto * loop : loops_) {
+        unsigned long entries = count(loop), iterations = count(loop, 1);
+        if (entries == 0)
+          continue;
+        if (iterations < entries) {
+          profile.loop_hints_[loop] = BranchHint::UNLIKELY;
+          stats_.early_exit_loops_++;
+        } else {
+          profile.loop_hints_[loop] = BranchHint::LIKELY;
+        }
+      }
+    }
+    /**
+     * Accessor for the number of optimizations selected from the profile.
+     *
+     * @return Statistics of the last plan
+     */
+    const ProfileStats& stats() const { return stats_; }
+    /**
+     * Checks whether counts were read from a profile file.
+     *
+     * @return True if a profile was read
+     */
+    bool has_counts() const { return !counts_.empty(); }
+    /**
+     * Accessor for a count read from the profile.
+     *
+     * @param key Owner of the counter
+     * @param offset Position of the counter after the owner's first counter
+     * @return Count
+     */
+    unsigned long count(const void * key, unsigned long offset = 0) const {
+      return counts_[profile_->counters_.at(key) + offset];
+    }
+
+   private:
+    /**
+     * Assigns the counters of a function and everything in its body.
+     *
+     * @param func Function
+     * @param name Name of the generated function
+     */
+    void add_function(Quack::Method * func, const std::string &name) {
+      func_name_ = name;
+      num_sites_ = num_typecases_ = num_loops_ = 0;
+      funcs_.emplace_back(func);
+      add_counter(func, name + " calls");
+      walk(func->block_);
+    }
+    /**
+     * Assigns the first counter of a function, call site, typecase, or loop.
+     *
+     * @param key Owner of the counter
+     * @param name Name of the counter
+     */
+    void add_counter(const void * key, const std::string &name) {
+      profile_->counters_.emplace(key, profile_->names_.size());
+      profile_->names_.emplace_back(name);
+    }
+    /**
+     * Visits all statements in a block.
+     *
+     * @param block Block to visit
+     */
+    void walk(const AST::Block * block) {
+      if (!block)
+        return;
+      for (auto * stmt : block->stmts_)
+        walk(stmt);
+    }
+    /**
+     * Assigns the counters of a statement or expression and all of its subexpressions.
+     *
+     * @param node Node to visit
+     */
+    void walk(const AST::ASTNode * node) {
+      if (!node)
+        return;
+
+      if (auto * if_node = dynamic_cast<const AST::If*>(node)) {
+        walk(if_node->cond_);
+        walk(if_node->truepart_);
+        walk(if_node->falsepart_);
+      } else if (auto * while_node = dynamic_cast<const AST::While*>(node)) {
+        std::string name = func_name_ + " loop" + std::to_string(num_loops_++);
+        loops_.emplace_back(while_node);
+        add_counter(while_node, name + " entries");
+        profile_->names_.emplace_back(name + " iterations");
+        walk(while_node->cond_);
+        walk(while_node->body_);
+      } else if (auto * ret = dynamic_cast<const AST::Return*>(node)) {
+        walk(ret->right_);
+      } else if (auto * assn = dynamic_cast<const AST::Assn*>(node)) {
+        walk(assn->rhs_);
+        walk(assn->lhs_);
+      } else if (auto * tc = dynamic_cast<const AST::Typecase*>(node)) {
+        walk(tc->expr_);
+        std::string name = func_name_ + " typecase" + std::to_string(num_typecases_++);
+        typecases_.emplace_back(tc);
+        for (unsigned long i = 0; i < tc->alts_->size(); i++) {
+          std::string alt_name = name + " " + (*tc->alts_)[i]->type_names_[1];
+          if (i == 0)
+            add_counter(tc, alt_name);
+          else
+            profile_->names_.emplace_back(alt_name);
+        }
+        for (auto * alt : *tc->alts_)
+          walk(alt->block_);
+      } else if (auto * obj_call = dynamic_cast<const AST::ObjectCall*>(node)) {
+        walk(obj_call->object_);
+        auto * func_call = dynamic_cast<const AST::FunctionCall*>(obj_call->next_);
+        if (!func_call)
+          return;
+        walk(func_call->args_);
+        add_site(obj_call->object_->get_node_type(), func_call);
+      } else if (auto * bool_op = dynamic_cast<const AST::BoolOp*>(node)) {
+        walk(bool_op->left_);
+        walk(bool_op->right_);
+      } else if (auto * bin_op = dynamic_cast<const AST::BinOp*>(node)) {
+        walk(bin_op->left_);
+        walk(bin_op->right_);
+      } else if (auto * uni_op = dynamic_cast<const AST::UniOp*>(node)) {
+        walk(uni_op->right_);
+      } else if (auto * func_call = dynamic_cast<const AST::FunctionCall*>(node)) {
+        walk(func_call->args_);
+      } else if (auto * args = dynamic_cast<const AST::RhsArgs*>(node)) {
+        for (auto * arg : args->args_)
+          walk(arg);
+      } else if (auto * typing = dynamic_cast<const AST::Typing*>(node)) {
+        walk(typing->expr_);
+      }
+    }
+    /**
+     * Assigns one counter per class the receiver of a call site may have.  Calls whose
+     * receiver class is known at compile time are not counted.
+     *
+     * @param static_type Static type of the receiver
+     * @param site Method call
+     */
+    void add_site(Quack::Class * static_type, const AST::FunctionCall * site) {
+      if (static_type->is_leaf_class())
+        return;
+
+      std::string name = func_name_ + " site" + std::to_string(num_sites_++) + " "
+                         + site->ident_;
+      std::vector<Quack::Class*> &classes = sites_[site];
+      auto end = id_classes_.upper_bound(static_type->class_max_id());
+      for (auto itr = id_classes_.find(static_type->class_id()); itr != end; itr++) {
+        std::string class_name = name + " " + itr->second->name_;
+        if (classes.empty())
+          add_counter(site, class_name);
+        else
+          profile_->names_.emplace_back(class_name);
+        classes.emplace_back(itr->second);
+      }
+    }
+    /**
+     * Chooses the layout of a typecase from the number of times each alternative was taken.
+     *
+     * @param profile Profile receiving the layout
+     * @param tc Typecase
+     */
+    void plan_typecase(Profile &profile, const AST::Typecase * tc) {
+      unsigned long num_alts = tc->alts_->size();
+      if (num_alts == 0)
+        return;
+      std::vector<unsigned long> hits = counts(tc, num_alts);
+
+      TypecaseLayout layout;
+      layout.order_.resize(num_alts);
+      for (unsigned long i = 0; i < num_alts; i++)
+        layout.order_[i] = i;
+      std::stable_sort(layout.order_.begin(), layout.order_.end(),
+                       [&hits](unsigned long a, unsigned long b) { return hits[a] > hits[b]; });
+
+      // The fast path is a single class id range check
+      layout.fast_alt_ = dominant(hits);
+      if (layout.fast_alt_ < num_alts) {
+        std::vector<unsigned long> targets = tc->resolve_alternatives();
+        layout.fast_lo_ = layout.fast_hi_ = -1;
+        for (unsigned long id = 0; id < targets.size(); id++) {
+          if (targets[id] != layout.fast_alt_)
+            continue;
+          if (layout.fast_lo_ >= 0 && layout.fast_hi_ != static_cast<int>(id) - 1) {
+            layout.fast_alt_ = num_alts;
+            break;
+          }
+          if (layout.fast_lo_ < 0)
+            layout.fast_lo_ = static_cast<int>(id);
+          layout.fast_hi_ = static_cast<int>(id);
+        }
+      }
+
+      bool is_reordered = layout.fast_alt_ < num_alts;
+      for (unsigned long i = 0; i < num_alts; i++)
+        is_reordered = is_reordered || layout.order_[i] != i;
+      if (!is_reordered)
+        return;
+      profile.typecases_[tc] = layout;
+      stats_.typecases_++;
+    }
+    /**
+     * Finds the entry that accounts for nearly all of the total.
+     *
+     * @param hist Counts
+     * @return Index of the dominant count or the size of \p hist if there is none
+     */
+    static unsigned long dominant(const std::vector<unsigned long> &hist) {
+      unsigned long total = 0, best = 0;
+      for (unsigned long i = 0; i < hist.size(); i++) {
+        total += hist[i];
+        if (hist[i] > hist[best])
+          best = i;
+      }
+      if (total == 0 || hist[best] * 100 < total * PROFILE_DOMINANT_PERCENT)
+        return hist.size();
+      return best;
+    }
+    /**
+     * Accessor for consecutive counts read from the profile.
+     *
+     * @param key Owner of the counters
+     * @param num Number of counters
+     * @return Counts
+     */
+    std::vector<unsigned long> counts(const void * key, unsigned long num) const {
+      std::vector<unsigned long> vals(num);
+      for (unsigned long i = 0; i < num; i++)
+        vals[i] = count(key, i);
+      return vals;
+    }
+
+    Quack::Method * main_;
+    Profile * profile_ = nullptr;
+    /** Every class by class id */
+    std::map<int, Quack::Class*> id_classes_;
+    /** Counts read from the profile file by counter */
+    std::vector<unsigned long> counts_;
+
+    // Owners of the counters in the order they were assigned
+    std::vector<const Quack::Method*> funcs_;
+    std::map<const AST::FunctionCall*, std::vector<Quack::Class*>> sites_;
+    std::vector<const AST::Typecase*> typecases_;
+    std::vector<const AST::While*> loops_;
+
+    ProfileStats stats_;
+
+    // State of the function currently being numbered
+    std::string func_name_;
+    unsigned long num_sites_ = 0;
+    unsigned long num_typecases_ = 0;
+    unsigned long num_loops_ = 0;
+  };
+}
+
+#endif //CODE_GENERATOR_PROFILE_ANALYSIS_H
@@ -12,11 +12,13 @@
 #include <stdexcept>
 #include <algorithm>
 #include <fstream>
+#include <sstream>
 
 #include "container_templates.h"
 #include "quack_method.h"
 #include "quack_field.h"
 #include "keywords.h"
+#include "asm_gen_utils.h"
 
 // Forward declaration
 namespace CodeGen{ class Gen; }
@@ -29,6 +31,15 @@ namespace Quack {
   class Class {
     friend class TypeChecker;
     friend class CodeGen::Gen;
+    friend class CodeGen::EscapeAnalysis;
+    friend class CodeGen::LoopAnalysis;
+    friend class CodeGen::EffectAnalysis;
+    friend class CodeGen::ValueNumbering;
+    friend class CodeGen::TailCallAnalysis;
+    friend class CodeGen::FieldLayout;
+    friend class CodeGen::DispatchLayout;
+    friend class CodeGen::ProfileAnalysis;
+    friend class CodeGen::RefCountAnalysis;
    public:
 
     class Container : public MapContainer<Class> {
@@ -447,6 +458,15 @@ namespace Quack {
     const std::string generated_constructor_name() const {
       return "new_" + name_;
     }
+    /**
+     * Gets the name of the function that runs the constructor body on already allocated memory.
+     * It is used to build objects allocated on the stack.
+     *
+     * @return Initializer function name
+     */
+    const std::string generated_initializer_name() const {
+      return "init_" + name_;
+    }
     /**
      * Gets the name of the struct object used to store the clazz information include super class.
      * This function is used in typecase statements and in the generated class definitions.
@@ -457,11 +477,13 @@ namespace Quack {
       return this->generated_clazz_obj_name() + "_struct";
     }
     /**
-     * Generates all code associated with a specific class
+     * Generates the structs, prototypes, and clazz object of a class.  The declarations of all
+     * classes precede any method definitions so that a method can call the functions of any
+     * class directly.
      *
      * @param settings Code generator settings
      */
-    void generate_code(CodeGen::Settings settings) {
+    void generate_declarations(CodeGen::Settings settings) {
       assert(this->is_user_class());
 
       settings.fout_ << "/*======================= " << name_ << " =======================*/\n"
@@ -469,6 +491,9 @@ namespace Quack {
                      << "struct " << generated_struct_clazz_name() << ";\n"
                      << "typedef struct " << generated_struct_clazz_name()
                      << "* " << generated_clazz_type_name() << ";\n"
+                     << "struct " << generated_malloc_obj_name() << ";\n"
+                     << "typedef struct " << generated_malloc_obj_name()
+                     << "* " << generated_object_type_name() << ";\n"
                      << std::endl;
 
       generate_object_struct(settings);
@@ -479,11 +504,282 @@ namespace Quack {
 
       generate_clazz_object(settings);
 
+      settings.fout_ << "\n" << std::endl;
+    }
+    /**
+     * Generates the constructor and method definitions of a class.
+     *
+     * @param settings Code generator settings
+     */
+    void generate_definitions(CodeGen::Settings settings) {
+      assert(this->is_user_class());
+
+      settings.fout_ << "/*=================== " << name_ << " Methods ===================*/";
       generate_constructor(settings);
       generate_methods(settings);
 
       settings.fout_ << std::endl;
     }
+    /**
+     * Numbers all classes in preorder of the class hierarchy.  The builtin classes have the fixed
+     * ids the runtime uses, and Obj's interval covers every id.  User classes are numbered after
+     * them with siblings in name order.
+     */
+    static void assign_class_ids() {
+      std::pair<Class*, int> builtins[] = {{Container::Obj(), CLASS_ID_OBJ},
+                                           {Container::Bool(), CLASS_ID_BOOLEAN},
+                                           {Container::Int(), CLASS_ID_INT},
+                                           {Container::Nothing(), CLASS_ID_NOTHING},
+                                           {Container::Str(), CLASS_ID_STRING}};
+      for (auto &builtin : builtins)
+        builtin.first->class_id_ = builtin.first->class_max_id_ = builtin.second;
+      Container::Obj()->class_max_id_ = CLASS_ID_MAX;
+
+      int next_id = CLASS_ID_FIRST_USER;
+      for (auto * q_class : Container::Obj()->subclasses())
+        if (q_class->is_user_class())
+          q_class->assign_preorder_ids(next_id);
+    }
+    /**
+     * Accessor for the preorder id of the class.
+     *
+     * @return Class id
+     */
+    int class_id() const { return class_id_; }
+    /**
+     * Accessor for the largest id of the class and its subclasses.
+     *
+     * @return Last id of the class's preorder interval
+     */
+    int class_max_id() const { return class_max_id_; }
+    /**
+     * Checks whether any class extends this class.  The dynamic type of an object whose static
+     * type has no subclasses is known at compile time.
+     *
+     * @return True if no class has this class as its super class
+     */
+    bool is_leaf_class() const {
+      for (auto &class_pair : *Container::singleton())
+        if (class_pair.second->super_ == this)
+          return false;
+      return true;
+    }
+    /**
+     * Name of the C function that implements a method for objects whose dynamic type is exactly
+     * this class.  Int's arithmetic and comparison methods resolve to the static inline fast
+     * paths in builtins.h.
+     *
+     * @param method_name Name of the method
+     * @return Implementing class and the name of its C function
+     */
+    std::pair<Class*, std::string> generated_direct_method(const std::string &method_name) {
+      auto impl = generated_method(method_name);
+      if (impl.first == Container::Int() && method_name != METHOD_STR
+          && method_name != METHOD_PRINT)
+        return {impl.first, impl.first->name_ + "_inline_" + method_name};
+      return {impl.first, generated_method_name(impl.first, impl.second)};
+    }
+    /**
+     * Implementation of a method for objects whose dynamic type is exactly this class.
+     *
+     * @param method_name Name of the method
+     * @return Class that defines the implementation and the method itself
+     */
+    std::pair<Class*, Method*> generated_method(const std::string &method_name) {
+      build_generated_methods(this);
+      for (auto method_info : *gen_methods_)
+        if (method_info.second->name_ == method_name)
+          return method_info;
+      throw std::runtime_error("Unknown method \"" + method_name + "\" in class " + name_);
+    }
+    /**
+     * Byte offset of a method's function pointer in the class struct.  The class struct starts
+     * with the super class pointer, the two class id ints, the object size, the pointer map,
+     * and the constructor.
+     *
+     * @param method_name Name of the method
+     * @return Offset of the method in the class struct
+     */
+    long generated_method_offset(const std::string &method_name) {
+      build_generated_methods(this);
+      for (unsigned long i = 0; i < gen_methods_->size(); i++)
+        if ((*gen_methods_)[i].second->name_ == method_name)
+          return ASM_WORD_SIZE * (5 + i);
+      throw std::runtime_error("Unknown method \"" + method_name + "\" in class " + name_);
+    }
+    /**
+     * Checks whether a field can be stored as a native value in the object struct instead of
+     * as a pointer to a boxed object.  The field must have the same Int or Boolean type in
+     * every class that has it so that a super or subclass never expects a boxed value.
+     *
+     * @param field_name Name of the field
+     * @return Int or Boolean class if the field can be unboxed and nullptr otherwise
+     */
+    Class * unboxed_field_type(const std::string &field_name) {
+      // Fields are checked from the highest class in the hierarchy that has the field
+      Class * root = this;
+      while (root->super_ && root->super_->has_field(field_name))
+        root = root->super_;
+
+      Class * field_type = root->fields_->get(field_name)->type_;
+      if (field_type != Container::Int() && field_type != Container::Bool())
+        return nullptr;
+      return root->has_uniform_field_type(field_name, field_type) ? field_type : nullptr;
+    }
+    /**
+     * Generates the C type of a field in the object struct.
+     *
+     * @param settings Code generator settings
+     * @param field Field of interest
+     * @return Native type of unboxed fields and the object type otherwise
+     */
+    std::string generated_field_type_name(const CodeGen::Settings &settings, Field * field) {
+      Class * unboxed_type = settings.optimize(2) ? unboxed_field_type(field->name_) : nullptr;
+      if (unboxed_type == Container::Int())
+        return GENERATED_NATIVE_INT;
+      if (unboxed_type == Container::Bool())
+        return GENERATED_NATIVE_BOOL;
+      return field->type_->generated_object_type_name();
+    }
+    /**
+     * Byte offset of a field in the object struct.  The object struct starts with the clazz
+     * pointer.
+     *
+     * @param field_name Name of the field
+     * @return Offset of the field in the object struct
+     */
+    long generated_field_offset(const std::string &field_name) {
+      build_generated_fields(this);
+      for (unsigned long i = 0; i < gen_fields_->size(); i++)
+        if ((*gen_fields_)[i].second->name_ == field_name)
+          return ASM_WORD_SIZE * (1 + i);
+      throw std::runtime_error("Unknown field \"" + field_name + "\" in class " + name_);
+    }
+    /**
+     * Size in bytes of the object struct allocated by the constructor.
+     *
+     * @return Object size in bytes
+     */
+    unsigned long generated_object_size() {
+      build_generated_fields(this);
+      return ASM_WORD_SIZE * (1 + gen_fields_->size());
+    }
+    /**
+     * Generates the x86-64 assembly for the class.  The class struct and the objects use
+     * the same layout as the generated C code so the output links against builtins.c.
+     *
+     * @param settings Assembly generator settings
+     */
+    void generate_asm(CodeGen::AsmSettings &settings) {
+      assert(this->is_user_class());
+
+      settings.fout_ << "\n# ======================= " << name_ << " =======================\n";
+
+      std::string class_obj_struct = generated_clazz_obj_struct_name();
+      settings.fout_ << "\t.data\n\t.globl " << class_obj_struct << "\n\t.align 8\n";
+      settings.emit_label(class_obj_struct);
+      settings.emit(".quad " + super_->generated_clazz_obj_struct_name());
+      settings.emit(".long " + std::to_string(class_id_) + ", " + std::to_string(class_max_id_));
+      settings.emit(".quad " + std::to_string(generated_object_size()));
+      settings.emit(".quad " + generated_ptr_map_name());
+      settings.emit(".quad " + generated_constructor_name());
+      build_generated_methods(this);
+      for (auto method_info : *gen_methods_)
+        settings.emit(".quad " + generated_method_name(method_info.first, method_info.second));
+
+      settings.fout_ << "\t.globl " << generated_clazz_obj_name() << "\n\t.align 8\n";
+      settings.emit_label(generated_clazz_obj_name());
+      settings.emit(".quad " + class_obj_struct);
+
+      // Every field holds an object
+      settings.fout_ << "\t.align 2\n";
+      settings.emit_label(generated_ptr_map_name());
+      for (unsigned long i = 0; i < gen_fields_->size(); i++)
+        settings.emit(".short " + std::to_string(ASM_WORD_SIZE * (1 + i)));
+      settings.emit(".short 0");
+
+      settings.fout_ << "\t.text\n";
+      generate_asm_function(settings, generated_constructor_name(), constructor_, this, true);
+      for (const auto &method_info : *methods_)
+        generate_asm_function(settings, generated_method_name(this, method_info.second),
+                              method_info.second, this, false);
+    }
+    /**
+     * Generates the x86-64 assembly for a single function.  Every parameter and local is given
+     * a stack slot.  Register parameters are spilled to their slots in the prologue.
+     *
+     * @param settings Assembly generator settings
+     * @param func_name Name of the generated function
+     * @param method Method whose body is generated
+     * @param this_class Class of the implicit "this" object.  nullptr if there is none.
+     * @param is_constructor True if the function is a constructor
+     */
+    static void generate_asm_function(CodeGen::AsmSettings &settings, const std::string &func_name,
+                                      Method * method, Class * this_class, bool is_constructor) {
+      CodeGen::AsmFrame frame;
+      std::vector<std::pair<std::string, std::string>> spills;
+
+      // Register and stack parameters
+      unsigned long arg_idx = 0;
+      if (this_class != nullptr && !is_constructor) {
+        frame.add_local(OBJECT_SELF);
+        spills.emplace_back(frame.local(OBJECT_SELF), CodeGen::ASM_ARG_REGS[arg_idx++]);
+      }
+      for (unsigned long i = 0; i < method->params_->count(); i++, arg_idx++) {
+        const std::string &param_name = (*method->params_)[i]->name_;
+        if (arg_idx < ASM_NUM_ARG_REGS) {
+          frame.add_local(param_name);
+          spills.emplace_back(frame.local(param_name), CodeGen::ASM_ARG_REGS[arg_idx]);
+        } else {
+          long offset = 2 * ASM_WORD_SIZE + ASM_WORD_SIZE * (arg_idx - ASM_NUM_ARG_REGS);
+          frame.add_stack_param(param_name, offset);
+        }
+      }
+      // All other locals
+      if (is_constructor)
+        frame.add_local(OBJECT_SELF);
+      for (const auto &symbol_info : *method->symbol_table_) {
+        Symbol * sym = symbol_info.second;
+        if (!sym->is_field_)
+          frame.add_local(sym->name_);
+      }
+
+      // Body is generated first since the frame size is not known until it is complete
+      std::ostringstream body;
+      CodeGen::AsmSettings body_settings(body, settings.strings_, settings.literals_);
+      body_settings.frame_ = &frame;
+      body_settings.return_label_ = ".Lreturn_" + func_name;
+
+      if (is_constructor) {
+        body_settings.emit("movl $" + std::to_string(this_class->generated_object_size())
+                           + ", %edi");
+        body_settings.emit("call " ALLOC_OBJECT_FUNC);
+        body_settings.emit("movq %rax, " + frame.local(OBJECT_SELF));
+        body_settings.emit("leaq " + this_class->generated_clazz_obj_struct_name()
+                           + "(%rip), %rcx");
+        body_settings.emit("movq %rcx, (%rax)");
+      }
+      method->block_->generate_asm(body_settings);
+      if (is_constructor)
+        body_settings.emit("movq " + frame.local(OBJECT_SELF) + ", %rax");
+      else
+        body_settings.emit("movq " GENERATED_LIT_NONE "(%rip), %rax");
+
+      settings.fout_ << "\n\t.globl " << func_name << "\n\t.type " << func_name
+                     << ", @function\n";
+      settings.emit_label(func_name);
+      settings.emit("pushq %rbp");
+      settings.emit("movq %rsp, %rbp");
+      if (frame.size() > 0)
+        settings.emit("subq $" + std::to_string(frame.size()) + ", %rsp");
+      for (const auto &spill : spills)
+        settings.emit("movq " + spill.second + ", " + spill.first);
+      settings.fout_ << body.str();
+      settings.emit_label(body_settings.return_label_);
+      settings.emit("leave");
+      settings.emit("ret");
+      settings.fout_ << "\t.size " << func_name << ", .-" << func_name << "\n";
+    }
    private:
     /**
      * Generates the struct that contains all methods for the class including the constructor.
@@ -496,7 +792,12 @@ namespace Quack {
       // Put constructor function pointer
       std::string indent = AST::ASTNode::indent_str(1);
       settings.fout_ << "\n" << indent << Container::Obj()->generated_clazz_type_name() << " "
-                     << GENERATED_SUPER_FIELD << ";";
+                     << GENERATED_SUPER_FIELD << ";"
+                     << "\n" << indent << "int " << GENERATED_CLASS_ID_FIELD << ";"
+                     << "\n" << indent << "int " << GENERATED_CLASS_MAX_ID_FIELD << ";"
+                     << "\n" << indent << "unsigned long " << GENERATED_OBJ_SIZE_FIELD << ";"
+                     << "\n" << indent << "const unsigned short *" << GENERATED_PTR_MAP_FIELD
+                     << ";";
 
       settings.fout_ << "\n" << indent << generated_object_type_name()
                      << " (*" << METHOD_CONSTRUCTOR << ")(";
@@ -504,8 +805,9 @@ namespace Quack {
       settings.fout_ << ");";
 
       // Function pointers for all other methods
-      build_generated_methods(this);
-      for (auto method_info : *gen_methods_) {
+      unsigned long num_methods = generated_clazz_method_count(settings);
+      for (unsigned long i = 0; i < num_methods; i++) {
+        const auto &method_info = (*gen_methods_)[i];
         settings.fout_ << "\n" << indent
                        << method_info.second->return_type_->generated_object_type_name()
                        << " (*" << method_info.second->name_ << ")(";
@@ -519,13 +821,26 @@ namespace Quack {
       settings.fout_ << "\n};\n";
 
     }
+    /**
+     * Number of method pointers in the class struct.  Obj's methods come first in every class
+     * and are the only ones left when the other methods are in the shared dispatch table.
+     *
+     * @param settings Code generator settings
+     * @return Number of leading generated methods in the class struct
+     */
+    unsigned long generated_clazz_method_count(const CodeGen::Settings &settings) {
+      build_generated_methods(this);
+      if (settings.dispatch_)
+        return build_generated_methods(Container::Obj())->size();
+      return gen_methods_->size();
+    }
     /**
      * Generates the object struct for the class.
      *
      * @param settings Code generator settings
      */
     void generate_object_struct(CodeGen::Settings settings) {
-      settings.fout_ << "typedef struct " << generated_malloc_obj_name() << " {";
+      settings.fout_ << "struct " << generated_malloc_obj_name() << " {";
       // ToDo Add super
       // Method object field
       settings.fout_ << "\n" << AST::ASTNode::indent_str(1)
@@ -534,14 +849,22 @@ namespace Quack {
       build_generated_fields(this);
       for (auto field_info : *gen_fields_) {
         settings.fout_ << "\n" << AST::ASTNode::indent_str(1)
-                       << field_info.second->type_->generated_object_type_name() << " "
+                       << generated_field_type_name(settings, field_info.second) << " "
                        << field_info.second->name_ << ";";
       }
-      settings.fout_ << "\n} * " << generated_object_type_name() << ";\n";
+      settings.fout_ << "\n};\n";
     }
     const std::string generated_clazz_obj_name() const {
       return "the_class_" + name_;
     }
+    /**
+     * Array of the offsets of the object fields traced by the garbage collector.
+     *
+     * @return Name of the pointer map of the class
+     */
+    const std::string generated_ptr_map_name() const {
+      return PTR_MAP_HEADER + name_;
+    }
     /**
      * Struct that stores the allocated memory size of an object of this type.
      *
@@ -550,6 +873,16 @@ namespace Quack {
     const std::string generated_malloc_obj_name() const {
       return "obj_" + name_ + "_struct";
     }
+    /**
+     * Heap allocation of the memory of an object of this type.
+     *
+     * @return Expression that allocates an object
+     */
+    const std::string generated_malloc_call(bool is_counted = false) const {
+      return "(" + generated_object_type_name() + ")"
+             + (is_counted ? RC_ALLOC_FUNC : ALLOC_FUNC) + "(sizeof(struct "
+             + generated_malloc_obj_name() + "))";
+    }
     /**
      * Helper function used to generate the code for a method prototype.  It should not be used
      * for a constructor. Likewise, it includes no preceding indents nor does not include
@@ -560,6 +893,10 @@ namespace Quack {
      */
     void generate_method_prototype(CodeGen::Settings settings, Method* method,
                                    bool is_constructor=false) {
+      // Internal linkage lets the C compiler inline and specialize the function
+      if (settings.optimize(2))
+        settings.fout_ << "static ";
+      generate_profile_attributes(settings, method);
       settings.fout_ << method->return_type_->generated_object_type_name() << " ";
 
       if (is_constructor)
@@ -576,6 +913,37 @@ namespace Quack {
       method->params_->generate_code(settings, true, !is_constructor);
       settings.fout_ << ")";
     }
+    /**
+     * Generates the attributes of a function selected from the profile.  Hot functions are
+     * optimized for speed (and suggested for inlining when they are static) and functions that
+     * were never called are optimized for size and moved away from the hot code.
+     *
+     * @param settings Code generator settings
+     * @param method Function whose prototype is generated
+     */
+    static void generate_profile_attributes(CodeGen::Settings &settings, const Method * method) {
+      if (!settings.profile_)
+        return;
+      if (settings.profile_->hot_.count(method))
+        settings.fout_ << (settings.optimize(2) ? "inline " : "") << "__attribute__((hot)) ";
+      else if (settings.profile_->cold_.count(method))
+        settings.fout_ << "__attribute__((cold)) ";
+    }
+    /**
+     * Generates the prototype of the initializer.  It takes the memory of the object as its
+     * first parameter followed by the constructor parameters.
+     *
+     * @param settings Code generator settings
+     */
+    void generate_initializer_prototype(CodeGen::Settings settings) {
+      if (settings.optimize(2))
+        settings.fout_ << "static ";
+      generate_profile_attributes(settings, constructor_);
+      settings.fout_ << generated_object_type_name() << " " << generated_initializer_name() << "("
+                     << generated_object_type_name() << " " << OBJECT_SELF;
+      constructor_->params_->generate_code(settings, true, true);
+      settings.fout_ << ")";
+    }
     /**
      * Generates all prototypes for all methods and the constructor.
      *
@@ -586,6 +954,10 @@ namespace Quack {
 
       generate_method_prototype(settings, constructor_, true);
       settings.fout_ << ";\n";
+      if (settings.stack_allocs_) {
+        generate_initializer_prototype(settings);
+        settings.fout_ << ";\n";
+      }
 
       for (const auto &method : *methods_) {
         generate_method_prototype(settings, method.second);
@@ -601,6 +973,18 @@ namespace Quack {
     void generate_clazz_object(CodeGen::Settings settings) {
       std::string class_obj_struct = generated_clazz_obj_struct_name();
 
+      // Offsets of the fields holding objects, which the garbage collector traces
+      settings.fout_ << "\nstatic const unsigned short " << generated_ptr_map_name() << "[] = {";
+      build_generated_fields(this);
+      for (auto field_info : *gen_fields_) {
+        Field * field = field_info.second;
+        std::string field_type = generated_field_type_name(settings, field);
+        if (field_type == field->type_->generated_object_type_name())
+          settings.fout_ << " offsetof(struct " << generated_malloc_obj_name() << ", "
+                         << field->name_ << "),";
+      }
+      settings.fout_ << " 0 };\n";
+
       settings.fout_ << "\nstruct " << generated_struct_clazz_name() << " "
                      << class_obj_struct << " = {";
 
@@ -612,10 +996,14 @@ namespace Quack {
                      << "(" << Quack::Class::Container::Obj()->generated_clazz_type_name() << ")"
                      << "&" << super_obj_struct;
 
+      settings.fout_ << ",\n" << indent_str << class_id_ << ", " << class_max_id_;
+      settings.fout_ << ",\n" << indent_str << "sizeof(struct " << generated_malloc_obj_name()
+                     << "), " << generated_ptr_map_name();
       settings.fout_ << ",\n" << indent_str << generated_constructor_name();
 
-      build_generated_methods(this);
-      for (auto method_info : *gen_methods_) {
+      unsigned long num_methods = generated_clazz_method_count(settings);
+      for (unsigned long i = 0; i < num_methods; i++) {
+        const auto &method_info = (*gen_methods_)[i];
         settings.fout_ << ",\n" << indent_str
                        << generated_method_name(method_info.first, method_info.second);
       }
@@ -634,6 +1022,8 @@ namespace Quack {
     static void generate_symbol_table(CodeGen::Settings settings, unsigned indent_lvl,
                                       Method * method) {
       std::string indent_str = AST::ASTNode::indent_str(indent_lvl);
+      // Roots must never hold garbage when the collector runs, nor locals released on return
+      std::string init = (settings.collect_garbage() || settings.ref_counts_) ? " = NULL" : "";
 
       for (const auto &symbol_info : *method->symbol_table_) {
         Symbol * sym = symbol_info.second;
@@ -641,7 +1031,120 @@ namespace Quack {
           continue;
 
         settings.fout_ << indent_str << sym->get_type()->generated_object_type_name()
-                       << " " << sym->name_ << ";\n";
+                       << " " << sym->name_ << init << ";\n";
+      }
+
+      // Locals holding values computed once and reused
+      if (settings.value_numbers_) {
+        auto itr = settings.value_numbers_->decls_.find(method);
+        if (itr != settings.value_numbers_->decls_.end())
+          for (const auto &decl : itr->second)
+            settings.fout_ << indent_str << decl.second->generated_object_type_name() << " "
+                           << decl.first << init << ";\n";
+      }
+
+      // Memory of the objects that never escape the method
+      if (!settings.stack_allocs_)
+        return;
+      auto itr = settings.stack_allocs_->decls_.find(method);
+      if (itr == settings.stack_allocs_->decls_.end())
+        return;
+      for (const auto &decl : itr->second)
+        settings.fout_ << indent_str << "struct " << decl.second->generated_malloc_obj_name()
+                       << " " << decl.first << ";\n";
+    }
+    /**
+     * Generates the statements of a function after its locals up to the closing brace.  When
+     * objects are garbage collected, the statements are generated first so the temporaries
+     * they use can be declared and registered as roots, together with the locals, before them.
+     *
+     * @param settings Code generator settings
+     * @param func_name Name of the generated function
+     * @param method Method whose body is generated
+     * @param has_self True if the function has a "this" parameter or local
+     * @param result Value returned after the last statement.  If empty, the function ends
+     *               with its last statement.
+     */
+    static void generate_function_body(CodeGen::Settings settings, const std::string &func_name,
+                                       Method * method, bool has_self,
+                                       const std::string &result) {
+      std::ostringstream body;
+      CodeGen::Settings body_settings = settings.with_output(body);
+      std::string indent_str = AST::ASTNode::indent_str(1);
+
+      // Self tail calls jump back here after reassigning this and the parameters
+      if (settings.tail_calls_ && settings.tail_calls_->methods_.count(method))
+        AST::ASTNode::generate_label(body_settings, 1, TAIL_CALL_LABEL, true);
+      settings.temps_->start_method(func_name);
+      if (settings.ref_counts_)
+        start_ref_counts(settings, func_name, method);
+      AST::ASTNode::generate_gc_poll(body_settings, 1);
+      AST::ASTNode::generate_profile_count(body_settings, 1, method);
+      method->block_->generate_code(body_settings, 0);
+
+      if (!settings.collect_garbage()) {
+        if (settings.ref_counts_) {
+          // Assigned parameters own their object like the locals
+          for (const auto &param : settings.ref_counts_->assigned_params())
+            settings.fout_ << indent_str << RC_RETAIN_FUNC "(" << param << ");\n";
+        }
+        settings.fout_ << body.str();
+        if (!result.empty()) {
+          if (settings.ref_counts_)
+            settings.ref_counts_->release_all(*settings.temps_, settings.fout_, 1, result);
+          settings.fout_ << indent_str << "return " << result << ";\n";
+        }
+        settings.fout_ << "}\n";
+        return;
+      }
+
+      std::vector<std::string> roots;
+      if (has_self)
+        roots.emplace_back(OBJECT_SELF);
+      for (const auto &symbol_info : *method->symbol_table_) {
+        Symbol * sym = symbol_info.second;
+        if (!sym->is_field_ && sym->name_ != OBJECT_SELF)
+          roots.emplace_back(sym->name_);
+      }
+      if (settings.value_numbers_) {
+        auto itr = settings.value_numbers_->decls_.find(method);
+        if (itr != settings.value_numbers_->decls_.end())
+          for (const auto &decl : itr->second)
+            roots.emplace_back(decl.first);
+      }
+      CodeGen::ShadowStack::generate_frame(settings.fout_, roots,
+                                           settings.temps_->hoisted_decls());
+      std::string type = settings.return_type_->generated_object_type_name();
+      settings.fout_ << body.str() << indent_str
+                     << (result.empty() ? CodeGen::ShadowStack::pop_statement()
+                                        : CodeGen::ShadowStack::return_statement(type, result))
+                     << "\n}\n";
+    }
+    /**
+     * Registers the locals, assigned parameters and reused values that own their object when
+     * objects are reference counted.  A constructor's this is allocated by the constructor itself but
+     * returned so it is not released.
+     *
+     * @param settings Code generator settings
+     * @param func_name Name of the generated function
+     * @param method Method whose body is generated
+     */
+    static void start_ref_counts(CodeGen::Settings &settings, const std::string &func_name,
+                                 Method * method) {
+      settings.ref_counts_->start_method(method, func_name);
+      for (const auto &symbol_info : *method->symbol_table_) {
+        Symbol * sym = symbol_info.second;
+        if (sym->is_field_ || method->params_->get(sym->name_) || sym->name_ == OBJECT_SELF)
+          continue;
+        settings.ref_counts_->add_local(sym->name_);
+      }
+      for (const auto &param : settings.ref_counts_->assigned_params())
+        settings.ref_counts_->add_local(param);
+      if (settings.value_numbers_) {
+        auto itr = settings.value_numbers_->decls_.find(method);
+        if (itr != settings.value_numbers_->decls_.end())
+          for (const auto &decl : itr->second)
+            settings.ref_counts_->add_local(decl.first);
       }
     }
     /**
@@ -654,14 +1157,24 @@ namespace Quack {
       settings.st_ = constructor_->symbol_table_;
 
       settings.fout_ << "\n";
-      generate_method_prototype(settings, constructor_, true);
-      settings.fout_ << " {";
-
-      // Allocate the memory for the object itself
       std::string indent_str = AST::ASTNode::indent_str(1);
-      settings.fout_ << "\n" << indent_str << generated_object_type_name() << " " << OBJECT_SELF
-                     << " = (" << generated_object_type_name() << ")malloc(sizeof(struct "
-                     << generated_malloc_obj_name() << "));\n";
+      if (settings.stack_allocs_) {
+        // The object's memory is supplied by the caller
+        generate_initializer_prototype(settings);
+        settings.fout_ << " {\n";
+        // Memory reused from an earlier object must not be traced before the fields are set
+        if (settings.collect_garbage())
+          settings.fout_ << indent_str << "*" << OBJECT_SELF << " = (struct "
+                         << generated_malloc_obj_name() << "){0};\n";
+      } else {
+        generate_method_prototype(settings, constructor_, true);
+        settings.fout_ << " {";
+
+        // Allocate the memory for the object itself
+        settings.fout_ << "\n" << indent_str << generated_object_type_name() << " " << OBJECT_SELF
+                       << " = " << generated_malloc_call(settings.ref_counts_ != nullptr)
+                       << ";\n";
+      }
 
       // Define the object that will store the class methods
       settings.fout_ << indent_str << OBJECT_SELF << "->" << GENERATED_CLASS_FIELD
@@ -669,10 +1182,18 @@ namespace Quack {
 
       generate_symbol_table(settings, 1, constructor_);
       settings.fout_ << "\n" << AST::ASTNode::indent_str(1) << "/* Method statements */\n";
-      constructor_->block_->generate_code(settings, 0);
+      generate_function_body(settings, generated_constructor_name(), constructor_, true,
+                             OBJECT_SELF);
 
-      settings.fout_ << "\n" << indent_str << "return " << OBJECT_SELF << ";";
-      settings.fout_ << "\n}\n";
+      if (settings.stack_allocs_) {
+        settings.fout_ << "\n";
+        generate_method_prototype(settings, constructor_, true);
+        settings.fout_ << " {\n" << indent_str << "return " << generated_initializer_name() << "("
+                       << generated_malloc_call();
+        for (auto * param : *constructor_->params_)
+          settings.fout_ << ", " << param->name_;
+        settings.fout_ << ");\n}\n";
+      }
 
       settings.return_type_ = nullptr;
       settings.st_ = nullptr;
@@ -695,14 +1216,51 @@ namespace Quack {
         settings.fout_ << " {\n";
 
         generate_symbol_table(settings, 1, method);
-
-        method->block_->generate_code(settings, 0);
-
-        settings.fout_ << "}\n";
+        generate_function_body(settings, generated_method_name(this, method), method, true, "");
       }
       settings.return_type_ = nullptr;
       settings.st_ = nullptr;
     }
+    /**
+     * Direct subclasses of this class ordered by name.
+     *
+     * @return Classes whose super class is this class
+     */
+    std::vector<Class*> subclasses() const {
+      std::vector<Class*> children;
+      for (auto &class_pair : *Container::singleton())
+        if (class_pair.second->super_ == this)
+          children.emplace_back(class_pair.second);
+      std::sort(children.begin(), children.end(),
+                [](const Class * a, const Class * b) { return a->name_ < b->name_; });
+      return children;
+    }
+    /**
+     * Checks whether a field has the specified type in this class and all of its subclasses.
+     *
+     * @param field_name Name of the field
+     * @param field_type Expected type of the field
+     * @return True if every class that declares the field uses \p field_type
+     */
+    bool has_uniform_field_type(const std::string &field_name, const Class * field_type) const {
+      if (fields_->exists(field_name) && fields_->get(field_name)->type_ != field_type)
+        return false;
+      for (auto * q_class : subclasses())
+        if (!q_class->has_uniform_field_type(field_name, field_type))
+          return false;
+      return true;
+    }
+    /**
+     * Numbers this class and its subclasses in preorder.
+     *
+     * @param next_id Next unused class id.  It is updated as ids are assigned.
+     */
+    void assign_preorder_ids(int &next_id) {
+      class_id_ = next_id++;
+      for (auto * q_class : subclasses())
+        q_class->assign_preorder_ids(next_id);
+      class_max_id_ = next_id - 1;
+    }
     /** Container used to store generated objects in the class */
     template <typename _S>
     class GenObjContainer : public std::vector<std::pair<Class *, _S*>> {};
@@ -724,6 +1282,12 @@ namespace Quack {
         throw ClassHierarchyException("UnknownSuper", msg);
       }
       super_ = classes->get(super_name);
+
+      // Builtin objects have hidden fields the runtime alone creates so only Obj can be extended
+      if (is_user_class() && !super_->is_user_class() && super_name != CLASS_OBJ) {
+        std::string msg = "Class \"" + name_ + "\" cannot extend builtin class " + super_name;
+        throw ClassHierarchyException("BuiltinSuper", msg);
+      }
     }
     /**
      * Basic configuration of method parameters including verify no parameter has type nothing
@@ -844,6 +1408,10 @@ namespace Quack {
     GenObjContainer<Method>* gen_methods_;
     /** Generated fields for the class in order */
     GenObjContainer<Field>* gen_fields_;
+    /** Preorder id of the class */
+    int class_id_ = CLASS_ID_OBJ;
+    /** Largest id of the class and its subclasses */
+    int class_max_id_ = CLASS_ID_MAX;
     /**
      * Used to add binary operation methods to the a class.  Only used for base classes
      * like Obj, Boolean, Integer, etc.
@@ -900,7 +1468,12 @@ namespace Quack {
   struct NothingClass : public Class {
     explicit NothingClass()
         : Class(strdup(CLASS_NOTHING), strdup(CLASS_OBJ), new Param::Container(),
-                new AST::Block(), new Method::Container()) { }
+                new AST::Block(), new Method::Container()) {
+      // Overridden in the runtime to return "None"
+      add_unary_op_method(METHOD_STR, CLASS_STR);
+      // Overridden in the runtime to write the text without creating a String
+      add_unary_op_method(METHOD_PRINT, CLASS_OBJ);
+    }
     /**
     * Primitives are all base (i.e., not user) classes in Quack so this function always returns
     * true.
@@ -929,6 +1502,7 @@ namespace Quack {
 
   struct IntClass : public PrimitiveClass {
     IntClass() : PrimitiveClass(strdup(CLASS_INT)) {
+      add_unary_op_method(METHOD_PRINT, CLASS_OBJ);
       add_unary_op_method(METHOD_STR, CLASS_STR);
 
       add_binop_method(METHOD_ADD, CLASS_INT, CLASS_INT);
@@ -946,6 +1520,7 @@ namespace Quack {
 
   struct StringClass : public PrimitiveClass {
     StringClass() : PrimitiveClass(strdup(CLASS_STR)) {
+      add_unary_op_method(METHOD_PRINT, CLASS_OBJ);
       add_unary_op_method(METHOD_STR, CLASS_STR);
 
       add_binop_method(METHOD_ADD, CLASS_STR, CLASS_STR);
@@ -960,9 +1535,10 @@ namespace Quack {
 
   struct BooleanClass : public PrimitiveClass {
     BooleanClass() : PrimitiveClass(strdup(CLASS_BOOL)) {
+      add_unary_op_method(METHOD_PRINT, CLASS_OBJ);
       add_unary_op_method(METHOD_STR, CLASS_STR);
 
-      add_binop_method(METHOD_EQUALITY, CLASS_BOOL, CLASS_OBJ);
+      // EQUALS is inherited from Obj as in the runtime
 
 //      add_binop_method(METHOD_OR, CLASS_BOOL, CLASS_BOOL);
 //      add_binop_method(METHOD_AND, CLASS_BOOL, CLASS_BOOL);
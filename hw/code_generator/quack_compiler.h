@@ -1,7 +1,10 @@
 #ifndef PROJECT01_QUACKCOMPILER_H
 #define PROJECT01_QUACKCOMPILER_H
 
+#include <cctype>
+#include <climits>
 #include <string>
+#include <stdexcept>
 #include <fstream>
 #include <iostream>
 
@@ -9,6 +12,7 @@
 #include "quack_program.h"
 #include "quack_class.h"
 #include "code_generator.h"
+#include "asm_generator.h"
 #include "type_checker.h"
 #include "keywords.h"
 #include "compiler_utils.h"
@@ -41,12 +45,30 @@ namespace Quack {
       }
 
       int c;
-      while ((c = getopt(argc, argv, "t")) != -1) {
+      while ((c = getopt(argc, argv, "tsSO:f:")) != -1) {
         if (c == 't') {
           std::cerr << "Warning: Running in debugging mode" << std::endl;
           debug_ = true;
+        } else if (c == 's') {
+          gen_options_.report_stats_ = true;
+        } else if (c == 'S') {
+          gen_options_.emit_asm_ = true;
+        } else if (c == 'O') {
+          std::string level(optarg);
+          if (level.size() != 1 || level[0] < '0' || level[0] > '0' + OPT_LEVEL_MAX) {
+            std::cerr << "Invalid optimization level \"" << level << "\".  It must be between 0 "
+                      << "and " << OPT_LEVEL_MAX << "." << std::endl;
+            exit(EXIT_FAILURE);
+          }
+          gen_options_.opt_level_ = static_cast<unsigned>(level[0] - '0');
+        } else if (c == 'f') {
+          parse_feature(optarg);
         }
       }
+      if (gen_options_.profile_generate_ && gen_options_.profile_use_) {
+        std::cerr << "-fprofile-generate and -fprofile-use cannot be used together." << std::endl;
+        exit(EXIT_FAILURE);
+      }
       // Verify that there is at least one file to parse
       unsigned int num_files = argc - optind;
       if (num_files == 0) {
@@ -61,6 +83,91 @@ namespace Quack {
         input_files_.emplace_back(argv[i + optind]);
     }
 
+    /**
+     * Parses a -f option.  The profile options take an optional path to the profile file,
+     * e.g., -fprofile-use=train.qprof, -fdispatch selects the method dispatch tables,
+     * -finline-caches adds a cache to every dynamically dispatched call site,
+     * -fheap-size limits the memory the objects are allocated from, e.g., -fheap-size=512M,
+     * -fgc selects how unreachable objects are freed (none, mark-sweep, generational or rc),
+     * and -fnursery-size sets the size of the generational collector's nursery.
+     *
+     * @param feature Option text after -f
+     */
+    void parse_feature(const std::string &feature) {
+      std::size_t eq_loc = feature.find('=');
+      std::string name = feature.substr(0, eq_loc);
+      std::string value = (eq_loc == std::string::npos) ? "" : feature.substr(eq_loc + 1);
+      if (name == "profile-generate" || name == "profile-use") {
+        if (name == "profile-generate")
+          gen_options_.profile_generate_ = true;
+        else
+          gen_options_.profile_use_ = true;
+        if (!value.empty())
+          gen_options_.profile_path_ = value;
+      } else if (name == "dispatch" && (value == "vtable" || value == "compact")) {
+        gen_options_.compact_dispatch_ = (value == "compact");
+      } else if (feature == "inline-caches") {
+        gen_options_.inline_caches_ = true;
+      } else if (name == "gc" && value == "none") {
+        gen_options_.gc_ = CodeGen::GcMode::NONE;
+      } else if (name == "gc" && value == "mark-sweep") {
+        gen_options_.gc_ = CodeGen::GcMode::MARK_SWEEP;
+      } else if (name == "gc" && value == "generational") {
+        gen_options_.gc_ = CodeGen::GcMode::GENERATIONAL;
+      } else if (name == "gc" && value == "rc") {
+        gen_options_.gc_ = CodeGen::GcMode::RC;
+      } else if (name == "heap-size") {
+        if (!parse_size(value, gen_options_.heap_size_) || gen_options_.heap_size_ == 0) {
+          std::cerr << "Invalid heap size \"" << value << "\"." << std::endl;
+          exit(EXIT_FAILURE);
+        }
+      } else if (name == "nursery-size") {
+        if (!parse_size(value, gen_options_.nursery_size_) || gen_options_.nursery_size_ == 0) {
+          std::cerr << "Invalid nursery size \"" << value << "\"." << std::endl;
+          exit(EXIT_FAILURE);
+        }
+      } else {
+        std::cerr << "Unknown option \"-f" << feature << "\"." << std::endl;
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    /**
+     * Parses a size in bytes optionally followed by K, M, or G.
+     *
+     * @param text Text to parse
+     * @param size Set to the size if the text is valid
+     * @return True if the text is a valid size that fits in an unsigned long
+     */
+    static bool parse_size(const std::string &text, unsigned long &size) {
+      if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0])))
+        return false;
+      std::size_t end;
+      unsigned long value;
+      try {
+        value = std::stoul(text, &end);
+      } catch (const std::invalid_argument &) {
+        return false;
+      } catch (const std::out_of_range &) {
+        return false;
+      }
+      std::string suffix = text.substr(end);
+      unsigned shift = 0;
+      if (suffix == "G" || suffix == "g")
+        shift = 30;
+      else if (suffix == "M" || suffix == "m")
+        shift = 20;
+      else if (suffix == "K" || suffix == "k")
+        shift = 10;
+      else if (!suffix.empty())
+        return false;
+      // Sizes that do not fit in an unsigned long are invalid rather than truncated
+      if (value > (ULONG_MAX >> shift))
+        return false;
+      size = value << shift;
+      return true;
+    }
+
     void run() {
       num_errs_ = 0;
       for (const std::string &file_path : input_files_) {
@@ -94,8 +201,13 @@ namespace Quack {
         auto type_checker = Quack::TypeChecker();
         type_checker.run(prog);
 
-        CodeGen::Gen gen(prog, file_path);
-        gen.run();
+        if (gen_options_.emit_asm_) {
+          CodeGen::AsmGen gen(prog, file_path, gen_options_);
+          gen.run();
+        } else {
+          CodeGen::Gen gen(prog, file_path, gen_options_);
+          gen.run();
+        }
       }
     }
 
@@ -133,6 +245,10 @@ namespace Quack {
      * Select to run the compiler in debug mode.
      */
     bool debug_ = false;
+    /**
+     * Options passed to the code generator.
+     */
+    CodeGen::Options gen_options_;
     /**
      * Input file to be compiled.
      */
@@ -16,7 +16,10 @@
 #include "symbol_table.h"
 #include "initialized_list.h"
 
-namespace CodeGen { class Gen; }
+namespace CodeGen {
+  class Gen; class EscapeAnalysis; class LoopAnalysis; class EffectAnalysis; class ValueNumbering;
+  class TailCallAnalysis; class ProfileAnalysis; class FieldLayout;
+}
 
 namespace Quack {
   // Forward declarations
@@ -29,6 +32,14 @@ namespace Quack {
     friend class Quack::Class;
     friend class Quack::Program;
     friend class CodeGen::Gen;
+    friend class CodeGen::EscapeAnalysis;
+    friend class CodeGen::LoopAnalysis;
+    friend class CodeGen::EffectAnalysis;
+    friend class CodeGen::ValueNumbering;
+    friend class CodeGen::TailCallAnalysis;
+    friend class CodeGen::FieldLayout;
+    friend class CodeGen::ProfileAnalysis;
+    friend class CodeGen::RefCountAnalysis;
    public:
     class Container : public MapContainer<Method> {
      public:
@@ -14,7 +14,7 @@
 #include "quack_method.h"
 #include "keywords.h"
 
-namespace CodeGen { class Gen; }
+namespace CodeGen { class Gen; class AsmGen; }
 
 namespace Quack {
   // Forward Declarations
@@ -23,6 +23,7 @@ namespace Quack {
   class Program {
     friend class TypeChecker;
     friend class CodeGen::Gen;
+    friend class CodeGen::AsmGen;
 
    public:
     explicit Program(Class::Container *classes, AST::Block *block) : classes_(classes) {
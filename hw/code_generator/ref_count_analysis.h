@@ -0,0 +1,95 @@
+//
+// Finds the parameters each method assigns, which own their object when objects are reference
+// counted.
+//
+
+#ifndef CODE_GENERATOR_REF_COUNT_ANALYSIS_H
+#define CODE_GENERATOR_REF_COUNT_ANALYSIS_H
+
+#include <vector>
+
+#include "quack_class.h"
+#include "quack_method.h"
+#include "code_gen_utils.h"
+#include "ASTNode.h"
+
+namespace CodeGen {
+  /**
+   * A parameter is borrowed from the caller unless the method assigns it.  The store then
+   * releases the caller's object, so such a parameter is retained at the start of the method
+   * and released when it returns like a local.  The parameters must be known before the body
+   * is generated since a return may precede the assignment.  A self tail call assigns this and
+   * every parameter, so all of them own their object in a method containing one.
+   */
+  class RefCountAnalysis {
+   public:
+    /**
+     * Finds the assigned parameters of all methods and constructors.
+     *
+     * @param classes User classes of the program
+     * @param tail_calls Methods whose self tail calls reassign this and the parameters, or
+     *                   nullptr if tail calls are not converted
+     * @param ref_counts Pool recording the assigned parameters
+     */
+    void run(const std::vector<Quack::Class*> &classes, const TailCalls * tail_calls,
+             RefCountPool &ref_counts) {
+      for (auto * q_class : classes) {
+        method_ = q_class->get_constructor();
+        walk(method_->block_, ref_counts);
+        for (auto &method_pair : *q_class->methods_) {
+          method_ = method_pair.second;
+          walk(method_->block_, ref_counts);
+          if (tail_calls && tail_calls->methods_.count(method_)) {
+            ref_counts.add_assigned_param(method_, OBJECT_SELF);
+            for (auto * param : *method_->params_)
+              ref_counts.add_assigned_param(method_, param->name_);
+          }
+        }
+      }
+    }
+
+   private:
+    /**
+     * Visits all statements in a block.
+     *
+     * @param block Block to visit
+     * @param ref_counts Pool recording the assigned parameters
+     */
+    void walk(const AST::Block * block, RefCountPool &ref_counts) {
+      if (!block)
+        return;
+      for (auto * stmt : block->stmts_)
+        walk(stmt, ref_counts);
+    }
+    /**
+     * Visits a statement and all statements nested in it.  Assignments can only appear as
+     * statements so expressions are not visited.
+     *
+     * @param node Statement to visit
+     * @param ref_counts Pool recording the assigned parameters
+     */
+    void walk(const AST::ASTNode * node, RefCountPool &ref_counts) {
+      if (auto * if_node = dynamic_cast<const AST::If*>(node)) {
+        walk(if_node->truepart_, ref_counts);
+        walk(if_node->falsepart_, ref_counts);
+      } else if (auto * while_node = dynamic_cast<const AST::While*>(node)) {
+        walk(while_node->body_, ref_counts);
+      } else if (auto * tc = dynamic_cast<const AST::Typecase*>(node)) {
+        for (auto * alt : *tc->alts_)
+          walk(alt->block_, ref_counts);
+      } else if (auto * assn = dynamic_cast<const AST::Assn*>(node)) {
+        const AST::ASTNode * lhs = assn->lhs_;
+        while (auto * typing = dynamic_cast<const AST::Typing*>(lhs))
+          lhs = typing->expr_;
+        auto * ident = dynamic_cast<const AST::Ident*>(lhs);
+        if (ident && method_->params_->get(ident->text_))
+          ref_counts.add_assigned_param(method_, ident->text_);
+      }
+    }
+
+    /** Method currently being analyzed */
+    Quack::Method * method_ = nullptr;
+  };
+}
+
+#endif //CODE_GENERATOR_REF_COUNT_ANALYSIS_H
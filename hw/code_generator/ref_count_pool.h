@@ -0,0 +1,245 @@
+//
+// References owned by the generated functions when objects are reference counted.
+//
+
+#ifndef CODE_GENERATOR_REF_COUNT_POOL_H
+#define CODE_GENERATOR_REF_COUNT_POOL_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <algorithm>
+
+#include "keywords.h"
+#include "temp_var_pool.h"
+
+namespace Quack { class Method; }
+
+namespace CodeGen {
+  /** Retain and release statistics of a single generated method */
+  struct RefCountStats {
+    std::string method_name_;
+    /** Number of references owned by temporaries */
+    unsigned long temps_ = 0;
+    /** Number of owned references moved into a local, a field, or the result */
+    unsigned long moved_ = 0;
+    /** Number of owned temporaries released as soon as they were computed */
+    unsigned long dropped_ = 0;
+    /** Number of borrowed references retained for a call */
+    unsigned long retained_ = 0;
+  };
+
+  /**
+   * Tracks the references owned by the function being generated.  Locals own the objects they
+   * hold, as do parameters assigned in the method, which are retained at its start.  Other
+   * parameters, including this, are borrowed from the caller, which holds its arguments until
+   * the call returns.  Calls and constructors return a reference owned by a temporary.
+   *
+   * An owned temporary is released after the statement or branch condition using it, or when it
+   * is computed if it is never read.  Storing it in a local or a field, or returning it, moves
+   * the reference instead so the pair of a retain by the store and a release of the temporary
+   * is never generated.  Locals and parameters are passed to calls without being retained, and
+   * field values only are when the call may run Quack code that could replace the field.
+   */
+  class RefCountPool {
+   public:
+    /**
+     * Records a parameter that the method assigns.  Called before any code is generated.
+     *
+     * @param method Method or constructor
+     * @param name Name of the parameter
+     */
+    void add_assigned_param(const Quack::Method * method, const std::string &name) {
+      assigned_params_[method].insert(name);
+    }
+    /**
+     * Resets the pool at the start of a new function.
+     *
+     * @param method Method whose body is generated
+     * @param func_name Name of the generated function used in the statistics report
+     */
+    void start_method(const Quack::Method * method, const std::string &func_name) {
+      owned_.clear();
+      locals_.clear();
+      borrowed_.clear();
+      auto itr = assigned_params_.find(method);
+      params_ = (itr == assigned_params_.end()) ? std::set<std::string>() : itr->second;
+
+      stats_.emplace_back();
+      stats_.back().method_name_ = func_name;
+    }
+    /**
+     * Accessor for the parameters of the current method that own their object.
+     *
+     * @return Names of the parameters retained at the start of the method
+     */
+    const std::set<std::string>& assigned_params() const { return params_; }
+    /**
+     * Adds a local (or assigned parameter) that owns its object until the function returns.
+     *
+     * @param name Name of the C local
+     */
+    void add_local(const std::string &name) { locals_.emplace_back(name); }
+    /**
+     * Adds a temporary owning the reference returned by a call or a retain.
+     *
+     * @param temp Name of the temporary
+     */
+    void add_temp(const std::string &temp) {
+      owned_.push_back({temp, false});
+      stats_.back().temps_++;
+    }
+    /**
+     * Adds a temporary holding a field value that is not retained.
+     *
+     * @param temp Name of the temporary
+     */
+    void add_borrowed(const std::string &temp) { borrowed_.insert(temp); }
+    /**
+     * Checks whether a borrowed field value must be retained before it is passed to a call.
+     *
+     * @param var Argument or receiver of the call
+     * @return True if \p var is a temporary holding a field value
+     */
+    bool is_borrowed_field(const std::string &var) const { return borrowed_.count(var) > 0; }
+    /** Counts a borrowed reference retained for a call */
+    void count_retained() { stats_.back().retained_++; }
+    /**
+     * Checks whether a temporary owns a reference that was not moved.
+     *
+     * @param var Temporary or any other expression
+     * @return True if \p var owns its object
+     */
+    bool owns(const std::string &var) const {
+      for (const auto &temp : owned_)
+        if (temp.name_ == var)
+          return !temp.is_moved_;
+      return false;
+    }
+    /**
+     * Transfers the reference of an owned temporary, e.g., to the local it is stored in.
+     *
+     * @param var Owned temporary
+     */
+    void move(const std::string &var) {
+      for (auto &temp : owned_) {
+        if (temp.name_ == var && !temp.is_moved_) {
+          temp.is_moved_ = true;
+          stats_.back().moved_++;
+        }
+      }
+    }
+    /**
+     * Marks the temporaries owned so far.  Those added after the mark are released by
+     * release_since.
+     *
+     * @return Mark
+     */
+    unsigned long mark() const { return owned_.size(); }
+    /**
+     * Releases the temporaries added since the mark once the code using them is written.
+     *
+     * @param temps Temporary variable pool holding the temporaries
+     * @param out Stream where the releases are written
+     * @param indent_lvl Indentation level of the releases
+     * @param mark Value returned by mark
+     * @param is_reachable False if the code using the temporaries always returns so no
+     *                     release is written
+     */
+    void release_since(TempVarPool &temps, std::ostream &out, unsigned indent_lvl,
+                       unsigned long mark, bool is_reachable = true) {
+      for (unsigned long i = mark; i < owned_.size(); i++) {
+        std::string slot = temps.written(out, owned_[i].name_);
+        if (slot.empty()) {
+          // Never read so it was released when it was computed
+          stats_.back().dropped_++;
+          continue;
+        }
+        if (!owned_[i].is_moved_ && is_reachable)
+          out << std::string(indent_lvl, '\t') << RC_RELEASE_FUNC "(" << slot << ");\n";
+        temps.unpin(slot);
+      }
+      owned_.erase(owned_.begin() + std::min(mark, owned_.size()), owned_.end());
+    }
+    /**
+     * Releases every reference the function owns before it returns.  The temporaries remain
+     * owned by the code following the return statement.
+     *
+     * @param temps Temporary variable pool holding the temporaries
+     * @param out Stream where the releases are written
+     * @param indent_lvl Indentation level of the releases
+     * @param result Local whose reference is returned and so is not released
+     */
+    void release_all(TempVarPool &temps, std::ostream &out, unsigned indent_lvl,
+                     const std::string &result) {
+      std::string indent_str(indent_lvl, '\t');
+      release_temps(temps, out, indent_lvl);
+      for (const auto &local : locals_)
+        if (local != result)
+          out << indent_str << RC_RELEASE_FUNC "(" << local << ");\n";
+    }
+    /**
+     * Releases every temporary owned when control leaves the statement without reaching its
+     * end, e.g., by a self tail call.  The temporaries remain owned by the code following it.
+     *
+     * @param temps Temporary variable pool holding the temporaries
+     * @param out Stream where the releases are written
+     * @param indent_lvl Indentation level of the releases
+     */
+    void release_temps(TempVarPool &temps, std::ostream &out, unsigned indent_lvl) {
+      for (const auto &temp : owned_) {
+        std::string slot = temps.written(out, temp.name_);
+        if (!slot.empty() && !temp.is_moved_)
+          out << std::string(indent_lvl, '\t') << RC_RELEASE_FUNC "(" << slot << ");\n";
+      }
+    }
+    /**
+     * Checks whether a local owns its object.
+     *
+     * @param name Name of the C local
+     * @return True if \p name is released when the function returns
+     */
+    bool is_owned_local(const std::string &name) const {
+      return std::find(locals_.begin(), locals_.end(), name) != locals_.end();
+    }
+    /**
+     * Checks whether a value is a statically allocated object, which is never counted.
+     *
+     * @param value Generated expression
+     * @return True if retaining or releasing \p value has no effect
+     */
+    static bool is_static(const std::string &value) {
+      static const std::string literal = "(&";
+      return value == GENERATED_LIT_TRUE || value == GENERATED_LIT_FALSE
+             || value == GENERATED_LIT_NONE || value.compare(0, literal.size(), literal) == 0;
+    }
+    /**
+     * Accessor for the per method statistics.
+     *
+     * @return Statistics for each function generated so far
+     */
+    const std::vector<RefCountStats>& stats() const { return stats_; }
+
+   private:
+    /** A temporary owning the reference returned by a call */
+    struct OwnedTemp {
+      std::string name_;
+      /** True once the reference is transferred to a local, a field, or the result */
+      bool is_moved_;
+    };
+    /** Parameters assigned by each method */
+    std::map<const Quack::Method*, std::set<std::string>> assigned_params_;
+
+    // State of the function currently being generated
+    std::vector<OwnedTemp> owned_;
+    std::vector<std::string> locals_;
+    std::set<std::string> params_;
+    std::set<std::string> borrowed_;
+
+    std::vector<RefCountStats> stats_;
+  };
+}
+
+#endif //CODE_GENERATOR_REF_COUNT_POOL_H
@@ -0,0 +1,93 @@
+//
+// Shadow stack frames through which the generated functions register their object locals as
+// roots of the garbage collector.
+//
+
+#ifndef CODE_GENERATOR_SHADOW_STACK_H
+#define CODE_GENERATOR_SHADOW_STACK_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include <ostream>
+
+#include "keywords.h"
+
+namespace CodeGen {
+  /**
+   * Generates the shadow stack frame of a function.  The frame holds the address of every
+   * parameter, local, and temporary that may hold an object.  It is pushed before the first
+   * statement and popped by every return.  The collector only runs at the polls at function
+   * entries and loop back edges, where all live objects are in these locals.
+   */
+  class ShadowStack {
+   public:
+    /**
+     * Writes the declarations of the hoisted temporaries and pushes the frame.  Every root is
+     * a C local or parameter already initialized to an object or NULL.
+     *
+     * @param out Stream where the code is written
+     * @param roots Names of the locals and parameters holding objects
+     * @param temps Name and C type of the temporaries declared at the start of the function
+     */
+    static void generate_frame(std::ostream &out, std::vector<std::string> roots,
+                               const std::vector<std::pair<std::string, std::string>> &temps) {
+      for (const auto &temp : temps) {
+        out << "\t" << temp.second << " " << temp.first;
+        if (is_object_type(temp.second)) {
+          out << " = NULL";
+          roots.emplace_back(temp.first);
+        }
+        out << ";\n";
+      }
+
+      out << "\t" GC_ROOT_TYPE " *" GC_ROOTS_VAR "[] = {";
+      for (unsigned long i = 0; i < roots.size(); i++)
+        out << (i == 0 ? " " : ", ") << "(" GC_ROOT_TYPE " *)&" << roots[i];
+      // An empty initializer list is not valid C
+      if (roots.empty())
+        out << " NULL";
+      out << " };\n"
+          << "\tstruct " GC_FRAME_STRUCT " " GC_FRAME_VAR " = { " GC_TOP_VAR ", " << roots.size()
+          << ", " GC_ROOTS_VAR " };\n"
+          << "\t" GC_TOP_VAR " = &" GC_FRAME_VAR ";\n";
+    }
+    /**
+     * Statement that runs the collector if a collection was requested.
+     *
+     * @return C statement
+     */
+    static std::string poll_statement() { return GC_POLL_FUNC "();"; }
+    /**
+     * Return statement that pops the frame after the value is computed.
+     *
+     * @param type C type returned by the function
+     * @param value Value returned
+     * @return C statement
+     */
+    static std::string return_statement(const std::string &type, const std::string &value) {
+      return "return (" + type + ")" GC_POP_FUNC "(&" GC_FRAME_VAR ", " + value + ");";
+    }
+    /**
+     * Statement popping the frame at the end of a function that falls off its end.
+     *
+     * @return C statement
+     */
+    static std::string pop_statement() {
+      return GC_POP_FUNC "(&" GC_FRAME_VAR ", NULL);";
+    }
+    /**
+     * Checks whether a C type is a reference to an object.  Pointers to object references,
+     * e.g., the address of a field being assigned, are not roots.
+     *
+     * @param type C type
+     * @return True if a local of the type holds an object
+     */
+    static bool is_object_type(const std::string &type) {
+      static const std::string prefix = OBJ_TYPE_PREFIX;
+      return type.compare(0, prefix.size(), prefix) == 0 && type.find('*') == std::string::npos;
+    }
+  };
+}
+
+#endif //CODE_GENERATOR_SHADOW_STACK_H
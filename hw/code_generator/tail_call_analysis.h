@@ -0,0 +1,131 @@
+//
+// Finds recursive calls in return statements that can reuse the stack frame of the method
+// making them.
+//
+
+#ifndef CODE_GENERATOR_TAIL_CALL_ANALYSIS_H
+#define CODE_GENERATOR_TAIL_CALL_ANALYSIS_H
+
+#include <string>
+#include <vector>
+
+#include "quack_class.h"
+#include "quack_method.h"
+#include "code_gen_utils.h"
+#include "ASTNode.h"
+
+namespace CodeGen {
+  /** Number of self tail calls in a method that jump back to its start */
+  struct TailCallStats {
+    std::string method_name_;
+    unsigned long calls_;
+  };
+
+  /**
+   * A method call returned by a method is a self tail call if every class the receiver may have
+   * at run time implements the called method with the returning method itself, e.g., a call on
+   * this to a method no subclass overrides.  Nothing of the caller is used after such a call so
+   * it is compiled to a jump back to the start of the method with this and the parameters
+   * reassigned.  The recursion then runs in constant stack space.
+   */
+  class TailCallAnalysis {
+   public:
+    /**
+     * Finds the self tail calls in all methods.  Constructors and the main function cannot
+     * call themselves so they are skipped.
+     *
+     * @param classes User classes of the program
+     * @param tail_calls Self tail calls found by the analysis
+     */
+    void run(const std::vector<Quack::Class*> &classes, TailCalls &tail_calls) {
+      stats_.clear();
+      for (auto * q_class : classes) {
+        for (auto &method_pair : *q_class->methods_) {
+          method_ = method_pair.second;
+          calls_ = 0;
+          walk(method_->block_, tail_calls);
+          if (calls_ > 0)
+            tail_calls.methods_.insert(method_);
+          stats_.push_back({Quack::Class::generated_method_name(q_class, method_), calls_});
+        }
+      }
+    }
+    /**
+     * Accessor for the per method tail call statistics.
+     *
+     * @return Statistics for each method in the order they were analyzed
+     */
+    const std::vector<TailCallStats>& stats() const { return stats_; }
+
+   private:
+    /**
+     * Visits all statements in a block.
+     *
+     * @param block Block to visit
+     * @param tail_calls Self tail calls found so far
+     */
+    void walk(const AST::Block * block, TailCalls &tail_calls) {
+      if (!block)
+        return;
+      for (auto * stmt : block->stmts_)
+        walk(stmt, tail_calls);
+    }
+    /**
+     * Visits a statement and all statements nested in it.  Return statements can only appear
+     * as statements so expressions are not visited.
+     *
+     * @param node Statement to visit
+     * @param tail_calls Self tail calls found so far
+     */
+    void walk(const AST::ASTNode * node, TailCalls &tail_calls) {
+      if (auto * if_node = dynamic_cast<const AST::If*>(node)) {
+        walk(if_node->truepart_, tail_calls);
+        walk(if_node->falsepart_, tail_calls);
+      } else if (auto * while_node = dynamic_cast<const AST::While*>(node)) {
+        walk(while_node->body_, tail_calls);
+      } else if (auto * tc = dynamic_cast<const AST::Typecase*>(node)) {
+        for (auto * alt : *tc->alts_)
+          walk(alt->block_, tail_calls);
+      } else if (auto * ret = dynamic_cast<const AST::Return*>(node)) {
+        if (const AST::ObjectCall * call = self_call(ret->right_)) {
+          tail_calls.calls_[ret] = call;
+          calls_++;
+        }
+      }
+    }
+    /**
+     * Checks whether an expression is a call that always runs the method being analyzed.
+     *
+     * @param node Returned expression
+     * @return Call or nullptr if the expression is not a self call
+     */
+    const AST::ObjectCall * self_call(const AST::ASTNode * node) const {
+      while (auto * typing = dynamic_cast<const AST::Typing*>(node))
+        node = typing->expr_;
+      auto * call = dynamic_cast<const AST::ObjectCall*>(node);
+      if (!call)
+        return nullptr;
+      auto * func_call = dynamic_cast<const AST::FunctionCall*>(call->next_);
+      if (!func_call || func_call->ident_ != method_->name_)
+        return nullptr;
+
+      Quack::Class * static_type = call->object_->get_node_type();
+      for (auto &class_pair : *Quack::Class::Container::singleton()) {
+        Quack::Class * q_class = class_pair.second;
+        if (q_class->is_subtype(static_type)
+            && q_class->generated_method(func_call->ident_).second != method_)
+          return nullptr;
+      }
+      return call;
+    }
+
+    /** Statistics of each method */
+    std::vector<TailCallStats> stats_;
+
+    // State of the method currently being analyzed
+    Quack::Method * method_ = nullptr;
+    unsigned long calls_ = 0;
+  };
+}
+
+#endif //CODE_GENERATOR_TAIL_CALL_ANALYSIS_H
@@ -0,0 +1,442 @@
+//
+// Temporary variable pool used by the code generator to minimize the number of C locals.
+//
+
+#ifndef CODE_GENERATOR_TEMP_VAR_POOL_H
+#define CODE_GENERATOR_TEMP_VAR_POOL_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <algorithm>
+#include <cctype>
+
+#include "keywords.h"
+
+namespace CodeGen {
+  /**
+   * Describes how a generated C expression may be reordered relative to other expressions.
+   * Ordering matters since C leaves the evaluation order of function arguments unspecified.
+   */
+  enum class ExprKind {
+    PURE = 0,    /** No side effects and no reads of mutable memory, e.g., literals and locals */
+    READ = 1,    /** Reads mutable object memory, e.g., a field load */
+    EFFECT = 2   /** May have side effects, e.g., any method or constructor call */
+  };
+
+  /** Temporary variable counts for a single generated method */
+  struct TempVarStats {
+    std::string method_name_;
+    /** Number of temporaries requested by the code generator */
+    unsigned long requested_ = 0;
+    /** Number of C locals actually declared for temporaries */
+    unsigned long declared_ = 0;
+    /** Number of temporaries forwarded directly into their consumer expression */
+    unsigned long forwarded_ = 0;
+    /** Number of temporaries whose value was never read */
+    unsigned long discarded_ = 0;
+  };
+
+  /**
+   * Manages the temporaries of a method.  Temporaries are not written when they are defined.
+   * Instead, they are held pending until the consumer is generated.  At that point, a temporary
+   * that is used exactly once is forwarded into the consumer's expression, a temporary that
+   * is never used is dropped (or kept as an expression statement if it has side effects), and
+   * all other temporaries are written to a C local.  Locals whose value is dead are reused by
+   * later temporaries of the same type.
+   *
+   * Any output written through PRINT_INDENT first flushes the pending temporaries so the
+   * generated code is always correct even if a consumer does not resolve its temporaries.
+   *
+   * When objects are garbage collected, every temporary holding an object must be a root while
+   * any call can run the collector.  Only pure expressions are then forwarded and the locals
+   * are declared by the caller at the start of the function (see hoisted_decls).
+   *
+   * When objects are reference counted, a temporary may own a reference to its object.  Owned
+   * temporaries are never forwarded since the reference must be released after the consumer.
+   * Their locals stay pinned until they are released (see written and unpin), and one that is
+   * never read is released as soon as it is computed.
+   */
+  class TempVarPool {
+   public:
+    explicit TempVarPool(bool optimize = true, bool hoist_decls = false)
+        : optimize_(optimize), hoist_decls_(hoist_decls) {}
+    /**
+     * Resets the pool at the start of a new method.
+     *
+     * @param method_name Name of the method used in the statistics report.
+     */
+    void start_method(const std::string &method_name) {
+      pending_.clear();
+      aliases_.clear();
+      free_slots_.clear();
+      slot_types_.clear();
+      pinned_.clear();
+      hoisted_decls_.clear();
+      scopes_.clear();
+
+      stats_.emplace_back();
+      stats_.back().method_name_ = method_name;
+    }
+    /**
+     * Accessor for the name of the method currently being generated.
+     *
+     * @return Name passed to the last start_method
+     */
+    const std::string& method_name() const { return stats_.back().method_name_; }
+    /**
+     * Defines a new temporary.  Any pending temporaries used by \p expr are resolved first.
+     *
+     * @param out Stream where any flushed temporaries are written
+     * @param name Name of the temporary
+     * @param type C type of the temporary (without the pointer for left hand sides)
+     * @param expr Expression stored in the temporary
+     * @param kind Reordering class of the expression itself (not including any subexpressions)
+     * @param indent_lvl Indentation level if the temporary is written
+     * @param is_lhs True if the temporary stores the address of \p expr.
+     * @param is_owned True if the temporary owns a reference to its object
+     */
+    void define(std::ostream &out, const std::string &name, const std::string &type,
+                const std::string &expr, ExprKind kind, unsigned indent_lvl, bool is_lhs,
+                bool is_owned = false) {
+      stats_.back().requested_++;
+
+      Item item;
+      item.name_ = name;
+      item.type_ = is_lhs ? type + " *" : type;
+      item.indent_lvl_ = indent_lvl;
+      item.is_owned_ = is_owned;
+
+      ExprKind sub_kind;
+      item.init_ = resolve(out, is_lhs ? "&(" + expr + ")" : expr, item.deps_, sub_kind);
+      item.kind_ = std::max(kind, sub_kind);
+
+      pending_.emplace_back(item);
+      if (!optimize_)
+        flush(out);
+    }
+    /**
+     * Resolves all temporaries referenced in \p expr.  Pending temporaries used once are
+     * substituted directly into the expression when doing so does not change the evaluation
+     * order of any side effects.  All other referenced temporaries are written to locals.
+     *
+     * @param out Stream where any flushed temporaries are written
+     * @param expr Expression that consumes the temporaries
+     * @param deps Locals referenced by the returned expression.  They must be released after
+     *             the expression is written.
+     * @param kind Combined reordering class of all forwarded subexpressions
+     * @return Expression with all temporaries resolved
+     */
+    std::string resolve(std::ostream &out, const std::string &expr,
+                        std::set<std::string> &deps, ExprKind &kind) {
+      kind = ExprKind::PURE;
+
+      std::map<std::string, unsigned> refs;
+      for_each_temp(expr, [&refs](const std::string &temp) { refs[temp]++; });
+
+      // Forward the longest suffix of single use temporaries that can be mutually reordered.
+      unsigned long start = pending_.size();
+      while (optimize_ && start > 0) {
+        const Item &item = pending_[start - 1];
+        auto itr = refs.find(item.name_);
+        if (itr == refs.end() || itr->second != 1 || !commutes(item.kind_, kind)
+            || (hoist_decls_ && item.kind_ != ExprKind::PURE) || item.is_owned_)
+          break;
+        kind = std::max(kind, item.kind_);
+        start--;
+      }
+
+      // Earlier temporaries are written out if used or if they cannot be evaluated after the
+      // forwarded expressions.
+      unsigned long flush_cnt = 0;
+      for (unsigned long i = 0; i < start; i++) {
+        if (refs.count(pending_[i].name_) > 0 || !commutes(pending_[i].kind_, kind))
+          flush_cnt = i + 1;
+      }
+      flush(out, flush_cnt);
+      start -= flush_cnt;
+
+      std::map<std::string, const Item*> forwarded;
+      for (unsigned long i = start; i < pending_.size(); i++)
+        forwarded[pending_[i].name_] = &pending_[i];
+
+      std::string resolved = substitute(expr, [&](const std::string &temp) {
+        auto fwd_itr = forwarded.find(temp);
+        if (fwd_itr != forwarded.end()) {
+          const Item * item = fwd_itr->second;
+          deps.insert(item->deps_.begin(), item->deps_.end());
+          return "((" + item->type_ + ")" + item->init_ + ")";
+        }
+
+        auto alias_itr = aliases_.find(temp);
+        if (alias_itr == aliases_.end())
+          return temp;
+        deps.insert(temp);
+        return alias_itr->second;
+      });
+
+      stats_.back().forwarded_ += pending_.size() - start;
+      pending_.erase(pending_.begin() + start, pending_.end());
+      return resolved;
+    }
+    /**
+     * Writes the specified temporary to a local (if it is pending) and returns the local's name.
+     * Used when a value is referenced by multiple statements.
+     *
+     * @param out Stream where any flushed temporaries are written
+     * @param var Temporary (or any other expression) to be written
+     * @param pin If true, the local is not reused until \p unpin is called.
+     * @return Name of the local storing the temporary.
+     */
+    std::string materialize(std::ostream &out, const std::string &var, bool pin) {
+      for (unsigned long i = 0; i < pending_.size(); i++) {
+        if (pending_[i].name_ == var) {
+          flush(out, i + 1);
+          break;
+        }
+      }
+
+      auto alias_itr = aliases_.find(var);
+      if (alias_itr == aliases_.end())
+        return var;
+      if (pin)
+        pinned_.insert(alias_itr->second);
+      return alias_itr->second;
+    }
+    /**
+     * Writes the specified temporary to a local if it is pending.  Unlike materialize, a
+     * temporary that is no longer held in a local is not an error.
+     *
+     * @param out Stream where any flushed temporaries are written
+     * @param var Temporary
+     * @return Name of the local storing the temporary or an empty string if the temporary was
+     *         dropped or its local reused
+     */
+    std::string written(std::ostream &out, const std::string &var) {
+      std::string slot = materialize(out, var, false);
+      return aliases_.count(var) > 0 ? slot : "";
+    }
+    /**
+     * Allows a pinned local to be reused.  A local pinned several times (e.g., an owned
+     * temporary that is also materialized with a pin) is only reused once every pin is removed.
+     *
+     * @param var Temporary name or local name
+     */
+    void unpin(const std::string &var) {
+      auto alias_itr = aliases_.find(var);
+      std::string slot = (alias_itr == aliases_.end()) ? var : alias_itr->second;
+      auto pin_itr = pinned_.find(slot);
+      if (pin_itr == pinned_.end())
+        return;
+      pinned_.erase(pin_itr);
+      if (pinned_.count(slot) > 0)
+        return;
+
+      for (alias_itr = aliases_.begin(); alias_itr != aliases_.end(); ) {
+        if (alias_itr->second == slot)
+          alias_itr = aliases_.erase(alias_itr);
+        else
+          alias_itr++;
+      }
+      if (optimize_)
+        free_slots_[slot_types_[slot]].emplace_back(slot);
+    }
+    /**
+     * Starts a C block.  Locals declared in it go out of scope with the block so they are not
+     * reused after close_scope.
+     */
+    void open_scope() { scopes_.emplace_back(); }
+    /** Ends the C block started by the last open_scope. */
+    void close_scope() {
+      for (const auto &slot : scopes_.back()) {
+        slot_types_.erase(slot);
+        for (auto &free_pair : free_slots_) {
+          std::vector<std::string> &free_slots = free_pair.second;
+          free_slots.erase(std::remove(free_slots.begin(), free_slots.end(), slot),
+                           free_slots.end());
+        }
+      }
+      scopes_.pop_back();
+    }
+    /**
+     * Writes all pending temporaries to locals.
+     *
+     * @param out Stream where the temporaries are written
+     */
+    void flush(std::ostream &out) { flush(out, pending_.size()); }
+    /**
+     * Called at the end of a statement.  Any temporaries still pending are never read.  Those
+     * with side effects become expression statements and all others are dropped.
+     *
+     * @param out Stream where any expression statements are written
+     * @param stmt_result Result of the statement.  Any local it references is dead.
+     */
+    void discard(std::ostream &out, const std::string &stmt_result) {
+      for (auto &item : pending_) {
+        if (item.is_owned_)
+          out << std::string(item.indent_lvl_, '\t') << RC_RELEASE_FUNC "(" << item.init_
+              << ");\n";
+        else if (item.kind_ == ExprKind::EFFECT)
+          out << std::string(item.indent_lvl_, '\t') << item.init_ << ";\n";
+        release(item.deps_);
+        stats_.back().discarded_++;
+      }
+      pending_.clear();
+
+      std::set<std::string> dead;
+      for_each_temp(stmt_result, [&dead](const std::string &temp) { dead.insert(temp); });
+      release(dead);
+    }
+    /**
+     * Marks the locals as dead so they can be reused by later temporaries.
+     *
+     * @param temps Temporaries that are dead.
+     */
+    void release(const std::set<std::string> &temps) {
+      for (const auto &temp : temps) {
+        auto alias_itr = aliases_.find(temp);
+        if (alias_itr == aliases_.end() || pinned_.count(alias_itr->second) > 0)
+          continue;
+
+        const std::string &slot = alias_itr->second;
+        auto type_itr = slot_types_.find(slot);
+        if (optimize_ && type_itr != slot_types_.end())
+          free_slots_[type_itr->second].emplace_back(slot);
+        aliases_.erase(alias_itr);
+      }
+    }
+    /**
+     * Accessor for the per method temporary statistics.
+     *
+     * @return Statistics for each method generated so far
+     */
+    const std::vector<TempVarStats>& stats() const { return stats_; }
+    /**
+     * Accessor for the locals of the current method that were assigned without being declared.
+     *
+     * @return Name and C type of each local in the order they were first written
+     */
+    const std::vector<std::pair<std::string, std::string>>& hoisted_decls() const {
+      return hoisted_decls_;
+    }
+
+   private:
+    /** A temporary that has been defined but not yet written to a local */
+    struct Item {
+      std::string name_;
+      std::string type_;
+      std::string init_;
+      ExprKind kind_;
+      unsigned indent_lvl_;
+      /** True if the temporary owns a reference to its object */
+      bool is_owned_;
+      /** Locals referenced by init_ */
+      std::set<std::string> deps_;
+    };
+    /**
+     * Checks whether two expressions can be evaluated in either order.
+     */
+    static bool commutes(ExprKind a, ExprKind b) {
+      return a == ExprKind::PURE || b == ExprKind::PURE
+             || (a == ExprKind::READ && b == ExprKind::READ);
+    }
+    /**
+     * Writes the first \p cnt pending temporaries to locals, reusing dead locals when possible.
+     */
+    void flush(std::ostream &out, unsigned long cnt) {
+      for (unsigned long i = 0; i < cnt; i++) {
+        Item &item = pending_[i];
+        out << std::string(item.indent_lvl_, '\t');
+
+        std::vector<std::string> &free_slots = free_slots_[item.type_];
+        std::string slot;
+        if (!free_slots.empty()) {
+          slot = free_slots.back();
+          free_slots.pop_back();
+          out << slot << " = " << item.init_ << ";\n";
+        } else {
+          slot = item.name_;
+          slot_types_[slot] = item.type_;
+          if (hoist_decls_) {
+            hoisted_decls_.emplace_back(slot, item.type_);
+            out << slot << " = " << item.init_ << ";\n";
+          } else {
+            out << item.type_ << " " << slot << " = " << item.init_ << ";\n";
+            if (!scopes_.empty())
+              scopes_.back().insert(slot);
+          }
+          stats_.back().declared_++;
+        }
+        aliases_[item.name_] = slot;
+        if (item.is_owned_)
+          pinned_.insert(slot);
+        release(item.deps_);
+      }
+      pending_.erase(pending_.begin(), pending_.begin() + cnt);
+    }
+    /**
+     * Calls \p func on each temporary variable name in \p expr.  String literals are skipped.
+     */
+    template <typename _F>
+    static void for_each_temp(const std::string &expr, _F func) {
+      substitute(expr, [&func](const std::string &temp) { func(temp); return temp; });
+    }
+    /**
+     * Replaces each temporary variable name in \p expr with the value returned by \p func.
+     * String literals are copied unchanged.
+     */
+    template <typename _F>
+    static std::string substitute(const std::string &expr, _F func) {
+      static const std::string header = TEMP_VAR_HEADER;
+
+      std::string out;
+      out.reserve(expr.size());
+      unsigned long i = 0;
+      while (i < expr.size()) {
+        if (expr[i] == '"') {
+          unsigned long end = i + 1;
+          while (end < expr.size() && expr[end] != '"')
+            end += (expr[end] == '\\') ? 2 : 1;
+          end = std::min<unsigned long>(end + 1, expr.size());
+          out += expr.substr(i, end - i);
+          i = end;
+          continue;
+        }
+        if (expr.compare(i, header.size(), header) == 0) {
+          unsigned long end = i + header.size();
+          while (end < expr.size() && isdigit(expr[end]))
+            end++;
+          out += func(expr.substr(i, end - i));
+          i = end;
+          continue;
+        }
+        out += expr[i++];
+      }
+      return out;
+    }
+    /** If false, every temporary is written to its own local as soon as it is defined */
+    const bool optimize_;
+    /** If true, locals are declared at the start of the function instead of where defined */
+    const bool hoist_decls_;
+    /** Locals of the current method to be declared at its start */
+    std::vector<std::pair<std::string, std::string>> hoisted_decls_;
+    /** Temporaries not yet written in the order they were defined */
+    std::vector<Item> pending_;
+    /** Maps a written temporary to the local storing it */
+    std::map<std::string, std::string> aliases_;
+    /** Type of each declared local */
+    std::map<std::string, std::string> slot_types_;
+    /** Dead locals available for reuse, by type */
+    std::map<std::string, std::vector<std::string>> free_slots_;
+    /** Locals that must not be reused, once per pin */
+    std::multiset<std::string> pinned_;
+    /** Locals declared in each open C block */
+    std::vector<std::set<std::string>> scopes_;
+
+    std::vector<TempVarStats> stats_;
+  };
+}
+
+#endif //CODE_GENERATOR_TEMP_VAR_POOL_H
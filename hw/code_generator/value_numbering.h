@@ -0,0 +1,618 @@
+//
+// Global value numbering and loop invariant code motion.  Field reads and pure calls whose
+// value is already available are read from a C local instead of being evaluated again, and
+// loop invariant ones are evaluated once before the loop.
+//
+
+#ifndef CODE_GENERATOR_VALUE_NUMBERING_H
+#define CODE_GENERATOR_VALUE_NUMBERING_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "quack_class.h"
+#include "quack_method.h"
+#include "code_gen_utils.h"
+#include "effect_analysis.h"
+#include "ASTNode.h"
+
+namespace CodeGen {
+  /** Number of expressions in a function moved out of loops and of reused values */
+  struct ValueNumberStats {
+    std::string method_name_;
+    unsigned long hoisted_;
+    unsigned long reused_;
+  };
+
+  /**
+   * Numbers field reads and calls of pure methods (see Effects::is_pure) by their operands.  The
+   * statements of a function are visited in execution order while tracking the expressions
+   * whose values are available.  An assignment to a local makes the expressions using it
+   * unavailable, and a store to any field (directly or in a callee) makes every field read
+   * unavailable.  At a branch, only values available on all paths remain available afterwards.
+   *
+   * Before a loop, everything the loop may invalidate is dropped.  Expressions in the loop that
+   * the loop does not invalidate and that can be evaluated speculatively are then computed
+   * before the loop.
+   */
+  class ValueNumbering {
+   public:
+    /**
+     * @param main Method containing the body of the Quack main
+     * @param effects Effect summaries of the program's functions
+     */
+    ValueNumbering(Quack::Method * main, const EffectAnalysis &effects)
+        : main_(main), effects_(effects) {}
+    /**
+     * Numbers the values of every function in the program.
+     *
+     * @param classes User classes of the program
+     * @param loops Loops whose counters are native ints or nullptr if there are none
+     * @param numbers Reused values found by the analysis
+     */
+    void run(const std::vector<Quack::Class*> &classes, const CountedLoops * loops,
+             ValueNumbers &numbers) {
+      counted_loops_ = loops;
+      stats_.clear();
+      for (auto * q_class : classes) {
+        analyze(q_class->get_constructor(), q_class->generated_constructor_name(), numbers);
+        for (auto &method_pair : *q_class->methods_)
+          analyze(method_pair.second,
+                  Quack::Class::generated_method_name(q_class, method_pair.second), numbers);
+      }
+      analyze(main_, METHOD_MAIN, numbers);
+    }
+    /**
+     * Accessor for the per function statistics.
+     *
+     * @return Statistics for each function in the order they were analyzed
+     */
+    const std::vector<ValueNumberStats>& stats() const { return stats_; }
+
+   private:
+    /** Canonical form of an expression's value */
+    struct Key {
+      std::string text_;
+      /** Locals the value depends on */
+      std::set<std::string> vars_;
+      /** True if the value depends on the contents of a field */
+      bool reads_memory_ = false;
+      /** True if evaluating the expression may not return */
+      bool may_not_return_ = false;
+    };
+    /** Value computed by an expression */
+    struct Entry {
+      Key key_;
+      /** Expression that computes the value */
+      const AST::ASTNode * def_;
+      /** Loop the value is computed before or nullptr if computed by def_ in place */
+      const AST::While * hoist_;
+      /** True if the value is read by another expression */
+      bool used_;
+      /** C local holding the value */
+      std::string var_;
+    };
+    /** Available values by the text of their key */
+    typedef std::map<std::string, unsigned long> Table;
+    /** Values a loop may invalidate */
+    struct Kills {
+      std::set<std::string> vars_;
+      bool memory_ = false;
+    };
+    /**
+     * Numbers the values of a single function.
+     *
+     * @param func Function to analyze
+     * @param name Name of the generated function
+     * @param numbers Reused values found so far
+     */
+    void analyze(Quack::Method * func, const std::string &name, ValueNumbers &numbers) {
+      entries_.clear();
+      uses_.clear();
+      table_.clear();
+      counters_.clear();
+      numbering_ = true;
+      walk(func->block_);
+
+      ValueNumberStats stats = {name, 0, uses_.size()};
+      for (auto &entry : entries_) {
+        if (!entry.used_)
+          continue;
+        std::string var = VALUE_VAR_HEADER + std::to_string(var_cnt_++);
+        numbers.decls_[func].emplace_back(var, entry.def_->get_node_type());
+        numbers.values_[entry.def_] = {var, entry.hoist_ == nullptr};
+        if (entry.hoist_) {
+          numbers.hoisted_[entry.hoist_].emplace_back(entry.def_);
+          stats.hoisted_++;
+        }
+        entry.var_ = var;
+      }
+      for (auto &use : uses_)
+        numbers.values_[use.first] = {entries_[use.second].var_, false};
+      stats_.emplace_back(stats);
+    }
+    /**
+     * Visits all statements in a block.
+     *
+     * @param block Block to visit
+     */
+    void walk(const AST::Block * block) {
+      if (!block)
+        return;
+      for (auto * stmt : block->stmts_)
+        walk(stmt);
+    }
+    /**
+     * Visits a statement or expression in execution order and numbers its values.
+     *
+     * @param node Node to visit
+     * @param is_native True if the value of \p node is used as a native int or bool
+     */
+    void walk(const AST::ASTNode * node, bool is_native = false) {
+      if (!node)
+        return;
+
+      if (auto * if_node = dynamic_cast<const AST::If*>(node)) {
+        walk(if_node->cond_, true);
+        Table after_cond = table_;
+        walk(if_node->truepart_);
+        Table after_true = table_;
+        table_ = after_cond;
+        walk(if_node->falsepart_);
+        intersect(table_, after_true);
+      } else if (auto * while_node = dynamic_cast<const AST::While*>(node)) {
+        bool is_counted = counted_loops_ && counted_loops_->loops_.count(while_node) > 0;
+        if (is_counted)
+          counters_.emplace_back(counted_loops_->loops_.at(while_node).var_);
+        enter_loop(while_node);
+        walk(while_node->cond_, true);
+        // The condition is evaluated last when the loop exits
+        Table after_cond = table_;
+        walk(while_node->body_);
+        table_ = after_cond;
+        if (is_counted)
+          counters_.pop_back();
+      } else if (auto * ret = dynamic_cast<const AST::Return*>(node)) {
+        walk(ret->right_);
+      } else if (auto * assn = dynamic_cast<const AST::Assn*>(node)) {
+        const AST::ASTNode * lhs = assn->lhs_->expr_;
+        while (auto * typing = dynamic_cast<const AST::Typing*>(lhs))
+          lhs = typing->expr_;
+        if (auto * ident = dynamic_cast<const AST::Ident*>(lhs)) {
+          walk(assn->rhs_, is_counter(ident->text_));
+          kill_var(ident->text_);
+        } else if (auto * field = dynamic_cast<const AST::ObjectCall*>(lhs)) {
+          walk(assn->rhs_, is_unboxed_field(field));
+          // The object of a stored field is generated as a left hand side
+          numbering_ = false;
+          walk(field->object_);
+          numbering_ = true;
+          kill_memory();
+        }
+      } else if (auto * tc = dynamic_cast<const AST::Typecase*>(node)) {
+        walk(tc->expr_);
+        Table before = table_;
+        Table after = table_;
+        for (auto * alt : *tc->alts_) {
+          table_ = before;
+          kill_var(alt->type_names_[0]);
+          walk(alt->block_);
+          intersect(after, table_);
+        }
+        table_ = after;
+      } else if (auto * bool_op = dynamic_cast<const AST::BoolOp*>(node)) {
+        walk(bool_op->left_, true);
+        // The right operand is not always evaluated
+        Table after_left = table_;
+        walk(bool_op->right_, true);
+        intersect(table_, after_left);
+      } else if (auto * uni_op = dynamic_cast<const AST::UniOp*>(node)) {
+        walk(uni_op->right_, true);
+      } else if (auto * args = dynamic_cast<const AST::RhsArgs*>(node)) {
+        for (auto * arg : args->args_)
+          walk(arg);
+      } else if (auto * typing = dynamic_cast<const AST::Typing*>(node)) {
+        walk(typing->expr_, is_native);
+      } else if (!number(node, is_native)) {
+        walk_operands(node);
+      }
+    }
+    /**
+     * Visits the operands of a call, field read, or binary operator and applies the effects of
+     * the node itself.
+     *
+     * @param node Node whose operands are visited
+     */
+    void walk_operands(const AST::ASTNode * node) {
+      if (auto * obj_call = dynamic_cast<const AST::ObjectCall*>(node)) {
+        walk(obj_call->object_);
+        if (auto * func_call = dynamic_cast<const AST::FunctionCall*>(obj_call->next_)) {
+          walk(func_call->args_);
+          apply(effects_.call_effects(obj_call->object_->get_node_type(), func_call->ident_));
+        }
+      } else if (auto * bin_op = dynamic_cast<const AST::BinOp*>(node)) {
+        // Int operands of native arithmetic and comparisons are never boxed
+        bool is_native = !is_call(bin_op) && is_int(bin_op->left_);
+        walk(bin_op->left_, is_native);
+        walk(bin_op->right_, is_native);
+        apply(effects_.call_effects(bin_op->left_->get_node_type(),
+                                    AST::BinOp::op_lookup(bin_op->opsym)));
+      } else if (auto * func_call = dynamic_cast<const AST::FunctionCall*>(node)) {
+        // Outside of an ObjectCall, a function call is always a constructor call
+        walk(func_call->args_);
+        apply(effects_.constructor_effects(
+            Quack::Class::Container::singleton()->get(func_call->ident_)));
+      }
+    }
+    /**
+     * Numbers an expression.  If its value is available, the expression reuses it.  Otherwise,
+     * its value becomes available.
+     *
+     * @param node Expression to number
+     * @param is_native True if the value of \p node is used as a native int or bool
+     * @return True if \p node was numbered (and its operands visited if needed)
+     */
+    bool number(const AST::ASTNode * node, bool is_native) {
+      Key key;
+      if (!numbering_ || !is_candidate(node) || !key_of(node, key))
+        return false;
+
+      auto itr = table_.find(key.text_);
+      if (itr != table_.end()) {
+        uses_.emplace_back(node, itr->second);
+        entries_[itr->second].used_ = true;
+        return true;
+      }
+
+      walk_operands(node);
+      // Storing the value of an unboxed field that is only used natively would box it
+      if (!is_native || !is_unboxed_field(node))
+        add_entry(key, node, nullptr);
+      return true;
+    }
+    /**
+     * Drops the values a loop may invalidate and computes the loop's invariant expressions
+     * just before it.
+     *
+     * @param while_node Loop being entered
+     */
+    void enter_loop(const AST::While * while_node) {
+      Kills kills;
+      find_kills(while_node, kills);
+      for (auto &var : kills.vars_)
+        kill_var(var);
+      if (kills.memory_)
+        kill_memory();
+
+      hoist_invariants(while_node->cond_, while_node, kills);
+      hoist_invariants(while_node->body_, while_node, kills);
+    }
+    /**
+     * Finds the largest loop invariant expressions in a loop that are not yet available and
+     * computes them before the loop.
+     *
+     * @param node Statement or expression in the loop
+     * @param while_node Loop whose invariants are found
+     * @param kills Values the loop may invalidate
+     */
+    void hoist_invariants(const AST::ASTNode * node, const AST::While * while_node,
+                          const Kills &kills) {
+      Key key;
+      if (is_candidate(node) && key_of(node, key) && !key.may_not_return_
+          && !(key.reads_memory_ && kills.memory_) && !uses_any(key, kills.vars_)) {
+        if (table_.count(key.text_) == 0) {
+          walk_operands(node);
+          add_entry(key, node, while_node);
+          entries_.back().used_ = true;
+        }
+        return;
+      }
+      for_each_child(node, [&](const AST::ASTNode * child) {
+        hoist_invariants(child, while_node, kills);
+      }, false);
+    }
+    /**
+     * Visits the statements of a block for hoisting.
+     */
+    void hoist_invariants(const AST::Block * block, const AST::While * while_node,
+                          const Kills &kills) {
+      if (!block)
+        return;
+      for (auto * stmt : block->stmts_)
+        hoist_invariants(stmt, while_node, kills);
+    }
+    /**
+     * Finds the locals assigned in a statement or expression and whether it may store to a
+     * field.
+     *
+     * @param node Node to visit
+     * @param kills Values invalidated by \p node
+     */
+    void find_kills(const AST::ASTNode * node, Kills &kills) const {
+      if (auto * assn = dynamic_cast<const AST::Assn*>(node)) {
+        const AST::ASTNode * lhs = assn->lhs_->expr_;
+        while (auto * typing = dynamic_cast<const AST::Typing*>(lhs))
+          lhs = typing->expr_;
+        if (auto * ident = dynamic_cast<const AST::Ident*>(lhs))
+          kills.vars_.insert(ident->text_);
+        else
+          kills.memory_ = true;
+      } else if (auto * tc = dynamic_cast<const AST::Typecase*>(node)) {
+        for (auto * alt : *tc->alts_)
+          kills.vars_.insert(alt->type_names_[0]);
+      } else if (auto * obj_call = dynamic_cast<const AST::ObjectCall*>(node)) {
+        auto * func_call = dynamic_cast<const AST::FunctionCall*>(obj_call->next_);
+        if (func_call && effects_.call_effects(obj_call->object_->get_node_type(),
+                                               func_call->ident_).writes_memory_)
+          kills.memory_ = true;
+      } else if (auto * bin_op = dynamic_cast<const AST::BinOp*>(node)) {
+        if (!dynamic_cast<const AST::BoolOp*>(node)
+            && effects_.call_effects(bin_op->left_->get_node_type(),
+                                     AST::BinOp::op_lookup(bin_op->opsym)).writes_memory_)
+          kills.memory_ = true;
+      } else if (auto * func_call = dynamic_cast<const AST::FunctionCall*>(node)) {
+        Quack::Class * q_class = Quack::Class::Container::singleton()->get(func_call->ident_);
+        if (effects_.constructor_effects(q_class).writes_memory_)
+          kills.memory_ = true;
+      }
+      for_each_child(node, [&](const AST::ASTNode * child) { find_kills(child, kills); }, true);
+    }
+    /**
+     * Calls a function on each direct subexpression and each statement directly nested in a
+     * node.
+     *
+     * @param node Parent node
+     * @param func Function to call
+     * @param with_lhs If false, the left hand side of assignments is skipped
+     */
+    template <typename _F>
+    static void for_each_child(const AST::ASTNode * node, _F func, bool with_lhs) {
+      auto blocks = [&func](const AST::Block * block) {
+        if (block)
+          for (auto * stmt : block->stmts_)
+            func(stmt);
+      };
+      if (auto * if_node = dynamic_cast<const AST::If*>(node)) {
+        func(if_node->cond_);
+        blocks(if_node->truepart_);
+        blocks(if_node->falsepart_);
+      } else if (auto * while_node = dynamic_cast<const AST::While*>(node)) {
+        func(while_node->cond_);
+        blocks(while_node->body_);
+      } else if (auto * ret = dynamic_cast<const AST::Return*>(node)) {
+        if (ret->right_)
+          func(ret->right_);
+      } else if (auto * assn = dynamic_cast<const AST::Assn*>(node)) {
+        func(assn->rhs_);
+        if (with_lhs)
+          func(assn->lhs_);
+      } else if (auto * tc = dynamic_cast<const AST::Typecase*>(node)) {
+        func(tc->expr_);
+        for (auto * alt : *tc->alts_)
+          blocks(alt->block_);
+      } else if (auto * obj_call = dynamic_cast<const AST::ObjectCall*>(node)) {
+        func(obj_call->object_);
+        if (auto * func_call = dynamic_cast<const AST::FunctionCall*>(obj_call->next_))
+          func(func_call->args_);
+      } else if (auto * bin_op = dynamic_cast<const AST::BinOp*>(node)) {
+        func(bin_op->left_);
+        if (bin_op->right_)
+          func(bin_op->right_);
+      } else if (auto * uni_op = dynamic_cast<const AST::UniOp*>(node)) {
+        func(uni_op->right_);
+      } else if (auto * func_call = dynamic_cast<const AST::FunctionCall*>(node)) {
+        func(func_call->args_);
+      } else if (auto * args = dynamic_cast<const AST::RhsArgs*>(node)) {
+        for (auto * arg : args->args_)
+          func(arg);
+      } else if (auto * typing = dynamic_cast<const AST::Typing*>(node)) {
+        func(typing->expr_);
+      }
+    }
+    /**
+     * Builds the key of an expression's value.
+     *
+     * @param node Expression
+     * @param key Key of the expression
+     * @return True if the value depends only on locals, literals, fields, and pure calls
+     */
+    bool key_of(const AST::ASTNode * node, Key &key) const {
+      if (auto * typing = dynamic_cast<const AST::Typing*>(node))
+        return key_of(typing->expr_, key);
+      if (auto * ident = dynamic_cast<const AST::Ident*>(node)) {
+        key.text_ += "$" + ident->text_;
+        key.vars_.insert(ident->text_);
+        return true;
+      }
+      if (auto * int_lit = dynamic_cast<const AST::IntLit*>(node)) {
+        key.text_ += "#" + std::to_string(int_lit->value_);
+        return true;
+      }
+      if (auto * str_lit = dynamic_cast<const AST::StrLit*>(node)) {
+        key.text_ += "\"" + str_lit->value_ + "\"";
+        return true;
+      }
+      if (auto * bool_lit = dynamic_cast<const AST::BoolLit*>(node)) {
+        key.text_ += bool_lit->value_ ? "#true" : "#false";
+        return true;
+      }
+      if (dynamic_cast<const AST::NothingLit*>(node)) {
+        key.text_ += "#none";
+        return true;
+      }
+      if (auto * uni_op = dynamic_cast<const AST::UniOp*>(node)) {
+        key.text_ += uni_op->opsym;
+        return key_of(uni_op->right_, key);
+      }
+
+      Effects effects;
+      if (auto * obj_call = dynamic_cast<const AST::ObjectCall*>(node)) {
+        key.text_ += "(";
+        if (!key_of(obj_call->object_, key))
+          return false;
+        key.text_ += ").";
+        if (auto * field = dynamic_cast<const AST::Ident*>(obj_call->next_)) {
+          key.text_ += field->text_;
+          key.reads_memory_ = true;
+          return true;
+        }
+        auto * func_call = dynamic_cast<const AST::FunctionCall*>(obj_call->next_);
+        effects = effects_.call_effects(obj_call->object_->get_node_type(), func_call->ident_);
+        key.text_ += func_call->ident_ + "(";
+        for (auto * arg : func_call->args_->args_) {
+          if (!key_of(arg, key))
+            return false;
+          key.text_ += ",";
+        }
+        key.text_ += ")";
+      } else if (auto * bin_op = dynamic_cast<const AST::BinOp*>(node)) {
+        if (dynamic_cast<const AST::BoolOp*>(node))
+          return false;
+        effects = effects_.call_effects(bin_op->left_->get_node_type(),
+                                        AST::BinOp::op_lookup(bin_op->opsym));
+        key.text_ += "(";
+        if (!key_of(bin_op->left_, key))
+          return false;
+        key.text_ += bin_op->opsym;
+        if (!key_of(bin_op->right_, key))
+          return false;
+        key.text_ += ")";
+      } else {
+        return false;
+      }
+
+      key.reads_memory_ = key.reads_memory_ || effects.reads_memory_;
+      key.may_not_return_ = key.may_not_return_ || effects.may_not_return_;
+      return effects.is_pure();
+    }
+    /**
+     * Checks whether an expression is worth numbering.  Locals and literals are already
+     * cheap, and native Int arithmetic and comparisons do not create any object.
+     *
+     * @param node Expression
+     * @return True if the expression is a field read, a method call, or a binary operator
+     *         implemented by a call
+     */
+    static bool is_candidate(const AST::ASTNode * node) {
+      if (dynamic_cast<const AST::ObjectCall*>(node))
+        return true;
+      auto * bin_op = dynamic_cast<const AST::BinOp*>(node);
+      return bin_op && !dynamic_cast<const AST::BoolOp*>(node) && is_call(bin_op);
+    }
+    /**
+     * Checks whether a binary operator is implemented by a call.  Otherwise, it is evaluated
+     * natively.
+     */
+    static bool is_call(const AST::BinOp * bin_op) {
+      return !bin_op->is_native_arithmetic() && !bin_op->native_compare_class();
+    }
+    /**
+     * Checks whether an expression reads a field stored as a native value.
+     */
+    static bool is_unboxed_field(const AST::ASTNode * node) {
+      auto * obj_call = dynamic_cast<const AST::ObjectCall*>(node);
+      if (!obj_call)
+        return false;
+      auto * field = dynamic_cast<const AST::Ident*>(obj_call->next_);
+      return field && obj_call->object_->get_node_type()->unboxed_field_type(field->text_);
+    }
+
+    static bool is_int(const AST::ASTNode * node) {
+      return node->get_node_type() == Quack::Class::Container::Int();
+    }
+    /**
+     * Checks whether a local is the counter of an enclosing counted loop.  Its value is stored
+     * as a native int.
+     */
+    bool is_counter(const std::string &var) const {
+      for (auto &counter : counters_)
+        if (counter == var)
+          return true;
+      return false;
+    }
+
+    static bool uses_any(const Key &key, const std::set<std::string> &vars) {
+      for (auto &var : key.vars_)
+        if (vars.count(var) > 0)
+          return true;
+      return false;
+    }
+    /**
+     * Makes the value of an expression available.
+     *
+     * @param key Key of the value
+     * @param def Expression computing the value
+     * @param hoist Loop the value is computed before or nullptr
+     */
+    void add_entry(const Key &key, const AST::ASTNode * def, const AST::While * hoist) {
+      table_[key.text_] = entries_.size();
+      entries_.push_back({key, def, hoist, false, ""});
+    }
+    /**
+     * Applies the effects of a call to the available values.
+     */
+    void apply(const Effects &effects) {
+      if (effects.writes_memory_)
+        kill_memory();
+    }
+    /**
+     * Drops the values that depend on a local.
+     */
+    void kill_var(const std::string &var) {
+      for (auto itr = table_.begin(); itr != table_.end(); ) {
+        if (entries_[itr->second].key_.vars_.count(var) > 0)
+          itr = table_.erase(itr);
+        else
+          itr++;
+      }
+    }
+    /**
+     * Drops the values that depend on the contents of a field.
+     */
+    void kill_memory() {
+      for (auto itr = table_.begin(); itr != table_.end(); ) {
+        if (entries_[itr->second].key_.reads_memory_)
+          itr = table_.erase(itr);
+        else
+          itr++;
+      }
+    }
+    /**
+     * Keeps only the values also available in another table, i.e., on another path.
+     *
+     * @param table Table that is updated
+     * @param other Values available on the other path
+     */
+    static void intersect(Table &table, const Table &other) {
+      for (auto itr = table.begin(); itr != table.end(); ) {
+        auto other_itr = other.find(itr->first);
+        if (other_itr == other.end() || other_itr->second != itr->second)
+          itr = table.erase(itr);
+        else
+          itr++;
+      }
+    }
+
+    Quack::Method * main_;
+    const EffectAnalysis &effects_;
+    const CountedLoops * counted_loops_ = nullptr;
+    /** Statistics of each function */
+    std::vector<ValueNumberStats> stats_;
+    /** Number of value locals declared so far */
+    unsigned long var_cnt_ = 0;
+
+    // State of the function currently being analyzed
+    std::vector<Entry> entries_;
+    /** Expressions that reuse a value and the index of the value in entries_ */
+    std::vector<std::pair<const AST::ASTNode*, unsigned long>> uses_;
+    Table table_;
+    /** Counters of the enclosing counted loops */
+    std::vector<std::string> counters_;
+    /** False while visiting code that must not reuse values */
+    bool numbering_ = true;
+  };
+}
+
+#endif //CODE_GENERATOR_VALUE_NUMBERING_H
@@ -6,7 +6,9 @@
 #
 # Test bench for the Quack compiler although it should be portable to other languages as well.
 # It reads an input CSV formatted as rows in the form "<test_file>,<exit_code>", where <exit_code>
-# is the expected return code of the compiler on different inputs.  Each stage in the compilation
+# is the expected return code of the compiler on different inputs.  A row may add a third column
+# of compiler flags used for that test only, e.g., "<test_file>,PASS,-O2", which are passed after
+# <CompilerFlags> so they take precedence.  Each stage in the compilation
 # process (e.g, lexer, parser, well-formed class hierarchy, initialized before use, and type
 # inference) each has exit code in the compiler as defined in the function "get_exit_code".  If your
 # program does not use that convention, you can change that function as needed.
@@ -14,8 +16,8 @@
 VERSION_NUM=2.00.00
 printf "Quack Compiler - Testbench Version ${VERSION_NUM}\n\n"
 
-if [[ $# -ne 4 ]] ; then
-    echo "Correct command \"test_type_checker.sh <BinFile> <TestCsvFile> <SamplesFolder> <ExpectedOutFolder>\""
+if [[ $# -ne 4 && $# -ne 5 ]] ; then
+    echo "Correct command \"test_type_checker.sh <BinFile> <TestCsvFile> <SamplesFolder> <ExpectedOutFolder> [<CompilerFlags>]\""
     exit 1
 fi
 
@@ -23,6 +25,8 @@ BIN=$1
 ALL_TESTS=$2
 SAMPLES_FOLDER=$3
 EXPECTED_OUT_FOLDER=$4
+# Optional flags passed to the compiler (e.g., "-S" to test the assembly backend)
+COMPILER_FLAGS=$5
 BUILTINS_C_FILE=builtins.c
 BUILTINS_C_PATH=${SAMPLES_FOLDER}/${BUILTINS_C_FILE}
 
@@ -41,15 +45,17 @@ fi
 test_code_file () {
     ((TOTAL_TESTS++))
     local TEST_FILE=$1
+    local TEST_FLAGS=$3
 
     get_exit_code $2
     local EXIT_CODE=$?
 
     BASE_FILENAME=$( echo "${TEST_FILE}" | rev | cut -d '.' -f 2- | rev )
     COMPILED_C_FILE="${SAMPLES_FOLDER}/${BASE_FILENAME}.c"
-    rm ${COMPILED_C_FILE} &> /dev/null    
+    COMPILED_ASM_FILE="${SAMPLES_FOLDER}/${BASE_FILENAME}.s"
+    rm ${COMPILED_C_FILE} ${COMPILED_ASM_FILE} &> /dev/null
     
-    ${BIN} ${SAMPLES_FOLDER}/${TEST_FILE} &> /dev/null
+    ${BIN} ${COMPILER_FLAGS} ${TEST_FLAGS} ${SAMPLES_FOLDER}/${TEST_FILE} &> /dev/null
     local RETURN_CODE=$?
     if [[ ${RETURN_CODE} == ${TEST_PASSED} ]]; then
         COMPILE_PASSED=true
@@ -64,6 +70,10 @@ test_code_file () {
         if ${COMPILE_PASSED}; then
             COMPILED_PROG=${SAMPLES_FOLDER}/a.out
             rm -rf a.out ${COMPILED_PROG} &> /dev/null      
+            # The assembly backend writes a ".s" file instead of a ".c" file
+            if [[ -f ${COMPILED_ASM_FILE} ]]; then
+                COMPILED_C_FILE=${COMPILED_ASM_FILE}
+            fi
             gcc ${COMPILED_C_FILE} ${BUILTINS_C_PATH} -o ${COMPILED_PROG} &> /dev/null
             if [[ $? -ne 0 ]]; then
                 printf "generated output ${RED}does not compile${NOCOLOR}.\n"
@@ -101,7 +111,7 @@ test_code_file () {
     else
         printf "Test #${TOTAL_TESTS}: ${TEST_FILE} ${RED}FAILED${NOCOLOR} with return code ${RETURN_CODE}\n"
         # Rerun the command so the error message is visible.  Can comment out.
-        ${BIN} ${SAMPLES_FOLDER}/${TEST_FILE}
+        ${BIN} ${COMPILER_FLAGS} ${TEST_FLAGS} ${SAMPLES_FOLDER}/${TEST_FILE}
     fi
 }
 
@@ -134,6 +144,7 @@ get_exit_code() {
 
 # Delete all existing C-files in the samples directory to prevent any weirdness 
 ( find ${SAMPLES_FOLDER}*.c -type f -not -name ${BUILTINS_C_FILE} | xargs rm ) &> /dev/null 
+( rm -f ${SAMPLES_FOLDER}/*.s ) &> /dev/null
 # Delete any already compiled binarys
 ( rm -rf ${SAMPLES_FOLDER}/*.out ) &> /dev/null
 
@@ -141,10 +152,14 @@ get_exit_code() {
 get_exit_code "PASS"
 TEST_PASSED=$?
 
-for TEST in $( cat ${ALL_TESTS} ) ; do
-    IFS="," read TEST_FILE EXIT_TYPE <<< "${TEST}"
-    test_code_file ${TEST_FILE} ${EXIT_TYPE}
-done
+# Rows are read from descriptor 3 so the tested programs cannot consume them, and the flags
+# column may hold several space separated flags
+while IFS="," read -u 3 TEST_FILE EXIT_TYPE TEST_FLAGS || [[ -n ${TEST_FILE} ]] ; do
+    if [[ -z ${TEST_FILE} ]]; then
+        continue
+    fi
+    test_code_file ${TEST_FILE} ${EXIT_TYPE} "${TEST_FLAGS}"
+done 3< ${ALL_TESTS}
 
 
 if [[ ${TOTAL_TESTS} = ${PASSING_CNT} ]] ; then